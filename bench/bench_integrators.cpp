@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "integrators/adaptive.hpp"
+#include "integrators/integrators.hpp"
+#include "particles.hpp"
+#include "utils/compute_energy.hpp"
+#include "utils/init_galaxy.hpp"
+
+/// wall-clock time needed by every integrator to cover a time span within a
+/// given relative energy drift: the step is halved until the drift is met,
+/// the run meeting it is the one reported. Adaptive leapfrogs
+/// (integrators::adaptive) halve their accuracy parameter eta instead, the
+/// time they save over the fixed step leapfrog is reported last. Systems are
+/// stored in double so that the drift is not hidden by rounding.
+
+using System = nbody::System<std::vector, nbody::precision::dual, SoA>;
+
+// default values
+std::size_t NParticles = 256;
+double Span = 5.0e4;
+double Target = 1.0e-8;
+unsigned MaxHalvings = 12;
+
+void print_usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "Options:\n"
+              << "  -n <nParticles>  number of particles (default: "
+              << NParticles << ")\n"
+              << "  -t <span>        simulated time span (default: " << Span
+              << ")\n"
+              << "  -e <drift>       target relative energy drift (default: "
+              << Target << ")\n"
+              << "  -k <halvings>    maximum number of step halvings "
+                 "(default: "
+              << MaxHalvings << ")\n"
+              << "  -h               display this help\n";
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc)
+            NParticles = std::stoul(argv[++i]);
+        else if (arg == "-t" && i + 1 < argc)
+            Span = std::stod(argv[++i]);
+        else if (arg == "-e" && i + 1 < argc)
+            Target = std::stod(argv[++i]);
+        else if (arg == "-k" && i + 1 < argc)
+            MaxHalvings = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "-h") {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            std::cout << "Unknown argument: " << arg << "\n";
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+}
+
+struct candidate {
+    std::string name;
+    /// force evaluations per step
+    unsigned stages;
+    /// builds a fresh stepper, integrators may keep state between steps
+    std::function<std::function<void(System&, float)>()> make;
+};
+
+struct run {
+    unsigned long steps;
+    double seconds;
+    double drift;
+};
+
+System make_system() {
+    System system;
+    nbody::utils::init_galaxy(system, static_cast<int>(NParticles), 42);
+    nbody::physics::compute_accelerations(system);
+    return system;
+}
+
+double drift(System& system, double e_initial) {
+    const double e_final = nbody::utils::compute_energy(system);
+    return std::abs(e_final - e_initial) / std::abs(e_initial);
+}
+
+run integrate(const candidate& c, unsigned long steps) {
+    System system = make_system();
+    const double e_initial = nbody::utils::compute_energy(system);
+
+    auto step = c.make();
+    const auto dt = static_cast<float>(Span / double(steps));
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < steps; ++i) step(system, dt);
+    const auto end = std::chrono::steady_clock::now();
+
+    return {steps, std::chrono::duration<double>(end - start).count(),
+            drift(system, e_initial)};
+}
+
+/// @brief leapfrog with adaptive steps of at most Span / 16
+run integrate_adaptive(nbody::integrators::criterion criterion, double eta,
+                       bool symmetric) {
+    System system = make_system();
+    const double e_initial = nbody::utils::compute_energy(system);
+
+    auto step = [](System& s, float dt) {
+        nbody::integrators::leapfrog(s, dt);
+    };
+    nbody::integrators::adaptive controller(criterion, eta, symmetric);
+    const double dt_max = Span / 16.0;
+    double time = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    while (time < Span)
+        time += double(controller(
+            system, step, static_cast<float>(std::min(dt_max, Span - time))));
+    const auto end = std::chrono::steady_clock::now();
+
+    /// symmetrized steps evaluate the forces twice
+    return {controller.steps() * (symmetric ? 2 : 1),
+            std::chrono::duration<double>(end - start).count(),
+            drift(system, e_initial)};
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+    namespace integrators = nbody::integrators;
+
+    const std::vector<candidate> candidates{
+        {"leapfrog", 1,
+         [] {
+             return [](System& s, float dt) { integrators::leapfrog(s, dt); };
+         }},
+        {"yoshida4", 3,
+         [] {
+             return [](System& s, float dt) { integrators::yoshida4(s, dt); };
+         }},
+        {"yoshida6", 7,
+         [] {
+             return [](System& s, float dt) { integrators::yoshida6(s, dt); };
+         }},
+        {"hermite", 1, [] {
+             return [h = integrators::hermite{}](System& s, float dt) mutable {
+                 h(s, dt);
+             };
+         }}};
+
+    std::cout << "bodies: " << NParticles << ", span: " << Span
+              << ", target drift: " << Target << "\n\n"
+              << std::left << std::setw(10) << "integrator" << std::right
+              << std::setw(10) << "steps" << std::setw(12) << "forces"
+              << std::setw(14) << "drift" << std::setw(12) << "time [s]"
+              << "\n";
+
+    auto print = [](const std::string& name, const run& r, unsigned stages,
+                    bool reached) {
+        std::cout << std::left << std::setw(10) << name << std::right
+                  << std::setw(10) << r.steps << std::setw(12)
+                  << r.steps * stages << std::setw(14) << std::setprecision(3)
+                  << r.drift << std::setw(12) << r.seconds
+                  << (reached ? "" : "  (target not reached)") << "\n";
+    };
+
+    double fixed_leapfrog = 0.0;
+    for (const auto& c : candidates) {
+        run r{};
+        bool reached = false;
+        for (unsigned k = 0; k <= MaxHalvings && !reached; ++k) {
+            r = integrate(c, 16ul << k);
+            reached = r.drift <= Target;
+        }
+        print(c.name, r, c.stages, reached);
+        if (c.name == "leapfrog" && reached) fixed_leapfrog = r.seconds;
+    }
+
+    /// adaptive rows: the steps column counts force evaluations as well
+    using nbody::integrators::criterion;
+    for (const auto& [name, crit, symmetric] :
+         {std::tuple{"aarseth", criterion::aarseth, false},
+          std::tuple{"aarseth-s", criterion::aarseth, true}}) {
+        run r{};
+        bool reached = false;
+        double eta = 0.5;
+        for (unsigned k = 0; k <= MaxHalvings && !reached; ++k, eta /= 2) {
+            r = integrate_adaptive(crit, eta, symmetric);
+            reached = r.drift <= Target;
+        }
+        print(name, r, 1, reached);
+        if (reached && fixed_leapfrog > 0.0)
+            std::cout << "  saves " << fixed_leapfrog - r.seconds << " s ("
+                      << 100.0 * (1.0 - r.seconds / fixed_leapfrog)
+                      << "%) over the fixed step leapfrog\n";
+    }
+}
@@ -0,0 +1,124 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "particles.hpp"
+#include "physics/barnes_hut.hpp"
+#include "physics/updates.hpp"
+#include "utils/init_galaxy.hpp"
+#include "utils/reorder.hpp"
+
+/// wall-clock time of the Barnes-Hut force pass and of the update passes of a
+/// leapfrog step, on particles left in insertion order and sorted along the
+/// Morton and Hilbert curves, for every layout. The time of the reordering
+/// itself is reported with the speedups over the insertion order.
+
+// default values
+std::size_t NParticles = 1'000'000;
+unsigned Repetitions = 3;
+float Theta = 0.5f;
+
+void print_usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "Options:\n"
+              << "  -n <nParticles>  number of particles (default: "
+              << NParticles << ")\n"
+              << "  -r <reps>        timed repetitions of every pass "
+                 "(default: "
+              << Repetitions << ")\n"
+              << "  -th <theta>      tree opening angle (default: " << Theta
+              << ")\n"
+              << "  -h               display this help\n";
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc)
+            NParticles = std::stoul(argv[++i]);
+        else if (arg == "-r" && i + 1 < argc)
+            Repetitions = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "-th" && i + 1 < argc)
+            Theta = std::stof(argv[++i]);
+        else if (arg == "-h") {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            std::cout << "Unknown argument: " << arg << "\n";
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+}
+
+/// @brief best time of Repetitions calls of f, in seconds
+template <typename F>
+double best_of(F&& f) {
+    double best = 0.0;
+    for (unsigned r = 0; r < Repetitions; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const auto end = std::chrono::steady_clock::now();
+        const double t = std::chrono::duration<double>(end - start).count();
+        if (r == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+template <typename Layout>
+void run_layout(const std::string& name) {
+    using System = nbody::System<std::vector, float, Layout>;
+    using nbody::utils::curve;
+
+    double force_reference = 0.0, update_reference = 0.0;
+    for (const auto& [order, c] :
+         {std::pair{"insertion", curve::morton},
+          std::pair{"morton", curve::morton},
+          std::pair{"hilbert", curve::hilbert}}) {
+        System system;
+        nbody::utils::init_galaxy(system, static_cast<int>(NParticles), 42);
+
+        double sort = 0.0;
+        if (std::string(order) != "insertion")
+            sort = best_of([&] { nbody::utils::reorder(system, c); });
+
+        nbody::physics::barnes_hut<float> solver(Theta);
+        const double force = best_of([&] { solver(system); });
+        const double update = best_of([&] {
+            nbody::physics::kick_drift(system, 0.01f, 0.01f);
+            nbody::physics::update_velocities(system, 0.005f);
+        });
+        if (std::string(order) == "insertion") {
+            force_reference = force;
+            update_reference = update;
+        }
+
+        std::cout << std::left << std::setw(8) << name << std::setw(11)
+                  << order << std::right << std::fixed
+                  << std::setprecision(4) << std::setw(11) << sort
+                  << std::setw(11) << force << std::setprecision(2)
+                  << std::setw(9) << force_reference / force
+                  << std::setprecision(4) << std::setw(11) << update
+                  << std::setprecision(2) << std::setw(9)
+                  << update_reference / update << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+
+    std::cout << "bodies: " << NParticles << ", theta: " << Theta
+              << ", best of " << Repetitions << "\n\n"
+              << std::left << std::setw(8) << "layout" << std::setw(11)
+              << "order" << std::right << std::setw(11) << "sort [s]"
+              << std::setw(11) << "force [s]" << std::setw(9) << "speedup"
+              << std::setw(11) << "update [s]" << std::setw(9) << "speedup"
+              << "\n";
+
+    run_layout<SoA>("SoA");
+    run_layout<AoS>("AoS");
+    run_layout<AoSoA<>>("AoSoA");
+}
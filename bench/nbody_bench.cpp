@@ -0,0 +1,436 @@
+#include <tbb/global_control.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "integrators/integrators.hpp"
+#include "particles.hpp"
+#include "physics/compute_accelerations.hpp"
+#include "physics/updates.hpp"
+#include "utils/compute_energy.hpp"
+#include "utils/init_galaxy.hpp"
+
+/// microbenchmarks of the building blocks of a step: the direct force pass,
+/// the update passes, the energy and a step of every integrator, for sizes
+/// growing tenfold and for every layout, at every thread count of the sweep.
+/// Each result is the best time per call over a few batches of calls lasting
+/// at least the minimum time. Rates are derived from nominal operation
+/// counts: 20 flops per pair interaction of the force kernel (Nyland, Harris
+/// & Prins 2007), 60 for the force and jerk kernel of hermite, 10 for a pair
+/// of the energy, 6 per particle for a kick or a drift. Results are printed
+/// and written as JSON, one result per line, which a later run compares with
+/// through -b.
+
+// default values
+std::size_t MinParticles = 100;
+std::size_t MaxParticles = 1'000'000;
+/// largest size of the O(N^2) benchmarks, direct sums of 10^6 bodies take
+/// minutes per call
+std::size_t MaxQuadratic = 20'000;
+std::string Layouts = "AoS,SoA";
+std::string Threads;
+std::string Filter;
+double MinTime = 0.1;
+unsigned Repetitions = 3;
+std::string Output = "nbody_bench.json";
+std::string Baseline;
+double Tolerance = 0.1;
+std::string PartitionerTag = "auto";
+std::size_t Grain = 0;
+std::string RangeTag = "auto";
+
+inline constexpr double force_flops = 20.0;
+inline constexpr double jerk_flops = 60.0;
+inline constexpr double energy_flops = 10.0;
+inline constexpr double kick_flops = 6.0;
+
+void print_usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "Options:\n"
+              << "  -nmin <n>        smallest number of particles (default: "
+              << MinParticles << ")\n"
+              << "  -nmax <n>        largest number of particles (default: "
+              << MaxParticles << ")\n"
+              << "  -nq <n>          largest number of particles of the "
+                 "O(N^2) benchmarks\n"
+              << "                   (default: " << MaxQuadratic << ")\n"
+              << "  -l <layouts>     comma separated layouts: AoS, SoA, AoSoA "
+                 "(default: "
+              << Layouts << ")\n"
+              << "  -th <threads>    comma separated thread counts (default: "
+                 "powers of two\n"
+              << "                   up to the hardware threads)\n"
+              << "  -f <filter>      runs the benchmarks whose name contains "
+                 "filter\n"
+              << "  -mt <seconds>    minimum time of a batch of calls "
+                 "(default: "
+              << MinTime << ")\n"
+              << "  -r <reps>        batches, the best is kept (default: "
+              << Repetitions << ")\n"
+              << "  -o <file>        JSON output (default: " << Output
+              << ")\n"
+              << "  -b <file>        JSON baseline to compare with, exits "
+                 "with 1 on regressions\n"
+              << "  -tol <fraction>  slowdown over the baseline reported as a "
+                 "regression\n"
+              << "                   (default: " << Tolerance << ")\n"
+              << "  -pt <partitioner> auto, affinity or static (default: "
+              << PartitionerTag << ")\n"
+              << "  -g <grain>       particles per task, 0 for the default of "
+                 "every pass\n"
+              << "                   (default: " << Grain << ")\n"
+              << "  -rg <range>      splitting of the direct force pass: 1d, "
+                 "2d or auto\n"
+              << "                   (default: " << RangeTag << ")\n"
+              << "  -h               display this help\n";
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-nmin" && i + 1 < argc)
+            MinParticles = static_cast<std::size_t>(std::stod(argv[++i]));
+        else if (arg == "-nmax" && i + 1 < argc)
+            MaxParticles = static_cast<std::size_t>(std::stod(argv[++i]));
+        else if (arg == "-nq" && i + 1 < argc)
+            MaxQuadratic = static_cast<std::size_t>(std::stod(argv[++i]));
+        else if (arg == "-l" && i + 1 < argc)
+            Layouts = argv[++i];
+        else if (arg == "-th" && i + 1 < argc)
+            Threads = argv[++i];
+        else if (arg == "-f" && i + 1 < argc)
+            Filter = argv[++i];
+        else if (arg == "-mt" && i + 1 < argc)
+            MinTime = std::stod(argv[++i]);
+        else if (arg == "-r" && i + 1 < argc)
+            Repetitions = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "-o" && i + 1 < argc)
+            Output = argv[++i];
+        else if (arg == "-b" && i + 1 < argc)
+            Baseline = argv[++i];
+        else if (arg == "-tol" && i + 1 < argc)
+            Tolerance = std::stod(argv[++i]);
+        else if (arg == "-pt" && i + 1 < argc)
+            PartitionerTag = argv[++i];
+        else if (arg == "-g" && i + 1 < argc)
+            Grain = std::stoul(argv[++i]);
+        else if (arg == "-rg" && i + 1 < argc)
+            RangeTag = argv[++i];
+        else if (arg == "-h") {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            std::cout << "Unknown argument: " << arg << "\n";
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    for (std::string item; std::getline(ss, item, ',');)
+        if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+struct result {
+    std::string name;
+    std::string layout;
+    std::size_t n;
+    unsigned threads;
+    /// best time of a call, and the calls of its batch
+    double seconds;
+    unsigned long calls;
+    /// pair interactions and flops of a call
+    double pairs;
+    double flops;
+    /// over the first thread count of the sweep
+    double speedup{1.0};
+    double efficiency{1.0};
+};
+
+/// @brief a benchmark on a system of some layout
+template <typename System>
+struct benchmark {
+    std::string name;
+    bool quadratic;
+    double pairs;
+    double flops;
+    std::function<void(System&)> call;
+};
+
+/// @brief best time per call over Repetitions batches lasting MinTime at
+/// least, after a warm-up call
+template <typename F>
+std::pair<double, unsigned long> measure(F&& f) {
+    using clock = std::chrono::steady_clock;
+    f();
+    double best = std::numeric_limits<double>::infinity();
+    unsigned long best_calls = 0;
+    for (unsigned r = 0; r < std::max(Repetitions, 1u); ++r) {
+        unsigned long calls = 0;
+        const auto start = clock::now();
+        double elapsed = 0.0;
+        do {
+            f();
+            ++calls;
+            elapsed =
+                std::chrono::duration<double>(clock::now() - start).count();
+        } while (elapsed < MinTime);
+        if (elapsed / double(calls) < best) {
+            best = elapsed / double(calls);
+            best_calls = calls;
+        }
+    }
+    return {best, best_calls};
+}
+
+void print_header() {
+    std::cout << std::left << std::setw(33) << "benchmark" << std::setw(7)
+              << "layout" << std::right << std::setw(9) << "n"
+              << std::setw(5) << "thr" << std::setw(13) << "time [s]"
+              << std::setw(13) << "pairs/s" << std::setw(10) << "GFLOP/s"
+              << "\n";
+}
+
+void print(const result& r) {
+    std::cout << std::left << std::setw(33) << r.name << std::setw(7)
+              << r.layout << std::right << std::setw(9) << r.n << std::setw(5)
+              << r.threads << std::scientific << std::setprecision(3)
+              << std::setw(13) << r.seconds << std::setw(13)
+              << r.pairs / r.seconds << std::fixed << std::setprecision(2)
+              << std::setw(10) << r.flops / r.seconds * 1e-9 << "\n";
+}
+
+template <typename Layout>
+void run_layout(const std::string& layout, unsigned threads,
+                std::vector<result>& results) {
+    using System = nbody::System<std::vector, float, Layout>;
+    namespace integrators = nbody::integrators;
+    namespace physics = nbody::physics;
+    constexpr float dt = 1e-3f;
+
+    for (std::size_t n = MinParticles; n <= MaxParticles; n *= 10) {
+        System system;
+        nbody::utils::init_galaxy(system, static_cast<int>(n), 42);
+        physics::compute_accelerations(system);
+
+        const double N = double(n), N2 = N * N;
+        auto hermite = std::make_shared<integrators::hermite>();
+        const std::vector<benchmark<System>> benchmarks{
+            {"compute_accelerations", true, N2, force_flops * N2,
+             [](System& s) { physics::compute_accelerations(s); }},
+            {"update_velocities", false, 0.0, kick_flops * N,
+             [](System& s) { physics::update_velocities(s, dt); }},
+            {"update_positions", false, 0.0, kick_flops * N,
+             [](System& s) { physics::update_positions(s, dt); }},
+            {"update_positions_and_velocities", false, 0.0, 2 * kick_flops * N,
+             [](System& s) {
+                 physics::update_positions_and_velocities(s, dt);
+             }},
+            {"kick_drift", false, 0.0, 2 * kick_flops * N,
+             [](System& s) { physics::kick_drift(s, dt, dt); }},
+            {"compute_energy", true, N * (N - 1) / 2,
+             energy_flops * N * (N - 1) / 2,
+             [](System& s) { (void)nbody::utils::compute_energy(s); }},
+            {"step/euler", true, N2, force_flops * N2 + 2 * kick_flops * N,
+             [](System& s) { integrators::euler(s, dt); }},
+            {"step/verlet", true, N2, force_flops * N2 + 2 * kick_flops * N,
+             [](System& s) { integrators::verlet(s, dt); }},
+            {"step/leapfrog", true, N2, force_flops * N2 + 3 * kick_flops * N,
+             [](System& s) { integrators::leapfrog(s, dt); }},
+            {"step/yoshida4", true, 3 * N2,
+             3 * (force_flops * N2 + 2 * kick_flops * N),
+             [](System& s) { integrators::yoshida4(s, dt); }},
+            {"step/yoshida6", true, 7 * N2,
+             7 * (force_flops * N2 + 2 * kick_flops * N),
+             [](System& s) { integrators::yoshida6(s, dt); }},
+            {"step/hermite", true, N2, jerk_flops * N2,
+             [hermite](System& s) { (*hermite)(s, dt); }}};
+
+        for (const auto& b : benchmarks) {
+            if (b.quadratic && n > MaxQuadratic) continue;
+            if (b.name.find(Filter) == std::string::npos) continue;
+            const auto [seconds, calls] =
+                measure([&] { b.call(system); });
+            results.push_back({b.name, layout, n, threads, seconds, calls,
+                               b.pairs, b.flops});
+            print(results.back());
+        }
+    }
+}
+
+/// @brief speedups and efficiencies over the first thread count
+void scaling(std::vector<result>& results, unsigned reference) {
+    std::map<std::tuple<std::string, std::string, std::size_t>, double> base;
+    for (const auto& r : results)
+        if (r.threads == reference) base[{r.name, r.layout, r.n}] = r.seconds;
+    for (auto& r : results) {
+        const auto it = base.find({r.name, r.layout, r.n});
+        if (it == base.end()) continue;
+        r.speedup = it->second / r.seconds;
+        r.efficiency = r.speedup * reference / r.threads;
+    }
+}
+
+void write_json(const std::vector<result>& results) {
+    std::ofstream out(Output);
+    out << std::setprecision(9) << "{\n"
+        << "  \"benchmark\": \"nbody_bench\",\n"
+        << "  \"isa\": \""
+        << nbody::detail::isa_name(nbody::detail::active_isa()) << "\",\n"
+        << "  \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << ",\n"
+        << "  \"partitioner\": \"" << PartitionerTag << "\", \"grain\": "
+        << Grain << ", \"range\": \"" << RangeTag << "\",\n"
+        << "  \"flops_per_pair\": {\"force\": " << force_flops
+        << ", \"jerk\": " << jerk_flops << ", \"energy\": " << energy_flops
+        << "},\n"
+        << "  \"results\": [\n";
+    for (std::size_t k = 0; k < results.size(); ++k) {
+        const auto& r = results[k];
+        out << "    {\"name\": \"" << r.name << "\", \"layout\": \""
+            << r.layout << "\", \"n\": " << r.n
+            << ", \"threads\": " << r.threads << ", \"seconds\": " << r.seconds
+            << ", \"calls\": " << r.calls
+            << ", \"pairs_per_second\": " << r.pairs / r.seconds
+            << ", \"gflops\": " << r.flops / r.seconds * 1e-9
+            << ", \"speedup\": " << r.speedup
+            << ", \"efficiency\": " << r.efficiency << "}"
+            << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+/// @brief value of key in a result line of the JSON output
+std::string json_value(const std::string& line, const std::string& key) {
+    const auto at = line.find("\"" + key + "\": ");
+    if (at == std::string::npos) return {};
+    auto first = at + key.size() + 4;
+    if (line[first] == '"') {
+        ++first;
+        return line.substr(first, line.find('"', first) - first);
+    }
+    return line.substr(first, line.find_first_of(",}", first) - first);
+}
+
+/// @brief compares the results with those of a baseline written by this
+/// program, matching name, layout, size and threads
+/// @return the number of regressions
+unsigned compare(const std::vector<result>& results) {
+    std::ifstream in(Baseline);
+    if (!in) {
+        std::cout << "Cannot read baseline: " << Baseline << "\n";
+        exit(-1);
+    }
+    using key = std::tuple<std::string, std::string, std::size_t, unsigned>;
+    std::map<key, double> base;
+    for (std::string line; std::getline(in, line);) {
+        if (json_value(line, "name").empty()) continue;
+        base[{json_value(line, "name"), json_value(line, "layout"),
+              std::stoul(json_value(line, "n")),
+              static_cast<unsigned>(std::stoul(json_value(line, "threads")))}] =
+            std::stod(json_value(line, "seconds"));
+    }
+
+    std::cout << "\nbaseline " << Baseline << " (time ratio, > 1 faster):\n";
+    unsigned regressions = 0;
+    for (const auto& r : results) {
+        const auto it = base.find({r.name, r.layout, r.n, r.threads});
+        if (it == base.end()) continue;
+        const double ratio = it->second / r.seconds;
+        const bool regression = ratio < 1.0 / (1.0 + Tolerance);
+        regressions += regression;
+        std::cout << std::left << std::setw(33) << r.name << std::setw(7)
+                  << r.layout << std::right << std::setw(9) << r.n
+                  << std::setw(5) << r.threads << std::fixed
+                  << std::setprecision(3) << std::setw(9) << ratio
+                  << (regression ? "  REGRESSION" : "") << "\n";
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+    try {
+        nbody::detail::set_execution(
+            {Grain, nbody::detail::parse_partitioner(PartitionerTag),
+             nbody::detail::parse_ranges(RangeTag)});
+    } catch (const std::invalid_argument& e) {
+        std::cout << e.what() << "\n";
+        return -1;
+    }
+
+    std::vector<unsigned> threads;
+    for (const auto& t : split(Threads))
+        threads.push_back(static_cast<unsigned>(std::stoul(t)));
+    if (threads.empty()) {
+        const unsigned hardware =
+            std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned t = 1; t < hardware; t *= 2) threads.push_back(t);
+        threads.push_back(hardware);
+    }
+
+    std::cout << "sizes: " << MinParticles << " to " << MaxParticles
+              << " (O(N^2) up to " << MaxQuadratic
+              << "), SIMD dispatch: "
+              << nbody::detail::isa_name(nbody::detail::active_isa())
+              << ", partitioner: " << PartitionerTag << ", grain: " << Grain
+              << ", range: " << RangeTag << "\n\n";
+    print_header();
+
+    std::vector<result> results;
+    for (const auto t : threads) {
+        tbb::global_control control(
+            tbb::global_control::max_allowed_parallelism, t);
+        for (const auto& layout : split(Layouts)) {
+            if (layout == "AoS")
+                run_layout<AoS>(layout, t, results);
+            else if (layout == "SoA")
+                run_layout<SoA>(layout, t, results);
+            else if (layout == "AoSoA")
+                run_layout<AoSoA<>>(layout, t, results);
+            else {
+                std::cout << "Unknown layout: " << layout << "\n";
+                return -1;
+            }
+        }
+    }
+
+    scaling(results, threads.front());
+    if (threads.size() > 1) {
+        std::cout << "\nstrong scaling over " << threads.front()
+                  << " thread(s):\n";
+        for (const auto& r : results)
+            if (r.threads != threads.front())
+                std::cout << std::left << std::setw(33) << r.name
+                          << std::setw(7) << r.layout << std::right
+                          << std::setw(9) << r.n << std::setw(5) << r.threads
+                          << std::fixed << std::setprecision(2)
+                          << std::setw(8) << r.speedup << std::setw(8)
+                          << r.efficiency << "\n";
+    }
+
+    write_json(results);
+    std::cout << "\nresults written to " << Output << "\n";
+    if (!Baseline.empty() && compare(results) > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include <tbb/global_control.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "detail/dispatch.hpp"
+#include "distributed/mpi.hpp"
+#include "integrators/integrators.hpp"
+#include "particles.hpp"
+#include "utils/init_galaxy.hpp"
+
+/// scaling of the distributed mode: leapfrog steps with the ring solver
+/// (distributed::ring_sum) on SoA particles, run once per rank count, e.g.
+///   for p in 1 2 4; do mpiexec -np $p nbody_mpi -s strong -n 20000; done
+///   for p in 1 2 4; do mpiexec -np $p nbody_mpi -s weak -n 5000; done
+/// Strong scaling keeps the total number of particles, weak scaling the
+/// number per rank. Every run appends one JSON line to the output; the
+/// efficiency is computed against the single rank run of the same mode and
+/// size found there: t1 / (p tp) strong; p t1 / tp weak, since all the pairs
+/// are computed the work of a rank grows with p at a fixed slice size.
+
+// default values
+std::string Scaling = "strong";
+std::size_t NParticles = 20'000;
+unsigned long NSteps = 10;
+float Dt = 0.01f;
+unsigned Threads = 0;
+std::string Output = "nbody_mpi.json";
+
+inline constexpr double force_flops = 20.0;
+
+void print_usage(const char* prog) {
+    std::cout << "Usage: mpiexec -np <ranks> " << prog << " [options]\n"
+              << "Options:\n"
+              << "  -s <mode>        strong (-n particles in total) or weak "
+                 "(-n per rank)\n"
+              << "                   (default: " << Scaling << ")\n"
+              << "  -n <n>           number of particles (default: "
+              << NParticles << ")\n"
+              << "  -i <steps>       timed steps (default: " << NSteps
+              << ")\n"
+              << "  -dt <dt>         timestep (default: " << Dt << ")\n"
+              << "  -th <threads>    TBB threads per rank (default: all)\n"
+              << "  -o <file>        JSON output, appended to (default: "
+              << Output << ")\n"
+              << "  -h               display this help\n";
+}
+
+/// @return false when the program must stop, with the exit code in code
+bool parse_args(int argc, char** argv, bool root, int& code) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-s" && i + 1 < argc)
+            Scaling = argv[++i];
+        else if (arg == "-n" && i + 1 < argc)
+            NParticles = static_cast<std::size_t>(std::stod(argv[++i]));
+        else if (arg == "-i" && i + 1 < argc)
+            NSteps = std::stoul(argv[++i]);
+        else if (arg == "-dt" && i + 1 < argc)
+            Dt = std::stof(argv[++i]);
+        else if (arg == "-th" && i + 1 < argc)
+            Threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "-o" && i + 1 < argc)
+            Output = argv[++i];
+        else if (arg == "-h") {
+            if (root) print_usage(argv[0]);
+            code = 0;
+            return false;
+        } else {
+            if (root) {
+                std::cout << "Unknown argument: " << arg << "\n";
+                print_usage(argv[0]);
+            }
+            code = -1;
+            return false;
+        }
+    }
+    if (Scaling != "strong" && Scaling != "weak") {
+        if (root) std::cout << "Unknown scaling mode: " << Scaling << "\n";
+        code = -1;
+        return false;
+    }
+    return true;
+}
+
+/// @brief value of key in a result line of the JSON output
+std::string json_value(const std::string& line, const std::string& key) {
+    const auto at = line.find("\"" + key + "\": ");
+    if (at == std::string::npos) return {};
+    auto first = at + key.size() + 4;
+    if (line[first] == '"') {
+        ++first;
+        return line.substr(first, line.find('"', first) - first);
+    }
+    return line.substr(first, line.find_first_of(",}", first) - first);
+}
+
+/// @brief seconds per step of the last single rank run of the same mode and
+/// size (-n) in the output, 0 if none
+double single_rank_seconds() {
+    std::ifstream in(Output);
+    double seconds = 0.0;
+    for (std::string line; std::getline(in, line);) {
+        if (json_value(line, "scaling") != Scaling ||
+            json_value(line, "ranks") != "1" ||
+            json_value(line, "n") != std::to_string(NParticles))
+            continue;
+        seconds = std::stod(json_value(line, "seconds"));
+    }
+    return seconds;
+}
+
+int run(const nbody::distributed::communicator& comm) {
+    using System = nbody::System<std::vector, float, SoA>;
+    const int ranks = comm.size();
+    const bool root = comm.rank() == 0;
+    const std::size_t total =
+        Scaling == "weak" ? NParticles * std::size_t(ranks) : NParticles;
+
+    std::unique_ptr<tbb::global_control> control;
+    if (Threads > 0)
+        control = std::make_unique<tbb::global_control>(
+            tbb::global_control::max_allowed_parallelism, Threads);
+
+    System local;
+    {
+        /// every rank builds the same galaxy and keeps its slice
+        System global;
+        nbody::utils::init_galaxy(global, static_cast<int>(total));
+        local = nbody::distributed::local_slice(global, comm);
+    }
+
+    nbody::distributed::ring_sum solver(comm);
+    solver(local);
+    const double e_initial = nbody::distributed::compute_energy(local, solver);
+
+    comm.barrier();
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned long k = 0; k < NSteps; ++k)
+        nbody::integrators::leapfrog(local, Dt, solver);
+    comm.barrier();
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start)
+            .count();
+    const double e_final = nbody::distributed::compute_energy(local, solver);
+
+    /// the slowest rank sets the pace, as does its share of waiting
+    const double seconds = comm.max(elapsed) / double(std::max(NSteps, 1ul));
+    const auto& stats = solver.stats();
+    const double wait = comm.max(stats.wait_seconds);
+    const double compute = comm.max(stats.compute_seconds);
+    if (!root) return 0;
+
+    const double pairs = double(total) * double(total);
+    const double reference = single_rank_seconds();
+    const double efficiency =
+        reference > 0.0 ? (Scaling == "strong"
+                               ? reference / (double(ranks) * seconds)
+                               : double(ranks) * reference / seconds)
+        : ranks == 1    ? 1.0
+                        : 0.0;
+    const double drift =
+        std::abs(e_final - e_initial) / std::abs(e_initial) * 100.0;
+
+    std::cout << std::fixed << std::setprecision(4) << Scaling
+              << " scaling, " << ranks << " ranks, " << total
+              << " particles (" << total / std::size_t(ranks)
+              << " per rank), SIMD dispatch: "
+              << nbody::detail::isa_name(nbody::detail::active_isa()) << "\n"
+              << "  step:        " << seconds * 1e3 << " ms\n"
+              << "  pairs/s:     " << std::scientific << std::setprecision(3)
+              << pairs / seconds << "\n"
+              << "  GFlop/s:     " << std::fixed << std::setprecision(2)
+              << pairs * force_flops / seconds * 1e-9 << "\n"
+              << "  wait share:  " << 100.0 * wait / (wait + compute)
+              << "%\n"
+              << "  efficiency:  "
+              << (reference > 0.0 || ranks == 1
+                      ? std::to_string(efficiency)
+                      : std::string("- (no single rank run in " + Output +
+                                    ")"))
+              << "\n"
+              << "  energy drift: " << std::scientific << drift << "%\n";
+
+    std::ofstream out(Output, std::ios::app);
+    out << std::setprecision(9) << "{\"scaling\": \"" << Scaling
+        << "\", \"ranks\": " << ranks << ", \"n\": " << NParticles
+        << ", \"total\": " << total << ", \"seconds\": " << seconds
+        << ", \"wait_seconds\": " << wait << ", \"efficiency\": " << efficiency
+        << "}\n";
+    if (!out) {
+        std::cout << "Cannot write " << Output << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    nbody::distributed::environment mpi(argc, argv);
+    const nbody::distributed::communicator comm;
+    int code = 0;
+    if (!parse_args(argc, argv, comm.rank() == 0, code)) return code;
+    try {
+        return run(comm);
+    } catch (const std::runtime_error& e) {
+        std::cout << e.what() << "\n";
+        return -1;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace nbody {
+
+/// alignment of the columns handed to the SIMD kernels: a cache line, which is
+/// also the width of the widest vectors (AVX-512)
+inline constexpr std::size_t cache_line = 64;
+
+namespace detail {
+
+/// @brief allocator returning storage aligned on Align bytes
+template <typename T, std::size_t Align = cache_line>
+struct aligned_allocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = aligned_allocator<U, Align>;
+    };
+
+    aligned_allocator() = default;
+    template <typename U>
+    constexpr aligned_allocator(const aligned_allocator<U, Align>&) noexcept {}
+
+    [[nodiscard]] T* allocate(std::size_t n) {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t{Align}));
+    }
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t{Align});
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Align>&) const noexcept {
+        return true;
+    }
+};
+}  // namespace detail
+
+/// @brief std::vector whose storage is aligned on a cache line. Used as the
+/// Container of a System, AoS systems get aligned particles and SoA systems
+/// the single arena storage of SoA_arena_particles (see particles.hpp)
+template <typename T>
+class aligned_vector : public std::vector<T, detail::aligned_allocator<T>> {
+    using base = std::vector<T, detail::aligned_allocator<T>>;
+
+   public:
+    using base::base;
+};
+}  // namespace nbody
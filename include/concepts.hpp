@@ -1,5 +1,6 @@
 #pragma once
 #include <concepts>
+#include <cstddef>
 #include <iterator>
 #include <ranges>
 #include <type_traits>
@@ -12,18 +13,28 @@ concept Scalar = std::is_arithmetic_v<T>;
 
 struct SoA {};
 struct AoS {};
+/// Array of Structures of Arrays: particles grouped in blocks of W, each block
+/// storing the W values of every field contiguously
+template <std::size_t W = 16>
+    requires(W > 0 && (W & (W - 1)) == 0)
+struct AoSoA {
+    static constexpr std::size_t width = W;
+};
+
+template <typename Tag>
+inline constexpr bool is_aosoa_tag = false;
+template <std::size_t W>
+inline constexpr bool is_aosoa_tag<AoSoA<W>> = true;
 
 template <typename Tag>
-concept is_layout_tag = std::same_as<Tag, AoS> || std::same_as<Tag, SoA>;
+concept is_layout_tag =
+    std::same_as<Tag, AoS> || std::same_as<Tag, SoA> || is_aosoa_tag<Tag>;
 
 /// concept do model a contiguous container, meaning that objects of the
 /// container are store physically in a contiguous way, we also need random
 template <typename C>
 concept particles_container = std::ranges::contiguous_range<C>;
 
-// (TODO) add a concept for System (like AoS particles and SoA particles
-// themselves) (TODO) add a concept for Integrator as well
-
 template <typename V>
 concept is_particle_view = requires(V v) {
     v.qx;
@@ -37,6 +48,12 @@ concept is_particle_view = requires(V v) {
     v.az;
     v.m;
 };
+namespace nbody {
+/// @brief fields of a particle, used to address the columns of columnar
+/// (SoA) systems
+enum class field { qx, qy, qz, vx, vy, vz, ax, ay, az, m, r };
+}  // namespace nbody
+
 template <typename S>
 concept particles_system = requires(S s) {
     { s.begin() };
@@ -45,3 +62,53 @@ concept particles_system = requires(S s) {
 } && requires(S s) {
     { *s.begin() } -> is_particle_view;
 };
+
+/// concept to model systems storing each field in its own contiguous column,
+/// letting kernels stream raw arrays instead of particle views
+template <typename S>
+concept columnar_system = particles_system<S> && requires(S s) {
+    { s.column(nbody::field::qx).data() };
+    { s.column(nbody::field::qx).size() } -> std::convertible_to<std::size_t>;
+};
+
+/// concept to model systems storing particles in blocks of block_width lanes
+/// per field (AoSoA layout), letting kernels stream the lanes of every block
+template <typename S>
+concept blocked_system = particles_system<S> && requires(S s) {
+    { s.blocks().data() };
+    { S::block_width } -> std::convertible_to<std::size_t>;
+};
+
+/// concept to model systems giving every particle a persistent identifier,
+/// which follows the particle when the system is reordered
+template <typename S>
+concept identified_system = particles_system<S> && requires(S s) {
+    { s.ids().data() };
+    { s.ids().size() } -> std::convertible_to<std::size_t>;
+};
+
+/// concept to model the complete systems nbody::System builds (AoS, SoA,
+/// arena and AoSoA particles), the ones the simulation driver, checkpoints
+/// and init_galaxy work with: identified particles of a scalar value type,
+/// built empty, grown particle by particle and moved into nbody::Nbody.
+/// Named after particles_system, nbody::System being the alias building them
+template <typename S>
+concept simulation_system =
+    identified_system<S> && std::default_initializable<S> &&
+    std::move_constructible<S> && Scalar<typename S::value_type> &&
+    requires(S s, std::size_t n) {
+        typename S::accum_type;
+        typename S::size_type;
+        s.reserve(n);
+        s.add_particle({});
+    };
+
+/// concept to model an integrator of systems of type S: a callable advancing
+/// the system by a step, integrators::adaptive and nbody::Nbody calling it
+/// as is. Integrators keeping state between steps (integrators::hermite,
+/// leapfrog_fused) are movable objects, stateless ones may be lambdas
+template <typename I, typename S>
+concept integrator_of = particles_system<S> && std::move_constructible<I> &&
+                        requires(I& integrator, S& system, float dt) {
+                            integrator(system, dt);
+                        };
@@ -1,8 +1,14 @@
 #pragma once
 
-/// constants used across the whole simulation
+/// constants used across the whole simulation, the variable templates give
+/// them in the precision of the kernel using them
 namespace nbody::constants {
 
-inline constexpr float G = 6.674e-11f;
-inline constexpr float soft = 0.035f;
+template <typename T>
+inline constexpr T G_v = T(6.674e-11);
+template <typename T>
+inline constexpr T soft_v = T(0.035);
+
+inline constexpr float G = G_v<float>;
+inline constexpr float soft = soft_v<float>;
 }  // namespace nbody::constants
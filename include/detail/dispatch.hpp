@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdlib>
+#include <string_view>
+
+#include "detail/simd.hpp"
+
+/// runtime selection of the instruction set used by the hot kernels. The
+/// binary is built for baseline x86-64 and every kernel is instantiated once
+/// per instruction set. Kernels written with the explicit SIMD wrappers carry
+/// the target of their wrapper (NBODY_SIMD_TARGET, see detail/simd.hpp), so
+/// that they are correct in every build; they are called through a target
+/// specific, flattened wrapper which, in optimized builds only, also inlines
+/// the auto-vectorized loops of the callable and compiles them for that
+/// instruction set. The widest instruction set supported by the CPU is
+/// picked at startup through CPUID, the NBODY_ISA environment variable
+/// (scalar, sse, avx2, avx512) can lower it.
+
+namespace nbody::detail {
+
+enum class isa { scalar, sse, avx2, avx512 };
+
+[[nodiscard]] constexpr const char* isa_name(isa i) {
+    switch (i) {
+        case isa::scalar: return "scalar";
+        case isa::sse: return "sse";
+        case isa::avx2: return "avx2";
+        case isa::avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+/// @brief whether the CPU running the program supports the instruction set
+[[nodiscard]] inline bool cpu_supports(isa i) {
+#if defined(NBODY_X86_64)
+    __builtin_cpu_init();
+    switch (i) {
+        case isa::scalar:
+        case isa::sse: return true;
+        case isa::avx2:
+            return __builtin_cpu_supports("avx2") &&
+                   __builtin_cpu_supports("fma");
+        case isa::avx512:
+            return __builtin_cpu_supports("avx512f") && cpu_supports(isa::avx2);
+    }
+    return false;
+#else
+    return i == isa::scalar;
+#endif
+}
+
+/// @brief widest instruction set supported by the CPU, capped by NBODY_ISA
+[[nodiscard]] inline isa detect_isa() {
+    auto best = isa::scalar;
+    for (auto i : {isa::sse, isa::avx2, isa::avx512})
+        if (cpu_supports(i)) best = i;
+
+    if (const char* env = std::getenv("NBODY_ISA")) {
+        for (auto i : {isa::scalar, isa::sse, isa::avx2, isa::avx512})
+            if (std::string_view(env) == isa_name(i) && i < best) best = i;
+    }
+    return best;
+}
+
+namespace dispatch_state {
+inline isa& current() {
+    static isa selected = detect_isa();
+    return selected;
+}
+}  // namespace dispatch_state
+
+/// @brief instruction set used by the kernels
+[[nodiscard]] inline isa active_isa() { return dispatch_state::current(); }
+
+/// @brief forces an instruction set, ignored when the CPU does not support
+/// it; mostly useful to compare the different paths
+inline void set_active_isa(isa i) {
+    if (cpu_supports(i)) dispatch_state::current() = i;
+}
+
+/// per instruction set wrappers, f being called with the matching SIMD
+/// wrapper of detail/simd.hpp
+template <typename F>
+[[gnu::flatten]] decltype(auto) run_scalar(F& f) {
+    return f(simd::scalar{});
+}
+#if defined(NBODY_X86_64)
+template <typename F>
+[[gnu::flatten]] decltype(auto) run_sse(F& f) {
+    return f(simd::sse{});
+}
+template <typename F>
+[[gnu::flatten]] NBODY_AVX2 decltype(auto) run_avx2(F& f) {
+    return f(simd::avx2{});
+}
+template <typename F>
+[[gnu::flatten]] NBODY_AVX512 decltype(auto) run_avx512(F& f) {
+    return f(simd::avx512{});
+}
+#endif
+
+/// @brief calls f with the SIMD wrapper of the given instruction set, f
+/// being compiled for it when inlined. f itself must not operate on vectors,
+/// which it would do with the default target in unoptimized builds, but hand
+/// them to NBODY_SIMD_TARGET kernels. f must not hand its work to other
+/// threads either: a task body is compiled for the default target, so
+/// parallel kernels dispatch inside each task.
+template <typename F>
+decltype(auto) dispatch(isa i, F&& f) {
+#if defined(NBODY_X86_64)
+    switch (i) {
+        case isa::avx512: return run_avx512(f);
+        case isa::avx2: return run_avx2(f);
+        case isa::sse: return run_sse(f);
+        case isa::scalar: break;
+    }
+#endif
+    return run_scalar(f);
+}
+
+/// @brief calls f with the SIMD wrapper of the active instruction set
+template <typename F>
+decltype(auto) dispatch(F&& f) {
+    return dispatch(active_isa(), f);
+}
+}  // namespace nbody::detail
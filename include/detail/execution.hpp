@@ -0,0 +1,265 @@
+#pragma once
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/// execution of the parallel passes: every pass over the particles goes
+/// through detail::parallel_for, a tbb::parallel_for over a blocked_range
+/// whose grain and partitioner come from a process wide policy (set by
+/// test_main through --grain, --partitioner and --range, the thread count
+/// being the one of the task arena the passes run in, see --threads and
+/// utils/affinity.hpp). The direct force kernels may split the sources as
+/// well, over a blocked_range2d of (sink blocks, source chunks), when there
+/// are too few blocks of sinks to feed every thread. The tree solvers use
+/// detail::parallel_for for their loops over nodes as well (the grain of the
+/// policy then counting nodes) and detail::parallel_reduce for their
+/// bounding box. The conflict free rounds of detail/triangular_schedule.hpp
+/// and the first touch of detail/memory.hpp (static by design) keep their
+/// own chunking.
+/// A thread may also run its passes serially (serial_scope): the ensemble
+/// runner (utils/ensemble.hpp) gets its parallelism from whole simulations
+/// running side by side, each one stepped by a single thread.
+///
+/// Which setting wins, from the structure of the passes:
+/// - automatic partitioning with the default grains is the safe choice at
+///   every N: the O(N^2) force pass has few, long and uniform tasks, the
+///   O(N) update passes are memory bound and only need chunks large enough
+///   to amortize the scheduling (a few thousand particles);
+/// - static partitioning has the least overhead and gives every thread the
+///   same particles in every pass, matching the NUMA first touch of
+///   detail/memory.hpp: best for the update passes from ~10^5 particles, when
+///   the columns no longer fit the caches, on a machine with no other load;
+/// - affinity partitioning replays the mapping of the previous call of the
+///   same loop, keeping the chunks of a thread in its caches: it helps when
+///   the working set of a thread fits its L2 (~10^4 to ~10^5 particles);
+/// - the 2D split pays off below a few blocks of sinks per thread (N under
+///   ~256 x 4 x threads, i.e. a few thousand particles on a large node),
+///   where the 1D force pass leaves threads idle; above, the extra partial
+///   sums only cost memory traffic, hence the automatic choice.
+/// bench/nbody_bench takes the same options to measure them on a machine.
+
+namespace nbody::detail {
+
+enum class partitioner { automatic, affinity, fixed };
+
+[[nodiscard]] constexpr const char* partitioner_name(partitioner p) {
+    switch (p) {
+        case partitioner::automatic: return "auto";
+        case partitioner::affinity: return "affinity";
+        case partitioner::fixed: return "static";
+    }
+    return "unknown";
+}
+
+/// @brief splitting of the direct force passes
+enum class ranges { automatic, one, two };
+
+[[nodiscard]] constexpr const char* ranges_name(ranges r) {
+    switch (r) {
+        case ranges::automatic: return "auto";
+        case ranges::one: return "1d";
+        case ranges::two: return "2d";
+    }
+    return "unknown";
+}
+
+/// @throws std::invalid_argument for an unknown name
+[[nodiscard]] inline partitioner parse_partitioner(std::string_view name) {
+    for (auto p :
+         {partitioner::automatic, partitioner::affinity, partitioner::fixed})
+        if (name == partitioner_name(p)) return p;
+    throw std::invalid_argument("unknown partitioner: " + std::string(name));
+}
+
+/// @throws std::invalid_argument for an unknown name
+[[nodiscard]] inline ranges parse_ranges(std::string_view name) {
+    for (auto r : {ranges::automatic, ranges::one, ranges::two})
+        if (name == ranges_name(r)) return r;
+    throw std::invalid_argument("unknown range: " + std::string(name));
+}
+
+/// @brief how the parallel passes are chunked and scheduled
+struct execution_policy {
+    /// particles per chunk, 0 for the default grain of every pass
+    std::size_t grain{0};
+    partitioner partition{partitioner::automatic};
+    ranges split{ranges::automatic};
+};
+
+namespace execution_state {
+inline execution_policy& current() {
+    static execution_policy policy;
+    return policy;
+}
+
+/// whether the passes started by the calling thread run serially
+inline bool& serial() {
+    thread_local bool flag = false;
+    return flag;
+}
+}  // namespace execution_state
+
+/// @brief policy of the passes run from now on
+[[nodiscard]] inline execution_policy active_execution() {
+    return execution_state::current();
+}
+inline void set_execution(execution_policy p) {
+    execution_state::current() = p;
+}
+
+/// @brief runs the passes started by the calling thread serially, in one
+/// chunk, for its lifetime. Scopes nest, the outer setting being restored
+class serial_scope {
+   public:
+    serial_scope() : saved_(execution_state::serial()) {
+        execution_state::serial() = true;
+    }
+    serial_scope(const serial_scope&) = delete;
+    serial_scope& operator=(const serial_scope&) = delete;
+    ~serial_scope() { execution_state::serial() = saved_; }
+
+   private:
+    bool saved_;
+};
+
+/// @brief whether the passes of the calling thread run serially
+[[nodiscard]] inline bool serial_passes() { return execution_state::serial(); }
+
+/// @brief grain of a pass, the one of the policy when set: unit is the
+/// number of particles per index of the range (e.g. the width of the blocks
+/// of an AoSoA system)
+[[nodiscard]] inline std::size_t grain_of(std::size_t default_grain,
+                                          std::size_t unit = 1) {
+    const auto g = active_execution().grain;
+    if (g == 0) return std::max<std::size_t>(default_grain, 1);
+    return std::max<std::size_t>(g / std::max<std::size_t>(unit, 1), 1);
+}
+
+/// @brief affinity state of a loop, replayed by its next calls: one per body
+/// type, i.e. per loop of the code, and per calling thread so that loops run
+/// concurrently by different threads (an ensemble) keep their own
+template <typename Body>
+tbb::affinity_partitioner& affinity_of() {
+    static thread_local tbb::affinity_partitioner p;
+    return p;
+}
+
+/// @brief runs body on chunks of [begin, end) with the partitioner of the
+/// policy, chunks of the policy grain or of default_grain
+/// @param body: callable taking a const tbb::blocked_range<std::size_t>&
+/// @param unit: particles per index, see grain_of
+template <typename Body>
+void parallel_for(std::size_t begin, std::size_t end,
+                  std::size_t default_grain, Body&& body,
+                  std::size_t unit = 1) {
+    const tbb::blocked_range<std::size_t> range(
+        begin, end, grain_of(default_grain, unit));
+    if (serial_passes()) {
+        if (!range.empty()) body(range);
+        return;
+    }
+    switch (active_execution().partition) {
+        case partitioner::automatic:
+            tbb::parallel_for(range, body, tbb::auto_partitioner{});
+            break;
+        case partitioner::affinity:
+            tbb::parallel_for(range, body,
+                              affinity_of<std::decay_t<Body>>());
+            break;
+        case partitioner::fixed:
+            tbb::parallel_for(range, body, tbb::static_partitioner{});
+            break;
+    }
+}
+
+/// @brief reduces [begin, end) with the partitioner of the policy, chunks of
+/// the policy grain or of default_grain
+/// @param body: callable taking a const tbb::blocked_range<std::size_t>& and
+/// the value of the chunks before it, returning the value with the chunk
+/// @param join: callable combining the values of two sets of chunks
+/// @param unit: particles per index, see grain_of
+template <typename Value, typename Body, typename Join>
+[[nodiscard]] Value parallel_reduce(std::size_t begin, std::size_t end,
+                                   std::size_t default_grain,
+                                   const Value& identity, Body&& body,
+                                   Join&& join, std::size_t unit = 1) {
+    const tbb::blocked_range<std::size_t> range(
+        begin, end, grain_of(default_grain, unit));
+    if (serial_passes())
+        return range.empty() ? identity : body(range, identity);
+    switch (active_execution().partition) {
+        case partitioner::automatic:
+            return tbb::parallel_reduce(range, identity, body, join,
+                                        tbb::auto_partitioner{});
+        case partitioner::affinity:
+            return tbb::parallel_reduce(range, identity, body, join,
+                                        affinity_of<std::decay_t<Body>>());
+        case partitioner::fixed:
+            return tbb::parallel_reduce(range, identity, body, join,
+                                        tbb::static_partitioner{});
+    }
+    return identity;
+}
+
+/// @brief runs body on tiles of [0, rows) x [0, cols), with the partitioner
+/// of the policy
+/// @param body: callable taking a const tbb::blocked_range2d<std::size_t>&
+template <typename Body>
+void parallel_for_2d(std::size_t rows, std::size_t row_grain,
+                     std::size_t cols, std::size_t col_grain, Body&& body) {
+    const tbb::blocked_range2d<std::size_t> range(0, rows, row_grain, 0, cols,
+                                                  col_grain);
+    if (serial_passes()) {
+        if (!range.empty()) body(range);
+        return;
+    }
+    switch (active_execution().partition) {
+        case partitioner::automatic:
+            tbb::parallel_for(range, body, tbb::auto_partitioner{});
+            break;
+        case partitioner::affinity:
+            tbb::parallel_for(range, body,
+                              affinity_of<std::decay_t<Body>>());
+            break;
+        case partitioner::fixed:
+            tbb::parallel_for(range, body, tbb::static_partitioner{});
+            break;
+    }
+}
+
+/// @brief threads the passes may run on: those of the current arena, capped
+/// by a tbb::global_control
+[[nodiscard]] inline std::size_t concurrency() {
+    const auto arena = tbb::this_task_arena::max_concurrency();
+    const auto allowed = tbb::global_control::active_value(
+        tbb::global_control::max_allowed_parallelism);
+    return std::max<std::size_t>(
+        std::min<std::size_t>(static_cast<std::size_t>(arena), allowed), 1);
+}
+
+/// @brief whether the direct force pass over blocks of sinks should split
+/// the sources as well: forced by the policy, or when the blocks are too few
+/// for the threads (see concurrency). Never for serial passes
+[[nodiscard]] inline bool split_sources(std::size_t sink_blocks) {
+    if (serial_passes()) return false;
+    switch (active_execution().split) {
+        case ranges::one: return false;
+        case ranges::two: return true;
+        case ranges::automatic: break;
+    }
+    const auto threads = concurrency();
+    return threads > 1 && sink_blocks < 4 * threads;
+}
+}  // namespace nbody::detail
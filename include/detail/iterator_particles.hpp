@@ -1,26 +1,34 @@
 #pragma once
 #include <cstddef>
 #include <iterator>
+#include <utility>
 
 #include "detail/particle_view.hpp"
 
 namespace nbody::detail {
 
+/// @brief random access iterator over the particles of a storage, yielding
+/// particle views by value. A const Storage gives the const iterator, whose
+/// views hold const references
 template <typename Storage>
 struct Iterator_particles {
     using iterator_category = std::random_access_iterator_tag;
+    using iterator_concept = std::random_access_iterator_tag;
     using difference_type = std::ptrdiff_t;
-    using value_type = ParticleView<typename Storage::value_type>;
+    using value_type = decltype(std::declval<Storage&>().view(0));
     using pointer = void;
     using reference = value_type;
     using size_type = std::size_t;
 
+    Iterator_particles() = default;
     explicit Iterator_particles(Storage* storage, size_type index)
         : storage_(storage), i(index) {}
 
     // dereference
-    auto operator*() { return storage_->view(i); }
-    auto operator[](difference_type n) const { return storage_->view(i + n); }
+    reference operator*() const { return storage_->view(i); }
+    reference operator[](difference_type n) const {
+        return storage_->view(i + static_cast<size_type>(n));
+    }
 
     // increment / decrement
     Iterator_particles& operator++() noexcept {
@@ -44,21 +52,22 @@ struct Iterator_particles {
 
     // arithmetic
     Iterator_particles& operator+=(difference_type n) {
-        i += n;
+        i += static_cast<size_type>(n);
         return *this;
     }
     Iterator_particles& operator-=(difference_type n) {
-        i -= n;
+        i -= static_cast<size_type>(n);
         return *this;
     }
     Iterator_particles operator+(difference_type n) const {
-        return Iterator_particles{storage_, i + n};
+        return Iterator_particles{storage_, i + static_cast<size_type>(n)};
     }
     Iterator_particles operator-(difference_type n) const {
-        return Iterator_particles{storage_, i - n};
+        return Iterator_particles{storage_, i - static_cast<size_type>(n)};
     }
     difference_type operator-(const Iterator_particles& other) const {
-        return i - other.i;
+        return static_cast<difference_type>(i) -
+               static_cast<difference_type>(other.i);
     }
 
     // comparison
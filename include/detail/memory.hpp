@@ -0,0 +1,84 @@
+#pragma once
+#include <sys/mman.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+/// placement of the particle storage on NUMA machines. Linux puts a page on
+/// the node of the thread writing it first, so that an arena zeroed by the
+/// thread building the system lands on a single socket and every thread of
+/// the others reads it remotely. With first touch, new arenas are zeroed in
+/// parallel instead: the particles are split in chunks of the grain of the
+/// force kernels, evenly over the threads like their own splitting, each
+/// chunk being zeroed in every column by the thread that will compute it.
+/// Large arenas may be backed by transparent huge pages, cutting the TLB
+/// misses of the column streams. Both apply to SoA_arena_particles (the
+/// aligned_vector container with the SoA layout), the policy being process
+/// wide like the instruction set of detail/dispatch.hpp.
+
+namespace nbody::detail {
+
+/// @brief how arenas are allocated and first written
+struct memory_policy {
+    /// zero new arenas in parallel, chunk by chunk
+    bool first_touch{true};
+    /// map arenas of at least huge_page bytes with madvise(MADV_HUGEPAGE)
+    bool huge_pages{false};
+};
+
+/// size of a transparent huge page on x86-64
+inline constexpr std::size_t huge_page = std::size_t{2} << 20;
+/// particles per chunk of the first touch, detail::i_block of the kernels
+inline constexpr std::size_t touch_grain = 256;
+
+namespace memory_state {
+inline memory_policy& current() {
+    static memory_policy policy;
+    return policy;
+}
+}  // namespace memory_state
+
+/// @brief policy of the arenas allocated from now on
+[[nodiscard]] inline memory_policy active_memory_policy() {
+    return memory_state::current();
+}
+inline void set_memory_policy(memory_policy p) { memory_state::current() = p; }
+
+/// @brief anonymous mapping of bytes advised to use huge pages, nullptr when
+/// the mapping fails. The kernel may still back it with small pages (THP set
+/// to never, no huge page available)
+[[nodiscard]] inline void* map_huge(std::size_t bytes) {
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+inline void unmap(void* p, std::size_t bytes) noexcept { munmap(p, bytes); }
+
+/// @brief zeroes columns of capacity scalars each, starting at p, with the
+/// policy: in parallel by chunks of particles for first touch
+template <typename T>
+void zero_columns(T* p, std::size_t columns, std::size_t capacity,
+                  const memory_policy& policy) {
+    if (!policy.first_touch) {
+        std::fill_n(p, columns * capacity, T{0});
+        return;
+    }
+    tbb::parallel_for(
+        tbb::blocked_range<std::size_t>(0, capacity, touch_grain),
+        [&](const tbb::blocked_range<std::size_t>& r) {
+            for (std::size_t c = 0; c < columns; ++c)
+                std::fill(p + c * capacity + r.begin(),
+                          p + c * capacity + r.end(), T{0});
+        },
+        tbb::static_partitioner{});
+}
+}  // namespace nbody::detail
@@ -0,0 +1,165 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define NBODY_X86_64 1
+#define NBODY_AVX2 [[gnu::target("avx2,fma")]]
+#define NBODY_AVX512 [[gnu::target("avx512f,avx2,fma")]]
+/// compiles a kernel template for the instruction set of its SIMD wrapper V
+#define NBODY_SIMD_TARGET(V) [[gnu::target(V::target)]]
+#else
+#define NBODY_SIMD_TARGET(V)
+#endif
+
+/// thin wrappers over the SIMD instruction sets used by the vectorized
+/// kernels, all exposing the same static interface so that a kernel is
+/// written once as a template over them. Every wrapper is compiled for its own
+/// instruction set through target attributes, whatever the -m flags of the
+/// build. Kernels taking or returning vectors are declared with
+/// NBODY_SIMD_TARGET(V), so that they are compiled for the instruction set of
+/// their wrapper even when they are not inlined (unoptimized builds), and no
+/// vector ever crosses a call between functions of different targets. They
+/// must only be instantiated through detail/dispatch.hpp, which selects the
+/// wrapper matching the CPU at runtime.
+
+namespace nbody::detail::simd {
+
+/// @brief portable fallback, one lane of any floating point type
+template <typename T>
+struct basic_scalar {
+    using value_type = T;
+    using vec = T;
+    static constexpr std::size_t width = 1;
+    static constexpr const char* name = "scalar";
+    /// target attribute of the kernels, baseline of x86-64
+    static constexpr const char target[] = "sse2";
+
+    static vec load(const T* p) { return *p; }
+    static void store(T* p, vec v) { *p = v; }
+    static vec set1(T x) { return x; }
+    static vec zero() { return T{0}; }
+    static vec add(vec a, vec b) { return a + b; }
+    static vec sub(vec a, vec b) { return a - b; }
+    static vec mul(vec a, vec b) { return a * b; }
+    static vec fmadd(vec a, vec b, vec c) { return a * b + c; }
+    static vec rsqrt(vec x) { return T{1} / std::sqrt(x); }
+    /// x where a > b, zero elsewhere
+    static vec select_gt(vec a, vec b, vec x) { return a > b ? x : T{0}; }
+    static T sum(vec v) { return v; }
+};
+using scalar = basic_scalar<float>;
+
+#if defined(NBODY_X86_64)
+/// @brief SSE, 4 lanes: baseline of every x86-64 CPU
+struct sse {
+    using value_type = float;
+    using vec = __m128;
+    static constexpr std::size_t width = 4;
+    static constexpr const char* name = "sse";
+    static constexpr const char target[] = "sse2";
+
+    static vec load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, vec v) { _mm_storeu_ps(p, v); }
+    static vec set1(float x) { return _mm_set1_ps(x); }
+    static vec zero() { return _mm_setzero_ps(); }
+    static vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+    static vec sub(vec a, vec b) { return _mm_sub_ps(a, b); }
+    static vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+    static vec fmadd(vec a, vec b, vec c) {
+        return _mm_add_ps(_mm_mul_ps(a, b), c);
+    }
+    /// 12 bits hardware estimate refined by one Newton-Raphson step
+    static vec rsqrt(vec x) {
+        const vec y = _mm_rsqrt_ps(x);
+        const vec yyx = _mm_mul_ps(_mm_mul_ps(y, y), x);
+        return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y),
+                          _mm_sub_ps(_mm_set1_ps(3.0f), yyx));
+    }
+    static vec select_gt(vec a, vec b, vec x) {
+        return _mm_and_ps(_mm_cmpgt_ps(a, b), x);
+    }
+    static float sum(vec v) {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+        return _mm_cvtss_f32(v);
+    }
+};
+
+/// @brief AVX2 + FMA, 8 lanes
+struct avx2 {
+    using value_type = float;
+    using vec = __m256;
+    static constexpr std::size_t width = 8;
+    static constexpr const char* name = "avx2";
+    static constexpr const char target[] = "avx2,fma";
+
+    NBODY_AVX2 static vec load(const float* p) { return _mm256_loadu_ps(p); }
+    NBODY_AVX2 static void store(float* p, vec v) { _mm256_storeu_ps(p, v); }
+    NBODY_AVX2 static vec set1(float x) { return _mm256_set1_ps(x); }
+    NBODY_AVX2 static vec zero() { return _mm256_setzero_ps(); }
+    NBODY_AVX2 static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+    NBODY_AVX2 static vec sub(vec a, vec b) { return _mm256_sub_ps(a, b); }
+    NBODY_AVX2 static vec mul(vec a, vec b) { return _mm256_mul_ps(a, b); }
+    NBODY_AVX2 static vec fmadd(vec a, vec b, vec c) {
+        return _mm256_fmadd_ps(a, b, c);
+    }
+    /// 12 bits hardware estimate refined by one Newton-Raphson step
+    NBODY_AVX2 static vec rsqrt(vec x) {
+        const vec y = _mm256_rsqrt_ps(x);
+        const vec yyx = _mm256_mul_ps(_mm256_mul_ps(y, y), x);
+        return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y),
+                             _mm256_sub_ps(_mm256_set1_ps(3.0f), yyx));
+    }
+    NBODY_AVX2 static vec select_gt(vec a, vec b, vec x) {
+        return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ), x);
+    }
+    NBODY_AVX2 static float sum(vec v) {
+        return sse::sum(_mm_add_ps(_mm256_castps256_ps128(v),
+                                   _mm256_extractf128_ps(v, 1)));
+    }
+};
+
+/// @brief AVX-512F, 16 lanes
+struct avx512 {
+    using value_type = float;
+    using vec = __m512;
+    static constexpr std::size_t width = 16;
+    static constexpr const char* name = "avx512";
+    static constexpr const char target[] = "avx512f,avx2,fma";
+
+    NBODY_AVX512 static vec load(const float* p) { return _mm512_loadu_ps(p); }
+    NBODY_AVX512 static void store(float* p, vec v) { _mm512_storeu_ps(p, v); }
+    NBODY_AVX512 static vec set1(float x) { return _mm512_set1_ps(x); }
+    NBODY_AVX512 static vec zero() { return _mm512_setzero_ps(); }
+    NBODY_AVX512 static vec add(vec a, vec b) { return _mm512_add_ps(a, b); }
+    NBODY_AVX512 static vec sub(vec a, vec b) { return _mm512_sub_ps(a, b); }
+    NBODY_AVX512 static vec mul(vec a, vec b) { return _mm512_mul_ps(a, b); }
+    NBODY_AVX512 static vec fmadd(vec a, vec b, vec c) {
+        return _mm512_fmadd_ps(a, b, c);
+    }
+    /// 14 bits hardware estimate refined by one Newton-Raphson step. The
+    /// zero masked forms of this wrapper avoid the undefined vectors of the
+    /// plain intrinsics, which GCC 12 reports as maybe uninitialized
+    NBODY_AVX512 static vec rsqrt(vec x) {
+        const vec y = _mm512_maskz_rsqrt14_ps(0xFFFF, x);
+        const vec yyx = _mm512_mul_ps(_mm512_mul_ps(y, y), x);
+        return _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), y),
+                             _mm512_sub_ps(_mm512_set1_ps(3.0f), yyx));
+    }
+    NBODY_AVX512 static vec select_gt(vec a, vec b, vec x) {
+        return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_GT_OQ), x);
+    }
+    NBODY_AVX512 static float sum(vec v) {
+        const __m512d d = _mm512_castps_pd(v);
+        const __m256 lo =
+            _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, d, 0));
+        const __m256 hi =
+            _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, d, 1));
+        return avx2::sum(_mm256_add_ps(lo, hi));
+    }
+};
+#endif
+
+}  // namespace nbody::detail::simd
@@ -0,0 +1,50 @@
+#pragma once
+#include <tbb/parallel_for.h>
+
+#include <cstddef>
+#include <utility>
+
+#include "detail/execution.hpp"
+
+namespace nbody::detail {
+
+/// @brief visits every unordered pair of blocks (I, J), I <= J, out of nb
+/// blocks, in rounds where no block appears twice: pairs of a round run in
+/// parallel without any synchronization, while rounds run one after the
+/// other. The schedule (round robin tournament, diagonal pairs first) only
+/// depends on nb, hence every block sees its pairs in the same order whatever
+/// the number of threads, keeping reductions deterministic. Serial passes (see
+/// detail::serial_scope) visit the same schedule on the calling thread.
+/// @param nb number of blocks
+/// @param f callable taking (I, J)
+template <typename F>
+void for_each_block_pair(std::size_t nb, F&& f) {
+    if (nb == 0) return;
+    auto round = [](std::size_t count, auto&& g) {
+        if (serial_passes())
+            for (std::size_t k = 0; k < count; ++k) g(k);
+        else
+            tbb::parallel_for(std::size_t{0}, count, g);
+    };
+
+    /// diagonal round, every block with itself
+    round(nb, [&](std::size_t b) { f(b, b); });
+
+    /// an odd number of blocks gets a dummy block, paired blocks sit out
+    const std::size_t p = nb + nb % 2;
+    const std::size_t rounds = p - 1;
+    for (std::size_t r = 0; r < rounds; ++r) {
+        round(p / 2, [&](std::size_t k) {
+            std::size_t a = r;
+            std::size_t b = p - 1;
+            if (k > 0) {
+                a = (r + k) % rounds;
+                b = (r + rounds - k) % rounds;
+            }
+            if (a >= nb || b >= nb) return;
+            if (a > b) std::swap(a, b);
+            f(a, b);
+        });
+    }
+}
+}  // namespace nbody::detail
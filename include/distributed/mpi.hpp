@@ -0,0 +1,345 @@
+#pragma once
+#include <mpi.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "aligned_vector.hpp"
+#include "concepts.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "physics/direct_soa.hpp"
+#include "precision.hpp"
+#include "utils/compute_energy.hpp"
+#include "utils/profiler.hpp"
+
+/// distributed memory mode (cmake -DNBODY_MPI=ON): the particles are split in
+/// contiguous slices, one per rank, every rank stepping its own slice with the
+/// usual integrators. Forces come from distributed::ring_sum, a systolic ring:
+/// the positions and masses of every slice travel once around the ranks, tile
+/// by tile, each rank summing the interactions of its particles with the tile
+/// it holds while the next one is in flight. Update passes only touch local
+/// particles and need no communication, energies are summed with an
+/// allreduce (distributed::compute_energy).
+///
+/// MPI is called from the thread driving the integrator only
+/// (MPI_THREAD_FUNNELED), the kernels of a tile run on TBB as usual.
+
+namespace nbody::distributed {
+
+namespace detail {
+
+/// @brief throws on a failed MPI call, environment makes them return
+inline void check(int rc, const char* what) {
+    if (rc == MPI_SUCCESS) return;
+    char message[MPI_MAX_ERROR_STRING];
+    int length = 0;
+    MPI_Error_string(rc, message, &length);
+    throw std::runtime_error(std::string("mpi ") + what + ": " +
+                             std::string(message, std::size_t(length)));
+}
+
+template <Scalar T>
+[[nodiscard]] MPI_Datatype datatype() {
+    if constexpr (sizeof(T) == sizeof(float))
+        return MPI_FLOAT;
+    else
+        return MPI_DOUBLE;
+}
+
+inline constexpr int ring_tag = 0x6e62;
+}  // namespace detail
+
+/// @brief MPI for the lifetime of the object, errors being reported as
+/// exceptions instead of aborting
+class environment {
+   public:
+    environment(int& argc, char**& argv) {
+        int provided = 0;
+        detail::check(
+            MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided),
+            "init");
+        MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+    }
+    environment(const environment&) = delete;
+    environment& operator=(const environment&) = delete;
+    ~environment() { MPI_Finalize(); }
+};
+
+/// @brief ranks sharing the particles
+struct communicator {
+    MPI_Comm comm{MPI_COMM_WORLD};
+
+    [[nodiscard]] int rank() const {
+        int r = 0;
+        detail::check(MPI_Comm_rank(comm, &r), "rank");
+        return r;
+    }
+    [[nodiscard]] int size() const {
+        int s = 1;
+        detail::check(MPI_Comm_size(comm, &s), "size");
+        return s;
+    }
+    void barrier() const { detail::check(MPI_Barrier(comm), "barrier"); }
+
+    /// @brief sum over the ranks, returned to all of them
+    [[nodiscard]] double sum(double x) const {
+        double total = 0.0;
+        detail::check(
+            MPI_Allreduce(&x, &total, 1, MPI_DOUBLE, MPI_SUM, comm),
+            "allreduce");
+        return total;
+    }
+    /// @brief maximum over the ranks, returned to all of them
+    [[nodiscard]] double max(double x) const {
+        double top = 0.0;
+        detail::check(
+            MPI_Allreduce(&x, &top, 1, MPI_DOUBLE, MPI_MAX, comm),
+            "allreduce");
+        return top;
+    }
+};
+
+/// @brief particles [begin, end) of the global numbering
+struct slice {
+    std::size_t begin{0}, end{0};
+    [[nodiscard]] std::size_t size() const { return end - begin; }
+};
+
+/// @brief block partition of n particles, the first n % ranks slices holding
+/// one more particle
+[[nodiscard]] inline slice partition(std::size_t n, int ranks, int rank) {
+    const auto p = static_cast<std::size_t>(ranks);
+    const auto r = static_cast<std::size_t>(rank);
+    const auto base = n / p, extra = n % p;
+    const auto begin = r * base + std::min(r, extra);
+    return {begin, begin + base + (r < extra ? 1 : 0)};
+}
+
+/// @brief slice of the particles of a system owned by this rank, identifiers
+/// included: every rank builds the same global system (e.g. init_galaxy with
+/// the same seed) and keeps its part
+template <typename System>
+    requires identified_system<System>
+[[nodiscard]] System local_slice(const System& global,
+                                 const communicator& comm = {}) {
+    const auto part = partition(global.size(), comm.size(), comm.rank());
+    System local;
+    if constexpr (requires { local.reserve(part.size()); })
+        local.reserve(part.size());
+    auto first = global.begin();
+    for (auto i = part.begin; i < part.end; ++i) {
+        auto&& p = first[i];
+        local.add_particle({p.qx, p.qy, p.qz, p.vx, p.vy, p.vz, p.ax, p.ay,
+                            p.az, p.m, p.r});
+    }
+    const auto ids = global.ids().subspan(part.begin, part.size());
+    std::copy(ids.begin(), ids.end(), local.ids().begin());
+    return local;
+}
+
+/// @brief time spent by the ring passes of a solver
+struct ring_stats {
+    std::size_t passes{0};
+    /// summing the interactions with the tiles
+    double compute_seconds{0.0};
+    /// blocked on the exchange of the next tile, once the current one is done
+    double wait_seconds{0.0};
+    /// sent by this rank
+    std::uint64_t bytes{0};
+};
+
+/// @brief direct summation over the particles of every rank, as a force
+/// solver for the integrators: each rank computes the accelerations of its
+/// own particles. Tiles hold the positions and masses of a slice, padded to
+/// the largest one with null masses; a pass takes as many stages as ranks,
+/// the tile of stage s + 1 being received from the previous rank and the one
+/// of stage s forwarded to the next while the kernels of detail::direct_sinks
+/// run on it. Tile partial sums are accumulated in the accumulation type of
+/// the system.
+/// Every rank must call the solver the same number of times.
+class ring_sum {
+   public:
+    explicit ring_sum(communicator comm = {}) : comm_(comm) {}
+
+    /// @brief accelerations of the local particles
+    template <typename System>
+        requires particles_system<System>
+    void operator()(System& system) {
+        using T = typename System::value_type;
+        using Accum = precision::system_accum_t<System>;
+        const auto n = system.size();
+        std::vector<Accum> ax(n), ay(n), az(n);
+        pass<false>(system, ax, ay, az, {});
+        auto first = system.begin();
+        for (std::size_t i = 0; i < n; ++i) {
+            auto&& p = first[i];
+            p.ax = static_cast<T>(precision::value(ax[i]));
+            p.ay = static_cast<T>(precision::value(ay[i]));
+            p.az = static_cast<T>(precision::value(az[i]));
+        }
+    }
+
+    /// @brief softened potentials of the local particles due to all of them,
+    /// accelerations are left untouched
+    template <typename System>
+        requires particles_system<System>
+    void potentials(const System& system, std::span<double> phi) {
+        using Accum = precision::system_accum_t<System>;
+        const auto n = system.size();
+        std::vector<Accum> ax(n), ay(n), az(n);
+        pass<true>(system, ax, ay, az, phi);
+    }
+
+    [[nodiscard]] const communicator& comm() const { return comm_; }
+    [[nodiscard]] const ring_stats& stats() const { return stats_; }
+
+   private:
+    using clock = std::chrono::steady_clock;
+
+    /// @brief tiles in flight: the one computed on and the one received,
+    /// columns qx, qy, qz, m of capacity scalars each
+    template <Scalar T>
+    struct tiles {
+        aligned_vector<T> current, next;
+        std::size_t capacity{0};
+
+        void resize(std::size_t c) {
+            capacity = c;
+            current.assign(4 * c, T{0});
+            next.assign(4 * c, T{0});
+        }
+        [[nodiscard]] T* column(aligned_vector<T>& t, std::size_t f) {
+            return t.data() + f * capacity;
+        }
+    };
+
+    template <Scalar T>
+    tiles<T>& tiles_of() {
+        if constexpr (sizeof(T) == sizeof(float))
+            return float_tiles_;
+        else
+            return double_tiles_;
+    }
+
+    template <bool Potential, typename System, typename Accum>
+    void pass(const System& system, std::vector<Accum>& acc_x,
+              std::vector<Accum>& acc_y, std::vector<Accum>& acc_z,
+              std::span<double> phi) {
+        using T = typename System::value_type;
+        NBODY_PROFILE_PHASE("ring");
+        const auto n = system.size();
+        const int ranks = comm_.size();
+        const int rank = comm_.rank();
+
+        std::uint64_t local = n, largest = 0;
+        detail::check(MPI_Allreduce(&local, &largest, 1, MPI_UINT64_T,
+                                    MPI_MAX, comm_.comm),
+                      "allreduce");
+        auto& t = tiles_of<T>();
+        t.resize(static_cast<std::size_t>(largest));
+        const auto cap = t.capacity;
+
+        /// the sinks keep their own copy of the positions, the tile moves on
+        std::vector<T> xs(n), ys(n), zs(n), ax(n), ay(n), az(n);
+        std::vector<double> stage_phi(Potential ? n : 0);
+        auto first = system.begin();
+        for (std::size_t i = 0; i < n; ++i) {
+            auto&& p = first[i];
+            xs[i] = t.column(t.current, 0)[i] = p.qx;
+            ys[i] = t.column(t.current, 1)[i] = p.qy;
+            zs[i] = t.column(t.current, 2)[i] = p.qz;
+            t.column(t.current, 3)[i] = p.m;
+        }
+        if constexpr (Potential) std::fill(phi.begin(), phi.end(), 0.0);
+
+        const int next = (rank + 1) % ranks;
+        const int previous = (rank + ranks - 1) % ranks;
+        const auto count = static_cast<int>(4 * cap);
+        const auto type = detail::datatype<T>();
+        for (int stage = 0; stage < ranks; ++stage) {
+            const bool forward = stage + 1 < ranks;
+            MPI_Request requests[2];
+            if (forward) {
+                detail::check(MPI_Irecv(t.next.data(), count, type, previous,
+                                        detail::ring_tag, comm_.comm,
+                                        &requests[0]),
+                              "irecv");
+                detail::check(MPI_Isend(t.current.data(), count, type, next,
+                                        detail::ring_tag, comm_.comm,
+                                        &requests[1]),
+                              "isend");
+                stats_.bytes += std::uint64_t(count) * sizeof(T);
+            }
+
+            const auto start = clock::now();
+            const physics::detail::column_sources<T> sources{
+                t.column(t.current, 0), t.column(t.current, 1),
+                t.column(t.current, 2), t.column(t.current, 3)};
+            nbody::detail::parallel_for(
+                0, n, physics::detail::i_block,
+                [&](const tbb::blocked_range<std::size_t>& r) {
+                    NBODY_PROFILE_TASK();
+                    nbody::detail::dispatch([&]<typename D>(D) {
+                        using V = std::conditional_t<
+                            std::same_as<T, float>, D,
+                            nbody::detail::simd::basic_scalar<T>>;
+                        const auto b = r.begin();
+                        physics::detail::direct_sinks<V, Accum, Potential>(
+                            sources, cap, &xs[b], &ys[b], &zs[b], r.size(),
+                            &ax[b], &ay[b], &az[b],
+                            Potential ? &stage_phi[b] : nullptr);
+                    });
+                    for (auto i = r.begin(); i != r.end(); ++i) {
+                        precision::accumulate(acc_x[i], ax[i]);
+                        precision::accumulate(acc_y[i], ay[i]);
+                        precision::accumulate(acc_z[i], az[i]);
+                        if constexpr (Potential) phi[i] += stage_phi[i];
+                    }
+                });
+            const auto computed = clock::now();
+            stats_.compute_seconds +=
+                std::chrono::duration<double>(computed - start).count();
+
+            if (forward) {
+                detail::check(
+                    MPI_Waitall(2, requests, MPI_STATUSES_IGNORE), "waitall");
+                std::swap(t.current, t.next);
+                stats_.wait_seconds +=
+                    std::chrono::duration<double>(clock::now() - computed)
+                        .count();
+            }
+        }
+        ++stats_.passes;
+    }
+
+    communicator comm_;
+    tiles<float> float_tiles_;
+    tiles<double> double_tiles_;
+    ring_stats stats_;
+};
+
+/// @brief total energy of the particles of every rank, returned to all of
+/// them: the potentials come from a ring pass, the local energies are summed
+/// with an allreduce. Integrators keeping velocities staggered must be
+/// synchronized first
+template <typename System>
+    requires particles_system<System>
+[[nodiscard]] double compute_energy(const System& system, ring_sum& solver) {
+    std::vector<double> phi(system.size());
+    solver.potentials(system, phi);
+    const double local =
+        static_cast<double>(utils::compute_energy(system, phi));
+    return solver.comm().sum(local);
+}
+}  // namespace nbody::distributed
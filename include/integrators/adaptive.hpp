@@ -0,0 +1,181 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "concepts.hpp"
+#include "constants.hpp"
+#include "physics/jerk.hpp"
+
+/// adaptive global timestep: the step of every call is picked from the
+/// accelerations left in the system by the force pass of the previous step,
+/// so that choosing it costs O(N) next to the O(N^2) force pass.
+
+namespace nbody::integrators {
+
+/// @brief timestep criteria
+///   acceleration: dt = eta sqrt(soft / max |a_i|), free fall time over the
+///                 softening length
+///   aarseth:      dt = eta min |a_i| / |da_i/dt|, the jerks being estimated
+///                 from the change of the accelerations over the last step
+///                 (computed explicitly on the first one)
+enum class criterion { acceleration, aarseth };
+
+/// @brief adaptive global timestep controller, advancing a system with any
+/// integrator taking (system, dt), see Nbody::step(controller, dt_max).
+/// The symmetric variant keeps leapfrog time-symmetric (Hut, Makino &
+/// McMillan 1995): a trial step of h(t) gives h(t + h), the state is rolled
+/// back and the step actually taken is (h(t) + h(t + h)) / 2, at the price of
+/// one more force evaluation per step. Rolling back restores the system only,
+/// the integrator must not keep state between steps (integrators::leapfrog,
+/// not leapfrog_fused).
+class adaptive {
+   public:
+    /// @param eta: accuracy parameter of the criterion
+    /// @param symmetric: symmetrized steps
+    /// @param dt_min: lower bound of the step, raised to dt_max / 2^20
+    explicit adaptive(criterion c = criterion::aarseth, double eta = 0.02,
+                      bool symmetric = false, float dt_min = 0.0f)
+        : criterion_(c), eta_(eta), symmetric_(symmetric), dt_min_(dt_min) {}
+
+    /// @brief advances the system by one step of at most dt_max
+    /// @return the step taken
+    template <typename System, typename Integrator>
+        requires particles_system<System>
+    float operator()(System& system, Integrator& integrator, float dt_max) {
+        if (criterion_ == criterion::aarseth &&
+            previous_.size() != 3 * system.size())
+            start(system);
+
+        const double h0 = estimate(system);
+        auto dt = clamp(h0, dt_max);
+        if (symmetric_) {
+            const System snapshot = system;
+            const auto history = previous_;
+            gather(system);
+            integrator(system, dt);
+            const double h1 = estimate(system, dt, true);
+            system = snapshot;
+            previous_ = history;
+            dt = clamp(criterion_ == criterion::aarseth ? h1 : 0.5 * (h0 + h1),
+                       dt_max);
+        }
+
+        gather(system);
+        integrator(system, dt);
+        last_dt_ = dt;
+        ++steps_;
+        time_ += double(dt);
+        return dt;
+    }
+
+    /// @brief number of steps taken
+    [[nodiscard]] std::size_t steps() const { return steps_; }
+    /// @brief time covered by the steps taken
+    [[nodiscard]] double time() const { return time_; }
+
+   private:
+    /// @brief explicit jerks, the accelerations being refreshed as well
+    template <typename System>
+    void start(System& system) {
+        physics::jerk_columns<double> jerk;
+        physics::compute_accelerations_and_jerks(system, jerk);
+        gather(system);
+        /// previous accelerations such that (a - previous) / dt is the jerk
+        last_dt_ = 1.0;
+        for (std::size_t i = 0; i < system.size(); ++i) {
+            previous_[3 * i] -= jerk.x[i];
+            previous_[3 * i + 1] -= jerk.y[i];
+            previous_[3 * i + 2] -= jerk.z[i];
+        }
+    }
+
+    /// @brief accelerations at the start of the step, kept for the jerks
+    template <typename System>
+    void gather(System& system) {
+        if (criterion_ != criterion::aarseth) return;
+        previous_.resize(3 * system.size());
+        auto it = system.begin();
+        for (std::size_t i = 0; i < system.size(); ++i, ++it) {
+            auto&& p = *it;
+            previous_[3 * i] = p.ax;
+            previous_[3 * i + 1] = p.ay;
+            previous_[3 * i + 2] = p.az;
+        }
+    }
+
+    /// @brief step given by the criterion from the current accelerations,
+    /// dt being the time elapsed since the previous ones were gathered. With
+    /// both_ends, the Aarseth step is the mean of the steps given by the
+    /// previous and the current accelerations with the same jerks, a function
+    /// of the states at both ends of the step which does not depend on the
+    /// direction of time
+    template <typename System>
+    [[nodiscard]] double estimate(System& system, double dt,
+                                  bool both_ends = false) const {
+        constexpr double inf = std::numeric_limits<double>::infinity();
+        double h = inf;
+        auto it = system.begin();
+        if (criterion_ == criterion::acceleration) {
+            double a2_max = 0.0;
+            for (std::size_t i = 0; i < system.size(); ++i, ++it) {
+                auto&& p = *it;
+                const double ax = p.ax, ay = p.ay, az = p.az;
+                a2_max = std::max(a2_max, ax * ax + ay * ay + az * az);
+            }
+            if (a2_max > 0.0)
+                h = eta_ * std::sqrt(constants::soft_v<double> /
+                                     std::sqrt(a2_max));
+        } else {
+            double h_previous = inf;
+            for (std::size_t i = 0; i < system.size(); ++i, ++it) {
+                auto&& p = *it;
+                const double ax = p.ax, ay = p.ay, az = p.az;
+                const double bx = previous_[3 * i];
+                const double by = previous_[3 * i + 1];
+                const double bz = previous_[3 * i + 2];
+                const double jx = (ax - bx) / dt;
+                const double jy = (ay - by) / dt;
+                const double jz = (az - bz) / dt;
+                const double j2 = jx * jx + jy * jy + jz * jz;
+                if (!(j2 > 0.0)) continue;
+                h = std::min(h, std::sqrt((ax * ax + ay * ay + az * az) / j2));
+                if (both_ends)
+                    h_previous = std::min(
+                        h_previous,
+                        std::sqrt((bx * bx + by * by + bz * bz) / j2));
+            }
+            h = eta_ * (both_ends ? 0.5 * (h + h_previous) : h);
+        }
+        return h;
+    }
+
+    template <typename System>
+    [[nodiscard]] double estimate(System& system) const {
+        return estimate(system, last_dt_);
+    }
+
+    /// @brief step of the estimate h bounded to [dt_min, dt_max]. The lower
+    /// bound is never below dt_max / 2^20: a particle without acceleration
+    /// but with a jerk gives an Aarseth estimate of 0, which would stall time
+    [[nodiscard]] float clamp(double h, float dt_max) const {
+        const double lo = std::max(double(std::min(dt_min_, dt_max)),
+                                   double(dt_max) * min_fraction);
+        return static_cast<float>(h > lo ? std::min(h, double(dt_max)) : lo);
+    }
+
+    static constexpr double min_fraction = 0x1p-20;
+
+    criterion criterion_;
+    double eta_;
+    bool symmetric_;
+    float dt_min_;
+    std::size_t steps_{0};
+    double time_{0.0};
+    double last_dt_{1.0};
+    /// accelerations at the start of the last step, interleaved
+    std::vector<double> previous_;
+};
+}  // namespace nbody::integrators
@@ -1,43 +1,456 @@
 #pragma once
+#include "detail/execution.hpp"
+#include "physics/barnes_hut.hpp"
+#include "physics/fmm.hpp"
+#include "physics/symmetric.hpp"
 #include "physics/compute_accelerations.hpp"
+#include "physics/jerk.hpp"
 #include "physics/updates.hpp"
+#include "utils/profiler.hpp"
+
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
 
 /// integrators are implemented as free functions which are themselves a simple
 /// composition of different methods, this permitted to reduce boiler-plate
-/// while providing as well lot of extensibility
+/// while providing as well lot of extensibility. The force solver is a
+/// template parameter as well: any callable updating the accelerations of the
+/// system (physics::direct_sum, physics::symmetric_sum, physics::barnes_hut...) can be plugged in.
 
 namespace nbody::integrators {
 
 /// @brief forward euler
 /// @param system the particle system
 /// @param dt timestep
-template <typename System>
+/// @param solver force solver, direct summation by default
+template <typename System, typename Solver = physics::direct_sum>
     requires particles_system<System>
-void euler(System& system, float dt) {
-    physics::compute_accelerations(system);
-    physics::update_velocities(system, dt);
-    physics::update_positions(system, dt);
+void euler(System& system, float dt, Solver&& solver = {}) {
+    NBODY_PROFILE_PASS("force", solver(system));
+    NBODY_PROFILE_PASS("kick", physics::update_velocities(system, dt));
+    NBODY_PROFILE_PASS("drift", physics::update_positions(system, dt));
 }
 
 /// @brief verlet integrator
 /// @param system the particle system
 /// @param dt timestep
-template <typename System>
+/// @param solver force solver, direct summation by default
+template <typename System, typename Solver = physics::direct_sum>
     requires particles_system<System>
-void verlet(System& system, float dt) {
-    physics::compute_accelerations(system);
-    physics::update_positions_and_velocities(system, dt);
+void verlet(System& system, float dt, Solver&& solver = {}) {
+    NBODY_PROFILE_PASS("force", solver(system));
+    NBODY_PROFILE_PASS("kick_drift",
+                       physics::update_positions_and_velocities(system, dt));
 }
 
 /// @brief leapfrog integrator
 /// @param system the particle system
 /// @param dt timestep
-template <typename System>
+/// @param solver force solver, direct summation by default
+template <typename System, typename Solver = physics::direct_sum>
+    requires particles_system<System>
+void leapfrog(System& system, float dt, Solver&& solver = {}) {
+    NBODY_PROFILE_PASS("kick", physics::update_velocities(system, dt * 0.5f));
+    NBODY_PROFILE_PASS("drift", physics::update_positions(system, dt));
+    NBODY_PROFILE_PASS("force", solver(system));
+    NBODY_PROFILE_PASS("kick", physics::update_velocities(system, dt * 0.5f));
+}
+
+namespace detail {
+
+/// @brief composition of leapfrog steps of w[k] * dt: a symmetric sequence
+/// of weights cancels the error terms of the lower orders (Yoshida 1990).
+/// The closing half kick of a stage and the opening half kick of the next one
+/// share the same accelerations, they are fused with the drift
+/// (physics::kick_drift), so that a step costs one force evaluation per stage
+template <std::size_t S, typename System, typename Solver>
+void compose(System& system, float dt, const std::array<double, S>& w,
+             Solver& solver) {
+    float pending = 0.0f;
+    for (const double wk : w) {
+        const auto h = static_cast<float>(wk * double(dt));
+        NBODY_PROFILE_PASS("kick_drift",
+                           physics::kick_drift(system, pending + h * 0.5f, h));
+        NBODY_PROFILE_PASS("force", solver(system));
+        pending = h * 0.5f;
+    }
+    NBODY_PROFILE_PASS("kick", physics::update_velocities(system, pending));
+}
+
+/// 2^(1/3)
+inline constexpr double cbrt2 = 1.2599210498948731648;
+/// weights of the fourth order composition
+inline constexpr double y4_w1 = 1.0 / (2.0 - cbrt2);
+inline constexpr std::array<double, 3> yoshida4_weights{y4_w1, -cbrt2 * y4_w1,
+                                                        y4_w1};
+/// weights of the sixth order composition, solution A of Yoshida
+inline constexpr double y6_w1 = -1.17767998417887;
+inline constexpr double y6_w2 = 0.235573213359357;
+inline constexpr double y6_w3 = 0.784513610477560;
+inline constexpr double y6_w0 = 1.0 - 2.0 * (y6_w1 + y6_w2 + y6_w3);
+inline constexpr std::array<double, 7> yoshida6_weights{
+    y6_w3, y6_w2, y6_w1, y6_w0, y6_w1, y6_w2, y6_w3};
+}  // namespace detail
+
+/// @brief fourth order symplectic integrator, three leapfrog stages
+/// (three force evaluations per step)
+/// @param system the particle system
+/// @param dt timestep
+/// @param solver force solver, direct summation by default
+template <typename System, typename Solver = physics::direct_sum>
     requires particles_system<System>
-void leapfrog(System& system, float dt) {
-    physics::update_velocities(system, dt * 0.5f);
-    physics::update_positions(system, dt);
-    physics::compute_accelerations(system);
-    physics::update_velocities(system, dt * 0.5f);
+void yoshida4(System& system, float dt, Solver&& solver = {}) {
+    detail::compose(system, dt, detail::yoshida4_weights, solver);
 }
+
+/// @brief sixth order symplectic integrator, seven leapfrog stages
+/// (seven force evaluations per step)
+/// @param system the particle system
+/// @param dt timestep
+/// @param solver force solver, direct summation by default
+template <typename System, typename Solver = physics::direct_sum>
+    requires particles_system<System>
+void yoshida6(System& system, float dt, Solver&& solver = {}) {
+    detail::compose(system, dt, detail::yoshida6_weights, solver);
+}
+
+/// @brief leapfrog integrator fusing the closing half kick of a step with the
+/// opening half kick and the drift of the next one (physics::kick_drift):
+/// one sweep over the particles per step instead of three. Velocities are
+/// therefore left half a step behind between calls, synchronize() applies the
+/// pending half kick, Nbody calls it before computing energies.
+/// @tparam Solver force solver, direct summation by default, may be a
+/// reference to a solver owned elsewhere
+template <typename Solver = physics::direct_sum>
+class leapfrog_fused {
+   public:
+    leapfrog_fused() = default;
+    explicit leapfrog_fused(Solver solver)
+        : solver_(std::forward<Solver>(solver)) {}
+
+    /// @brief advances the system by dt
+    template <typename System>
+        requires particles_system<System> && std::invocable<Solver&, System&>
+    void operator()(System& system, float dt) {
+        NBODY_PROFILE_PASS("kick_drift",
+                           physics::kick_drift(system, pending_ + dt * 0.5f,
+                                               dt));
+        NBODY_PROFILE_PASS("force", solver_(system));
+        pending_ = dt * 0.5f;
+    }
+
+    /// @brief applies the pending half kick, velocities then match positions
+    template <typename System>
+        requires particles_system<System>
+    void synchronize(System& system) {
+        if (pending_ == 0.0f) return;
+        NBODY_PROFILE_PASS("kick",
+                           physics::update_velocities(system, pending_));
+        pending_ = 0.0f;
+    }
+
+    [[nodiscard]] Solver& solver() { return solver_; }
+
+   private:
+    Solver solver_{};
+    /// half kick owed to the velocities by the last step
+    float pending_{0.0f};
+};
+
+/// @brief leapfrog with hierarchical block time steps: every particle gets a
+/// power of two level l, its own step being dt / 2^l, from the Aarseth-like
+/// criterion dt_i = eta |a| / |da/dt|. A call advances the whole system by dt:
+/// at every step boundary the positions of all the particles are predicted,
+/// then only the particles ending their step (the active set) get their forces
+/// recomputed, through physics::compute_accelerations_active, and are kicked
+/// (KDK leapfrog per particle). Particles far from close encounters stay at
+/// level 0 and cost one force evaluation per call.
+/// Levels are computed from explicit jerks on the first call
+/// (physics::compute_accelerations_and_jerks), then from the change of the
+/// acceleration of every particle over its last step. A level may always
+/// increase, and decrease by one when the current time is a boundary of the
+/// longer step, so that every call ends with all particles synchronized.
+class block_leapfrog {
+   public:
+    /// @param max_level: deepest level, the shortest step is dt / 2^max_level
+    /// @param eta: accuracy parameter of the timestep criterion
+    explicit block_leapfrog(unsigned max_level = 10, double eta = 0.02)
+        : max_level_(std::min(max_level, 30u)), eta_(eta) {}
+
+    /// @brief advances the system by dt
+    template <typename System>
+        requires particles_system<System>
+    void operator()(System& system, float dt) {
+        using T = typename System::value_type;
+        const auto n = system.size();
+        if (n == 0) return;
+        if (levels_.size() != n) start(system, dt);
+
+        /// time is counted in ticks of the shortest step
+        const std::uint64_t end = std::uint64_t{1} << max_level_;
+        const double tick = static_cast<double>(dt) / static_cast<double>(end);
+        auto first = system.begin();
+
+        std::vector<std::size_t> all(n);
+        std::iota(all.begin(), all.end(), std::size_t{0});
+        for (std::size_t i = 0; i < n; ++i) next_[i] = stride(levels_[i]);
+        mark_start(system, all);
+        NBODY_PROFILE_PASS("kick", kick(system, all, tick, 0.5));
+
+        std::uint64_t t = 0;
+        std::vector<std::size_t> active;
+        std::vector<T> old_x, old_y, old_z;
+        while (t < end) {
+            t = *std::min_element(next_.begin(), next_.end());
+            NBODY_PROFILE_PASS("drift", predict(system, t, tick));
+
+            active.clear();
+            for (std::size_t i = 0; i < n; ++i)
+                if (next_[i] == t) active.push_back(i);
+
+            const auto na = active.size();
+            old_x.resize(na);
+            old_y.resize(na);
+            old_z.resize(na);
+            for (std::size_t k = 0; k < na; ++k) {
+                auto&& p = first[static_cast<std::ptrdiff_t>(active[k])];
+                old_x[k] = p.ax;
+                old_y[k] = p.ay;
+                old_z[k] = p.az;
+            }
+            const std::span<const std::size_t> indices(active);
+            NBODY_PROFILE_PASS("force", physics::compute_accelerations_active(
+                                            system, indices));
+            evaluations_ += na;
+            NBODY_PROFILE_PASS("kick", kick(system, active, tick, 0.5));
+
+            /// new levels from the change of the accelerations over the step
+            for (std::size_t k = 0; k < na; ++k) {
+                const auto i = active[k];
+                auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                const double h = tick * double(stride(levels_[i]));
+                const double jx = (double(p.ax) - double(old_x[k])) / h;
+                const double jy = (double(p.ay) - double(old_y[k])) / h;
+                const double jz = (double(p.az) - double(old_z[k])) / h;
+                auto level = criterion(p.ax, p.ay, p.az, jx, jy, jz, dt);
+                if (level < levels_[i])
+                    level = t % stride(levels_[i] - 1) == 0 ? levels_[i] - 1
+                                                            : levels_[i];
+                levels_[i] = static_cast<unsigned char>(level);
+                next_[i] = t + stride(level);
+            }
+            if (t < end) {
+                mark_start(system, active);
+                NBODY_PROFILE_PASS("kick", kick(system, active, tick, 0.5));
+            }
+        }
+    }
+
+    /// @brief number of particles whose forces were computed since the start,
+    /// n per call with a single global step
+    [[nodiscard]] std::size_t evaluations() const { return evaluations_; }
+    /// @brief current level of every particle
+    [[nodiscard]] std::span<const unsigned char> levels() const {
+        return levels_;
+    }
+
+   private:
+    /// @brief forces and levels of every particle from explicit jerks
+    template <typename System>
+    void start(System& system, float dt) {
+        const auto n = system.size();
+        physics::jerk_columns<typename System::value_type> jerk;
+        NBODY_PROFILE_PASS(
+            "force", physics::compute_accelerations_and_jerks(system, jerk));
+        evaluations_ += n;
+        levels_.resize(n);
+        next_.resize(n);
+        auto first = system.begin();
+        for (std::size_t i = 0; i < n; ++i) {
+            auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+            levels_[i] = static_cast<unsigned char>(criterion(
+                p.ax, p.ay, p.az, jerk.x[i], jerk.y[i], jerk.z[i], dt));
+        }
+    }
+
+    /// @brief level whose step is the longest power of two fraction of dt
+    /// below eta |a| / |j|
+    [[nodiscard]] unsigned criterion(double ax, double ay, double az,
+                                     double jx, double jy, double jz,
+                                     float dt) const {
+        const double a2 = ax * ax + ay * ay + az * az;
+        const double j2 = jx * jx + jy * jy + jz * jz;
+        if (!(j2 > 0.0)) return 0;
+        const double dt_i = eta_ * std::sqrt(a2 / j2);
+        if (dt_i >= double(dt)) return 0;
+        const double level = std::ceil(std::log2(double(dt) / dt_i));
+        return level >= max_level_ ? max_level_ : unsigned(level);
+    }
+
+    [[nodiscard]] std::uint64_t stride(unsigned level) const {
+        return std::uint64_t{1} << (max_level_ - level);
+    }
+
+    /// @brief records the positions of the given particles, which start a step
+    template <typename System>
+    void mark_start(System& system, std::span<const std::size_t> particles) {
+        base_x_.resize(system.size());
+        base_y_.resize(system.size());
+        base_z_.resize(system.size());
+        auto first = system.begin();
+        for (auto i : particles) {
+            auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+            base_x_[i] = p.qx;
+            base_y_[i] = p.qy;
+            base_z_[i] = p.qz;
+        }
+    }
+
+    /// @brief positions of every particle at tick t, drifted from the start of
+    /// its step in one go: drifting all the particles by the short steps of
+    /// the deepest level would accumulate one rounding per step
+    template <typename System>
+    void predict(System& system, std::uint64_t t, double tick) {
+        using T = typename System::value_type;
+        auto first = system.begin();
+        nbody::detail::parallel_for(
+            0, system.size(), physics::detail::update_grain,
+            [&](const tbb::blocked_range<std::size_t>& range) {
+                for (auto i = range.begin(); i != range.end(); ++i) {
+                    const auto start = next_[i] - stride(levels_[i]);
+                    const double h = tick * double(t - start);
+                    auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                    p.qx = static_cast<T>(base_x_[i] + double(p.vx) * h);
+                    p.qy = static_cast<T>(base_y_[i] + double(p.vy) * h);
+                    p.qz = static_cast<T>(base_z_[i] + double(p.vz) * h);
+                }
+            });
+    }
+
+    /// @brief v += a * fraction * step of the particle, for the given ones
+    template <typename System>
+    void kick(System& system, std::span<const std::size_t> particles,
+              double tick, double fraction) {
+        using T = typename System::value_type;
+        auto first = system.begin();
+        nbody::detail::parallel_for(
+            0, particles.size(), physics::detail::update_grain,
+            [&](const tbb::blocked_range<std::size_t>& range) {
+                for (auto k = range.begin(); k != range.end(); ++k) {
+                    const auto i = particles[k];
+                    const auto h = static_cast<T>(
+                        fraction * tick * double(stride(levels_[i])));
+                    auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                    p.vx += p.ax * h;
+                    p.vy += p.ay * h;
+                    p.vz += p.az * h;
+                }
+            });
+    }
+
+    unsigned max_level_;
+    double eta_;
+    std::size_t evaluations_{0};
+    std::vector<unsigned char> levels_;
+    /// tick at which the current step of every particle ends
+    std::vector<std::uint64_t> next_;
+    /// positions at the start of the current step of every particle
+    std::vector<double> base_x_, base_y_, base_z_;
+};
+
+/// @brief fourth order Hermite predictor-corrector (Makino & Aarseth 1992),
+/// one evaluation of the accelerations and jerks per step
+/// (physics::compute_accelerations_and_jerks):
+///   predict  x_p = x + v dt + a dt^2/2 + j dt^3/6,  v_p = v + a dt + j dt^2/2
+///   evaluate a_1, j_1 at (x_p, v_p)
+///   correct  v_1 = v + (a + a_1) dt/2 + (j - j_1) dt^2/12
+///            x_1 = x + (v + v_1) dt/2 + (a - a_1) dt^2/12
+/// The state of the step start is kept in double, jerks of the last
+/// evaluation are kept between calls, they are computed on the first one.
+class hermite {
+   public:
+    /// @brief advances the system by dt
+    template <typename System>
+        requires particles_system<System>
+    void operator()(System& system, float dt) {
+        using T = typename System::value_type;
+        const auto n = system.size();
+        if (jerk_.size() != n) {
+            NBODY_PROFILE_PASS(
+                "force",
+                physics::compute_accelerations_and_jerks(system, jerk_));
+            start_.resize(n);
+        }
+        const double h = dt;
+        auto first = system.begin();
+
+        for_each_index("predict", n, [&](std::size_t i) {
+            auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+            auto& s = start_[i];
+            s = {p.qx, p.qy, p.qz, p.vx, p.vy, p.vz, p.ax, p.ay, p.az};
+            const double jx = jerk_.x[i], jy = jerk_.y[i], jz = jerk_.z[i];
+            p.qx = T(s.qx + h * (s.vx + h * (s.ax / 2 + h * jx / 6)));
+            p.qy = T(s.qy + h * (s.vy + h * (s.ay / 2 + h * jy / 6)));
+            p.qz = T(s.qz + h * (s.vz + h * (s.az / 2 + h * jz / 6)));
+            p.vx = T(s.vx + h * (s.ax + h * jx / 2));
+            p.vy = T(s.vy + h * (s.ay + h * jy / 2));
+            p.vz = T(s.vz + h * (s.az + h * jz / 2));
+        });
+
+        /// jerks of the start are kept aside for the corrector
+        std::swap(old_jerk_, jerk_);
+        NBODY_PROFILE_PASS(
+            "force", physics::compute_accelerations_and_jerks(system, jerk_));
+
+        for_each_index("correct", n, [&](std::size_t i) {
+            auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+            const auto& s = start_[i];
+            const double ax = p.ax, ay = p.ay, az = p.az;
+            const double dx = old_jerk_.x[i] - jerk_.x[i];
+            const double dy = old_jerk_.y[i] - jerk_.y[i];
+            const double dz = old_jerk_.z[i] - jerk_.z[i];
+            const double vx = s.vx + h / 2 * (s.ax + ax) + h * h / 12 * dx;
+            const double vy = s.vy + h / 2 * (s.ay + ay) + h * h / 12 * dy;
+            const double vz = s.vz + h / 2 * (s.az + az) + h * h / 12 * dz;
+            p.qx = T(s.qx + h / 2 * (s.vx + vx) + h * h / 12 * (s.ax - ax));
+            p.qy = T(s.qy + h / 2 * (s.vy + vy) + h * h / 12 * (s.ay - ay));
+            p.qz = T(s.qz + h / 2 * (s.vz + vz) + h * h / 12 * (s.az - az));
+            p.vx = T(vx);
+            p.vy = T(vy);
+            p.vz = T(vz);
+        });
+    }
+
+   private:
+    /// @brief state of a particle at the start of the step
+    struct state {
+        double qx, qy, qz, vx, vy, vz, ax, ay, az;
+    };
+
+    /// @brief runs f on every particle in parallel, as the given phase
+    template <typename F>
+    static void for_each_index([[maybe_unused]] const char* phase,
+                               std::size_t n, F&& f) {
+        NBODY_PROFILE_PHASE(phase);
+        nbody::detail::parallel_for(
+            0, n, physics::detail::update_grain,
+            [&](const tbb::blocked_range<std::size_t>& range) {
+                NBODY_PROFILE_TASK();
+                for (auto i = range.begin(); i != range.end(); ++i) f(i);
+            });
+    }
+
+    std::vector<state> start_;
+    physics::jerk_columns<double> jerk_, old_jerk_;
+};
 }  // namespace nbody::integrators
@@ -1,14 +1,17 @@
 #pragma once
+#include <concepts>
 #include <cstddef>
+#include <span>
 #include <utility>
 
 #include "concepts.hpp"
 #include "utils/compute_energy.hpp"
+#include "utils/profiler.hpp"
 
 namespace nbody {
 
 template <typename System, typename Integrator>
-    requires particles_system<System>
+    requires particles_system<System> && integrator_of<Integrator, System>
 class Nbody {
    public:
     using size_type = std::size_t;
@@ -20,13 +23,49 @@ class Nbody {
 
     [[nodiscard]] size_type size() const { return system_.size(); }
 
-    void step(float dt) { integrator_(system_, dt); }
+    /// @brief read-only access to the system, e.g. to checkpoint it after
+    /// synchronize()
+    [[nodiscard]] const System& system() const { return system_; }
+
+    void step(float dt) {
+        NBODY_PROFILE_PHASE("step");
+        integrator_(system_, dt);
+    }
+
+    /// @brief adaptive mode: advances the system by the step the controller
+    /// picks (integrators::adaptive), at most dt_max
+    /// @return the step taken
+    template <typename Controller>
+        requires requires(Controller& c, System& s, Integrator& i) {
+            { c(s, i, 1.0f) } -> std::convertible_to<float>;
+        }
+    float step(Controller& controller, float dt_max) {
+        NBODY_PROFILE_PHASE("step");
+        return controller(system_, integrator_, dt_max);
+    }
 
     /// @brief computes total energy of the system
     [[nodiscard]] auto energy() {
+        synchronize();
+        NBODY_PROFILE_PHASE("energy");
         return nbody::utils::compute_energy(system_);
     }
 
+    /// @brief total energy of the system from the potentials of a fused
+    /// force pass, which must match the current positions
+    [[nodiscard]] auto energy(std::span<const double> potential) {
+        synchronize();
+        NBODY_PROFILE_PHASE("energy");
+        return nbody::utils::compute_energy(system_, potential);
+    }
+
+    /// @brief brings velocities in step with positions for integrators
+    /// keeping them staggered (integrators::leapfrog_fused), no-op otherwise
+    void synchronize() {
+        if constexpr (requires { integrator_.synchronize(system_); })
+            integrator_.synchronize(system_);
+    }
+
    private:
     System system_;
     Integrator integrator_;
@@ -1,11 +1,25 @@
 #pragma once
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
 
+#include "aligned_vector.hpp"
 #include "concepts.hpp"
 #include "detail/iterator_particles.hpp"
+#include "detail/memory.hpp"
 #include "detail/particle_view.hpp"
+#include "precision.hpp"
 
 namespace nbody {
+/// @brief persistent identifier of a particle: its index at insertion, kept
+/// by the particle when the system is reordered (see utils/reorder.hpp)
+using particle_id = std::uint32_t;
+
 /// @brief struct of a single particle
 template <Scalar T>
 struct Particle {
@@ -20,40 +34,62 @@ struct Particle {
 /// @tparam Container: underlying container type, must store elements in a
 /// contiguous way in memory
 /// @tparam T: must be a scalar, respecting the Scalar concept
+/// @tparam Accum: type forces and energies are accumulated in, see
+/// precision.hpp
 
-template <template <typename...> class Container, Scalar T = float>
+template <template <typename...> class Container, Scalar T = float,
+          typename Accum = T>
     requires particles_container<Container<Particle<T>>>
 class AoS_particles {
    private:
     /// @brief underlying container of particles, forming an Array of Struct
     Container<Particle<T>> data_;
+    Container<particle_id> ids_;
 
    public:
     using size_type = std::size_t;
     using value_type = T;
+    using accum_type = Accum;
 
     /// @brief API method to add a full particle, taken by value. Redirects on
     /// the Container push_back fn.
     /// @requires a Particle p
-    void add_particle(Particle<T> p) { data_.push_back(std::move(p)); }
+    void add_particle(Particle<T> p) {
+        data_.push_back(std::move(p));
+        ids_.push_back(static_cast<particle_id>(ids_.size()));
+    }
 
     /// @brief simple reserve API that redirects to the underlying container
     /// @params n, number of Particles which must be allocated
     ///
-    void reserve(size_type n) { data_.reserve(n); }
+    void reserve(size_type n) {
+        data_.reserve(n);
+        ids_.reserve(n);
+    }
     /// Ranges interface
     [[nodiscard]] auto begin() { return data_.begin(); }
     [[nodiscard]] auto end() { return data_.end(); }
+    [[nodiscard]] auto begin() const { return data_.cbegin(); }
+    [[nodiscard]] auto end() const { return data_.cend(); }
+    [[nodiscard]] auto cbegin() const { return data_.cbegin(); }
+    [[nodiscard]] auto cend() const { return data_.cend(); }
     /// size getter, redirects to the underlying container
     [[nodiscard]] size_type size() const { return data_.size(); }
+
+    /// @brief persistent identifiers of the particles, in storage order
+    [[nodiscard]] std::span<particle_id> ids() { return ids_; }
+    [[nodiscard]] std::span<const particle_id> ids() const { return ids_; }
 };
 
 /// @brief class that organizes particles in a Struct of Array layout
 /// @tparam Container: underlying container type, must store elements in a
 /// contiguous way in memory
 /// @tparam T: must be a scalar, respecting the Scalar concept
+/// @tparam Accum: type forces and energies are accumulated in, see
+/// precision.hpp
 
-template <template <typename...> class Container, Scalar T = float>
+template <template <typename...> class Container, Scalar T = float,
+          typename Accum = T>
     requires particles_container<Container<Particle<T>>>
 class SoA_particles {
    private:
@@ -62,10 +98,13 @@ class SoA_particles {
     Container<T> ax, ay, az;
     Container<T> m;
     Container<T> r;
+    Container<particle_id> id;
 
    public:
     using iterator = detail::Iterator_particles<SoA_particles>;
+    using const_iterator = detail::Iterator_particles<const SoA_particles>;
     using value_type = T;
+    using accum_type = Accum;
     using size_type = std::size_t;
 
     /// @brief method to add a particle, must scatter all the params to the
@@ -86,6 +125,7 @@ class SoA_particles {
 
         m.push_back(p.m);
         r.push_back(p.r);
+        id.push_back(static_cast<particle_id>(id.size()));
     }
 
     /// @brief useful method to reserve up to n elements per Container,
@@ -103,11 +143,16 @@ class SoA_particles {
         az.reserve(n);
         m.reserve(n);
         r.reserve(n);
+        id.reserve(n);
     }
 
-    /// Ranges interface
+    /// Ranges interface, const systems giving read-only views
     [[nodiscard]] auto begin() { return iterator{this, 0}; }
     [[nodiscard]] auto end() { return iterator{this, qx.size()}; }
+    [[nodiscard]] auto begin() const { return const_iterator{this, 0}; }
+    [[nodiscard]] auto end() const { return const_iterator{this, qx.size()}; }
+    [[nodiscard]] auto cbegin() const { return begin(); }
+    [[nodiscard]] auto cend() const { return end(); }
 
     /// view method offering a particleView to the iterator, must have for
     /// std::range support
@@ -115,30 +160,400 @@ class SoA_particles {
         return {qx[i], qy[i], qz[i], vx[i], vy[i], vz[i],
                 ax[i], ay[i], az[i], m[i],  r[i]};
     }
+    [[nodiscard]] detail::ParticleView<const T> view(size_type i) const {
+        return {qx[i], qy[i], qz[i], vx[i], vy[i], vz[i],
+                ax[i], ay[i], az[i], m[i],  r[i]};
+    }
+
+    /// @brief raw access to the contiguous column of a field, used by the
+    /// vectorized kernels to bypass particle views
+    [[nodiscard]] std::span<T> column(field f) {
+        const auto c = std::as_const(*this).column(f);
+        return {const_cast<T*>(c.data()), c.size()};
+    }
+    [[nodiscard]] std::span<const T> column(field f) const {
+        switch (f) {
+            case field::qx: return qx;
+            case field::qy: return qy;
+            case field::qz: return qz;
+            case field::vx: return vx;
+            case field::vy: return vy;
+            case field::vz: return vz;
+            case field::ax: return ax;
+            case field::ay: return ay;
+            case field::az: return az;
+            case field::m: return m;
+            case field::r: return r;
+        }
+        return {};
+    }
 
     /// safe to look at just one dimension as invariants will always hold since
     /// we can only add a full formed particle
     [[nodiscard]] size_type size() const { return qx.size(); }
+
+    /// @brief persistent identifiers of the particles, in storage order
+    [[nodiscard]] std::span<particle_id> ids() { return id; }
+    [[nodiscard]] std::span<const particle_id> ids() const { return id; }
+};
+
+/// @brief Struct of Array layout keeping every column in one allocation: the
+/// columns follow each other in a single arena, each one starting on a cache
+/// line, the capacity being a multiple of the number of scalars per cache
+/// line. Lanes between size() and the padded size are zero, a null mass
+/// adding nothing to the sums, so that kernels may stream padded_size()
+/// sources without handling tails. Growing the system moves all the columns
+/// at once, resize() builds a system of any size in a single allocation.
+/// Arenas are placed following detail::memory_policy (parallel first touch,
+/// transparent huge pages).
+/// Selected with the aligned_vector container (see System below)
+/// @tparam T: must be a scalar, respecting the Scalar concept
+/// @tparam Accum: type forces and energies are accumulated in, see
+/// precision.hpp
+template <Scalar T = float, typename Accum = T>
+class SoA_arena_particles {
+   public:
+    using iterator = detail::Iterator_particles<SoA_arena_particles>;
+    using const_iterator =
+        detail::Iterator_particles<const SoA_arena_particles>;
+    using value_type = T;
+    using accum_type = Accum;
+    using size_type = std::size_t;
+
+    /// scalars per cache line, granularity of the capacity
+    static constexpr size_type lanes = cache_line / sizeof(T);
+
+    SoA_arena_particles() = default;
+    SoA_arena_particles(const SoA_arena_particles& other)
+        : SoA_arena_particles() {
+        *this = other;
+    }
+    SoA_arena_particles(SoA_arena_particles&& other) noexcept
+        : arena_(std::move(other.arena_)),
+          ids_(std::move(other.ids_)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)),
+          next_id_(std::exchange(other.next_id_, 0)) {}
+
+    SoA_arena_particles& operator=(const SoA_arena_particles& other) {
+        if (this == &other) return *this;
+        arena_ = allocate(other.capacity_);
+        std::copy_n(other.arena_.get(), fields * other.capacity_,
+                    arena_.get());
+        ids_ = other.ids_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        next_id_ = other.next_id_;
+        return *this;
+    }
+    SoA_arena_particles& operator=(SoA_arena_particles&& other) noexcept {
+        arena_ = std::move(other.arena_);
+        ids_ = std::move(other.ids_);
+        size_ = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        next_id_ = std::exchange(other.next_id_, 0);
+        return *this;
+    }
+
+    /// @brief system over an arena it did not allocate, laid out like its own
+    /// (the columns of capacity scalars each, capacity a multiple of lanes,
+    /// zero padding lanes): release is handed the arena when the system drops
+    /// it. Lets a memory mapped checkpoint be stepped in place, see
+    /// utils/checkpoint.hpp
+    static SoA_arena_particles adopt(T* arena, size_type size,
+                                     size_type capacity,
+                                     std::span<const particle_id> ids,
+                                     std::function<void(T*)> release) {
+        SoA_arena_particles s;
+        s.arena_ = arena_ptr(arena, arena_deleter{std::move(release)});
+        s.ids_.assign(ids.begin(), ids.end());
+        s.size_ = size;
+        s.capacity_ = capacity;
+        for (auto id : ids) s.next_id_ = std::max(s.next_id_, id + 1);
+        return s;
+    }
+
+    /// @brief method to add a particle, scattering its fields to the columns
+    /// @params Particle struct
+    void add_particle(Particle<T> p) {
+        if (size_ == capacity_) grow(std::max(2 * capacity_, lanes));
+        const T values[fields] = {p.qx, p.qy, p.qz, p.vx, p.vy, p.vz,
+                                  p.ax, p.ay, p.az, p.m,  p.r};
+        for (size_type f = 0; f < fields; ++f)
+            arena_[f * capacity_ + size_] = values[f];
+        ids_.push_back(next_id_++);
+        ++size_;
+    }
+
+    /// @brief allocates room for n particles at once
+    /// @params n, number of Particles which will be allocated
+    void reserve(size_type n) {
+        if (n > capacity_) grow(n);
+        ids_.reserve(n);
+    }
+
+    /// @brief sets the number of particles, new particles being zero (null
+    /// mass) with fresh identifiers: a system of n particles costs a single
+    /// allocation, its columns being then filled through column()
+    void resize(size_type n) {
+        reserve(n);
+        for (size_type f = 0; f < fields; ++f) {
+            T* first = arena_.get() + f * capacity_;
+            if (n < size_) std::fill(first + n, first + size_, T{0});
+        }
+        ids_.resize(std::min(n, size_));
+        while (ids_.size() < n) ids_.push_back(next_id_++);
+        size_ = n;
+    }
+
+    /// Ranges interface, const systems giving read-only views
+    [[nodiscard]] auto begin() { return iterator{this, 0}; }
+    [[nodiscard]] auto end() { return iterator{this, size_}; }
+    [[nodiscard]] auto begin() const { return const_iterator{this, 0}; }
+    [[nodiscard]] auto end() const { return const_iterator{this, size_}; }
+    [[nodiscard]] auto cbegin() const { return begin(); }
+    [[nodiscard]] auto cend() const { return end(); }
+
+    /// view method offering a particleView to the iterator, must have for
+    /// std::range support
+    [[nodiscard]] detail::ParticleView<T> view(size_type i) {
+        return view_at<T>(arena_.get() + i);
+    }
+    [[nodiscard]] detail::ParticleView<const T> view(size_type i) const {
+        return view_at<const T>(arena_.get() + i);
+    }
+
+    /// @brief raw access to the contiguous column of a field, aligned on a
+    /// cache line
+    [[nodiscard]] std::span<T> column(field f) {
+        return {arena_.get() + static_cast<size_type>(f) * capacity_, size_};
+    }
+    [[nodiscard]] std::span<const T> column(field f) const {
+        return {arena_.get() + static_cast<size_type>(f) * capacity_, size_};
+    }
+
+    /// @brief column of a field including its zero padding lanes
+    [[nodiscard]] std::span<T> padded_column(field f) {
+        return {arena_.get() + static_cast<size_type>(f) * capacity_,
+                padded_size()};
+    }
+
+    [[nodiscard]] size_type size() const { return size_; }
+    [[nodiscard]] size_type capacity() const { return capacity_; }
+    /// @brief size rounded up to a whole number of cache lines
+    [[nodiscard]] size_type padded_size() const { return round_up(size_); }
+
+    /// @brief persistent identifiers of the particles, in storage order
+    [[nodiscard]] std::span<particle_id> ids() { return ids_; }
+    [[nodiscard]] std::span<const particle_id> ids() const { return ids_; }
+
+   private:
+    static constexpr size_type fields = 11;
+
+    /// arenas come from allocate(), or from adopt() with their release
+    struct arena_deleter {
+        std::function<void(T*)> release;
+        void operator()(T* p) const noexcept {
+            if (release)
+                release(p);
+            else
+                ::operator delete(p, std::align_val_t{cache_line});
+        }
+    };
+    using arena_ptr = std::unique_ptr<T[], arena_deleter>;
+
+    /// @brief view of the particle whose qx is at a
+    template <typename U>
+    [[nodiscard]] detail::ParticleView<U> view_at(U* a) const {
+        const auto c = capacity_;
+        return {a[0],     a[c],     a[2 * c], a[3 * c], a[4 * c],  a[5 * c],
+                a[6 * c], a[7 * c], a[8 * c], a[9 * c], a[10 * c]};
+    }
+
+    static constexpr size_type round_up(size_type n) {
+        return (n + lanes - 1) / lanes * lanes;
+    }
+
+    /// @brief zeroed arena of every column for capacity particles, mapped on
+    /// huge pages and first touched as the memory policy says
+    static arena_ptr allocate(size_type capacity) {
+        if (capacity == 0) return nullptr;
+        const auto policy = detail::active_memory_policy();
+        const auto bytes = fields * capacity * sizeof(T);
+        T* p = nullptr;
+        arena_deleter deleter;
+        if (policy.huge_pages && bytes >= detail::huge_page) {
+            p = static_cast<T*>(detail::map_huge(bytes));
+            if (p)
+                deleter.release = [bytes](T* a) { detail::unmap(a, bytes); };
+        }
+        if (!p)
+            p = static_cast<T*>(
+                ::operator new(bytes, std::align_val_t{cache_line}));
+        detail::zero_columns(p, fields, capacity, policy);
+        return arena_ptr(p, std::move(deleter));
+    }
+
+    void grow(size_type n) {
+        const auto capacity = round_up(n);
+        auto arena = allocate(capacity);
+        for (size_type f = 0; f < fields; ++f)
+            std::copy_n(arena_.get() + f * capacity_, size_,
+                        arena.get() + f * capacity);
+        arena_ = std::move(arena);
+        capacity_ = capacity;
+    }
+
+    arena_ptr arena_{};
+    aligned_vector<particle_id> ids_;
+    size_type size_{0};
+    size_type capacity_{0};
+    particle_id next_id_{0};
+};
+
+/// @brief block of W particles of the AoSoA layout, one array of W lanes per
+/// field: the lanes of a field fill whole SIMD vectors, the fields of a block
+/// sit on a few neighbouring cache lines
+template <Scalar T, std::size_t W>
+struct alignas(std::min(W * sizeof(T), cache_line)) Particle_block {
+    static constexpr std::size_t width = W;
+    T qx[W], qy[W], qz[W];
+    T vx[W], vy[W], vz[W];
+    T ax[W], ay[W], az[W];
+    T m[W];
+    T r[W];
+};
+
+/// @brief class that organizes particles in an Array of Structures of Arrays
+/// layout: a container of blocks of W particles. The last block is padded
+/// with zero lanes (null masses), so that kernels may stream whole blocks
+/// @tparam Container: underlying container type, must store elements in a
+/// contiguous way in memory
+/// @tparam T: must be a scalar, respecting the Scalar concept
+/// @tparam Accum: type forces and energies are accumulated in, see
+/// precision.hpp
+/// @tparam W: particles per block, a power of two
+template <template <typename...> class Container, Scalar T = float,
+          typename Accum = T, std::size_t W = AoSoA<>::width>
+    requires particles_container<Container<Particle_block<T, W>>>
+class AoSoA_particles {
+   public:
+    using iterator = detail::Iterator_particles<AoSoA_particles>;
+    using const_iterator = detail::Iterator_particles<const AoSoA_particles>;
+    using value_type = T;
+    using accum_type = Accum;
+    using size_type = std::size_t;
+    using block_type = Particle_block<T, W>;
+
+    static constexpr size_type block_width = W;
+
+    /// @brief method to add a particle, opening a zeroed block every W
+    /// particles
+    /// @params Particle struct
+    void add_particle(Particle<T> p) {
+        if (size_ % W == 0) blocks_.push_back(block_type{});
+        auto& b = blocks_.back();
+        const auto l = size_ % W;
+        b.qx[l] = p.qx;
+        b.qy[l] = p.qy;
+        b.qz[l] = p.qz;
+        b.vx[l] = p.vx;
+        b.vy[l] = p.vy;
+        b.vz[l] = p.vz;
+        b.ax[l] = p.ax;
+        b.ay[l] = p.ay;
+        b.az[l] = p.az;
+        b.m[l] = p.m;
+        b.r[l] = p.r;
+        ids_.push_back(static_cast<particle_id>(size_));
+        ++size_;
+    }
+
+    /// @brief reserves the blocks holding n particles
+    /// @params n, number of Particles which will be allocated
+    void reserve(size_type n) {
+        blocks_.reserve((n + W - 1) / W);
+        ids_.reserve(n);
+    }
+
+    /// Ranges interface, const systems giving read-only views
+    [[nodiscard]] auto begin() { return iterator{this, 0}; }
+    [[nodiscard]] auto end() { return iterator{this, size_}; }
+    [[nodiscard]] auto begin() const { return const_iterator{this, 0}; }
+    [[nodiscard]] auto end() const { return const_iterator{this, size_}; }
+    [[nodiscard]] auto cbegin() const { return begin(); }
+    [[nodiscard]] auto cend() const { return end(); }
+
+    /// view method offering a particleView to the iterator, must have for
+    /// std::range support
+    [[nodiscard]] detail::ParticleView<T> view(size_type i) {
+        return view_at<T>(blocks_[i / W], i % W);
+    }
+    [[nodiscard]] detail::ParticleView<const T> view(size_type i) const {
+        return view_at<const T>(blocks_[i / W], i % W);
+    }
+
+    /// @brief raw access to the blocks, the last one being padded
+    [[nodiscard]] std::span<block_type> blocks() { return blocks_; }
+    [[nodiscard]] std::span<const block_type> blocks() const {
+        return blocks_;
+    }
+
+    [[nodiscard]] size_type size() const { return size_; }
+    /// @brief size rounded up to a whole number of blocks
+    [[nodiscard]] size_type padded_size() const { return blocks_.size() * W; }
+
+    /// @brief persistent identifiers of the particles, in storage order
+    [[nodiscard]] std::span<particle_id> ids() { return ids_; }
+    [[nodiscard]] std::span<const particle_id> ids() const { return ids_; }
+
+   private:
+    /// @brief view of lane l of block b
+    template <typename U, typename B>
+    [[nodiscard]] static detail::ParticleView<U> view_at(B& b, size_type l) {
+        return {b.qx[l], b.qy[l], b.qz[l], b.vx[l], b.vy[l], b.vz[l],
+                b.ax[l], b.ay[l], b.az[l], b.m[l],  b.r[l]};
+    }
+
+    Container<block_type> blocks_;
+    Container<particle_id> ids_;
+    size_type size_{0};
 };
 
 /// Type alias with implementing a small compile time dipatching through tags to
-/// have better readability and easier usage
+/// have better readability and easier usage. The precision is either a scalar
+/// or a policy of precision.hpp
 
-template <template <typename...> class Container, Scalar T, typename Layout>
+template <template <typename...> class Container, Scalar T, typename Accum,
+          typename Layout>
 struct Storage;
 
-template <template <typename...> class Container, Scalar T>
-struct Storage<Container, T, AoS> {
-    using type = nbody::AoS_particles<Container, T>;
+template <template <typename...> class Container, Scalar T, typename Accum>
+struct Storage<Container, T, Accum, AoS> {
+    using type = nbody::AoS_particles<Container, T, Accum>;
 };
 
-template <template <typename...> class Container, Scalar T>
-struct Storage<Container, T, SoA> {
-    using type = nbody::SoA_particles<Container, T>;
+template <template <typename...> class Container, Scalar T, typename Accum>
+struct Storage<Container, T, Accum, SoA> {
+    using type = nbody::SoA_particles<Container, T, Accum>;
 };
 
-template <template <typename...> class Container, Scalar T, typename Layout>
-    requires particles_container<Container<Particle<T>>>
-using System = Storage<Container, T, Layout>::type;
+template <template <typename...> class Container, Scalar T, typename Accum,
+          std::size_t W>
+struct Storage<Container, T, Accum, AoSoA<W>> {
+    using type = nbody::AoSoA_particles<Container, T, Accum, W>;
+};
+
+/// SoA systems over aligned_vector use the single arena storage
+template <Scalar T, typename Accum>
+struct Storage<aligned_vector, T, Accum, SoA> {
+    using type = nbody::SoA_arena_particles<T, Accum>;
+};
+
+template <template <typename...> class Container, precision_like P,
+          typename Layout>
+    requires particles_container<Container<Particle<precision::storage_t<P>>>>
+using System = Storage<Container, precision::storage_t<P>,
+                       precision::accum_t<P>, Layout>::type;
 
 }  // namespace nbody
@@ -1,73 +1,166 @@
 #pragma once
 #include <sys/cdefs.h>
+#include <tbb/blocked_range.h>
 
 #include <algorithm>
 #include <bit>
 #include <cmath>
-#include <execution>
+#include <concepts>
+#include <cstdint>
+#include <span>
 
 #include "concepts.hpp"
 #include "constants.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "precision.hpp"
+#include "physics/direct_soa.hpp"
+#include "utils/profiler.hpp"
 
 namespace nbody::physics {
 
-constexpr __always_inline auto fast_rsqrt(float x) -> float;
-/// @brief free method to compute the acceleration of each particle. The method
-/// is parallelized with C++ std::for_each, taking parallel unseq as execution
-/// policy (as the method is embarassingly parallel, there is no need to
-/// synchronize threads
-/// @tparams a system of particles
+template <std::floating_point T>
+    requires(sizeof(T) == 4 || sizeof(T) == 8)
+constexpr __always_inline auto fast_rsqrt(T x) -> T;
+
+namespace detail {
+
+/// @brief direct sum of the interactions of particle i with every particle of
+/// the system, through detail::dispatch. Pairwise terms are computed in the
+/// value type of the system, their sums in its accumulation type
+/// @param phi: when not null, receives the softened potential of particle i
 template <typename System>
     requires particles_system<System>
-void compute_accelerations(System& system) {
+void accelerate_particle(System& system, std::size_t i, double* phi) {
     using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
     /// constants needeed
-    constexpr auto G = constants::G;
-    constexpr auto soft_squared = constants::soft * constants::soft;
+    constexpr auto G = constants::G_v<T>;
+    constexpr auto soft_squared = constants::soft_v<T> * constants::soft_v<T>;
+
+    auto&& pi = system.begin()[static_cast<std::ptrdiff_t>(i)];
+    const auto qxi = pi.qx;
+    const auto qyi = pi.qy;
+    const auto qzi = pi.qz;
 
-    std::for_each(std::execution::par_unseq, system.begin(), system.end(),
-                  [&](auto&& pi) {
-                      const auto qxi = pi.qx;
-                      const auto qyi = pi.qy;
-                      const auto qzi = pi.qz;
+    auto sum_aix = Accum{};
+    auto sum_aiy = Accum{};
+    auto sum_aiz = Accum{};
+    auto sum_pi = Accum{};
 
-                      auto sum_aix = T{};
-                      auto sum_aiy = T{};
-                      auto sum_aiz = T{};
+    nbody::detail::dispatch([&](auto) {
+        for (auto&& pj : system) {
+            const auto rijx = pj.qx - qxi;
+            const auto rijy = pj.qy - qyi;
+            const auto rijz = pj.qz - qzi;
 
-                      for (auto&& pj : system) {
-                          const auto rijx = pj.qx - qxi;
-                          const auto rijy = pj.qy - qyi;
-                          const auto rijz = pj.qz - qzi;
+            const auto r2 =
+                rijx * rijx + rijy * rijy + rijz * rijz + soft_squared;
 
-                          const auto r2 = rijx * rijx + rijy * rijy +
-                                          rijz * rijz + soft_squared;
+            const auto inv_r = fast_rsqrt(r2);
+            const auto inv_r3 = inv_r * inv_r * inv_r;
 
-                          const auto inv_r = fast_rsqrt(r2);
-                          const auto inv_r3 = inv_r * inv_r * inv_r;
+            const auto ai = G * pj.m * inv_r3;
 
-                          const auto ai = G * pj.m * inv_r3;
+            precision::accumulate(sum_aix, ai * rijx);
+            precision::accumulate(sum_aiy, ai * rijy);
+            precision::accumulate(sum_aiz, ai * rijz);
+            if (phi && r2 > soft_squared)
+                precision::accumulate(sum_pi, pj.m * inv_r);
+        }
+    });
 
-                          sum_aix += ai * rijx;
-                          sum_aiy += ai * rijy;
-                          sum_aiz += ai * rijz;
-                      }
+    pi.ax = static_cast<T>(precision::value(sum_aix));
+    pi.ay = static_cast<T>(precision::value(sum_aiy));
+    pi.az = static_cast<T>(precision::value(sum_aiz));
+    if (phi)
+        *phi = -constants::G_v<double> *
+               static_cast<double>(precision::value(sum_pi));
+}
+}  // namespace detail
+
+/// @brief free method to compute the acceleration of each particle. The method
+/// is parallelized with TBB over the particles (as the method is
+/// embarassingly parallel, there is no need to synchronize threads). The inner
+/// loop of every particle runs through detail::dispatch, compiled for the
+/// instruction set of the CPU. Columnar and blocked systems are redirected to
+/// the tiled kernels of direct_soa.hpp.
+/// Pairwise terms are computed in the value type of the system, their sums in
+/// its accumulation type (see precision.hpp)
+/// @tparams a system of particles
+/// @param potential: when not empty, receives the softened potential of every
+/// particle (fused mode), pairs at null separation being left out. It costs
+/// one more multiply-add per pair, the distances being already there
+template <typename System>
+    requires particles_system<System>
+void compute_accelerations(System& system, std::span<double> potential = {}) {
+    if constexpr (columnar_system<System>) {
+        compute_accelerations_soa(system, potential);
+        return;
+    } else if constexpr (blocked_system<System>) {
+        compute_accelerations_aosoa(system, potential);
+        return;
+    }
+    nbody::detail::parallel_for(
+        0, system.size(), 1,
+        [&](const tbb::blocked_range<std::size_t>& range) {
+            NBODY_PROFILE_TASK();
+            for (auto i = range.begin(); i != range.end(); ++i)
+                detail::accelerate_particle(
+                    system, i, potential.empty() ? nullptr : &potential[i]);
+        });
+}
 
-                      pi.ax = sum_aix;
-                      pi.ay = sum_aiy;
-                      pi.az = sum_aiz;
-                  });
+/// @brief compute_accelerations restricted to a set of active particles
+/// (block time steps, see integrators::block_leapfrog): the accelerations of
+/// the active particles are summed over all the particles, the other ones are
+/// left untouched. The cost is O(N) per active particle
+/// @param active: indices of the particles to update
+template <typename System>
+    requires particles_system<System>
+void compute_accelerations_active(System& system,
+                                  std::span<const std::size_t> active) {
+    if constexpr (columnar_system<System> || blocked_system<System>) {
+        compute_accelerations_soa_active(system, active);
+        return;
+    }
+    nbody::detail::parallel_for(
+        0, active.size(), 1,
+        [&](const tbb::blocked_range<std::size_t>& range) {
+            NBODY_PROFILE_TASK();
+            for (auto k = range.begin(); k != range.end(); ++k)
+                detail::accelerate_particle(system, active[k], nullptr);
+        });
 }
 
-constexpr __always_inline auto fast_rsqrt(float x) -> float {
-    const float x2 = x * 0.5f;
-    auto i = std::bit_cast<std::int32_t>(x);
-    i = 0x5f3759df - (i >> 1);
-    auto y = std::bit_cast<float>(i);
-    y = y * (1.5f - (x2 * y * y));  // 1st Newton-Raphson iteration
-    y = y * (1.5f -
-             (x2 * y *
-              y));  // 2nd iteration — more accurate, remove if speed > accuracy
+/// @brief force solver wrapping the direct summation of
+/// compute_accelerations, default solver used by the integrators. Setting
+/// potential switches the fused mode on for the following evaluations
+struct direct_sum {
+    std::span<double> potential{};
+
+    template <typename System>
+        requires particles_system<System>
+    void operator()(System& system) const {
+        compute_accelerations(system, potential);
+    }
+};
+
+/// @brief fast inverse square root, magic constant estimate refined by two
+/// Newton-Raphson steps for floats and three for doubles
+template <std::floating_point T>
+    requires(sizeof(T) == 4 || sizeof(T) == 8)
+constexpr __always_inline auto fast_rsqrt(T x) -> T {
+    using Bits = std::conditional_t<sizeof(T) == 4, std::int32_t, std::int64_t>;
+    constexpr Bits magic = sizeof(T) == 4 ? Bits(0x5f3759df)
+                                          : Bits(0x5fe6eb50c7b537a9);
+    constexpr int steps = sizeof(T) == 4 ? 2 : 3;
+
+    const T x2 = x * T{0.5};
+    auto i = std::bit_cast<Bits>(x);
+    i = magic - (i >> 1);
+    auto y = std::bit_cast<T>(i);
+    for (int k = 0; k < steps; ++k) y = y * (T{1.5} - (x2 * y * y));
     return y;
 };
 }  // namespace nbody::physics
@@ -0,0 +1,537 @@
+#pragma once
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "concepts.hpp"
+#include "constants.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "detail/simd.hpp"
+#include "precision.hpp"
+#include "utils/profiler.hpp"
+
+namespace nbody::physics {
+
+namespace detail {
+
+/// j particles streamed per tile: 4 columns of 1024 floats take 16 KiB, so
+/// that a tile stays in L1 while every i particle of a block walks it
+inline constexpr std::size_t j_tile = 1024;
+/// i particles sharing the loads of each j vector (register blocking)
+inline constexpr std::size_t i_group = 4;
+/// i particles handled by a task, all of them reusing the same j tiles
+inline constexpr std::size_t i_block = 256;
+
+/// @brief j particles read from contiguous columns
+template <typename T>
+struct column_sources {
+    const T *qx, *qy, *qz, *m;
+
+    /// @brief pointers to the fields of particle j, followed by the next ones
+    [[nodiscard]] std::array<const T*, 4> operator()(std::size_t j) const {
+        return {qx + j, qy + j, qz + j, m + j};
+    }
+};
+
+/// @brief j particles read from the blocks of an AoSoA system: the lanes of a
+/// block are contiguous, SIMD vectors narrower than a block never straddle
+/// two of them
+template <typename Block>
+struct block_sources {
+    const Block* blocks;
+
+    [[nodiscard]] auto operator()(std::size_t j) const {
+        const auto& b = blocks[j / Block::width];
+        const auto l = j % Block::width;
+        return std::array{&b.qx[l], &b.qy[l], &b.qz[l], &b.m[l]};
+    }
+};
+
+/// @brief SIMD registers of a group of i_group sinks: broadcast positions and
+/// partial sums over the current j tile
+template <typename V>
+struct sink_group {
+    using vec = typename V::vec;
+    vec x[i_group], y[i_group], z[i_group];
+    vec sx[i_group], sy[i_group], sz[i_group], sp[i_group];
+};
+
+/// @brief interactions of a group of sinks with the width j particles at
+/// (px, py, pz, pm), added to its partial sums
+template <typename V, bool Potential, typename T>
+NBODY_SIMD_TARGET(V)
+void interact(sink_group<V>& s, const T* px, const T* py, const T* pz,
+              const T* pm) {
+    using vec = typename V::vec;
+    constexpr auto soft_squared = constants::soft_v<T> * constants::soft_v<T>;
+    const vec soft2 = V::set1(soft_squared);
+    const vec xj = V::load(px);
+    const vec yj = V::load(py);
+    const vec zj = V::load(pz);
+    const vec mj = V::load(pm);
+    for (std::size_t g = 0; g < i_group; ++g) {
+        const vec dx = V::sub(xj, s.x[g]);
+        const vec dy = V::sub(yj, s.y[g]);
+        const vec dz = V::sub(zj, s.z[g]);
+        const vec r2 =
+            V::fmadd(dx, dx, V::fmadd(dy, dy, V::fmadd(dz, dz, soft2)));
+        const vec inv_r = V::rsqrt(r2);
+        const vec f = V::mul(mj, V::mul(inv_r, V::mul(inv_r, inv_r)));
+        s.sx[g] = V::fmadd(f, dx, s.sx[g]);
+        s.sy[g] = V::fmadd(f, dy, s.sy[g]);
+        s.sz[g] = V::fmadd(f, dz, s.sz[g]);
+        if constexpr (Potential)
+            s.sp[g] = V::fmadd(V::select_gt(r2, soft2, mj), inv_r, s.sp[g]);
+    }
+}
+
+/// @brief tiled direct summation over ns sinks at (xs, ys, zs) due to the n
+/// particles of sources (column_sources or block_sources). The SIMD lanes sum
+/// the interactions of one j tile, the partial sums of the tiles are
+/// accumulated in Accum (see precision.hpp), bounding the length of the float
+/// sums whatever n. The sums of sink i, not yet scaled by G, are handed to
+/// store(i, x, y, z, p). When Potential is set, the softened potential p of
+/// every sink is accumulated as well, pairs at null separation (the particle
+/// itself) being left out
+/// @tparam V: SIMD instruction set wrapper of detail/simd.hpp
+/// @tparam Accum: accumulation type of the tile partial sums
+/// @tparam Potential: whether p is computed
+template <typename V, typename Accum = typename V::value_type,
+          bool Potential = false, typename T = typename V::value_type,
+          typename Sources, typename Store>
+NBODY_SIMD_TARGET(V)
+void direct_sink_sums(const Sources& sources, std::size_t n, const T* xs,
+                      const T* ys, const T* zs, std::size_t ns,
+                      Store&& store) {
+    constexpr auto W = V::width;
+
+    /// the last incomplete j vector is copied into a padded buffer, padding
+    /// lanes having a null mass they add nothing to the sums
+    const std::size_t n_full = n - n % W;
+    alignas(64) std::array<T, W> tail_qx{}, tail_qy{}, tail_qz{}, tail_m{};
+    for (std::size_t j = n_full; j < n; ++j) {
+        const auto [px, py, pz, pm] = sources(j);
+        tail_qx[j - n_full] = *px;
+        tail_qy[j - n_full] = *py;
+        tail_qz[j - n_full] = *pz;
+        tail_m[j - n_full] = *pm;
+    }
+
+    /// i particles are processed in chunks of i_block, each owning its
+    /// accumulators across the j tiles
+    Accum acc_x[i_block], acc_y[i_block], acc_z[i_block], acc_p[i_block];
+    for (std::size_t ib = 0; ib < ns; ib += i_block) {
+        const std::size_t ib_end = std::min(ib + i_block, ns);
+        std::fill(acc_x, acc_x + i_block, Accum{});
+        std::fill(acc_y, acc_y + i_block, Accum{});
+        std::fill(acc_z, acc_z + i_block, Accum{});
+        if constexpr (Potential) std::fill(acc_p, acc_p + i_block, Accum{});
+
+        for (std::size_t jt = 0; jt < n; jt += j_tile) {
+            const std::size_t j_end = std::min(jt + j_tile, n_full);
+            const bool with_tail = jt + j_tile >= n && n_full < n;
+
+            for (std::size_t i = ib; i < ib_end; i += i_group) {
+                sink_group<V> s;
+                for (std::size_t g = 0; g < i_group; ++g) {
+                    /// incomplete groups repeat their last particle
+                    const auto k = std::min(i + g, ib_end - 1);
+                    s.x[g] = V::set1(xs[k]);
+                    s.y[g] = V::set1(ys[k]);
+                    s.z[g] = V::set1(zs[k]);
+                    s.sx[g] = s.sy[g] = s.sz[g] = s.sp[g] = V::zero();
+                }
+
+                for (std::size_t j = jt; j < j_end; j += W) {
+                    const auto [px, py, pz, pm] = sources(j);
+                    interact<V, Potential>(s, px, py, pz, pm);
+                }
+                if (with_tail)
+                    interact<V, Potential>(s, tail_qx.data(), tail_qy.data(),
+                                           tail_qz.data(), tail_m.data());
+
+                for (std::size_t g = 0; g < i_group && i + g < ib_end; ++g) {
+                    precision::accumulate(acc_x[i + g - ib], V::sum(s.sx[g]));
+                    precision::accumulate(acc_y[i + g - ib], V::sum(s.sy[g]));
+                    precision::accumulate(acc_z[i + g - ib], V::sum(s.sz[g]));
+                    if constexpr (Potential)
+                        precision::accumulate(acc_p[i + g - ib],
+                                              V::sum(s.sp[g]));
+                }
+            }
+        }
+
+        for (auto i = ib; i < ib_end; ++i)
+            store(i, acc_x[i - ib], acc_y[i - ib], acc_z[i - ib],
+                  acc_p[i - ib]);
+    }
+}
+
+/// @brief direct_sink_sums writing the accelerations of the sinks to
+/// (ax, ay, az), and their potentials to phi when Potential is set
+template <typename V, typename Accum = typename V::value_type,
+          bool Potential = false, typename T = typename V::value_type,
+          typename Sources>
+void direct_sinks(const Sources& sources, std::size_t n, const T* xs,
+                  const T* ys, const T* zs, std::size_t ns, T* ax, T* ay,
+                  T* az, double* phi = nullptr) {
+    constexpr auto G = constants::G_v<precision::result_t<Accum>>;
+    direct_sink_sums<V, Accum, Potential>(
+        sources, n, xs, ys, zs, ns,
+        [&](std::size_t i, const Accum& x, const Accum& y, const Accum& z,
+            const Accum& p) {
+            ax[i] = static_cast<T>(G * precision::value(x));
+            ay[i] = static_cast<T>(G * precision::value(y));
+            az[i] = static_cast<T>(G * precision::value(z));
+            if constexpr (Potential)
+                phi[i] = -constants::G_v<double> *
+                         static_cast<double>(precision::value(p));
+        });
+}
+
+/// @brief direct_sinks over the n particles of raw columns
+template <typename V, typename Accum = typename V::value_type,
+          bool Potential = false, typename T = typename V::value_type>
+void direct_soa_sinks(const T* qx, const T* qy, const T* qz, const T* m,
+                      std::size_t n, const T* xs, const T* ys, const T* zs,
+                      std::size_t ns, T* ax, T* ay, T* az,
+                      double* phi = nullptr) {
+    direct_sinks<V, Accum, Potential>(column_sources<T>{qx, qy, qz, m}, n, xs,
+                                      ys, zs, ns, ax, ay, az, phi);
+}
+
+/// @brief direct_soa_sinks for the particles [i_begin, i_end) of the columns
+template <typename V, typename Accum = typename V::value_type,
+          bool Potential = false, typename T = typename V::value_type>
+void direct_soa_block(const T* qx, const T* qy, const T* qz, const T* m,
+                      std::size_t n, T* ax, T* ay, T* az, std::size_t i_begin,
+                      std::size_t i_end, double* phi = nullptr) {
+    direct_soa_sinks<V, Accum, Potential>(
+        qx, qy, qz, m, n, qx + i_begin, qy + i_begin, qz + i_begin,
+        i_end - i_begin, ax + i_begin, ay + i_begin, az + i_begin,
+        phi ? phi + i_begin : nullptr);
+}
+
+/// @brief number of source particles streamed by the kernels: the padded
+/// size for storages with zeroed padding lanes (SoA_arena_particles), whose
+/// null masses add nothing to the sums, so that no tail is left
+template <typename System>
+[[nodiscard]] std::size_t source_count(System& system) {
+    if constexpr (requires { system.padded_size(); })
+        return system.padded_size();
+    else
+        return system.size();
+}
+
+/// @brief j particles of a columnar or blocked system
+template <typename System>
+    requires columnar_system<System> || blocked_system<System>
+[[nodiscard]] auto sources_of(System& system) {
+    using T = typename System::value_type;
+    if constexpr (columnar_system<System>)
+        return column_sources<T>{system.column(field::qx).data(),
+                                 system.column(field::qy).data(),
+                                 system.column(field::qz).data(),
+                                 system.column(field::m).data()};
+    else
+        return block_sources<typename System::block_type>{
+            system.blocks().data()};
+}
+
+/// @brief whether vectors of D fit the layout of a system: vectors must not
+/// straddle two blocks of a blocked system
+template <typename System, typename D>
+constexpr bool vectors_fit() {
+    if constexpr (blocked_system<System>)
+        return System::block_width % D::width == 0;
+    else
+        return true;
+}
+
+/// @brief chunks the n sources are split in by the 2D force pass over
+/// sink_blocks blocks of sinks: enough tiles for 4 tasks per thread, at least
+/// two chunks, every chunk but the last holding whole j tiles. 1 when the
+/// sources fit a single tile. The chunks follow the thread count, which thus
+/// changes the order the tile sums are added in: the accelerations are
+/// reproducible for a thread count, not across thread counts
+[[nodiscard]] inline std::size_t source_chunks(std::size_t n,
+                                               std::size_t sink_blocks) {
+    const auto threads = nbody::detail::concurrency();
+    const auto wanted = std::max<std::size_t>(
+        (4 * threads + sink_blocks - 1) / std::max<std::size_t>(sink_blocks, 1),
+        2);
+    const auto tiles = (n + j_tile - 1) / j_tile;
+    return std::max<std::size_t>(std::min(wanted, tiles), 1);
+}
+
+/// @brief SIMD wrapper of the direct kernels for a system, D being the one of
+/// the instruction set: explicit SIMD for floats when the vectors fit the
+/// layout, scalar code otherwise
+template <typename System, typename D>
+using kernel_simd_t = std::conditional_t<
+    std::same_as<typename System::value_type, float> &&
+        vectors_fit<System, D>(),
+    D, nbody::detail::simd::basic_scalar<typename System::value_type>>;
+}  // namespace detail
+
+/// @brief direct summation of a columnar system split over sinks and sources:
+/// chunk c of the sources writes the partial sums of every sink in row c of
+/// scratch buffers of the accumulation type of the system, which a second
+/// pass adds in chunk order before scaling them by G, so that the split
+/// rounds no partial to the value type. Used by compute_accelerations_soa
+/// when the blocks of sinks are too few
+/// @param chunks: number of source chunks, see detail::source_chunks
+template <typename System>
+    requires columnar_system<System>
+void compute_accelerations_split(System& system, std::span<double> potential,
+                                 std::size_t chunks) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+    const auto n = system.size();
+    const auto n_src = detail::source_count(system);
+    const auto tiles = (n_src + detail::j_tile - 1) / detail::j_tile;
+    const auto chunk = (tiles + chunks - 1) / chunks * detail::j_tile;
+
+    const T* qx = system.column(field::qx).data();
+    const T* qy = system.column(field::qy).data();
+    const T* qz = system.column(field::qz).data();
+    const T* m = system.column(field::m).data();
+
+    std::vector<Accum> pax(chunks * n), pay(chunks * n), paz(chunks * n);
+    std::vector<double> pphi(potential.empty() ? 0 : chunks * n);
+
+    nbody::detail::parallel_for_2d(
+        n, nbody::detail::grain_of(detail::i_block), chunks, 1,
+        [&](const tbb::blocked_range2d<std::size_t>& r) {
+            NBODY_PROFILE_TASK();
+            nbody::detail::dispatch([&]<typename D>(D) {
+                using V = std::conditional_t<
+                    std::same_as<T, float>, D,
+                    nbody::detail::simd::basic_scalar<T>>;
+                const auto i0 = r.rows().begin();
+                const auto ns = r.rows().size();
+                for (auto c = r.cols().begin(); c != r.cols().end(); ++c) {
+                    const auto j0 = std::min(c * chunk, n_src);
+                    const auto j1 = std::min(j0 + chunk, n_src);
+                    const detail::column_sources<T> sources{
+                        qx + j0, qy + j0, qz + j0, m + j0};
+                    const auto row = c * n + i0;
+                    auto store = [&](std::size_t i, const Accum& x,
+                                     const Accum& y, const Accum& z,
+                                     const Accum& p) {
+                        pax[row + i] = x;
+                        pay[row + i] = y;
+                        paz[row + i] = z;
+                        if (!potential.empty())
+                            pphi[row + i] =
+                                static_cast<double>(precision::value(p));
+                    };
+                    if (potential.empty())
+                        detail::direct_sink_sums<V, Accum>(
+                            sources, j1 - j0, qx + i0, qy + i0, qz + i0, ns,
+                            store);
+                    else
+                        detail::direct_sink_sums<V, Accum, true>(
+                            sources, j1 - j0, qx + i0, qy + i0, qz + i0, ns,
+                            store);
+                }
+            });
+        });
+
+    T* ax = system.column(field::ax).data();
+    T* ay = system.column(field::ay).data();
+    T* az = system.column(field::az).data();
+    constexpr auto G = constants::G_v<precision::result_t<Accum>>;
+    nbody::detail::parallel_for(
+        0, n, detail::i_block,
+        [&](const tbb::blocked_range<std::size_t>& r) {
+            NBODY_PROFILE_TASK();
+            for (auto i = r.begin(); i != r.end(); ++i) {
+                Accum sx = pax[i], sy = pay[i], sz = paz[i];
+                double sp = potential.empty() ? 0.0 : pphi[i];
+                for (std::size_t c = 1; c < chunks; ++c) {
+                    sx += pax[c * n + i];
+                    sy += pay[c * n + i];
+                    sz += paz[c * n + i];
+                    if (!potential.empty()) sp += pphi[c * n + i];
+                }
+                ax[i] = static_cast<T>(G * precision::value(sx));
+                ay[i] = static_cast<T>(G * precision::value(sy));
+                az[i] = static_cast<T>(G * precision::value(sz));
+                if (!potential.empty())
+                    potential[i] = -constants::G_v<double> * sp;
+            }
+        });
+}
+
+/// @brief direct summation specialized for columnar systems: raw contiguous
+/// columns, j tiles shared by blocks of i particles, explicit SIMD for floats
+/// (widest instruction set of the CPU, see detail/dispatch.hpp) with hardware
+/// rsqrt plus one Newton step, scalar code compiled for that instruction set
+/// otherwise. Blocks of i particles are distributed with TBB,
+/// tile partial sums are accumulated in the accumulation type of the system.
+/// When the blocks are too few for the threads (see
+/// nbody::detail::split_sources), the sources are split in chunks as well:
+/// tiles of (sinks, sources) are distributed over a blocked_range2d, each
+/// chunk writing partial sums of the accumulation type that are added
+/// afterwards.
+/// @tparams a columnar system
+/// @param potential: when not empty, receives the softened potential of every
+/// particle, computed from the same distances
+template <typename System>
+    requires columnar_system<System>
+void compute_accelerations_soa(System& system,
+                               std::span<double> potential = {}) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+    const auto n = system.size();
+    const auto n_src = detail::source_count(system);
+
+    const T* qx = system.column(field::qx).data();
+    const T* qy = system.column(field::qy).data();
+    const T* qz = system.column(field::qz).data();
+    const T* m = system.column(field::m).data();
+    T* ax = system.column(field::ax).data();
+    T* ay = system.column(field::ay).data();
+    T* az = system.column(field::az).data();
+
+    const auto sink_blocks = (n + detail::i_block - 1) / detail::i_block;
+    if (nbody::detail::split_sources(sink_blocks)) {
+        const auto chunks = detail::source_chunks(n_src, sink_blocks);
+        if (chunks > 1) {
+            compute_accelerations_split(system, potential, chunks);
+            return;
+        }
+    }
+
+    nbody::detail::parallel_for(
+        0, n, detail::i_block,
+        [&](const tbb::blocked_range<std::size_t>& r) {
+            NBODY_PROFILE_TASK();
+            nbody::detail::dispatch([&]<typename D>(D) {
+                using V = std::conditional_t<
+                    std::same_as<T, float>, D,
+                    nbody::detail::simd::basic_scalar<T>>;
+                if (potential.empty())
+                    detail::direct_soa_block<V, Accum>(
+                        qx, qy, qz, m, n_src, ax, ay, az, r.begin(), r.end());
+                else
+                    detail::direct_soa_block<V, Accum, true>(
+                        qx, qy, qz, m, n_src, ax, ay, az, r.begin(), r.end(),
+                        potential.data());
+            });
+        });
+}
+
+/// @brief direct summation specialized for blocked (AoSoA) systems: the j
+/// particles are streamed straight from the lanes of the blocks, padding
+/// lanes included, and tasks of blocks gather the positions of their sinks in
+/// a few contiguous arrays. Same tiling, dispatch and accumulation as
+/// compute_accelerations_soa
+/// @param potential: when not empty, receives the softened potential of every
+/// particle
+template <typename System>
+    requires blocked_system<System>
+void compute_accelerations_aosoa(System& system,
+                                 std::span<double> potential = {}) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+    constexpr auto W = System::block_width;
+    /// blocks whose particles fill an i block of the kernel
+    constexpr auto grain = std::max<std::size_t>(detail::i_block / W, 1);
+
+    const auto n = system.size();
+    auto blocks = system.blocks();
+    const auto sources = detail::sources_of(system);
+    const auto n_src = system.padded_size();
+
+    nbody::detail::parallel_for(
+        0, blocks.size(), grain,
+        [&](const tbb::blocked_range<std::size_t>& r) {
+            NBODY_PROFILE_TASK();
+            nbody::detail::dispatch([&]<typename D>(D) {
+                using V = detail::kernel_simd_t<System, D>;
+                T xs[grain * W], ys[grain * W], zs[grain * W];
+                T axs[grain * W], ays[grain * W], azs[grain * W];
+                for (auto b0 = r.begin(); b0 < r.end(); b0 += grain) {
+                    const auto i0 = b0 * W;
+                    const auto i1 =
+                        std::min(std::min(b0 + grain, r.end()) * W, n);
+                    for (auto i = i0; i < i1; ++i) {
+                        const auto& b = blocks[i / W];
+                        xs[i - i0] = b.qx[i % W];
+                        ys[i - i0] = b.qy[i % W];
+                        zs[i - i0] = b.qz[i % W];
+                    }
+                    if (potential.empty())
+                        detail::direct_sinks<V, Accum>(sources, n_src, xs, ys,
+                                                       zs, i1 - i0, axs, ays,
+                                                       azs);
+                    else
+                        detail::direct_sinks<V, Accum, true>(
+                            sources, n_src, xs, ys, zs, i1 - i0, axs, ays,
+                            azs, potential.data() + i0);
+                    for (auto i = i0; i < i1; ++i) {
+                        auto& b = blocks[i / W];
+                        b.ax[i % W] = axs[i - i0];
+                        b.ay[i % W] = ays[i - i0];
+                        b.az[i % W] = azs[i - i0];
+                    }
+                }
+            });
+        },
+        W);
+}
+
+/// @brief direct summation restricted to the active particles of a columnar
+/// or blocked system: the positions of the sinks are gathered, blocks of them
+/// walk the j tiles of all the particles, the accelerations are scattered back
+/// @param active: indices of the particles whose acceleration is updated
+template <typename System>
+    requires columnar_system<System> || blocked_system<System>
+void compute_accelerations_soa_active(System& system,
+                                      std::span<const std::size_t> active) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+    const auto n = detail::source_count(system);
+    const auto ns = active.size();
+    const auto sources = detail::sources_of(system);
+    auto first = system.begin();
+
+    std::vector<T> xs(ns), ys(ns), zs(ns), axs(ns), ays(ns), azs(ns);
+    for (std::size_t k = 0; k < ns; ++k) {
+        auto&& p = first[static_cast<std::ptrdiff_t>(active[k])];
+        xs[k] = p.qx;
+        ys[k] = p.qy;
+        zs[k] = p.qz;
+    }
+
+    nbody::detail::parallel_for(
+        0, ns, detail::i_block,
+        [&](const tbb::blocked_range<std::size_t>& r) {
+            NBODY_PROFILE_TASK();
+            nbody::detail::dispatch([&]<typename D>(D) {
+                using V = detail::kernel_simd_t<System, D>;
+                const auto b = r.begin();
+                detail::direct_sinks<V, Accum>(sources, n, &xs[b], &ys[b],
+                                               &zs[b], r.size(), &axs[b],
+                                               &ays[b], &azs[b]);
+            });
+        });
+
+    for (std::size_t k = 0; k < ns; ++k) {
+        auto&& p = first[static_cast<std::ptrdiff_t>(active[k])];
+        p.ax = axs[k];
+        p.ay = ays[k];
+        p.az = azs[k];
+    }
+}
+}  // namespace nbody::physics
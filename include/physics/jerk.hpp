@@ -0,0 +1,178 @@
+#pragma once
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "concepts.hpp"
+#include "constants.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "detail/simd.hpp"
+#include "physics/direct_soa.hpp"
+#include "precision.hpp"
+
+namespace nbody::physics {
+
+namespace detail {
+
+/// @brief contiguous positions, velocities and masses of the j particles
+template <typename T>
+struct jerk_sources {
+    const T *qx, *qy, *qz, *vx, *vy, *vz, *m;
+};
+
+/// @brief interactions of particle i with the particles [j, j_end) of q
+/// handled by whole vectors of U, added to the six sums s (acceleration then
+/// jerk)
+/// @return first particle left, less than a vector before j_end
+template <typename U, typename T>
+NBODY_SIMD_TARGET(U)
+std::size_t jerk_sweep(const jerk_sources<T>& q, std::size_t i,
+                       std::size_t j, std::size_t j_end,
+                       typename U::vec* s) {
+    constexpr auto soft_squared = constants::soft_v<T> * constants::soft_v<T>;
+    const auto xi = U::set1(q.qx[i]), yi = U::set1(q.qy[i]);
+    const auto zi = U::set1(q.qz[i]), uxi = U::set1(q.vx[i]);
+    const auto uyi = U::set1(q.vy[i]), uzi = U::set1(q.vz[i]);
+    const auto soft2 = U::set1(soft_squared);
+    const auto three = U::set1(T{3});
+    for (; j + U::width <= j_end; j += U::width) {
+        const auto dx = U::sub(U::load(&q.qx[j]), xi);
+        const auto dy = U::sub(U::load(&q.qy[j]), yi);
+        const auto dz = U::sub(U::load(&q.qz[j]), zi);
+        const auto dvx = U::sub(U::load(&q.vx[j]), uxi);
+        const auto dvy = U::sub(U::load(&q.vy[j]), uyi);
+        const auto dvz = U::sub(U::load(&q.vz[j]), uzi);
+        const auto r2 =
+            U::fmadd(dx, dx, U::fmadd(dy, dy, U::fmadd(dz, dz, soft2)));
+        const auto inv_r = U::rsqrt(r2);
+        const auto inv_r2 = U::mul(inv_r, inv_r);
+        const auto a = U::mul(U::load(&q.m[j]), U::mul(inv_r2, inv_r));
+        const auto rv = U::fmadd(dx, dvx, U::fmadd(dy, dvy, U::mul(dz, dvz)));
+        /// - 3 m (r . v) / r^5
+        const auto b =
+            U::sub(U::zero(), U::mul(three, U::mul(a, U::mul(rv, inv_r2))));
+        s[0] = U::fmadd(a, dx, s[0]);
+        s[1] = U::fmadd(a, dy, s[1]);
+        s[2] = U::fmadd(a, dz, s[2]);
+        s[3] = U::fmadd(a, dvx, U::fmadd(b, dx, s[3]));
+        s[4] = U::fmadd(a, dvy, U::fmadd(b, dy, s[4]));
+        s[5] = U::fmadd(a, dvz, U::fmadd(b, dz, s[5]));
+    }
+    return j;
+}
+
+/// @brief interactions of particle i with the n particles of q, walked in j
+/// tiles with the SIMD wrapper V: the partial sums of every tile are added to
+/// acc (acceleration then jerk, not yet scaled by G)
+template <typename V, typename Accum, typename T>
+NBODY_SIMD_TARGET(V)
+void jerk_sums(const jerk_sources<T>& q, std::size_t n, std::size_t i,
+               Accum (&acc)[6]) {
+    using S = nbody::detail::simd::basic_scalar<T>;
+    for (std::size_t jt = 0; jt < n; jt += j_tile) {
+        const auto j_end = std::min(jt + j_tile, n);
+        typename V::vec sv[6];
+        std::fill(sv, sv + 6, V::zero());
+        const auto j = jerk_sweep<V>(q, i, jt, j_end, sv);
+        T s[6];
+        for (int c = 0; c < 6; ++c) s[c] = V::sum(sv[c]);
+        if constexpr (V::width > 1) jerk_sweep<S>(q, i, j, j_end, s);
+        for (int c = 0; c < 6; ++c) precision::accumulate(acc[c], s[c]);
+    }
+}
+}  // namespace detail
+
+/// @brief jerks (time derivatives of the accelerations) computed by
+/// compute_accelerations_and_jerks, one entry per sink
+template <Scalar T>
+struct jerk_columns {
+    std::vector<T> x, y, z;
+
+    void resize(std::size_t n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+    [[nodiscard]] std::size_t size() const { return x.size(); }
+};
+
+/// @brief direct summation of the accelerations and of the jerks of the active
+/// particles, due to all the particles:
+///   a_i = G sum_j m_j r_ij / r^3
+///   j_i = G sum_j m_j (v_ij / r^3 - 3 (r_ij . v_ij) r_ij / r^5)
+/// with softened distances. Positions, velocities and masses are gathered in
+/// contiguous scratch columns whatever the layout, active particles are
+/// distributed with TBB and the j loops run with the SIMD wrapper selected by
+/// detail::dispatch (floats) over j tiles whose partial sums are accumulated
+/// in the accumulation type of the system.
+/// Jerks drive the timestep criteria of the block and Hermite integrators.
+/// @param active: indices of the particles whose acceleration is updated
+/// @param jerk: receives the jerk of active[k] at index k, in its own scalar
+/// type
+template <typename System, Scalar J>
+    requires particles_system<System>
+void compute_accelerations_and_jerks(System& system,
+                                     std::span<const std::size_t> active,
+                                     jerk_columns<J>& jerk) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+
+    const auto n = system.size();
+    auto first = system.begin();
+
+    std::vector<T> qx(n), qy(n), qz(n), vx(n), vy(n), vz(n), m(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+        qx[i] = p.qx;
+        qy[i] = p.qy;
+        qz[i] = p.qz;
+        vx[i] = p.vx;
+        vy[i] = p.vy;
+        vz[i] = p.vz;
+        m[i] = p.m;
+    }
+    const detail::jerk_sources<T> q{qx.data(), qy.data(), qz.data(), vx.data(),
+                                    vy.data(), vz.data(), m.data()};
+    jerk.resize(active.size());
+
+    constexpr auto G = constants::G_v<precision::result_t<Accum>>;
+    nbody::detail::parallel_for(
+        0, active.size(), 64,
+        [&](const tbb::blocked_range<std::size_t>& range) {
+            nbody::detail::dispatch([&]<typename D>(D) {
+                using S = nbody::detail::simd::basic_scalar<T>;
+                using V = std::conditional_t<std::same_as<T, float>, D, S>;
+                for (auto k = range.begin(); k != range.end(); ++k) {
+                    const auto i = active[k];
+                    Accum acc[6]{};
+                    detail::jerk_sums<V>(q, n, i, acc);
+                    auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                    p.ax = static_cast<T>(G * precision::value(acc[0]));
+                    p.ay = static_cast<T>(G * precision::value(acc[1]));
+                    p.az = static_cast<T>(G * precision::value(acc[2]));
+                    jerk.x[k] = static_cast<J>(G * precision::value(acc[3]));
+                    jerk.y[k] = static_cast<J>(G * precision::value(acc[4]));
+                    jerk.z[k] = static_cast<J>(G * precision::value(acc[5]));
+                }
+            });
+        });
+}
+
+/// @brief accelerations and jerks of every particle, jerk[i] being the one of
+/// particle i
+template <typename System, Scalar J>
+    requires particles_system<System>
+void compute_accelerations_and_jerks(System& system, jerk_columns<J>& jerk) {
+    std::vector<std::size_t> all(system.size());
+    std::iota(all.begin(), all.end(), std::size_t{0});
+    compute_accelerations_and_jerks(system, std::span<const std::size_t>(all),
+                                    jerk);
+}
+}  // namespace nbody::physics
@@ -0,0 +1,329 @@
+#pragma once
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_sort.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "concepts.hpp"
+#include "detail/execution.hpp"
+
+namespace nbody::physics {
+
+/// @brief spreads the lower 21 bits of x so that two zero bits sit between
+/// each of them, building block of 3D Morton keys
+constexpr std::uint64_t spread_bits(std::uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+/// @brief interleaves three 21 bits integer coordinates into a 63 bits Morton
+/// key, x taking the most significant bit of every triplet
+constexpr std::uint64_t morton_key(std::uint32_t x, std::uint32_t y,
+                                   std::uint32_t z) {
+    return spread_bits(x) << 2 | spread_bits(y) << 1 | spread_bits(z);
+}
+
+/// @brief linear octree rebuilt from scratch at each call of build(). Bodies
+/// are sorted along a Morton curve and copied in the tree, so that every node
+/// owns a contiguous range of them; nodes are stored in breadth first order
+/// with the children of a node stored contiguously.
+/// @tparam T: scalar type of positions and masses
+template <Scalar T>
+class Octree {
+   public:
+    using size_type = std::size_t;
+    using index_type = std::uint32_t;
+
+    /// maximum depth reachable with 21 bits per dimension Morton keys
+    static constexpr index_type max_depth = 21;
+
+    struct Node {
+        /// geometric center and half side length of the cell
+        T cx, cy, cz;
+        T half;
+        /// total mass and center of mass of the cell
+        T mass;
+        T mx, my, mz;
+        /// range of bodies (in Morton order) owned by the cell
+        index_type first, count;
+        /// range of children in the nodes array, nchild == 0 for leaves
+        index_type child, nchild;
+        index_type depth;
+
+        [[nodiscard]] bool is_leaf() const { return nchild == 0; }
+    };
+
+    explicit Octree(size_type leaf_size = 16) : leaf_size_(leaf_size) {}
+
+    /// @brief builds the tree over the current positions of the system, every
+    /// pass of the build is parallelized with TBB
+    /// @tparams a system of particles
+    template <typename System>
+        requires particles_system<System>
+    void build(System& system) {
+        const auto n = system.size();
+        nodes_.clear();
+        levels_.clear();
+        if (n == 0) return;
+
+        compute_keys(system, n);
+        sort_bodies(system, n);
+        build_nodes(n);
+        compute_moments();
+    }
+
+    [[nodiscard]] const std::vector<Node>& nodes() const { return nodes_; }
+    /// index of the first node of each depth, followed by nodes().size()
+    [[nodiscard]] const std::vector<size_type>& levels() const {
+        return levels_;
+    }
+    [[nodiscard]] size_type size() const { return x_.size(); }
+    [[nodiscard]] size_type leaf_size() const { return leaf_size_; }
+
+    /// bodies in Morton order: positions, masses and index in the system
+    [[nodiscard]] const std::vector<T>& x() const { return x_; }
+    [[nodiscard]] const std::vector<T>& y() const { return y_; }
+    [[nodiscard]] const std::vector<T>& z() const { return z_; }
+    [[nodiscard]] const std::vector<T>& m() const { return m_; }
+    [[nodiscard]] const std::vector<index_type>& order() const {
+        return order_;
+    }
+
+   private:
+    struct Bounds {
+        std::array<T, 3> lo{std::numeric_limits<T>::max(),
+                            std::numeric_limits<T>::max(),
+                            std::numeric_limits<T>::max()};
+        std::array<T, 3> hi{std::numeric_limits<T>::lowest(),
+                            std::numeric_limits<T>::lowest(),
+                            std::numeric_limits<T>::lowest()};
+    };
+
+    template <typename System>
+    void compute_keys(System& system, size_type n) {
+        auto first = system.begin();
+
+        const auto box = nbody::detail::parallel_reduce(
+            0, n, 1, Bounds{},
+            [&](const tbb::blocked_range<size_type>& r, Bounds b) {
+                for (auto i = r.begin(); i != r.end(); ++i) {
+                    auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                    b.lo = {std::min(b.lo[0], p.qx), std::min(b.lo[1], p.qy),
+                            std::min(b.lo[2], p.qz)};
+                    b.hi = {std::max(b.hi[0], p.qx), std::max(b.hi[1], p.qy),
+                            std::max(b.hi[2], p.qz)};
+                }
+                return b;
+            },
+            [](Bounds a, const Bounds& b) {
+                for (std::size_t d = 0; d < 3; ++d) {
+                    a.lo[d] = std::min(a.lo[d], b.lo[d]);
+                    a.hi[d] = std::max(a.hi[d], b.hi[d]);
+                }
+                return a;
+            });
+
+        /// enclosing cube, slightly enlarged so that no body sits on the
+        /// upper faces
+        T extent = std::max({box.hi[0] - box.lo[0], box.hi[1] - box.lo[1],
+                             box.hi[2] - box.lo[2]});
+        if (!(extent > T{0})) extent = T{1};
+        half_ = extent * T{0.5} * T(1.0001);
+        for (std::size_t d = 0; d < 3; ++d)
+            center_[d] = (box.lo[d] + box.hi[d]) * T{0.5};
+
+        constexpr double cells = double(1u << max_depth);
+        const double scale = cells / (2.0 * double(half_));
+        auto quantize = [&](T q, std::size_t d) {
+            const double c = (double(q) - double(center_[d] - half_)) * scale;
+            return static_cast<std::uint32_t>(
+                std::clamp(c, 0.0, cells - 1.0));
+        };
+
+        keyed_.resize(n);
+        nbody::detail::parallel_for(
+            0, n, 1, [&](const tbb::blocked_range<size_type>& r) {
+                for (auto i = r.begin(); i != r.end(); ++i) {
+                    auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                    keyed_[i] = {morton_key(quantize(p.qx, 0),
+                                            quantize(p.qy, 1),
+                                            quantize(p.qz, 2)),
+                                 static_cast<index_type>(i)};
+                }
+            });
+    }
+
+    template <typename System>
+    void sort_bodies(System& system, size_type n) {
+        if (nbody::detail::serial_passes())
+            std::sort(keyed_.begin(), keyed_.end());
+        else
+            tbb::parallel_sort(keyed_.begin(), keyed_.end());
+
+        keys_.resize(n);
+        order_.resize(n);
+        x_.resize(n);
+        y_.resize(n);
+        z_.resize(n);
+        m_.resize(n);
+
+        auto first = system.begin();
+        nbody::detail::parallel_for(
+            0, n, 1, [&](const tbb::blocked_range<size_type>& r) {
+                for (auto k = r.begin(); k != r.end(); ++k) {
+                    const auto [key, i] = keyed_[k];
+                    auto&& p = first[i];
+                    keys_[k] = key;
+                    order_[k] = i;
+                    x_[k] = p.qx;
+                    y_[k] = p.qy;
+                    z_[k] = p.qz;
+                    m_[k] = p.m;
+                }
+            });
+    }
+
+    /// octant of a key at a given depth (depth 1 being the children of root)
+    static index_type octant(std::uint64_t key, index_type depth) {
+        return static_cast<index_type>(key >> (3 * (max_depth - depth))) & 7u;
+    }
+
+    /// builds the nodes level by level: each level splits its nodes in
+    /// parallel, then a prefix sum gives the position of the children
+    void build_nodes(size_type n) {
+        nodes_.push_back({center_[0], center_[1], center_[2], half_, T{}, T{},
+                          T{}, T{}, 0, static_cast<index_type>(n), 0, 0, 0});
+        levels_.push_back(0);
+
+        size_type begin = 0;
+        size_type end = 1;
+        std::vector<std::array<index_type, 9>> splits;
+        std::vector<index_type> offsets;
+
+        for (index_type depth = 0; begin < end && depth < max_depth; ++depth) {
+            const auto width = end - begin;
+            splits.assign(width, {});
+            offsets.assign(width + 1, 0);
+
+            nbody::detail::parallel_for(
+                0, width, 1, [&](const tbb::blocked_range<size_type>& r) {
+                    for (auto k = r.begin(); k != r.end(); ++k) {
+                        const auto& node = nodes_[begin + k];
+                        if (node.count <= leaf_size_) continue;
+
+                        auto lo = keys_.begin() + node.first;
+                        const auto hi = lo + node.count;
+                        index_type nonempty = 0;
+                        splits[k][0] = node.first;
+                        for (index_type o = 0; o < 8; ++o) {
+                            lo = std::partition_point(
+                                lo, hi, [&](std::uint64_t key) {
+                                    return octant(key, depth + 1) <= o;
+                                });
+                            splits[k][o + 1] =
+                                static_cast<index_type>(lo - keys_.begin());
+                            nonempty += splits[k][o + 1] != splits[k][o];
+                        }
+                        offsets[k + 1] = nonempty;
+                    }
+                });
+
+            for (size_type k = 0; k < width; ++k) offsets[k + 1] += offsets[k];
+            nodes_.resize(end + offsets[width]);
+
+            nbody::detail::parallel_for(
+                0, width, 1, [&](const tbb::blocked_range<size_type>& r) {
+                    for (auto k = r.begin(); k != r.end(); ++k) {
+                        auto& parent = nodes_[begin + k];
+                        if (offsets[k + 1] == offsets[k]) continue;
+
+                        const auto child_half = parent.half * T{0.5};
+                        auto c = static_cast<index_type>(end + offsets[k]);
+                        parent.child = c;
+                        parent.nchild = offsets[k + 1] - offsets[k];
+                        for (index_type o = 0; o < 8; ++o) {
+                            const auto count = splits[k][o + 1] - splits[k][o];
+                            if (count == 0) continue;
+                            nodes_[c++] = {
+                                parent.cx + ((o & 4u) ? child_half : -child_half),
+                                parent.cy + ((o & 2u) ? child_half : -child_half),
+                                parent.cz + ((o & 1u) ? child_half : -child_half),
+                                child_half, T{}, T{}, T{}, T{}, splits[k][o],
+                                count, 0, 0, depth + 1};
+                        }
+                    }
+                });
+
+            begin = end;
+            end = nodes_.size();
+            levels_.push_back(begin);
+        }
+        if (levels_.back() != nodes_.size()) levels_.push_back(nodes_.size());
+    }
+
+    /// mass and center of mass of every node, from the deepest level upward
+    void compute_moments() {
+        for (auto l = levels_.size() - 1; l-- > 0;) {
+            nbody::detail::parallel_for(
+                levels_[l], levels_[l + 1], 1,
+                [&](const tbb::blocked_range<size_type>& r) {
+                    for (auto k = r.begin(); k != r.end(); ++k) {
+                        auto& node = nodes_[k];
+                        T mass{}, mx{}, my{}, mz{};
+                        if (node.is_leaf()) {
+                            for (auto b = node.first;
+                                 b != node.first + node.count; ++b) {
+                                mass += m_[b];
+                                mx += m_[b] * x_[b];
+                                my += m_[b] * y_[b];
+                                mz += m_[b] * z_[b];
+                            }
+                        } else {
+                            for (auto c = node.child;
+                                 c != node.child + node.nchild; ++c) {
+                                const auto& ch = nodes_[c];
+                                mass += ch.mass;
+                                mx += ch.mass * ch.mx;
+                                my += ch.mass * ch.my;
+                                mz += ch.mass * ch.mz;
+                            }
+                        }
+                        node.mass = mass;
+                        if (mass > T{0}) {
+                            node.mx = mx / mass;
+                            node.my = my / mass;
+                            node.mz = mz / mass;
+                        } else {
+                            node.mx = node.cx;
+                            node.my = node.cy;
+                            node.mz = node.cz;
+                        }
+                    }
+                });
+        }
+    }
+
+    size_type leaf_size_;
+    std::array<T, 3> center_{};
+    T half_{};
+
+    std::vector<std::pair<std::uint64_t, index_type>> keyed_;
+    std::vector<std::uint64_t> keys_;
+    std::vector<index_type> order_;
+    std::vector<T> x_, y_, z_, m_;
+
+    std::vector<Node> nodes_;
+    std::vector<size_type> levels_;
+};
+}  // namespace nbody::physics
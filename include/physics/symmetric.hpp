@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include "concepts.hpp"
+#include "constants.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/simd.hpp"
+#include "detail/triangular_schedule.hpp"
+#include "physics/direct_soa.hpp"
+#include "precision.hpp"
+
+namespace nbody::physics {
+
+namespace detail {
+
+/// @brief interactions of particle i with the particles [j, j_last) of q
+/// handled by whole vectors of U: actions on i are added to (sx, sy, sz),
+/// reactions are scattered into rx, ry, rz (indexed from j_first)
+/// @return first particle left, less than a vector before j_last
+template <typename U, typename T>
+NBODY_SIMD_TARGET(U)
+std::size_t symmetric_sweep(const column_sources<T>& q, std::size_t i,
+                            std::size_t j, std::size_t j_last,
+                            std::size_t j_first, T* rx, T* ry, T* rz,
+                            typename U::vec& sx, typename U::vec& sy,
+                            typename U::vec& sz) {
+    constexpr auto soft_squared = constants::soft_v<T> * constants::soft_v<T>;
+    const auto xi = U::set1(q.qx[i]);
+    const auto yi = U::set1(q.qy[i]);
+    const auto zi = U::set1(q.qz[i]);
+    const auto mi = U::set1(q.m[i]);
+    const auto soft2 = U::set1(soft_squared);
+    for (; j + U::width <= j_last; j += U::width) {
+        const auto dx = U::sub(U::load(&q.qx[j]), xi);
+        const auto dy = U::sub(U::load(&q.qy[j]), yi);
+        const auto dz = U::sub(U::load(&q.qz[j]), zi);
+        const auto r2 =
+            U::fmadd(dx, dx, U::fmadd(dy, dy, U::fmadd(dz, dz, soft2)));
+        const auto inv_r = U::rsqrt(r2);
+        const auto inv_r3 = U::mul(inv_r, U::mul(inv_r, inv_r));
+
+        const auto sj = U::mul(U::load(&q.m[j]), inv_r3);
+        sx = U::fmadd(sj, dx, sx);
+        sy = U::fmadd(sj, dy, sy);
+        sz = U::fmadd(sj, dz, sz);
+
+        const auto si = U::mul(mi, inv_r3);
+        T* px = rx + (j - j_first);
+        T* py = ry + (j - j_first);
+        T* pz = rz + (j - j_first);
+        U::store(px, U::sub(U::load(px), U::mul(si, dx)));
+        U::store(py, U::sub(U::load(py), U::mul(si, dy)));
+        U::store(pz, U::sub(U::load(pz), U::mul(si, dz)));
+    }
+    return j;
+}
+
+/// @brief interactions of particle i with particles [j_begin, j_end) of q:
+/// reactions are scattered into rx, ry, rz (indexed from j_first), the action
+/// on i is returned. The j loop runs with the SIMD wrapper V, its tail with
+/// scalar code
+template <typename V, typename T>
+NBODY_SIMD_TARGET(V)
+std::array<T, 3> symmetric_pairs(const column_sources<T>& q, std::size_t i,
+                                 std::size_t j_begin, std::size_t j_end,
+                                 std::size_t j_first, T* rx, T* ry, T* rz) {
+    using S = nbody::detail::simd::basic_scalar<T>;
+    auto vx = V::zero(), vy = V::zero(), vz = V::zero();
+    const auto j = symmetric_sweep<V>(q, i, j_begin, j_end, j_first, rx, ry,
+                                      rz, vx, vy, vz);
+    T sx = V::sum(vx), sy = V::sum(vy), sz = V::sum(vz);
+    if constexpr (V::width > 1)
+        symmetric_sweep<S>(q, i, j, j_end, j_first, rx, ry, rz, sx, sy, sz);
+    return {sx, sy, sz};
+}
+}  // namespace detail
+
+/// @brief direct summation exploiting Newton's third law: every pair is
+/// evaluated once and its contribution scattered with opposite signs on both
+/// particles, halving the flop count of compute_accelerations. Particles are
+/// split in blocks visited by detail::for_each_block_pair, so that no two
+/// threads ever update the same block and the summation order is the same
+/// whatever the number of threads. Sums over one pair of blocks run in the
+/// value type of the system, then are accumulated in its accumulation type.
+/// @tparams a system of particles
+template <typename System>
+    requires particles_system<System>
+void compute_accelerations_symmetric(System& system) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+    using S = nbody::detail::simd::basic_scalar<T>;
+    constexpr std::size_t block = 256;
+    constexpr auto G = constants::G_v<precision::result_t<Accum>>;
+
+    const auto n = system.size();
+    auto first = system.begin();
+
+    /// positions and masses are gathered in contiguous scratch columns,
+    /// whatever the layout of the system
+    std::vector<T> qx(n), qy(n), qz(n), m(n);
+    std::vector<Accum> acc_x(n), acc_y(n), acc_z(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+        qx[i] = p.qx;
+        qy[i] = p.qy;
+        qz[i] = p.qz;
+        m[i] = p.m;
+    }
+    const detail::column_sources<T> q{qx.data(), qy.data(), qz.data(),
+                                      m.data()};
+
+    const auto nb = (n + block - 1) / block;
+    nbody::detail::for_each_block_pair(nb, [&](std::size_t I, std::size_t J) {
+        const auto i_end = std::min(n, (I + 1) * block);
+        const auto j_end = std::min(n, (J + 1) * block);
+        const auto j_first = J * block;
+
+        /// actions on I go straight to the accumulators, reactions on J are
+        /// summed over the pair first
+        T rx[block] = {}, ry[block] = {}, rz[block] = {};
+        nbody::detail::dispatch([&]<typename D>(D) {
+            using V = std::conditional_t<std::same_as<T, float>, D, S>;
+            for (auto i = I * block; i < i_end; ++i) {
+                const auto [sx, sy, sz] = detail::symmetric_pairs<V>(
+                    q, i, I == J ? i + 1 : j_first, j_end, j_first, rx, ry,
+                    rz);
+                precision::accumulate(acc_x[i], sx);
+                precision::accumulate(acc_y[i], sy);
+                precision::accumulate(acc_z[i], sz);
+            }
+        });
+        for (auto j = j_first; j < j_end; ++j) {
+            precision::accumulate(acc_x[j], rx[j - j_first]);
+            precision::accumulate(acc_y[j], ry[j - j_first]);
+            precision::accumulate(acc_z[j], rz[j - j_first]);
+        }
+    });
+
+    for (std::size_t i = 0; i < n; ++i) {
+        auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+        p.ax = static_cast<T>(G * precision::value(acc_x[i]));
+        p.ay = static_cast<T>(G * precision::value(acc_y[i]));
+        p.az = static_cast<T>(G * precision::value(acc_z[i]));
+    }
+}
+
+/// @brief force solver wrapping compute_accelerations_symmetric
+struct symmetric_sum {
+    template <typename System>
+        requires particles_system<System>
+    void operator()(System& system) const {
+        compute_accelerations_symmetric(system);
+    }
+};
+}  // namespace nbody::physics
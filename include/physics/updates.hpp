@@ -1,7 +1,103 @@
 #pragma once
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <cstddef>
+
 #include "concepts.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "detail/particle_view.hpp"
+#include "utils/profiler.hpp"
+
 namespace nbody::physics {
 
+namespace detail {
+
+/// particles per task of the update passes: a few hundred KiB of columns, so
+/// that the scheduling overhead stays negligible next to the memory traffic
+inline constexpr std::size_t update_grain = 4096;
+
+/// @brief applies f to every particle, blocks of particles being distributed
+/// with TBB (detail::parallel_for, following the execution policy) and every
+/// block running through detail::dispatch. Columnar
+/// systems hand f views built straight on raw column pointers, blocked ones
+/// on the lanes of every block, so that the loops vectorize.
+/// @param f callable taking a particle (or a particle view)
+template <typename System, typename F>
+    requires particles_system<System>
+void for_each_particle(System& system, F&& f) {
+    const auto n = system.size();
+    if constexpr (columnar_system<System>) {
+        using T = typename System::value_type;
+        T* qx = system.column(field::qx).data();
+        T* qy = system.column(field::qy).data();
+        T* qz = system.column(field::qz).data();
+        T* vx = system.column(field::vx).data();
+        T* vy = system.column(field::vy).data();
+        T* vz = system.column(field::vz).data();
+        T* ax = system.column(field::ax).data();
+        T* ay = system.column(field::ay).data();
+        T* az = system.column(field::az).data();
+        T* m = system.column(field::m).data();
+        T* r = system.column(field::r).data();
+        nbody::detail::parallel_for(
+            0, n, update_grain,
+            [&](const tbb::blocked_range<std::size_t>& range) {
+                NBODY_PROFILE_TASK();
+                const auto begin = range.begin();
+                const auto end = range.end();
+                nbody::detail::dispatch([&](auto) {
+                    /// columns never overlap, while runtime alias checks
+                    /// between 11 columns exceed what GCC accepts to version
+#pragma GCC ivdep
+                    for (auto i = begin; i != end; ++i)
+                        f(nbody::detail::ParticleView<T>{
+                            qx[i], qy[i], qz[i], vx[i], vy[i], vz[i], ax[i],
+                            ay[i], az[i], m[i], r[i]});
+                });
+            });
+    } else if constexpr (blocked_system<System>) {
+        using T = typename System::value_type;
+        constexpr auto W = System::block_width;
+        auto blocks = system.blocks();
+        nbody::detail::parallel_for(
+            0, blocks.size(), update_grain / W + 1,
+            [&](const tbb::blocked_range<std::size_t>& range) {
+                NBODY_PROFILE_TASK();
+                nbody::detail::dispatch([&](auto) {
+                    for (auto k = range.begin(); k != range.end(); ++k) {
+                        auto& b = blocks[k];
+                        /// the lanes past the last particle stay zero
+                        const auto lanes = std::min(W, n - k * W);
+#pragma GCC ivdep
+                        for (std::size_t l = 0; l < lanes; ++l)
+                            f(nbody::detail::ParticleView<T>{
+                                b.qx[l], b.qy[l], b.qz[l], b.vx[l], b.vy[l],
+                                b.vz[l], b.ax[l], b.ay[l], b.az[l], b.m[l],
+                                b.r[l]});
+                    }
+                });
+            },
+            W);
+    } else {
+        auto first = system.begin();
+        nbody::detail::parallel_for(
+            0, n, update_grain,
+            [&](const tbb::blocked_range<std::size_t>& range) {
+                NBODY_PROFILE_TASK();
+                nbody::detail::dispatch([&](auto) {
+                    for (auto i = range.begin(); i != range.end(); ++i)
+                        f(first[static_cast<std::ptrdiff_t>(i)]);
+                });
+            });
+    }
+}
+}  // namespace detail
+
+/// the update passes run in parallel through detail::for_each_particle, their
+/// loops being vectorized for the instruction set of the CPU
+
 /// @brief updates velocities from accelerations: v += a * dt
 /// @tparam System a particle system
 /// @param system the particle system to update
@@ -13,11 +109,11 @@ void update_velocities(System& system, float dt) {
 
     const T dt_ = dt;
 
-    for (auto&& p : system) {
+    detail::for_each_particle(system, [dt_](auto&& p) {
         p.vx += p.ax * dt_;
         p.vy += p.ay * dt_;
         p.vz += p.az * dt_;
-    }
+    });
 }
 
 /// @brief updates positions from velocities: q += v * dt
@@ -31,11 +127,11 @@ void update_positions(System& system, float dt) {
 
     const T dt_ = dt;
 
-    for (auto&& p : system) {
+    detail::for_each_particle(system, [dt_](auto&& p) {
         p.qx += p.vx * dt_;
         p.qy += p.vy * dt_;
         p.qz += p.vz * dt_;
-    }
+    });
 }
 
 /// @brief updates positions and velocities using the Verlet scheme
@@ -49,7 +145,7 @@ void update_positions_and_velocities(System& system, float dt) {
 
     const T dt_ = dt;
 
-    for (auto&& p : system) {
+    detail::for_each_particle(system, [dt_](auto&& p) {
         T ax_dt = p.ax * dt_;
         T ay_dt = p.ay * dt_;
         T az_dt = p.az * dt_;
@@ -59,7 +155,33 @@ void update_positions_and_velocities(System& system, float dt) {
         p.vx += ax_dt;
         p.vy += ay_dt;
         p.vz += az_dt;
-    }
+    });
+}
+
+/// @brief kick then drift in a single sweep: v += a * dt_kick, then
+/// q += v * dt_drift. Fusing the closing half kick of a leapfrog step with
+/// the opening half kick and the drift of the next one reads and writes every
+/// column once per step instead of three times
+/// @tparam System a particle system
+/// @param system the particle system to update
+/// @param dt_kick timestep of the kick
+/// @param dt_drift timestep of the drift
+template <typename System>
+    requires particles_system<System>
+void kick_drift(System& system, float dt_kick, float dt_drift) {
+    using T = typename System::value_type;
+
+    const T kick = dt_kick;
+    const T drift = dt_drift;
+
+    detail::for_each_particle(system, [kick, drift](auto&& p) {
+        p.vx += p.ax * kick;
+        p.vy += p.ay * kick;
+        p.vz += p.az * kick;
+        p.qx += p.vx * drift;
+        p.qy += p.vy * drift;
+        p.qz += p.vz * drift;
+    });
 }
 
 }  // namespace nbody::physics
@@ -0,0 +1,154 @@
+#pragma once
+#include <concepts>
+#include <type_traits>
+
+#include "concepts.hpp"
+
+/// precision policies: a policy pairs the scalar type particles are stored in
+/// with the type forces and energies are accumulated in. Plain scalars remain
+/// valid wherever a policy is expected and stand for storage = accumulation.
+///
+///   policy        storage  accumulation
+///   single        float    float
+///   dual          double   double
+///   mixed         float    double
+///   compensated   float    float-float (compensated<float>)
+///
+/// kernels compute every pairwise term in the storage type, the fast path,
+/// and only the long sums (over j tiles, over pairs of blocks) go through the
+/// accumulation type.
+
+namespace nbody::precision {
+
+/// @brief float-float accumulator: the running sum is kept as an unevaluated
+/// pair hi + lo, the rounding error of every addition (TwoSum) being folded
+/// into lo, then the pair renormalized (FastTwoSum) so that |lo| stays below
+/// half an ulp of hi. It gives roughly twice the precision of T for about ten
+/// flops per addition
+template <std::floating_point T>
+struct compensated {
+    T hi{};
+    T lo{};
+
+    constexpr compensated& operator+=(T x) {
+        const T s = hi + x;
+        const T b = s - hi;
+        const T e = (hi - (s - b)) + (x - b);
+        normalize(s, lo + e);
+        return *this;
+    }
+
+    constexpr compensated& operator+=(const compensated& other) {
+        *this += other.hi;
+        *this += other.lo;
+        return *this;
+    }
+
+   private:
+    constexpr void normalize(T s, T t) {
+        hi = s + t;
+        lo = t - (hi - s);
+    }
+};
+
+/// @brief type holding the value of an accumulator once the sum is over,
+/// float-float sums are widened to double so that their extra bits survive
+template <typename A>
+struct result {
+    using type = A;
+};
+template <>
+struct result<compensated<float>> {
+    using type = double;
+};
+template <typename T>
+struct result<compensated<T>> {
+    using type = T;
+};
+template <typename A>
+using result_t = typename result<A>::type;
+
+/// @brief adds x to the accumulator, x being converted explicitly. A wider
+/// x is added to a compensated sum as its rounding and the residual of it
+template <typename A, typename T>
+constexpr void accumulate(A& acc, T x) {
+    if constexpr (Scalar<A>) {
+        acc += static_cast<A>(x);
+    } else if constexpr (Scalar<T>) {
+        using H = decltype(acc.hi);
+        const auto hi = static_cast<H>(x);
+        acc += hi;
+        if constexpr (sizeof(T) > sizeof(H))
+            acc += static_cast<H>(x - static_cast<T>(hi));
+    } else {
+        acc += x;
+    }
+}
+
+/// @brief value of an accumulator
+template <typename A>
+constexpr result_t<A> value(const A& acc) {
+    if constexpr (Scalar<A>)
+        return acc;
+    else
+        return result_t<A>(acc.hi) + result_t<A>(acc.lo);
+}
+
+/// @brief generic policy
+template <Scalar Storage, typename Accum>
+struct policy {
+    using storage_type = Storage;
+    using accum_type = Accum;
+};
+
+struct single : policy<float, float> {
+    static constexpr const char* name = "single";
+};
+struct dual : policy<double, double> {
+    static constexpr const char* name = "double";
+};
+struct mixed : policy<float, double> {
+    static constexpr const char* name = "mixed";
+};
+struct compensated_single : policy<float, compensated<float>> {
+    static constexpr const char* name = "compensated";
+};
+
+template <typename P>
+concept precision_policy = requires {
+    typename P::storage_type;
+    typename P::accum_type;
+} && Scalar<typename P::storage_type>;
+
+/// @brief policy of a scalar or of a policy
+template <typename P>
+struct policy_of {
+    using type = P;
+};
+template <Scalar T>
+struct policy_of<T> {
+    using type = policy<T, T>;
+};
+
+template <typename P>
+using storage_t = typename policy_of<P>::type::storage_type;
+template <typename P>
+using accum_t = typename policy_of<P>::type::accum_type;
+
+/// @brief accumulation type of a system, its value type when the system
+/// does not define one
+template <typename System>
+struct system_accum {
+    using type = typename System::value_type;
+};
+template <typename System>
+    requires requires { typename System::accum_type; }
+struct system_accum<System> {
+    using type = typename System::accum_type;
+};
+template <typename System>
+using system_accum_t = typename system_accum<System>::type;
+}  // namespace nbody::precision
+
+template <typename P>
+concept precision_like = Scalar<P> || nbody::precision::precision_policy<P>;
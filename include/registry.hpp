@@ -0,0 +1,333 @@
+#pragma once
+#include <concepts>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "aligned_vector.hpp"
+#include "concepts.hpp"
+#include "integrators/integrators.hpp"
+#include "particles.hpp"
+#include "physics/barnes_hut.hpp"
+#include "physics/compute_accelerations.hpp"
+#include "physics/fmm.hpp"
+#include "physics/symmetric.hpp"
+#include "precision.hpp"
+
+/// compile time registry of the simulations the drivers can run: every
+/// combination of container, layout and precision is an entry of a
+/// std::variant, every integrator as well, each checked against
+/// simulation_system and integrator_of. The names of the command line select
+/// an alternative once, std::visit then hands the entry to a generic lambda,
+/// so that the step loop built from it is compiled for one system and one
+/// integrator type: nothing stands between the loop and the integrator, which
+/// may be inlined in it. The force solver stays a runtime choice
+/// (registry::solver), visited once per force pass, whose cost dwarfs a
+/// branch.
+
+namespace nbody::registry {
+
+template <typename... Ts>
+struct type_list {};
+
+/// ==================== entries ====================
+
+/// @brief container entries, building the systems of a precision and layout
+template <template <typename...> class Container>
+struct container_entry {
+    template <typename Precision, typename Layout>
+    using system = nbody::System<Container, Precision, Layout>;
+};
+struct vector_container : container_entry<std::vector> {
+    static constexpr std::string_view name = "vector";
+};
+struct aligned_container : container_entry<aligned_vector> {
+    static constexpr std::string_view name = "aligned";
+};
+
+struct soa_layout {
+    using type = SoA;
+    static constexpr std::string_view name = "SoA";
+};
+struct aos_layout {
+    using type = AoS;
+    static constexpr std::string_view name = "AoS";
+};
+struct aosoa_layout {
+    using type = AoSoA<>;
+    static constexpr std::string_view name = "AoSoA";
+};
+
+struct single_precision {
+    using type = precision::single;
+    static constexpr std::string_view name = "single";
+};
+struct double_precision {
+    using type = precision::dual;
+    static constexpr std::string_view name = "double";
+};
+struct mixed_precision {
+    using type = precision::mixed;
+    static constexpr std::string_view name = "mixed";
+};
+struct compensated_precision {
+    using type = precision::compensated_single;
+    static constexpr std::string_view name = "compensated";
+};
+
+/// @brief whether a solver computes the forces of a system, which the
+/// integrators built from it require
+template <typename Solver, typename System>
+concept solves = particles_system<std::remove_cvref_t<System>> &&
+                 std::invocable<Solver&, System&>;
+
+/// @brief integrator entries: make(solver) builds the integrator, solver
+/// being referenced by it. Lambdas declare their return type, so that
+/// checking them against integrator_of does not compile their body, and
+/// state what the body needs in their requires clause instead
+struct euler {
+    static constexpr std::string_view name = "euler";
+    template <typename Solver>
+    static auto make(Solver& solver) {
+        return [&solver](auto& system, float dt) -> void
+                   requires solves<Solver, decltype(system)> {
+            integrators::euler(system, dt, solver);
+        };
+    }
+};
+struct verlet {
+    static constexpr std::string_view name = "verlet";
+    template <typename Solver>
+    static auto make(Solver& solver) {
+        return [&solver](auto& system, float dt) -> void
+                   requires solves<Solver, decltype(system)> {
+            integrators::verlet(system, dt, solver);
+        };
+    }
+};
+/// kick and drift passes fused across steps
+struct leapfrog {
+    static constexpr std::string_view name = "leapfrog";
+    template <typename Solver>
+    static auto make(Solver& solver) {
+        return integrators::leapfrog_fused<Solver&>(solver);
+    }
+};
+/// leapfrog without state between steps, which the symmetrized adaptive
+/// steps need as they roll the system back
+struct leapfrog_kdk {
+    static constexpr std::string_view name = "leapfrog-kdk";
+    template <typename Solver>
+    static auto make(Solver& solver) {
+        return [&solver](auto& system, float dt) -> void
+                   requires solves<Solver, decltype(system)> {
+            integrators::leapfrog(system, dt, solver);
+        };
+    }
+};
+struct yoshida4 {
+    static constexpr std::string_view name = "yoshida4";
+    template <typename Solver>
+    static auto make(Solver& solver) {
+        return [&solver](auto& system, float dt) -> void
+                   requires solves<Solver, decltype(system)> {
+            integrators::yoshida4(system, dt, solver);
+        };
+    }
+};
+struct yoshida6 {
+    static constexpr std::string_view name = "yoshida6";
+    template <typename Solver>
+    static auto make(Solver& solver) {
+        return [&solver](auto& system, float dt) -> void
+                   requires solves<Solver, decltype(system)> {
+            integrators::yoshida6(system, dt, solver);
+        };
+    }
+};
+/// the predictor-corrector needs the jerks of the direct kernel, the solver
+/// is unused: drivers reject any other one
+struct hermite {
+    static constexpr std::string_view name = "hermite";
+    template <typename Solver>
+    static auto make(Solver&) {
+        return integrators::hermite{};
+    }
+};
+/// block time steps recompute the forces of the active particles only, with
+/// the direct kernel: the solver is unused, drivers reject any other one
+struct block {
+    static constexpr std::string_view name = "block";
+    template <typename Solver>
+    static auto make(Solver&) {
+        return integrators::block_leapfrog{};
+    }
+};
+
+using containers = type_list<vector_container, aligned_container>;
+using layouts = type_list<soa_layout, aos_layout, aosoa_layout>;
+using precisions = type_list<single_precision, double_precision,
+                             mixed_precision, compensated_precision>;
+using integrator_entries = type_list<euler, verlet, leapfrog, leapfrog_kdk,
+                                     yoshida4, yoshida6, hermite, block>;
+
+/// @brief a system of the registry, with the entries it is built from
+template <typename Container, typename Layout, typename Precision>
+struct system_entry {
+    using container = Container;
+    using layout = Layout;
+    using precision = Precision;
+    using type = typename Container::template system<typename Precision::type,
+                                                     typename Layout::type>;
+};
+
+/// ==================== force solvers ====================
+
+/// @brief force solver of a run, picked by name: direct, symmetric,
+/// barnes-hut or fmm
+template <Scalar T>
+class solver {
+   public:
+    /// @throws std::invalid_argument for an unknown solver
+    solver(std::string_view name, T theta, unsigned order) {
+        if (name == "direct")
+            solvers_.template emplace<physics::direct_sum>();
+        else if (name == "symmetric")
+            solvers_.template emplace<physics::symmetric_sum>();
+        else if (name == "barnes-hut")
+            solvers_.template emplace<physics::barnes_hut<T>>(theta);
+        else if (name == "fmm")
+            solvers_.template emplace<physics::fmm<T>>(order, theta);
+        else
+            throw std::invalid_argument("unknown force solver: " +
+                                        std::string(name));
+    }
+
+    template <typename System>
+        requires particles_system<System>
+    void operator()(System& system) {
+        std::visit([&](auto& f) { f(system); }, solvers_);
+    }
+
+    /// @brief the direct solver, to set its potential, nullptr for the
+    /// other ones
+    [[nodiscard]] physics::direct_sum* direct() {
+        return std::get_if<physics::direct_sum>(&solvers_);
+    }
+
+   private:
+    std::variant<physics::direct_sum, physics::symmetric_sum,
+                 physics::barnes_hut<T>, physics::fmm<T>>
+        solvers_;
+};
+
+/// @brief integrator an entry builds for a system, with the registry solver
+template <typename Entry, typename System>
+using integrator_t = decltype(Entry::make(
+    std::declval<solver<typename System::value_type>&>()));
+
+/// ==================== product and checks ====================
+
+namespace detail {
+template <typename C, typename L, typename... Ps>
+std::tuple<system_entry<C, L, Ps>...> cells(type_list<Ps...>);
+
+template <typename C, typename... Ls, typename Precisions>
+auto rows(type_list<Ls...>, Precisions p)
+    -> decltype(std::tuple_cat(cells<C, Ls>(p)...));
+
+template <typename... Cs, typename Layouts, typename Precisions>
+auto product(type_list<Cs...>, Layouts l, Precisions p)
+    -> decltype(std::tuple_cat(rows<Cs>(l, p)...));
+
+template <typename Tuple>
+struct variant_of;
+template <typename... Ts>
+struct variant_of<std::tuple<Ts...>> {
+    using type = std::variant<Ts...>;
+};
+template <typename... Ts>
+struct variant_of<type_list<Ts...>> {
+    using type = std::variant<Ts...>;
+};
+
+template <typename Entry, typename... Is>
+constexpr bool valid_system() {
+    using S = typename Entry::type;
+    return simulation_system<S> && (integrator_of<integrator_t<Is, S>, S> &&
+                                    ...);
+}
+
+template <typename... Es, typename... Is>
+constexpr bool all_valid(std::variant<Es...>*, type_list<Is...>) {
+    return (valid_system<Es, Is...>() && ...);
+}
+
+/// @brief alternative of a variant of entries whose name matches, if any
+template <typename Variant, typename Match>
+std::optional<Variant> find(Match match) {
+    std::optional<Variant> found;
+    [&]<typename... Es>(std::variant<Es...>*) {
+        (void)((match(Es{}) && (found.emplace(std::in_place_type<Es>), true)) ||
+               ...);
+    }(static_cast<Variant*>(nullptr));
+    return found;
+}
+
+template <typename... Es>
+bool known(type_list<Es...>, std::string_view name) {
+    return ((Es::name == name) || ...);
+}
+}  // namespace detail
+
+/// @brief every system of the registry, one alternative per combination
+using system_variant = typename detail::variant_of<decltype(detail::product(
+    containers{}, layouts{}, precisions{}))>::type;
+/// @brief every integrator of the registry
+using integrator_variant =
+    typename detail::variant_of<integrator_entries>::type;
+
+static_assert(detail::all_valid(static_cast<system_variant*>(nullptr),
+                                integrator_entries{}),
+              "every registered system must be a simulation_system, and "
+              "every registered integrator an integrator_of it");
+
+/// ==================== lookup ====================
+
+/// @brief system entry of a container, layout and precision, to be visited
+/// @throws std::invalid_argument naming the first unknown name
+[[nodiscard]] inline system_variant find_system(std::string_view container,
+                                                std::string_view layout,
+                                                std::string_view precision) {
+    if (!detail::known(containers{}, container))
+        throw std::invalid_argument("unknown container: " +
+                                    std::string(container));
+    if (!detail::known(layouts{}, layout))
+        throw std::invalid_argument("unknown layout: " + std::string(layout));
+    if (!detail::known(precisions{}, precision))
+        throw std::invalid_argument("unknown precision: " +
+                                    std::string(precision));
+    return *detail::find<system_variant>([&]<typename E>(E) {
+        return E::container::name == container && E::layout::name == layout &&
+               E::precision::name == precision;
+    });
+}
+
+/// @brief integrator entry of a name, to be visited
+/// @throws std::invalid_argument for an unknown integrator
+[[nodiscard]] inline integrator_variant find_integrator(
+    std::string_view name) {
+    auto found = detail::find<integrator_variant>(
+        [&]<typename E>(E) { return E::name == name; });
+    if (!found)
+        throw std::invalid_argument("unknown integrator: " +
+                                    std::string(name));
+    return *found;
+}
+}  // namespace nbody::registry
@@ -0,0 +1,149 @@
+#pragma once
+#include <sched.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// thread placement: the parallel loops run in a TBB task arena whose
+/// threads are pinned to a CPU each as they join it, slot k of the arena
+/// going to the k-th CPU of the order. Compact fills a socket before the
+/// next one, keeping the threads close to each other; spread alternates
+/// sockets, using every memory controller with few threads. Pinned threads
+/// keep the pages they first touched (detail/memory.hpp) local.
+
+namespace nbody::utils {
+
+enum class pinning { none, compact, spread };
+
+[[nodiscard]] constexpr const char* pinning_name(pinning p) {
+    switch (p) {
+        case pinning::none: return "none";
+        case pinning::compact: return "compact";
+        case pinning::spread: return "spread";
+    }
+    return "unknown";
+}
+
+/// @throws std::invalid_argument for an unknown name
+[[nodiscard]] inline pinning parse_pinning(std::string_view name) {
+    for (auto p : {pinning::none, pinning::compact, pinning::spread})
+        if (name == pinning_name(p)) return p;
+    throw std::invalid_argument("unknown pinning: " + std::string(name));
+}
+
+namespace detail {
+/// @brief socket of a CPU, 0 when sysfs does not tell
+[[nodiscard]] inline int package_of(int cpu) {
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                     "/topology/physical_package_id");
+    int package = 0;
+    if (!(in >> package)) return 0;
+    return package;
+}
+}  // namespace detail
+
+/// @brief CPUs the process may run on, in the order threads are pinned to
+[[nodiscard]] inline std::vector<int> cpu_order(pinning p) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {};
+
+    std::map<int, std::vector<int>> packages;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(std::size_t(cpu), &allowed))
+            packages[detail::package_of(cpu)].push_back(cpu);
+
+    std::vector<int> order;
+    if (p == pinning::spread) {
+        for (std::size_t k = 0;; ++k) {
+            const auto before = order.size();
+            for (const auto& [package, cpus] : packages)
+                if (k < cpus.size()) order.push_back(cpus[k]);
+            if (order.size() == before) break;
+        }
+    } else {
+        for (const auto& [package, cpus] : packages)
+            order.insert(order.end(), cpus.begin(), cpus.end());
+    }
+    return order;
+}
+
+/// @brief task arena of a given concurrency whose threads are pinned
+/// following a pinning order, and restored to their former affinity when they
+/// leave it. Work submitted through execute(), parallel loops included, runs
+/// on the threads of the arena
+class pinned_arena {
+   public:
+    /// @param threads: concurrency of the arena, all the hardware threads by
+    /// default
+    explicit pinned_arena(int threads = tbb::task_arena::automatic,
+                          pinning p = pinning::none)
+        : arena_(threads),
+          cpus_(p == pinning::none ? std::vector<int>{} : cpu_order(p)),
+          observer_(arena_, cpus_) {
+        if (!cpus_.empty()) observer_.observe(true);
+    }
+    pinned_arena(const pinned_arena&) = delete;
+    pinned_arena& operator=(const pinned_arena&) = delete;
+    ~pinned_arena() { observer_.observe(false); }
+
+    template <typename F>
+    decltype(auto) execute(F&& f) {
+        return arena_.execute(std::forward<F>(f));
+    }
+
+    [[nodiscard]] int max_concurrency() { return arena_.max_concurrency(); }
+    /// @brief CPUs of the slots, empty without pinning
+    [[nodiscard]] const std::vector<int>& cpus() const { return cpus_; }
+
+   private:
+    class observer : public tbb::task_scheduler_observer {
+       public:
+        observer(tbb::task_arena& arena, const std::vector<int>& cpus)
+            : tbb::task_scheduler_observer(arena), cpus_(cpus) {}
+
+        void on_scheduler_entry(bool) override {
+            const int slot = tbb::this_task_arena::current_thread_index();
+            if (slot < 0 || cpus_.empty()) return;
+            auto& s = saved();
+            s.valid = sched_getaffinity(0, sizeof(s.mask), &s.mask) == 0;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(std::size_t(cpus_[std::size_t(slot) % cpus_.size()]), &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+
+        void on_scheduler_exit(bool) override {
+            auto& s = saved();
+            if (s.valid) sched_setaffinity(0, sizeof(s.mask), &s.mask);
+            s.valid = false;
+        }
+
+       private:
+        /// affinity of the thread before it joined the arena
+        struct saved_mask {
+            cpu_set_t mask;
+            bool valid{false};
+        };
+        static saved_mask& saved() {
+            thread_local saved_mask s;
+            return s;
+        }
+
+        const std::vector<int>& cpus_;
+    };
+
+    tbb::task_arena arena_;
+    std::vector<int> cpus_;
+    observer observer_;
+};
+}  // namespace nbody::utils
@@ -0,0 +1,420 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "aligned_vector.hpp"
+#include "concepts.hpp"
+#include "particles.hpp"
+
+/// binary checkpoints, laid out to be memory mapped: a header of
+/// header_bytes, then the 11 columns of the particles in field order, each of
+/// capacity scalars (size rounded up to a cache line, zero padded), then the
+/// identifiers. Every column starts on a cache line of the file, hence of a
+/// mapping of it, which is exactly the arena of SoA_arena_particles: systems
+/// of that storage are restarted in place from a private (copy on write)
+/// mapping, without parsing nor copying the columns. Files are written next
+/// to their destination and renamed over it, a crash leaving the previous
+/// checkpoint intact. The integrators restart from the positions and
+/// velocities only: state they keep between steps (hermite jerks, block
+/// levels, Aarseth accelerations history) is rebuilt on the first step.
+
+namespace nbody::utils {
+
+/// @brief what a checkpoint records besides the particles. Names are free
+/// strings, main stores the tags of its command line and restores the run
+/// from them
+struct checkpoint_info {
+    std::uint64_t step{0};
+    double time{0.0};
+    double dt{0.0};
+    std::string integrator;
+    std::string layout;
+    std::string precision;
+    std::string container;
+    std::string solver;
+    std::string timestep;
+    /// accuracy of adaptive steps, opening angle and expansion order
+    double eta{0.0};
+    double theta{0.0};
+    std::uint32_t order{0};
+    /// particles of the checkpoint, filled when reading
+    std::uint64_t size{0};
+};
+
+namespace detail {
+
+inline constexpr std::size_t header_bytes = 256;
+inline constexpr char checkpoint_magic[8] = {'N', 'B', 'O', 'D',
+                                             'Y', 'C', 'K', 'P'};
+/// version 2 adds the container, solver and timestep fields, left empty
+/// (zero) by version 1 files, which are still read
+inline constexpr std::uint32_t checkpoint_version = 2;
+/// written in native order, read back as is on the same byte order only
+inline constexpr std::uint32_t byte_order = 0x01020304;
+inline constexpr std::size_t checkpoint_fields = 11;
+
+/// @brief on-disk header, padded with zeros to header_bytes
+struct checkpoint_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t scalar_size;
+    std::uint32_t fields;
+    std::uint64_t size;
+    std::uint64_t capacity;
+    std::uint64_t columns_offset;
+    std::uint64_t ids_offset;
+    std::uint64_t step;
+    double time;
+    double dt;
+    char integrator[32];
+    char layout[16];
+    char precision[16];
+    char container[16];
+    char solver[16];
+    char timestep[16];
+    double eta;
+    double theta;
+    std::uint32_t order;
+};
+static_assert(std::is_trivially_copyable_v<checkpoint_header> &&
+              sizeof(checkpoint_header) <= header_bytes);
+
+[[noreturn]] inline void fail(const std::string& path, const std::string& what,
+                              int error = 0) {
+    throw std::runtime_error("checkpoint " + path + ": " + what +
+                             (error ? std::string(": ") + std::strerror(error)
+                                    : std::string()));
+}
+
+inline std::size_t padded_bytes(std::size_t bytes) {
+    return (bytes + cache_line - 1) / cache_line * cache_line;
+}
+
+template <std::size_t N>
+void copy_name(char (&to)[N], std::string_view name) {
+    std::memset(to, 0, N);
+    std::memcpy(to, name.data(), std::min(name.size(), N - 1));
+}
+
+template <std::size_t N>
+std::string name_of(const char (&from)[N]) {
+    return {from, strnlen(from, N)};
+}
+
+/// @brief field f of a particle view
+template <typename View>
+auto field_of(const View& p, field f) {
+    switch (f) {
+        case field::qx: return p.qx;
+        case field::qy: return p.qy;
+        case field::qz: return p.qz;
+        case field::vx: return p.vx;
+        case field::vy: return p.vy;
+        case field::vz: return p.vz;
+        case field::ax: return p.ax;
+        case field::ay: return p.ay;
+        case field::az: return p.az;
+        case field::m: return p.m;
+        default: return p.r;
+    }
+}
+
+/// @brief file being written, appended to and flushed to disk
+class output_file {
+   public:
+    explicit output_file(std::string path) : path_(std::move(path)) {
+        fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) fail(path_, "cannot create", errno);
+    }
+    output_file(const output_file&) = delete;
+    output_file& operator=(const output_file&) = delete;
+    ~output_file() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    void write(const void* data, std::size_t bytes) {
+        const auto* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            const auto written = ::write(fd_, p, bytes);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) fail(path_, "write failed", errno);
+            p += written;
+            bytes -= static_cast<std::size_t>(written);
+        }
+    }
+
+    /// @brief zeros up to the next multiple of a cache line
+    void pad(std::size_t bytes) {
+        static constexpr std::array<char, cache_line> zeros{};
+        if (const auto tail = padded_bytes(bytes) - bytes; tail > 0)
+            write(zeros.data(), tail);
+    }
+
+    void close() {
+        if (::fsync(fd_) != 0) fail(path_, "fsync failed", errno);
+        const int fd = std::exchange(fd_, -1);
+        if (::close(fd) != 0) fail(path_, "close failed", errno);
+    }
+
+   private:
+    std::string path_;
+    int fd_{-1};
+};
+
+/// @brief read-only view of a checkpoint file mapped in memory, the header
+/// being validated against the size of the file
+class mapped_checkpoint {
+   public:
+    explicit mapped_checkpoint(const std::string& path) : path_(path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) fail(path, "cannot open", errno);
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            const int error = errno;
+            ::close(fd);
+            fail(path, "cannot stat", error);
+        }
+        length_ = static_cast<std::size_t>(st.st_size);
+        if (length_ < header_bytes) {
+            ::close(fd);
+            fail(path, "truncated header");
+        }
+        /// private writable pages: the columns may be stepped in place, the
+        /// file is never modified
+        void* base = ::mmap(nullptr, length_, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+        const int error = errno;
+        ::close(fd);
+        if (base == MAP_FAILED) fail(path, "mmap failed", error);
+        base_ = static_cast<std::byte*>(base);
+        std::memcpy(&header_, base_, sizeof(header_));
+        try {
+            validate();
+        } catch (...) {
+            ::munmap(std::exchange(base_, nullptr), length_);
+            throw;
+        }
+    }
+    mapped_checkpoint(const mapped_checkpoint&) = delete;
+    mapped_checkpoint& operator=(const mapped_checkpoint&) = delete;
+    ~mapped_checkpoint() {
+        if (base_) ::munmap(base_, length_);
+    }
+
+    [[nodiscard]] const checkpoint_header& header() const { return header_; }
+
+    [[nodiscard]] checkpoint_info info() const {
+        return {header_.step,
+                header_.time,
+                header_.dt,
+                name_of(header_.integrator),
+                name_of(header_.layout),
+                name_of(header_.precision),
+                name_of(header_.container),
+                name_of(header_.solver),
+                name_of(header_.timestep),
+                header_.eta,
+                header_.theta,
+                header_.order,
+                header_.size};
+    }
+
+    /// @brief padded column of a field, of header().capacity scalars
+    template <typename T>
+    [[nodiscard]] T* column(std::size_t f) const {
+        return reinterpret_cast<T*>(base_ + header_.columns_offset +
+                                    f * header_.capacity * sizeof(T));
+    }
+
+    [[nodiscard]] std::span<const particle_id> ids() const {
+        return {reinterpret_cast<const particle_id*>(base_ +
+                                                     header_.ids_offset),
+                header_.size};
+    }
+
+    /// @brief hands the mapping over, with its length
+    std::pair<std::byte*, std::size_t> release() {
+        return {std::exchange(base_, nullptr), length_};
+    }
+
+   private:
+    void validate() const {
+        const auto& h = header_;
+        if (std::memcmp(h.magic, checkpoint_magic, sizeof(h.magic)) != 0)
+            fail(path_, "not a checkpoint");
+        if (h.version == 0 || h.version > checkpoint_version)
+            fail(path_, "unsupported version " + std::to_string(h.version));
+        if (h.byte_order != byte_order)
+            fail(path_, "written with another byte order");
+        if (h.fields != checkpoint_fields ||
+            (h.scalar_size != sizeof(float) &&
+             h.scalar_size != sizeof(double)))
+            fail(path_, "unsupported particle format");
+        const auto column_bytes = h.capacity * h.scalar_size;
+        if (h.size > h.capacity || column_bytes % cache_line != 0 ||
+            h.columns_offset % cache_line != 0 ||
+            h.ids_offset != h.columns_offset + h.fields * column_bytes ||
+            h.ids_offset + h.size * sizeof(particle_id) > length_)
+            fail(path_, "inconsistent or truncated file");
+    }
+
+    std::string path_;
+    std::byte* base_{nullptr};
+    std::size_t length_{0};
+    checkpoint_header header_{};
+};
+
+/// @brief copies the columns of a checkpoint of scalars S into an empty
+/// system, then its identifiers
+template <typename S, typename System>
+void copy_particles(const mapped_checkpoint& file, System& system) {
+    using T = typename System::value_type;
+    const auto n = file.header().size;
+    std::array<const S*, checkpoint_fields> c;
+    for (std::size_t f = 0; f < checkpoint_fields; ++f)
+        c[f] = file.column<S>(f);
+    if constexpr (requires { system.reserve(n); }) system.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        system.add_particle(
+            {T(c[0][i]), T(c[1][i]), T(c[2][i]), T(c[3][i]), T(c[4][i]),
+             T(c[5][i]), T(c[6][i]), T(c[7][i]), T(c[8][i]), T(c[9][i]),
+             T(c[10][i])});
+    const auto ids = file.ids();
+    std::copy(ids.begin(), ids.end(), system.ids().begin());
+}
+}  // namespace detail
+
+/// @brief writes a checkpoint of the system, atomically replacing path: the
+/// file is written to path.tmp, flushed to disk and renamed over path.
+/// Integrators keeping velocities staggered must be synchronized first
+/// @throws std::runtime_error when the file cannot be written
+template <typename System>
+    requires identified_system<System>
+void write_checkpoint(const std::string& path, const System& system,
+                      const checkpoint_info& info) {
+    using T = typename System::value_type;
+    const std::size_t n = system.size();
+    const std::size_t capacity =
+        detail::padded_bytes(n * sizeof(T)) / sizeof(T);
+    const std::size_t column_bytes = capacity * sizeof(T);
+
+    detail::checkpoint_header h{};
+    std::memcpy(h.magic, detail::checkpoint_magic, sizeof(h.magic));
+    h.version = detail::checkpoint_version;
+    h.byte_order = detail::byte_order;
+    h.scalar_size = sizeof(T);
+    h.fields = detail::checkpoint_fields;
+    h.size = n;
+    h.capacity = capacity;
+    h.columns_offset = detail::header_bytes;
+    h.ids_offset = h.columns_offset + h.fields * column_bytes;
+    h.step = info.step;
+    h.time = info.time;
+    h.dt = info.dt;
+    detail::copy_name(h.integrator, info.integrator);
+    detail::copy_name(h.layout, info.layout);
+    detail::copy_name(h.precision, info.precision);
+    detail::copy_name(h.container, info.container);
+    detail::copy_name(h.solver, info.solver);
+    detail::copy_name(h.timestep, info.timestep);
+    h.eta = info.eta;
+    h.theta = info.theta;
+    h.order = info.order;
+
+    const std::string tmp = path + ".tmp";
+    {
+        detail::output_file out(tmp);
+        std::array<char, detail::header_bytes> header{};
+        std::memcpy(header.data(), &h, sizeof(h));
+        out.write(header.data(), header.size());
+
+        std::vector<T> buffer;
+        for (std::size_t f = 0; f < detail::checkpoint_fields; ++f) {
+            const auto fi = static_cast<field>(f);
+            if constexpr (columnar_system<const System>) {
+                out.write(system.column(fi).data(), n * sizeof(T));
+            } else {
+                buffer.resize(n);
+                auto it = system.begin();
+                for (std::size_t i = 0; i < n; ++i, ++it)
+                    buffer[i] = detail::field_of(*it, fi);
+                out.write(buffer.data(), n * sizeof(T));
+            }
+            out.pad(n * sizeof(T));
+        }
+        const auto ids = system.ids();
+        out.write(ids.data(), n * sizeof(particle_id));
+        out.pad(n * sizeof(particle_id));
+        out.close();
+    }
+
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        detail::fail(path, "rename failed", errno);
+    /// the rename itself reaches the disk with the directory
+    auto dir = std::filesystem::path(path).parent_path();
+    if (dir.empty()) dir = ".";
+    if (const int fd = ::open(dir.c_str(), O_RDONLY); fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+/// @brief header of a checkpoint, e.g. to pick the system to restore it into
+/// @throws std::runtime_error when the file is not a valid checkpoint
+inline checkpoint_info read_checkpoint_info(const std::string& path) {
+    return detail::mapped_checkpoint(path).info();
+}
+
+/// @brief system restored from a checkpoint. A SoA_arena_particles system of
+/// the precision of the file adopts the mapping of the file as its arena,
+/// the columns being paged in on first touch; other systems copy the
+/// particles, converting the scalars
+/// @throws std::runtime_error when the file is not a valid checkpoint
+template <typename System>
+    requires identified_system<System>
+System load_checkpoint(const std::string& path) {
+    using T = typename System::value_type;
+    detail::mapped_checkpoint file(path);
+    const auto& h = file.header();
+
+    if constexpr (std::is_same_v<
+                      System,
+                      SoA_arena_particles<T, typename System::accum_type>>) {
+        if (h.scalar_size == sizeof(T)) {
+            const auto size = h.size, capacity = h.capacity;
+            T* arena = file.column<T>(0);
+            const auto ids = file.ids();
+            /// ids are copied out of the mapping before it is handed over
+            std::vector<particle_id> copied(ids.begin(), ids.end());
+            const auto [base, length] = file.release();
+            return System::adopt(
+                arena, size, capacity, copied,
+                [base, length](T*) { ::munmap(base, length); });
+        }
+    }
+
+    System system;
+    if (h.scalar_size == sizeof(float))
+        detail::copy_particles<float>(file, system);
+    else
+        detail::copy_particles<double>(file, system);
+    return system;
+}
+}  // namespace nbody::utils
@@ -1,37 +1,156 @@
 #pragma once
+#include <algorithm>
 #include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <vector>
 
 #include "constants.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/simd.hpp"
+#include "detail/triangular_schedule.hpp"
+#include "precision.hpp"
 
 namespace nbody::utils {
 
-/// @brief util function to compute the total energy of a given system
+namespace detail {
+
+/// @brief adds m_j / r_ij over the particles j in [j, end) handled by whole
+/// vectors of U to sum
+/// @return first particle left, less than a vector before end
+template <typename U, typename T>
+NBODY_SIMD_TARGET(U)
+std::size_t potential_sweep(const T* qx, const T* qy, const T* qz,
+                            const T* m, std::size_t i, std::size_t j,
+                            std::size_t end, typename U::vec& sum) {
+    constexpr auto soft_squared = constants::soft_v<T> * constants::soft_v<T>;
+    const auto xi = U::set1(qx[i]);
+    const auto yi = U::set1(qy[i]);
+    const auto zi = U::set1(qz[i]);
+    const auto soft2 = U::set1(soft_squared);
+    for (; j + U::width <= end; j += U::width) {
+        const auto dx = U::sub(U::load(&qx[j]), xi);
+        const auto dy = U::sub(U::load(&qy[j]), yi);
+        const auto dz = U::sub(U::load(&qz[j]), zi);
+        const auto r2 =
+            U::fmadd(dx, dx, U::fmadd(dy, dy, U::fmadd(dz, dz, soft2)));
+        sum = U::fmadd(U::load(&m[j]), U::rsqrt(r2), sum);
+    }
+    return j;
+}
+
+/// @brief sum of m_j / r_ij over j in [j_begin, j_end), run with the SIMD
+/// wrapper V: every lane sums width apart terms in T, lanes and tail terms
+/// are accumulated one by one in Accum
+template <typename V, typename Accum, typename T>
+NBODY_SIMD_TARGET(V)
+Accum potential_row(const T* qx, const T* qy, const T* qz, const T* m,
+                    std::size_t i, std::size_t j_begin, std::size_t j_end) {
+    using S = nbody::detail::simd::basic_scalar<T>;
+    Accum sum{};
+    auto j = j_begin;
+    if constexpr (V::width > 1) {
+        auto v = V::zero();
+        j = potential_sweep<V>(qx, qy, qz, m, i, j, j_end, v);
+        alignas(64) T lanes[V::width];
+        V::store(lanes, v);
+        for (const auto x : lanes) precision::accumulate(sum, x);
+    }
+    for (; j < j_end; ++j) {
+        T term{0};
+        potential_sweep<S>(qx, qy, qz, m, i, j, j + 1, term);
+        precision::accumulate(sum, term);
+    }
+    return sum;
+}
+}  // namespace detail
+
+/// @brief util function to compute the total energy of a given system, every
+/// pair of particles being visited once for the (softened) potential. Pairs
+/// are split in blocks visited in parallel by detail::for_each_block_pair,
+/// the j loop of every particle running with the SIMD wrapper selected by
+/// detail::dispatch. Each block owns its accumulator and the schedule does
+/// not depend on the number of threads, so the result is deterministic.
+/// Terms are computed in the value type of the system, only the SIMD lanes of
+/// a row summing them in it: rows, their tails and the sums over a pair of
+/// blocks run in the accumulation type
 /// @tparams system of particles, either SoA or AoS
-/// @return total energy in Joules
-/// @note system should be marked const, this would require the implementation
-/// of a const iterator and duplication of ranges API
+/// @return total energy in Joules, in the result type of the accumulation
+/// type (see precision.hpp)
 template <typename System>
-auto compute_energy(System& system) {
+auto compute_energy(const System& system) {
     using T = typename System::value_type;
-    constexpr auto G = constants::G;
-    T kinetic{0.0};
-    T potential{0.0};
+    using Accum = precision::system_accum_t<System>;
+    constexpr std::size_t block = 256;
 
-    for (auto&& pi : system) {
-        auto vel_squared = pi.vx * pi.vx + pi.vy * pi.vy + pi.vz * pi.vz;
-        kinetic += 0.5f * pi.m * vel_squared;
+    const auto n = system.size();
+    auto first = system.begin();
 
-        for (auto&& pj : system) {
-            if (&pi.qx == &pj.qx) continue;
+    /// positions and masses are gathered in contiguous scratch columns,
+    /// whatever the layout of the system
+    std::vector<T> qx(n), qy(n), qz(n), m(n);
+    Accum kinetic{};
+    for (std::size_t i = 0; i < n; ++i) {
+        auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+        qx[i] = p.qx;
+        qy[i] = p.qy;
+        qz[i] = p.qz;
+        m[i] = p.m;
+        const auto vel_squared = p.vx * p.vx + p.vy * p.vy + p.vz * p.vz;
+        precision::accumulate(kinetic, T{0.5} * p.m * vel_squared);
+    }
+
+    /// G is applied to every row, products of two masses overflowing floats
+    using R = precision::result_t<Accum>;
+    constexpr auto G = constants::G_v<R>;
+    const auto nb = (n + block - 1) / block;
+    std::vector<Accum> potential(nb);
+    nbody::detail::for_each_block_pair(nb, [&](std::size_t I, std::size_t J) {
+        const auto i_end = std::min(n, (I + 1) * block);
+        const auto j_end = std::min(n, (J + 1) * block);
+        Accum pair_sum{};
+        nbody::detail::dispatch([&]<typename D>(D) {
+            using V = std::conditional_t<std::same_as<T, float>, D,
+                                         nbody::detail::simd::basic_scalar<T>>;
+            for (auto i = I * block; i < i_end; ++i) {
+                const auto j_begin = I == J ? i + 1 : J * block;
+                const auto r = precision::value(detail::potential_row<V, Accum>(
+                    qx.data(), qy.data(), qz.data(), m.data(), i, j_begin,
+                    j_end));
+                precision::accumulate(pair_sum, static_cast<R>(m[i]) * (G * r));
+            }
+        });
+        precision::accumulate(potential[I], pair_sum);
+    });
 
-            auto dx = pi.qx - pj.qx;
-            auto dy = pi.qy - pj.qy;
-            auto dz = pi.qz - pj.qz;
+    Accum total{};
+    for (const auto& p : potential) precision::accumulate(total, p);
+
+    return precision::value(kinetic) - precision::value(total);
+}
+
+/// @brief total energy from the potentials computed by a fused force pass
+/// (see physics::compute_accelerations), in O(N)
+/// @param potential: softened potential of every particle, matching the
+/// current positions
+template <typename System>
+auto compute_energy(const System& system, std::span<const double> potential) {
+    using T = typename System::value_type;
+    using Accum = precision::system_accum_t<System>;
+    Accum kinetic{};
+    double pot{0.0};
 
-            auto dist = std::sqrt(dx * dx + dy * dy + dz * dz);
-            potential += -(G * pi.m * pj.m) / dist;
-        }
+    auto it = system.begin();
+    for (std::size_t i = 0; i < system.size(); ++i, ++it) {
+        auto&& p = *it;
+        const auto vel_squared = p.vx * p.vx + p.vy * p.vy + p.vz * p.vz;
+        precision::accumulate(kinetic, T{0.5} * p.m * vel_squared);
+        pot += 0.5 * static_cast<double>(p.m) * potential[i];
     }
-    return kinetic + 0.5f * potential;
+    return static_cast<precision::result_t<Accum>>(
+        precision::value(kinetic) +
+        static_cast<precision::result_t<Accum>>(pot));
 }
 }  // namespace nbody::utils
@@ -0,0 +1,314 @@
+#pragma once
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "concepts.hpp"
+#include "detail/execution.hpp"
+#include "nbody.hpp"
+#include "physics/compute_accelerations.hpp"
+#include "registry.hpp"
+#include "utils/init_galaxy.hpp"
+
+/// ensembles of small independent simulations (parameter sweeps): a force
+/// pass over a few thousand particles cannot keep a large machine busy, many
+/// simulations side by side can. Every simulation is a task of the TBB pool
+/// of the calling arena, its passes running serially on the thread that
+/// picked it up (detail::serial_scope), so that the threads never wait on
+/// each other within a step and throughput grows with the cores as long as
+/// there are more runs than threads. Runs are started largest first, cutting
+/// the tail of the last long runs; idle threads steal the remaining ones.
+///
+/// Configurations are read from text, one run per line of whitespace
+/// separated key=value pairs, '#' starting a comment:
+///     n=2000 steps=500 dt=0.005 integrator=yoshida4 precision=double seed=7
+/// with the keys name, n, steps, dt, integrator, container, layout,
+/// precision, seed and repeat (the run is repeated with the seeds seed,
+/// seed + 1, ...), the other ones taking the defaults of run_config. The
+/// names are the ones of the registry (registry.hpp), like test_main.
+
+namespace nbody::utils {
+
+/// @brief one simulation of an ensemble: a galaxy of n particles drawn from
+/// seed, stepped steps times by dt with the direct solver
+struct run_config {
+    std::string name;
+    std::size_t n{1000};
+    unsigned long steps{1000};
+    float dt{0.01f};
+    std::string integrator{"leapfrog"};
+    std::string container{"vector"};
+    std::string layout{"SoA"};
+    std::string precision{"single"};
+    unsigned long seed{42};
+};
+
+/// @brief outcome of a run, error holding the message of a failed one
+struct run_result {
+    std::size_t index{0};
+    run_config config;
+    double energy_initial{0.0};
+    double energy_final{0.0};
+    /// relative energy drift, in percent like test_main
+    double drift{0.0};
+    /// time of the steps, the initial and final energies left out
+    double seconds{0.0};
+    /// slot of the arena that ran it
+    int thread{0};
+    std::string error;
+};
+
+/// @brief totals of an ensemble
+struct ensemble_stats {
+    std::size_t runs{0};
+    std::size_t failed{0};
+    /// wall time of the whole ensemble
+    double seconds{0.0};
+    /// sum of the times of the runs, energies included
+    double busy_seconds{0.0};
+};
+
+namespace detail {
+/// @brief value of a key, std::invalid_argument naming the key when it is
+/// not entirely a number
+template <typename T>
+[[nodiscard]] T number(std::string_view key, const std::string& value) {
+    std::istringstream in(value);
+    T x{};
+    const bool negative = std::is_unsigned_v<T> && value.starts_with('-');
+    if (negative || !(in >> x) || !in.eof())
+        throw std::invalid_argument("bad value for " + std::string(key) +
+                                    ": " + value);
+    return x;
+}
+}  // namespace detail
+
+/// @brief runs of one line of configuration, none for a blank or comment line
+/// @throws std::invalid_argument for an unknown key, name or a bad value
+[[nodiscard]] inline std::vector<run_config> parse_run_config(
+    std::string_view line) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream in{std::string(line)};
+    run_config config;
+    unsigned long repeat = 1;
+    bool empty = true;
+    for (std::string token; in >> token;) {
+        empty = false;
+        const auto eq = token.find('=');
+        if (eq == std::string::npos || eq == 0)
+            throw std::invalid_argument("expected key=value: " + token);
+        const auto key = token.substr(0, eq);
+        const auto value = token.substr(eq + 1);
+        if (key == "name")
+            config.name = value;
+        else if (key == "n")
+            config.n = detail::number<std::size_t>(key, value);
+        else if (key == "steps")
+            config.steps = detail::number<unsigned long>(key, value);
+        else if (key == "dt")
+            config.dt = detail::number<float>(key, value);
+        else if (key == "integrator")
+            config.integrator = value;
+        else if (key == "container")
+            config.container = value;
+        else if (key == "layout")
+            config.layout = value;
+        else if (key == "precision")
+            config.precision = value;
+        else if (key == "seed")
+            config.seed = detail::number<unsigned long>(key, value);
+        else if (key == "repeat")
+            repeat = detail::number<unsigned long>(key, value);
+        else
+            throw std::invalid_argument("unknown key: " + key);
+    }
+    if (empty) return {};
+
+    if (config.n == 0 || !(config.dt > 0.0f) || repeat == 0)
+        throw std::invalid_argument("n, dt and repeat must be positive");
+    /// names of the registry, which throws for the unknown ones
+    (void)registry::find_integrator(config.integrator);
+    (void)registry::find_system(config.container, config.layout,
+                                config.precision);
+
+    std::vector<run_config> runs(repeat, config);
+    for (unsigned long k = 0; k < repeat; ++k) runs[k].seed = config.seed + k;
+    return runs;
+}
+
+/// @brief runs of every line of a configuration stream
+/// @throws std::invalid_argument naming the line of an invalid one
+[[nodiscard]] inline std::vector<run_config> read_ensemble(std::istream& in) {
+    std::vector<run_config> runs;
+    std::size_t number = 0;
+    for (std::string line; std::getline(in, line);) {
+        ++number;
+        try {
+            auto more = parse_run_config(line);
+            runs.insert(runs.end(), more.begin(), more.end());
+        } catch (const std::invalid_argument& e) {
+            throw std::invalid_argument("line " + std::to_string(number) +
+                                        ": " + e.what());
+        }
+    }
+    return runs;
+}
+
+/// @throws std::runtime_error when the file cannot be read
+[[nodiscard]] inline std::vector<run_config> read_ensemble(
+    const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot read ensemble " + path);
+    return read_ensemble(in);
+}
+
+/// @brief steps the run of a configuration on a system of a given type, with
+/// the direct solver: the integrator of the registry is picked once, the step
+/// loop being compiled for each one
+/// @throws std::invalid_argument for an unknown integrator
+template <typename System>
+    requires simulation_system<System>
+run_result simulate(const run_config& config) {
+    run_result result;
+    result.config = config;
+
+    auto run = [&](auto integrator) {
+        System system;
+        init_galaxy(system, static_cast<int>(config.n), config.seed);
+        Nbody sim(std::move(system), std::move(integrator), config.steps);
+
+        result.energy_initial = static_cast<double>(sim.energy());
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < config.steps; ++i) sim.step(config.dt);
+        result.seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        result.energy_final = static_cast<double>(sim.energy());
+        result.drift = std::abs(result.energy_final - result.energy_initial) /
+                       std::abs(result.energy_initial) * 100.0;
+    };
+
+    physics::direct_sum direct;
+    std::visit([&]<typename Entry>(Entry) { run(Entry::make(direct)); },
+               registry::find_integrator(config.integrator));
+    return result;
+}
+
+/// @brief runs every configuration as a task of the current arena, passes
+/// serial within a run
+/// @param simulate: callable taking a run_config and returning its
+/// run_result, typically dispatching simulate<System> on the layout and
+/// precision of the run
+/// @param sink: callable taking a const run_result&, called once per run as
+/// soon as it ends, from the thread that ran it, never concurrently
+/// @return totals of the ensemble, failed runs being reported to sink with
+/// their error
+template <typename Simulate, typename Sink>
+ensemble_stats run_ensemble(std::span<const run_config> configs,
+                            Simulate&& simulate, Sink&& sink) {
+    using clock = std::chrono::steady_clock;
+
+    /// largest runs first, by their number of pair interactions
+    std::vector<std::size_t> order(configs.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    auto cost = [&](std::size_t k) {
+        const auto& c = configs[k];
+        return double(c.n) * double(c.n) * double(c.steps);
+    };
+    std::stable_sort(order.begin(), order.end(),
+                     [&](std::size_t a, std::size_t b) {
+                         return cost(a) > cost(b);
+                     });
+
+    ensemble_stats stats;
+    stats.runs = configs.size();
+    std::mutex sink_mutex;
+    const auto start = clock::now();
+    tbb::parallel_for(
+        tbb::blocked_range<std::size_t>(0, order.size(), 1),
+        [&](const tbb::blocked_range<std::size_t>& r) {
+            for (auto k = r.begin(); k != r.end(); ++k) {
+                const auto index = order[k];
+                const auto run_start = clock::now();
+                run_result result;
+                {
+                    const nbody::detail::serial_scope serial;
+                    try {
+                        result = simulate(configs[index]);
+                    } catch (const std::exception& e) {
+                        result.config = configs[index];
+                        result.error = e.what();
+                    }
+                }
+                result.index = index;
+                result.thread = tbb::this_task_arena::current_thread_index();
+                const double busy =
+                    std::chrono::duration<double>(clock::now() - run_start)
+                        .count();
+
+                const std::lock_guard lock(sink_mutex);
+                stats.busy_seconds += busy;
+                if (!result.error.empty()) ++stats.failed;
+                sink(std::as_const(result));
+            }
+        },
+        tbb::simple_partitioner{});
+    stats.seconds =
+        std::chrono::duration<double>(clock::now() - start).count();
+    return stats;
+}
+
+/// @brief result as a line of JSON, without the newline
+[[nodiscard]] inline std::string to_json(const run_result& r) {
+    auto quoted = [](const std::string& s) {
+        std::string out = "\"";
+        for (const char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    };
+    const auto& c = r.config;
+    std::ostringstream out;
+    out << std::setprecision(9) << "{\"run\": " << r.index
+        << ", \"name\": " << quoted(c.name) << ", \"n\": " << c.n
+        << ", \"steps\": " << c.steps << ", \"dt\": " << std::setprecision(7)
+        << c.dt << std::setprecision(9)
+        << ", \"integrator\": " << quoted(c.integrator)
+        << ", \"container\": " << quoted(c.container)
+        << ", \"layout\": " << quoted(c.layout)
+        << ", \"precision\": " << quoted(c.precision)
+        << ", \"seed\": " << c.seed << ", \"thread\": " << r.thread;
+    if (!r.error.empty()) {
+        out << ", \"error\": " << quoted(r.error) << "}";
+        return out.str();
+    }
+    out << ", \"seconds\": " << r.seconds << ", \"steps_per_second\": "
+        << (r.seconds > 0.0 ? double(c.steps) / r.seconds : 0.0)
+        << ", \"energy_initial\": " << r.energy_initial
+        << ", \"energy_final\": " << r.energy_final
+        << ", \"drift\": " << r.drift << "}";
+    return out.str();
+}
+}  // namespace nbody::utils
@@ -0,0 +1,445 @@
+#pragma once
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// hot path instrumentation. Phases are the passes of a step (force, kick,
+/// drift, ...), opened on the thread driving the integrator: they record
+/// their wall time and the hardware counters of every thread of the process
+/// over their span. Tasks are the bodies of the parallel loops: they record
+/// the wall time each thread spends in the current phase. Counters come from
+/// perf_event_open (cycles, instructions, cache misses and, on Intel, the
+/// retired scalar and packed floating point instructions giving the vector
+/// utilization); they are left out where the kernel or the CPU does not
+/// expose them.
+///
+/// The instrumentation of the passes compiles to nothing unless NBODY_PROFILE
+/// is defined (cmake -DNBODY_PROFILE=ON), the profiler itself can be used in
+/// any build.
+
+#define NBODY_PROFILE_CAT_(a, b) a##b
+#define NBODY_PROFILE_CAT(a, b) NBODY_PROFILE_CAT_(a, b)
+
+#ifdef NBODY_PROFILE
+/// @brief opens a phase until the end of the enclosing scope
+#define NBODY_PROFILE_PHASE(name)        \
+    ::nbody::utils::profile_phase        \
+    NBODY_PROFILE_CAT(nbody_profile_phase_, __LINE__)(name)
+/// @brief times the enclosing scope as a task of the current phase
+#define NBODY_PROFILE_TASK()             \
+    ::nbody::utils::profile_task         \
+    NBODY_PROFILE_CAT(nbody_profile_task_, __LINE__)
+#else
+#define NBODY_PROFILE_PHASE(name) static_cast<void>(0)
+#define NBODY_PROFILE_TASK() static_cast<void>(0)
+#endif
+
+/// @brief runs a statement as a phase
+#define NBODY_PROFILE_PASS(name, ...) \
+    do {                              \
+        NBODY_PROFILE_PHASE(name);    \
+        __VA_ARGS__;                  \
+    } while (0)
+
+namespace nbody::utils {
+
+/// @brief hardware counters over a span
+struct counters {
+    enum event : std::size_t {
+        cycles,
+        instructions,
+        cache_misses,
+        fp_scalar,
+        fp_packed,
+        events
+    };
+    std::array<std::uint64_t, events> value{};
+    /// events the kernel and the CPU provide
+    std::array<bool, events> available{};
+
+    counters& operator+=(const counters& other) {
+        for (std::size_t e = 0; e < events; ++e) {
+            value[e] += other.value[e];
+            available[e] = available[e] || other.available[e];
+        }
+        return *this;
+    }
+};
+
+namespace detail {
+
+/// @brief counters of the calling thread, opened when it first records
+class thread_counters {
+   public:
+    thread_counters() {
+        open(counters::cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open(counters::instructions, PERF_TYPE_HARDWARE,
+             PERF_COUNT_HW_INSTRUCTIONS);
+        open(counters::cache_misses, PERF_TYPE_HARDWARE,
+             PERF_COUNT_HW_CACHE_MISSES);
+#if defined(__x86_64__)
+        /// FP_ARITH_INST_RETIRED: scalar (umasks 0x03) and packed (0xfc)
+        if (__builtin_cpu_is("intel")) {
+            open(counters::fp_scalar, PERF_TYPE_RAW, 0x03c7);
+            open(counters::fp_packed, PERF_TYPE_RAW, 0xfcc7);
+        }
+#endif
+    }
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator=(const thread_counters&) = delete;
+    ~thread_counters() {
+        for (const int fd : fd_)
+            if (fd >= 0) ::close(fd);
+    }
+
+    /// @brief counts so far, scaled up when the events were multiplexed;
+    /// callable from any thread
+    [[nodiscard]] counters read() const {
+        counters c;
+        for (std::size_t e = 0; e < counters::events; ++e) {
+            std::uint64_t v[3];
+            if (fd_[e] < 0 || ::read(fd_[e], v, sizeof(v)) != sizeof(v))
+                continue;
+            c.available[e] = true;
+            c.value[e] = v[2] > 0 && v[2] < v[1]
+                             ? static_cast<std::uint64_t>(
+                                   double(v[0]) * double(v[1]) / double(v[2]))
+                             : v[0];
+        }
+        return c;
+    }
+
+   private:
+    void open(std::size_t e, std::uint32_t type, std::uint64_t config) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd_[e] = static_cast<int>(
+            ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    std::array<int, counters::events> fd_{-1, -1, -1, -1, -1};
+};
+}  // namespace detail
+
+/// @brief span of a phase or a task on a thread, times in nanoseconds since
+/// the profiler started
+struct profile_event {
+    const char* name;
+    std::uint32_t thread;
+    std::uint64_t start;
+    std::uint64_t duration;
+    bool phase;
+    /// counters of the whole process over a phase
+    counters delta;
+};
+
+/// @brief collects the events of every thread, see NBODY_PROFILE_PHASE and
+/// NBODY_PROFILE_TASK. Threads append to their own buffers, summary() and
+/// write_trace() must be called while no event is being recorded
+class profiler {
+   public:
+    /// events kept per thread for the timeline, the totals of the summary
+    /// keep counting past it
+    static constexpr std::size_t max_events = std::size_t{1} << 20;
+
+    static profiler& instance() {
+        static profiler p;
+        return p;
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    [[nodiscard]] std::uint64_t now() const {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now() - origin_)
+                .count());
+    }
+
+    /// @brief counters summed over the threads that recorded so far
+    [[nodiscard]] counters read() {
+        thread();
+        std::lock_guard lock(mutex_);
+        counters sum;
+        for (const auto& t : threads_) sum += t->counters.read();
+        return sum;
+    }
+
+    /// @brief phase tasks are attributed to, the innermost open one
+    [[nodiscard]] const char* current_phase() const {
+        return phase_.load(std::memory_order_relaxed);
+    }
+    const char* enter(const char* name) {
+        return phase_.exchange(name, std::memory_order_relaxed);
+    }
+    void leave(const char* previous) {
+        phase_.store(previous, std::memory_order_relaxed);
+    }
+
+    /// @brief appends an event of the calling thread
+    void record(profile_event e) {
+        auto& t = thread();
+        e.thread = t.index;
+        auto& totals = (e.phase ? t.phases : t.tasks)[e.name];
+        ++totals.calls;
+        totals.nanoseconds += e.duration;
+        totals.delta += e.delta;
+        if (t.events.size() < max_events)
+            t.events.push_back(e);
+        else
+            ++t.dropped;
+    }
+
+    /// @brief drops the events recorded so far
+    void reset() {
+        std::lock_guard lock(mutex_);
+        for (auto& t : threads_) {
+            t->events.clear();
+            t->phases.clear();
+            t->tasks.clear();
+            t->dropped = 0;
+        }
+    }
+
+    /// @brief per phase totals: calls, wall time, counters (instructions per
+    /// cycle, cache misses per thousand instructions, share of the floating
+    /// point instructions that are packed), then the time every thread spent
+    /// in tasks of each phase
+    void summary(std::ostream& out) const {
+        std::lock_guard lock(mutex_);
+        std::map<std::string, total> phases;
+        std::map<std::string, std::map<std::uint32_t, total>> tasks;
+        for (const auto& t : threads_) {
+            for (const auto& [name, tot] : t->phases) phases[name].merge(tot);
+            for (const auto& [name, tot] : t->tasks)
+                tasks[name][t->index].merge(tot);
+        }
+
+        out << "profile: phases\n"
+            << std::left << std::setw(20) << "phase" << std::right
+            << std::setw(10) << "calls" << std::setw(12) << "total [ms]"
+            << std::setw(12) << "mean [us]" << std::setw(8) << "IPC"
+            << std::setw(12) << "miss/kinst" << std::setw(10) << "packed"
+            << "\n";
+        for (const auto& [name, tot] : phases) {
+            const auto& c = tot.delta;
+            out << std::left << std::setw(20) << name << std::right
+                << std::setw(10) << tot.calls << std::fixed
+                << std::setprecision(3) << std::setw(12)
+                << double(tot.nanoseconds) * 1e-6 << std::setprecision(2)
+                << std::setw(12)
+                << double(tot.nanoseconds) * 1e-3 / double(tot.calls);
+            cell(out, 8,
+                 ratio(c, counters::instructions, counters::cycles, 1.0));
+            cell(out, 12, ratio(c, counters::cache_misses,
+                                counters::instructions, 1e3));
+            cell(out, 10, packed_share(c));
+            out << "\n";
+        }
+        if (!tasks.empty()) {
+            out << "profile: task time per thread [ms]\n";
+            for (const auto& [name, threads] : tasks) {
+                out << std::left << std::setw(20) << name << std::right;
+                for (const auto& [index, tot] : threads)
+                    out << "  #" << index << " " << std::fixed
+                        << std::setprecision(3)
+                        << double(tot.nanoseconds) * 1e-6;
+                out << "\n";
+            }
+        }
+        std::size_t dropped = 0;
+        for (const auto& t : threads_) dropped += t->dropped;
+        if (dropped > 0)
+            out << "profile: " << dropped
+                << " events past the timeline capacity\n";
+    }
+
+    /// @brief writes the timeline in the Chrome trace event format, opened
+    /// by chrome://tracing and Perfetto: one track per thread, phases
+    /// carrying their counters
+    /// @throws std::runtime_error when the file cannot be written
+    void write_trace(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) throw std::runtime_error("trace " + path + ": cannot create");
+        std::lock_guard lock(mutex_);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        auto separator = [&] {
+            out << (first ? "" : ",\n");
+            first = false;
+        };
+        for (const auto& t : threads_) {
+            separator();
+            out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+                   "\"tid\": "
+                << t->index << ", \"args\": {\"name\": \""
+                << (t->index == 0 ? "main" : "worker ") << t->index << "\"}}";
+        }
+        out << std::fixed << std::setprecision(3);
+        for (const auto& t : threads_)
+            for (const auto& e : t->events) {
+                separator();
+                out << "{\"name\": \"" << e.name << "\", \"cat\": \""
+                    << (e.phase ? "phase" : "task")
+                    << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e.thread
+                    << ", \"ts\": " << double(e.start) * 1e-3
+                    << ", \"dur\": " << double(e.duration) * 1e-3;
+                if (e.phase) {
+                    static constexpr const char* names[] = {
+                        "cycles", "instructions", "cache_misses",
+                        "fp_scalar", "fp_packed"};
+                    out << ", \"args\": {";
+                    bool any = false;
+                    for (std::size_t c = 0; c < counters::events; ++c) {
+                        if (!e.delta.available[c]) continue;
+                        out << (any ? ", " : "") << "\"" << names[c]
+                            << "\": " << e.delta.value[c];
+                        any = true;
+                    }
+                    out << "}";
+                }
+                out << "}";
+            }
+        out << "\n]}\n";
+        if (!out) throw std::runtime_error("trace " + path + ": write failed");
+    }
+
+   private:
+    struct total {
+        std::uint64_t calls{0};
+        std::uint64_t nanoseconds{0};
+        counters delta;
+
+        void merge(const total& other) {
+            calls += other.calls;
+            nanoseconds += other.nanoseconds;
+            delta += other.delta;
+        }
+    };
+
+    struct thread_state {
+        std::uint32_t index;
+        detail::thread_counters counters;
+        std::vector<profile_event> events;
+        /// totals by name
+        std::map<std::string, total> phases;
+        std::map<std::string, total> tasks;
+        std::size_t dropped{0};
+    };
+
+    profiler() : origin_(clock::now()) {}
+
+    /// @brief state of the calling thread, registered on first use
+    thread_state& thread() {
+        thread_local thread_state* state = nullptr;
+        if (!state) {
+            std::lock_guard lock(mutex_);
+            threads_.push_back(std::make_unique<thread_state>());
+            state = threads_.back().get();
+            state->index = static_cast<std::uint32_t>(threads_.size() - 1);
+        }
+        return *state;
+    }
+
+    /// @brief scale * a / b, nothing when a counter is missing
+    static std::optional<double> ratio(const counters& c, std::size_t a,
+                                       std::size_t b, double scale) {
+        if (!c.available[a] || !c.available[b] || c.value[b] == 0)
+            return std::nullopt;
+        return scale * double(c.value[a]) / double(c.value[b]);
+    }
+
+    static std::optional<double> packed_share(const counters& c) {
+        const double packed = double(c.value[counters::fp_packed]);
+        const double all = packed + double(c.value[counters::fp_scalar]);
+        if (!c.available[counters::fp_packed] || all == 0.0)
+            return std::nullopt;
+        return packed / all;
+    }
+
+    /// @brief a column of the summary, "-" for a missing counter
+    static void cell(std::ostream& out, int width,
+                     std::optional<double> value) {
+        out << std::setw(width);
+        if (value)
+            out << *value;
+        else
+            out << "-";
+    }
+
+    clock::time_point origin_;
+    std::atomic<const char*> phase_{"-"};
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<thread_state>> threads_;
+};
+
+/// @brief RAII phase, see NBODY_PROFILE_PHASE
+class profile_phase {
+   public:
+    explicit profile_phase(const char* name)
+        : name_(name),
+          previous_(profiler::instance().enter(name)),
+          counters_(profiler::instance().read()),
+          start_(profiler::instance().now()) {}
+    profile_phase(const profile_phase&) = delete;
+    profile_phase& operator=(const profile_phase&) = delete;
+
+    ~profile_phase() {
+        auto& p = profiler::instance();
+        const auto end = p.now();
+        auto delta = p.read();
+        for (std::size_t e = 0; e < counters::events; ++e)
+            delta.value[e] -= std::min(delta.value[e], counters_.value[e]);
+        p.record({name_, 0, start_, end - start_, true, delta});
+        p.leave(previous_);
+    }
+
+   private:
+    const char* name_;
+    const char* previous_;
+    counters counters_;
+    std::uint64_t start_;
+};
+
+/// @brief RAII task, see NBODY_PROFILE_TASK
+class profile_task {
+   public:
+    profile_task()
+        : name_(profiler::instance().current_phase()),
+          start_(profiler::instance().now()) {}
+    profile_task(const profile_task&) = delete;
+    profile_task& operator=(const profile_task&) = delete;
+
+    ~profile_task() {
+        auto& p = profiler::instance();
+        p.record({name_, 0, start_, p.now() - start_, false, {}});
+    }
+
+   private:
+    const char* name_;
+    std::uint64_t start_;
+};
+}  // namespace nbody::utils
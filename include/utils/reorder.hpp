@@ -0,0 +1,277 @@
+#pragma once
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "concepts.hpp"
+#include "particles.hpp"
+#include "physics/octree.hpp"
+
+/// space filling curve reordering: particles close in space are moved close in
+/// memory, so that the passes walking neighbours (tree builds and traversals,
+/// and the update passes that follow them) hit the cache. Particles keep their
+/// identifiers (ids()), outputs and diagnostics should go through them.
+
+namespace nbody::utils {
+
+/// @brief curves particles are sorted along
+///   morton:  bit interleaving, cheap, with jumps between octants
+///   hilbert: consecutive keys are neighbouring cells, better locality
+enum class curve { morton, hilbert };
+
+/// @brief 3D Hilbert key of 21 bits integer coordinates, following the
+/// transposition algorithm of Skilling (AIP Conf. Proc. 707, 2004): the
+/// coordinates are turned into the transposed Hilbert index, whose bits are
+/// then interleaved like a Morton key
+constexpr std::uint64_t hilbert_key(std::uint32_t x, std::uint32_t y,
+                                    std::uint32_t z) {
+    constexpr std::uint32_t bits = physics::Octree<float>::max_depth;
+    std::uint32_t X[3] = {x, y, z};
+    /// inverse undo
+    for (std::uint32_t q = 1u << (bits - 1); q > 1; q >>= 1) {
+        const std::uint32_t p = q - 1;
+        for (auto& xi : X) {
+            if (xi & q) {
+                X[0] ^= p;
+            } else {
+                const std::uint32_t t = (X[0] ^ xi) & p;
+                X[0] ^= t;
+                xi ^= t;
+            }
+        }
+    }
+    /// Gray encode
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    std::uint32_t t = 0;
+    for (std::uint32_t q = 1u << (bits - 1); q > 1; q >>= 1)
+        if (X[2] & q) t ^= q - 1;
+    for (auto& xi : X) xi ^= t;
+    return physics::morton_key(X[0], X[1], X[2]);
+}
+
+namespace detail {
+
+/// keys sorted by each task of the radix sort, enough to amortize its
+/// histogram of 256 buckets
+inline constexpr std::size_t radix_grain = 1 << 14;
+
+/// @brief stable LSD radix sort of keys, values following their key, one pass
+/// per byte. Each pass counts the digits of fixed chunks of keys in parallel,
+/// prefix sums the counts bucket by bucket and chunk by chunk, then every
+/// chunk scatters its keys in parallel to its own slots, so the result does
+/// not depend on the number of threads. Passes whose digit is the same for
+/// every key are skipped (the 63 bits space filling curve keys need 8 passes
+/// at most, fewer for small key ranges)
+inline void radix_sort(std::vector<std::uint64_t>& keys,
+                       std::vector<std::uint32_t>& values) {
+    constexpr unsigned digit_bits = 8;
+    constexpr std::size_t buckets = 1 << digit_bits;
+    const auto n = keys.size();
+    if (n < 2) return;
+
+    const std::size_t chunks = (n + radix_grain - 1) / radix_grain;
+    std::vector<std::array<std::size_t, buckets>> offsets(chunks);
+    std::vector<std::uint64_t> key_buffer(n);
+    std::vector<std::uint32_t> value_buffer(n);
+
+    for (unsigned shift = 0; shift < 64; shift += digit_bits) {
+        auto digit = [shift](std::uint64_t key) {
+            return static_cast<std::size_t>(key >> shift) & (buckets - 1);
+        };
+
+        tbb::parallel_for(
+            tbb::blocked_range<std::size_t>(0, chunks, 1),
+            [&](const tbb::blocked_range<std::size_t>& r) {
+                for (auto c = r.begin(); c != r.end(); ++c) {
+                    auto& count = offsets[c];
+                    count.fill(0);
+                    const auto end = std::min(n, (c + 1) * radix_grain);
+                    for (auto i = c * radix_grain; i < end; ++i)
+                        ++count[digit(keys[i])];
+                }
+            });
+
+        std::size_t sum = 0;
+        bool constant = false;
+        for (std::size_t b = 0; b < buckets; ++b) {
+            const auto bucket_begin = sum;
+            for (auto& count : offsets) {
+                const auto k = count[b];
+                count[b] = sum;
+                sum += k;
+            }
+            constant = constant || sum - bucket_begin == n;
+        }
+        if (constant) continue;
+
+        tbb::parallel_for(
+            tbb::blocked_range<std::size_t>(0, chunks, 1),
+            [&](const tbb::blocked_range<std::size_t>& r) {
+                for (auto c = r.begin(); c != r.end(); ++c) {
+                    auto& slot = offsets[c];
+                    const auto end = std::min(n, (c + 1) * radix_grain);
+                    for (auto i = c * radix_grain; i < end; ++i) {
+                        const auto s = slot[digit(keys[i])]++;
+                        key_buffer[s] = keys[i];
+                        value_buffer[s] = values[i];
+                    }
+                }
+            });
+        keys.swap(key_buffer);
+        values.swap(value_buffer);
+    }
+}
+
+/// @brief moves particle order[k] (and its identifier) to slot k
+template <typename System>
+    requires identified_system<System>
+void permute(System& system, std::span<const std::uint32_t> order) {
+    using T = typename System::value_type;
+    const auto n = system.size();
+    auto first = system.begin();
+    auto ids = system.ids();
+
+    std::vector<Particle<T>> particles(n);
+    std::vector<particle_id> moved_ids(n);
+    tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n),
+                      [&](const tbb::blocked_range<std::size_t>& r) {
+                          for (auto k = r.begin(); k != r.end(); ++k) {
+                              auto&& p = first[order[k]];
+                              particles[k] = {p.qx, p.qy, p.qz, p.vx,
+                                              p.vy, p.vz, p.ax, p.ay,
+                                              p.az, p.m,  p.r};
+                              moved_ids[k] = ids[order[k]];
+                          }
+                      });
+    tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n),
+                      [&](const tbb::blocked_range<std::size_t>& r) {
+                          for (auto k = r.begin(); k != r.end(); ++k) {
+                              auto&& p = first[static_cast<std::ptrdiff_t>(k)];
+                              const auto& q = particles[k];
+                              p.qx = q.qx;
+                              p.qy = q.qy;
+                              p.qz = q.qz;
+                              p.vx = q.vx;
+                              p.vy = q.vy;
+                              p.vz = q.vz;
+                              p.ax = q.ax;
+                              p.ay = q.ay;
+                              p.az = q.az;
+                              p.m = q.m;
+                              p.r = q.r;
+                              ids[k] = moved_ids[k];
+                          }
+                      });
+}
+}  // namespace detail
+
+/// @brief keys of the particles along a space filling curve, positions being
+/// quantized on a 2^21 grid over their bounding cube
+template <typename System>
+    requires particles_system<System>
+std::vector<std::uint64_t> curve_keys(System& system, curve c) {
+    using T = typename System::value_type;
+    const auto n = system.size();
+    auto first = system.begin();
+
+    using bounds = std::array<double, 6>;
+    constexpr double inf = std::numeric_limits<double>::infinity();
+    const auto box = tbb::parallel_reduce(
+        tbb::blocked_range<std::size_t>(0, n), bounds{inf, inf, inf, -inf,
+                                                      -inf, -inf},
+        [&](const tbb::blocked_range<std::size_t>& r, bounds b) {
+            for (auto i = r.begin(); i != r.end(); ++i) {
+                auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                const T q[3] = {p.qx, p.qy, p.qz};
+                for (std::size_t d = 0; d < 3; ++d) {
+                    b[d] = std::min(b[d], double(q[d]));
+                    b[d + 3] = std::max(b[d + 3], double(q[d]));
+                }
+            }
+            return b;
+        },
+        [](bounds a, const bounds& b) {
+            for (std::size_t d = 0; d < 3; ++d) {
+                a[d] = std::min(a[d], b[d]);
+                a[d + 3] = std::max(a[d + 3], b[d + 3]);
+            }
+            return a;
+        });
+
+    constexpr double cells = double(1u << physics::Octree<T>::max_depth);
+    const double extent =
+        std::max({box[3] - box[0], box[4] - box[1], box[5] - box[2]});
+    const double scale = extent > 0.0 ? cells / extent : 0.0;
+    auto quantize = [&](T q, std::size_t d) {
+        return static_cast<std::uint32_t>(
+            std::clamp((double(q) - box[d]) * scale, 0.0, cells - 1.0));
+    };
+
+    std::vector<std::uint64_t> keys(n);
+    tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n),
+                      [&](const tbb::blocked_range<std::size_t>& r) {
+                          for (auto i = r.begin(); i != r.end(); ++i) {
+                              auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                              const auto x = quantize(p.qx, 0);
+                              const auto y = quantize(p.qy, 1);
+                              const auto z = quantize(p.qz, 2);
+                              keys[i] = c == curve::morton
+                                            ? physics::morton_key(x, y, z)
+                                            : hilbert_key(x, y, z);
+                          }
+                      });
+    return keys;
+}
+
+/// @brief sorts the particles of the system along a space filling curve, with
+/// a parallel radix sort. Particles are moved with their identifiers, the
+/// order of equal keys being kept
+/// @return order: slot k now holds the particle that was at order[k]
+template <typename System>
+    requires identified_system<System>
+std::vector<std::uint32_t> reorder(System& system, curve c = curve::hilbert) {
+    auto keys = curve_keys(system, c);
+    std::vector<std::uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), std::uint32_t{0});
+    detail::radix_sort(keys, order);
+    detail::permute(system, order);
+    return order;
+}
+
+/// @brief periodic reordering pass, sorting the system every interval calls
+/// (never with interval 0). Integrators keeping per-particle state outside
+/// the system (hermite, block_leapfrog, adaptive aarseth steps) index it by
+/// slot, they must not be combined with it
+class reorder_pass {
+   public:
+    explicit reorder_pass(unsigned interval = 0, curve c = curve::hilbert)
+        : interval_(interval), curve_(c) {}
+
+    /// @brief counts a step, reorders the system every interval steps
+    /// @return whether the system was reordered
+    template <typename System>
+        requires identified_system<System>
+    bool operator()(System& system) {
+        if (interval_ == 0 || ++steps_ % interval_ != 0) return false;
+        reorder(system, curve_);
+        return true;
+    }
+
+    [[nodiscard]] unsigned interval() const { return interval_; }
+
+   private:
+    unsigned interval_;
+    curve curve_;
+    unsigned long steps_{0};
+};
+}  // namespace nbody::utils
@@ -0,0 +1,322 @@
+#pragma once
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concepts.hpp"
+#include "particles.hpp"
+
+/// trajectory snapshots written in the background: the step loop copies the
+/// state into one of a few reusable buffers and goes on stepping, while a
+/// writer thread hands the filled buffers to a sink (a file of raw frames by
+/// default). When every buffer waits for the sink the step loop blocks until
+/// one is written back, the time it waits being reported in the statistics.
+
+namespace nbody::utils {
+
+/// @brief state of the system at a step, field by field. Buffers are reused
+/// from one snapshot to the next, their storage grows to the largest system
+/// and is never released
+template <Scalar T>
+struct snapshot {
+    static constexpr std::size_t fields = 11;
+
+    std::uint64_t step{0};
+    double time{0.0};
+    std::vector<particle_id> ids;
+    /// the columns of the fields in field order, size() scalars each
+    std::vector<T> data;
+
+    [[nodiscard]] std::size_t size() const { return ids.size(); }
+
+    [[nodiscard]] std::span<T> column(field f) {
+        return {data.data() + static_cast<std::size_t>(f) * size(), size()};
+    }
+    [[nodiscard]] std::span<const T> column(field f) const {
+        return {data.data() + static_cast<std::size_t>(f) * size(), size()};
+    }
+
+    /// @brief copies the particles of the system, in parallel
+    template <typename System>
+        requires identified_system<System>
+    void assign(const System& system, std::uint64_t s, double t) {
+        const auto n = system.size();
+        step = s;
+        time = t;
+        ids.resize(n);
+        data.resize(fields * n);
+        const auto source = system.ids();
+        std::copy(source.begin(), source.end(), ids.begin());
+
+        if constexpr (columnar_system<const System>) {
+            tbb::parallel_for(std::size_t{0}, fields, [&](std::size_t f) {
+                const auto c = system.column(static_cast<field>(f));
+                std::copy(c.begin(), c.end(),
+                          data.begin() + static_cast<std::ptrdiff_t>(f * n));
+            });
+        } else {
+            auto first = system.begin();
+            tbb::parallel_for(
+                tbb::blocked_range<std::size_t>(0, n),
+                [&](const tbb::blocked_range<std::size_t>& r) {
+                    for (auto i = r.begin(); i != r.end(); ++i) {
+                        auto&& p = first[static_cast<std::ptrdiff_t>(i)];
+                        const T values[fields] = {p.qx, p.qy, p.qz, p.vx,
+                                                  p.vy, p.vz, p.ax, p.ay,
+                                                  p.az, p.m,  p.r};
+                        for (std::size_t f = 0; f < fields; ++f)
+                            data[f * n + i] = values[f];
+                    }
+                });
+        }
+    }
+};
+
+/// @brief raw frames: a header (magic, step, time, particles, scalar size),
+/// the identifiers then the columns, in native byte order
+inline constexpr char frame_magic[8] = {'N', 'B', 'O', 'D',
+                                        'Y', 'F', 'R', 'M'};
+
+template <Scalar T>
+void write_frame(std::ostream& out, const snapshot<T>& s) {
+    const std::uint64_t n = s.size();
+    const std::uint32_t scalar_size = sizeof(T);
+    out.write(frame_magic, sizeof(frame_magic));
+    out.write(reinterpret_cast<const char*>(&s.step), sizeof(s.step));
+    out.write(reinterpret_cast<const char*>(&s.time), sizeof(s.time));
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    out.write(reinterpret_cast<const char*>(&scalar_size),
+              sizeof(scalar_size));
+    out.write(reinterpret_cast<const char*>(s.ids.data()),
+              static_cast<std::streamsize>(n * sizeof(particle_id)));
+    out.write(reinterpret_cast<const char*>(s.data.data()),
+              static_cast<std::streamsize>(s.data.size() * sizeof(T)));
+}
+
+/// @brief reads the next raw frame into s
+/// @return false at the end of the stream
+/// @throws std::runtime_error on a malformed frame
+template <Scalar T>
+bool read_frame(std::istream& in, snapshot<T>& s) {
+    char magic[sizeof(frame_magic)];
+    if (!in.read(magic, sizeof(magic))) return false;
+    std::uint64_t n = 0;
+    std::uint32_t scalar_size = 0;
+    in.read(reinterpret_cast<char*>(&s.step), sizeof(s.step));
+    in.read(reinterpret_cast<char*>(&s.time), sizeof(s.time));
+    in.read(reinterpret_cast<char*>(&n), sizeof(n));
+    in.read(reinterpret_cast<char*>(&scalar_size), sizeof(scalar_size));
+    if (!in || std::memcmp(magic, frame_magic, sizeof(magic)) != 0 ||
+        scalar_size != sizeof(T))
+        throw std::runtime_error("snapshot: malformed frame");
+    s.ids.resize(n);
+    s.data.resize(snapshot<T>::fields * n);
+    in.read(reinterpret_cast<char*>(s.ids.data()),
+            static_cast<std::streamsize>(n * sizeof(particle_id)));
+    in.read(reinterpret_cast<char*>(s.data.data()),
+            static_cast<std::streamsize>(s.data.size() * sizeof(T)));
+    if (!in) throw std::runtime_error("snapshot: truncated frame");
+    return true;
+}
+
+/// @brief backpressure of a snapshot_writer
+struct snapshot_stats {
+    /// snapshots handed to the writer, and written by the sink
+    std::size_t submitted{0};
+    std::size_t written{0};
+    /// submissions that found no free buffer, and the time they waited
+    std::size_t stalls{0};
+    double stall_seconds{0.0};
+    /// time spent copying the state, on the stepping thread
+    double copy_seconds{0.0};
+    /// time spent in the sink, on the writer thread
+    double write_seconds{0.0};
+    /// most snapshots waiting for the sink at once
+    std::size_t max_pending{0};
+};
+
+/// @brief background snapshot writer over a pool of buffers: with the default
+/// two, the state is copied into one buffer while the other is written
+/// @tparam T: scalar of the snapshots, the one of the systems submitted
+template <Scalar T>
+class snapshot_writer {
+   public:
+    using sink_type = std::function<void(const snapshot<T>&)>;
+
+    /// @param sink: called on the writer thread, in submission order
+    /// @param buffers: snapshots in flight at most, the step loop blocks
+    /// beyond
+    explicit snapshot_writer(sink_type sink, std::size_t buffers = 2)
+        : sink_(std::move(sink)), pool_(std::max<std::size_t>(buffers, 1)) {
+        for (auto& b : pool_) free_.push_back(&b);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    /// @brief writer appending raw frames to a file (see write_frame)
+    /// @throws std::runtime_error when the file cannot be created
+    explicit snapshot_writer(const std::string& path, std::size_t buffers = 2)
+        : snapshot_writer(file_sink(path), buffers) {}
+
+    snapshot_writer(const snapshot_writer&) = delete;
+    snapshot_writer& operator=(const snapshot_writer&) = delete;
+
+    /// @brief writes the pending snapshots, then stops the writer thread
+    ~snapshot_writer() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        filled_.notify_one();
+        thread_.join();
+    }
+
+    /// @brief copies the state of the system and queues it, waiting for a
+    /// free buffer if the sink is behind. Integrators keeping velocities
+    /// staggered must be synchronized first
+    /// @throws the exception of a failed write
+    template <typename System>
+        requires identified_system<System>
+    void submit(const System& system, std::uint64_t step, double time) {
+        snapshot<T>* buffer = nullptr;
+        {
+            std::unique_lock lock(mutex_);
+            rethrow();
+            if (free_.empty()) {
+                ++stats_.stalls;
+                const auto start = clock::now();
+                released_.wait(lock,
+                               [this] { return !free_.empty() || error_; });
+                stats_.stall_seconds += seconds_since(start);
+                rethrow();
+            }
+            buffer = free_.back();
+            free_.pop_back();
+        }
+
+        const auto start = clock::now();
+        buffer->assign(system, step, time);
+        const double copy = seconds_since(start);
+
+        {
+            std::lock_guard lock(mutex_);
+            stats_.copy_seconds += copy;
+            ++stats_.submitted;
+            pending_.push_back(buffer);
+            stats_.max_pending = std::max(stats_.max_pending, pending_.size());
+        }
+        filled_.notify_one();
+    }
+
+    /// @brief waits until every snapshot submitted is written
+    /// @throws the exception of a failed write
+    void flush() {
+        std::unique_lock lock(mutex_);
+        released_.wait(lock, [this] {
+            return (pending_.empty() && !writing_) || error_;
+        });
+        rethrow();
+    }
+
+    [[nodiscard]] snapshot_stats stats() const {
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
+
+   private:
+    using clock = std::chrono::steady_clock;
+
+    static double seconds_since(clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    static sink_type file_sink(const std::string& path) {
+        auto out = std::make_shared<std::ofstream>(
+            path, std::ios::binary | std::ios::trunc);
+        if (!*out)
+            throw std::runtime_error("snapshot " + path + ": cannot create");
+        return [out, path](const snapshot<T>& s) {
+            write_frame(*out, s);
+            out->flush();
+            if (!*out)
+                throw std::runtime_error("snapshot " + path +
+                                         ": write failed");
+        };
+    }
+
+    /// @brief writer thread: drains the pending snapshots in order, a failed
+    /// write stops it and is reported to the step loop
+    void run() {
+        std::unique_lock lock(mutex_);
+        for (;;) {
+            filled_.wait(lock, [this] { return !pending_.empty() || stop_; });
+            if (pending_.empty()) return;
+            auto* buffer = pending_.front();
+            pending_.pop_front();
+            writing_ = true;
+            lock.unlock();
+
+            const auto start = clock::now();
+            std::exception_ptr error;
+            try {
+                sink_(*buffer);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            const double write = seconds_since(start);
+
+            lock.lock();
+            writing_ = false;
+            stats_.write_seconds += write;
+            free_.push_back(buffer);
+            if (error) {
+                error_ = error;
+                pending_.clear();
+                released_.notify_all();
+                return;
+            }
+            ++stats_.written;
+            released_.notify_all();
+        }
+    }
+
+    /// @brief rethrows the error of the writer thread, mutex_ held
+    void rethrow() const {
+        if (error_) std::rethrow_exception(error_);
+    }
+
+    sink_type sink_;
+    std::deque<snapshot<T>> pool_;
+    std::vector<snapshot<T>*> free_;
+    std::deque<snapshot<T>*> pending_;
+    bool writing_{false};
+    bool stop_{false};
+    std::exception_ptr error_;
+    snapshot_stats stats_;
+
+    mutable std::mutex mutex_;
+    /// signals pending snapshots to the writer thread
+    std::condition_variable filled_;
+    /// signals written snapshots to the step loop
+    std::condition_variable released_;
+    std::thread thread_;
+};
+}  // namespace nbody::utils
@@ -0,0 +1,585 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "concepts.hpp"
+#include "particles.hpp"
+#include "utils/snapshot.hpp"
+
+/// compressed snapshots: every frame stores a selection of fields. Positions
+/// and velocities are quantized on a grid whose step is a fraction of the
+/// extent of their bounding box, bounding the error; the other fields are
+/// kept bit for bit. Keyframes predict every particle from the previous one
+/// (neighbours in memory after a space filling curve sort, see reorder.hpp),
+/// the frames in between store the difference with the last keyframe, so
+/// that any frame is rebuilt from two. The residuals are written as zigzag
+/// varints, then entropy coded with an adaptive binary range coder, one model
+/// per field.
+
+namespace nbody::utils {
+
+/// @brief set of fields, bit f for field f
+using field_mask = std::uint32_t;
+
+constexpr field_mask mask_of(std::initializer_list<field> fields) {
+    field_mask mask = 0;
+    for (auto f : fields) mask |= field_mask{1} << static_cast<unsigned>(f);
+    return mask;
+}
+
+inline constexpr field_mask positions =
+    mask_of({field::qx, field::qy, field::qz});
+inline constexpr field_mask velocities =
+    mask_of({field::vx, field::vy, field::vz});
+inline constexpr field_mask all_fields = (field_mask{1} << 11) - 1;
+
+/// @brief what a compressed snapshot stores
+struct snapshot_codec_options {
+    /// fields written, the others are read back as zeros
+    field_mask fields = positions | velocities | mask_of({field::m});
+    /// quantization errors, relative to the extent of the bounding box of
+    /// the positions and of the velocities
+    double position_error = 1e-6;
+    double velocity_error = 1e-6;
+    /// frames from one keyframe to the next, 1 for keyframes only
+    unsigned keyframe_interval = 10;
+};
+
+namespace detail {
+
+/// @brief adaptive binary range coder (the one of LZMA): probabilities of 11
+/// bits, updated by 1/32 of the distance to the coded bit
+struct range_encoder {
+    std::vector<std::uint8_t>& out;
+    std::uint64_t low{0};
+    std::uint32_t range{0xFFFFFFFF};
+    std::uint8_t cache{0};
+    std::uint64_t cache_size{1};
+
+    void encode(std::uint16_t& p, unsigned bit) {
+        const std::uint32_t bound = (range >> 11) * p;
+        if (bit == 0) {
+            range = bound;
+            p = static_cast<std::uint16_t>(p + ((2048 - p) >> 5));
+        } else {
+            low += bound;
+            range -= bound;
+            p -= p >> 5;
+        }
+        while (range < (1u << 24)) {
+            range <<= 8;
+            shift_low();
+        }
+    }
+
+    void shift_low() {
+        if (static_cast<std::uint32_t>(low) < 0xFF000000u || (low >> 32) != 0) {
+            const auto carry = static_cast<std::uint8_t>(low >> 32);
+            auto byte = cache;
+            do {
+                out.push_back(static_cast<std::uint8_t>(byte + carry));
+                byte = 0xFF;
+            } while (--cache_size != 0);
+            cache = static_cast<std::uint8_t>(low >> 24);
+        }
+        ++cache_size;
+        low = (low & 0x00FFFFFF) << 8;
+    }
+
+    void finish() {
+        for (int i = 0; i < 5; ++i) shift_low();
+    }
+};
+
+struct range_decoder {
+    const std::uint8_t* next;
+    const std::uint8_t* end;
+    std::uint32_t range{0xFFFFFFFF};
+    std::uint32_t code{0};
+
+    range_decoder(const std::uint8_t* first, const std::uint8_t* last)
+        : next(first), end(last) {
+        for (int i = 0; i < 5; ++i) code = (code << 8) | byte();
+    }
+
+    std::uint8_t byte() { return next < end ? *next++ : 0; }
+
+    unsigned decode(std::uint16_t& p) {
+        const std::uint32_t bound = (range >> 11) * p;
+        unsigned bit;
+        if (code < bound) {
+            range = bound;
+            p = static_cast<std::uint16_t>(p + ((2048 - p) >> 5));
+            bit = 0;
+        } else {
+            code -= bound;
+            range -= bound;
+            p -= p >> 5;
+            bit = 1;
+        }
+        while (range < (1u << 24)) {
+            range <<= 8;
+            code = (code << 8) | byte();
+        }
+        return bit;
+    }
+};
+
+/// @brief order 0 model of bytes: a binary tree of the 8 bits, most
+/// significant first
+struct byte_model {
+    std::array<std::uint16_t, 256> p;
+    byte_model() { p.fill(1024); }
+
+    void encode(range_encoder& rc, std::uint8_t byte) {
+        unsigned node = 1;
+        for (int b = 7; b >= 0; --b) {
+            const unsigned bit = (byte >> b) & 1u;
+            rc.encode(p[node], bit);
+            node = 2 * node + bit;
+        }
+    }
+
+    std::uint8_t decode(range_decoder& rc) {
+        unsigned node = 1;
+        while (node < 256) node = 2 * node + rc.decode(p[node]);
+        return static_cast<std::uint8_t>(node - 256);
+    }
+};
+
+inline std::vector<std::uint8_t> compress(const std::vector<std::uint8_t>& in) {
+    std::vector<std::uint8_t> out;
+    out.reserve(in.size() / 2 + 16);
+    range_encoder rc{out};
+    byte_model model;
+    for (auto byte : in) model.encode(rc, byte);
+    rc.finish();
+    return out;
+}
+
+inline std::vector<std::uint8_t> decompress(const std::uint8_t* data,
+                                            std::size_t bytes,
+                                            std::size_t size) {
+    std::vector<std::uint8_t> out(size);
+    range_decoder rc(data, data + bytes);
+    byte_model model;
+    for (auto& byte : out) byte = model.decode(rc);
+    return out;
+}
+
+inline std::uint64_t zigzag(std::int64_t v) {
+    return (static_cast<std::uint64_t>(v) << 1) ^
+           static_cast<std::uint64_t>(v >> 63);
+}
+inline std::int64_t unzigzag(std::uint64_t u) {
+    return static_cast<std::int64_t>(u >> 1) ^
+           -static_cast<std::int64_t>(u & 1);
+}
+
+inline void put_varint(std::vector<std::uint8_t>& out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(v));
+}
+
+/// @brief cursor over a buffer, reads past its end throwing
+struct byte_reader {
+    const std::uint8_t* next;
+    const std::uint8_t* end;
+
+    void check(std::size_t bytes) const {
+        if (static_cast<std::size_t>(end - next) < bytes)
+            throw std::runtime_error("snapshot: truncated frame");
+    }
+
+    std::uint64_t varint() {
+        std::uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            check(1);
+            const auto byte = *next++;
+            v |= std::uint64_t(byte & 0x7F) << shift;
+            if (byte < 0x80) return v;
+        }
+        throw std::runtime_error("snapshot: malformed varint");
+    }
+
+    template <typename U>
+    U raw() {
+        check(sizeof(U));
+        U v;
+        std::memcpy(&v, next, sizeof(U));
+        next += sizeof(U);
+        return v;
+    }
+};
+
+template <typename U>
+void put_raw(std::vector<std::uint8_t>& out, const U& v) {
+    const auto* p = reinterpret_cast<const std::uint8_t*>(&v);
+    out.insert(out.end(), p, p + sizeof(U));
+}
+
+/// @brief varint stream of a field entropy coded: raw and coded lengths,
+/// then the coded bytes
+inline void put_block(std::vector<std::uint8_t>& out,
+                      const std::vector<std::uint8_t>& varints) {
+    const auto coded = compress(varints);
+    put_raw(out, std::uint64_t(varints.size()));
+    put_raw(out, std::uint64_t(coded.size()));
+    out.insert(out.end(), coded.begin(), coded.end());
+}
+
+inline std::vector<std::uint8_t> get_block(byte_reader& in) {
+    const auto size = in.raw<std::uint64_t>();
+    const auto bytes = in.raw<std::uint64_t>();
+    in.check(bytes);
+    auto varints = decompress(in.next, bytes, size);
+    in.next += bytes;
+    return varints;
+}
+
+inline constexpr char codec_magic[8] = {'N', 'B', 'O', 'D',
+                                        'Y', 'C', 'M', 'P'};
+inline constexpr std::uint32_t codec_version = 1;
+
+/// @brief header of a compressed frame, followed by payload bytes: the
+/// identifiers of a keyframe, then for every field of the mask its grid
+/// (quantized fields) and its block
+struct codec_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t scalar_size;
+    std::uint64_t step;
+    double time;
+    std::uint64_t size;
+    std::uint32_t fields;
+    std::uint32_t keyframe;
+    std::uint64_t payload;
+};
+
+/// @brief positions and velocities are quantized, other fields kept exactly
+constexpr bool quantized(std::size_t f) { return f < 6; }
+
+/// @brief last keyframe, the reference of the frames that follow it: the
+/// identifiers, the grids and the integers of every field (grid indices of
+/// quantized fields, bits of the others)
+struct keyframe_state {
+    bool valid{false};
+    field_mask fields{0};
+    std::vector<particle_id> ids;
+    std::array<double, 11> origin{};
+    std::array<double, 11> step{};
+    std::array<std::vector<std::int64_t>, 11> values;
+};
+
+template <Scalar T>
+using bits_t = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+}  // namespace detail
+
+/// @brief encoder of compressed frames, keeping the last keyframe. A frame is
+/// a keyframe every keyframe_interval frames, and whenever the particles or
+/// their order differ from the last keyframe (e.g. after a reorder pass)
+/// @tparam T: scalar of the snapshots
+template <Scalar T>
+class snapshot_encoder {
+   public:
+    /// @throws std::invalid_argument on non positive errors
+    explicit snapshot_encoder(snapshot_codec_options options = {})
+        : options_(options) {
+        if (!(options_.position_error > 0.0) ||
+            !(options_.velocity_error > 0.0))
+            throw std::invalid_argument(
+                "snapshot errors must be strictly positive");
+        options_.fields &= all_fields;
+        options_.keyframe_interval = std::max(options_.keyframe_interval, 1u);
+    }
+
+    /// @brief appends the frame of s to out
+    void encode(const snapshot<T>& s, std::ostream& out) {
+        using bits = detail::bits_t<T>;
+        const auto n = s.size();
+        auto& key = key_;
+        const bool keyframe = frames_ % options_.keyframe_interval == 0 ||
+                              !key.valid || key.fields != options_.fields ||
+                              key.ids != s.ids;
+        ++frames_;
+
+        std::vector<std::uint8_t> payload;
+        std::vector<std::uint8_t> varints;
+        if (keyframe) {
+            key.valid = true;
+            key.fields = options_.fields;
+            key.ids = s.ids;
+            particle_id previous = 0;
+            for (auto id : s.ids) {
+                detail::put_varint(varints,
+                                   detail::zigzag(std::int64_t(id) - previous));
+                previous = id;
+            }
+            detail::put_block(payload, varints);
+            grids(s);
+        }
+
+        for (std::size_t f = 0; f < snapshot<T>::fields; ++f) {
+            if (!(options_.fields >> f & 1u)) continue;
+            const auto c = s.column(static_cast<field>(f));
+            auto& ref = key.values[f];
+            if (keyframe) ref.resize(n);
+            varints.clear();
+
+            if (detail::quantized(f)) {
+                const double origin = key.origin[f], step = key.step[f];
+                detail::put_raw(payload, origin);
+                detail::put_raw(payload, step);
+                std::int64_t previous = 0;
+                for (std::size_t i = 0; i < n; ++i) {
+                    const auto q = static_cast<std::int64_t>(
+                        std::llround((double(c[i]) - origin) / step));
+                    const auto base = keyframe ? previous : ref[i];
+                    detail::put_varint(varints, detail::zigzag(q - base));
+                    if (keyframe) ref[i] = previous = q;
+                }
+            } else {
+                bits previous = 0;
+                for (std::size_t i = 0; i < n; ++i) {
+                    const auto b = std::bit_cast<bits>(c[i]);
+                    const auto base =
+                        keyframe ? previous : static_cast<bits>(ref[i]);
+                    detail::put_varint(varints, b ^ base);
+                    if (keyframe) {
+                        ref[i] = static_cast<std::int64_t>(b);
+                        previous = b;
+                    }
+                }
+            }
+            detail::put_block(payload, varints);
+        }
+
+        detail::codec_header h{};
+        std::memcpy(h.magic, detail::codec_magic, sizeof(h.magic));
+        h.version = detail::codec_version;
+        h.scalar_size = sizeof(T);
+        h.step = s.step;
+        h.time = s.time;
+        h.size = n;
+        h.fields = options_.fields;
+        h.keyframe = keyframe;
+        h.payload = payload.size();
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(payload.data()),
+                  static_cast<std::streamsize>(payload.size()));
+    }
+
+    [[nodiscard]] const snapshot_codec_options& options() const {
+        return options_;
+    }
+
+   private:
+    /// @brief grids of the quantized fields over the bounding box of the
+    /// frame: the cube of the largest extent of each group of three fields,
+    /// the step being twice the error allowed
+    void grids(const snapshot<T>& s) {
+        for (std::size_t group = 0; group < 6; group += 3) {
+            const double error = group == 0 ? options_.position_error
+                                            : options_.velocity_error;
+            double extent = 0.0;
+            for (auto f = group; f < group + 3; ++f) {
+                const auto c = s.column(static_cast<field>(f));
+                const auto [lo, hi] = std::minmax_element(c.begin(), c.end());
+                key_.origin[f] = lo == c.end() ? 0.0 : double(*lo);
+                if (lo != c.end())
+                    extent = std::max(extent, double(*hi) - double(*lo));
+            }
+            for (auto f = group; f < group + 3; ++f)
+                key_.step[f] = extent > 0.0 ? 2.0 * error * extent : 1.0;
+        }
+    }
+
+    snapshot_codec_options options_;
+    detail::keyframe_state key_;
+    std::size_t frames_{0};
+};
+
+/// @brief reader of a file of compressed frames, indexing them when opened:
+/// any frame is rebuilt from its keyframe, sequential reads decoding every
+/// keyframe once
+/// @tparam T: scalar the frames are read as
+template <Scalar T>
+class snapshot_reader {
+   public:
+    /// @throws std::runtime_error when the file cannot be read
+    explicit snapshot_reader(const std::string& path)
+        : in_(path, std::ios::binary) {
+        if (!in_)
+            throw std::runtime_error("snapshot " + path + ": cannot open");
+        detail::codec_header h;
+        std::uint64_t offset = 0;
+        while (in_.read(reinterpret_cast<char*>(&h), sizeof(h))) {
+            if (std::memcmp(h.magic, detail::codec_magic, sizeof(h.magic)) !=
+                    0 ||
+                h.version != detail::codec_version)
+                throw std::runtime_error("snapshot " + path +
+                                         ": not a compressed snapshot");
+            if (!h.keyframe && index_.empty())
+                throw std::runtime_error("snapshot " + path +
+                                         ": no leading keyframe");
+            index_.push_back({offset, h.keyframe
+                                          ? index_.size()
+                                          : index_.back().keyframe});
+            offset += sizeof(h) + h.payload;
+            in_.seekg(static_cast<std::streamoff>(offset));
+        }
+        in_.clear();
+    }
+
+    [[nodiscard]] std::size_t frames() const { return index_.size(); }
+
+    /// @brief rebuilds frame k into s, fields not stored being zeros
+    /// @throws std::runtime_error on a corrupted frame
+    void read(std::size_t k, snapshot<T>& s) {
+        if (k >= index_.size())
+            throw std::out_of_range("snapshot: no frame " + std::to_string(k));
+        const auto key = index_[k].keyframe;
+        if (loaded_ != key) {
+            loaded_ = static_cast<std::size_t>(-1);
+            key_header_ = decode(key, key_.values);
+            loaded_ = key;
+        }
+        if (k == key) return output(key_header_, key_.values, s);
+        const auto h = decode(k, values_);
+        output(h, values_, s);
+    }
+
+   private:
+    struct entry {
+        std::uint64_t offset;
+        std::size_t keyframe;
+    };
+    using columns = std::array<std::vector<std::int64_t>, 11>;
+
+    /// @brief integers of the fields of frame k: a keyframe is decoded into
+    /// the state (with its identifiers and grids), a frame in between against
+    /// it
+    detail::codec_header decode(std::size_t k, columns& values) {
+        detail::codec_header h;
+        in_.seekg(static_cast<std::streamoff>(index_[k].offset));
+        in_.read(reinterpret_cast<char*>(&h), sizeof(h));
+        std::vector<std::uint8_t> payload(h.payload);
+        in_.read(reinterpret_cast<char*>(payload.data()),
+                 static_cast<std::streamsize>(payload.size()));
+        if (!in_) throw std::runtime_error("snapshot: truncated frame");
+
+        detail::byte_reader r{payload.data(), payload.data() + payload.size()};
+        const auto n = h.size;
+        if (h.keyframe) {
+            const auto varints = detail::get_block(r);
+            detail::byte_reader v{varints.data(),
+                                  varints.data() + varints.size()};
+            key_.ids.resize(n);
+            std::int64_t previous = 0;
+            for (auto& id : key_.ids) {
+                previous += detail::unzigzag(v.varint());
+                id = static_cast<particle_id>(previous);
+            }
+            key_.fields = h.fields;
+        } else if (h.fields != key_.fields || n != key_.ids.size()) {
+            throw std::runtime_error("snapshot: frame does not match its key");
+        }
+
+        for (std::size_t f = 0; f < snapshot<T>::fields; ++f) {
+            if (!(h.fields >> f & 1u)) continue;
+            if (detail::quantized(f)) {
+                const auto origin = r.raw<double>();
+                const auto step = r.raw<double>();
+                if (h.keyframe) {
+                    key_.origin[f] = origin;
+                    key_.step[f] = step;
+                }
+            }
+            const auto varints = detail::get_block(r);
+            detail::byte_reader v{varints.data(),
+                                  varints.data() + varints.size()};
+            const auto& ref = key_.values[f];
+            auto& out = values[f];
+            out.resize(n);
+            std::int64_t previous = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto u = v.varint();
+                const auto base = h.keyframe ? previous : ref[i];
+                out[i] = detail::quantized(f)
+                             ? base + detail::unzigzag(u)
+                             : static_cast<std::int64_t>(
+                                   u ^ static_cast<std::uint64_t>(base));
+                previous = out[i];
+            }
+        }
+        return h;
+    }
+
+    /// @brief frame of the integers of its fields, quantized fields on the
+    /// grid of the keyframe, the others from their bits at the precision of
+    /// the file
+    void output(const detail::codec_header& h, const columns& values,
+                snapshot<T>& s) const {
+        const auto n = h.size;
+        s.step = h.step;
+        s.time = h.time;
+        s.ids = key_.ids;
+        s.data.assign(snapshot<T>::fields * n, T{0});
+        for (std::size_t f = 0; f < snapshot<T>::fields; ++f) {
+            if (!(h.fields >> f & 1u)) continue;
+            const auto& v = values[f];
+            auto c = s.column(static_cast<field>(f));
+            for (std::size_t i = 0; i < n; ++i) {
+                if (detail::quantized(f))
+                    c[i] = T(key_.origin[f] + double(v[i]) * key_.step[f]);
+                else if (h.scalar_size == sizeof(float))
+                    c[i] = T(std::bit_cast<float>(std::uint32_t(v[i])));
+                else
+                    c[i] = T(std::bit_cast<double>(std::uint64_t(v[i])));
+            }
+        }
+    }
+
+    std::ifstream in_;
+    std::vector<entry> index_;
+    detail::keyframe_state key_;
+    detail::codec_header key_header_{};
+    columns values_;
+    std::size_t loaded_{static_cast<std::size_t>(-1)};
+};
+
+/// @brief snapshot_writer sink encoding frames to a file, on the writer
+/// thread
+/// @throws std::runtime_error when the file cannot be created
+template <Scalar T>
+typename snapshot_writer<T>::sink_type compressed_sink(
+    const std::string& path, snapshot_codec_options options = {}) {
+    auto out = std::make_shared<std::ofstream>(
+        path, std::ios::binary | std::ios::trunc);
+    if (!*out) throw std::runtime_error("snapshot " + path + ": cannot create");
+    auto encoder = std::make_shared<snapshot_encoder<T>>(options);
+    return [out, encoder, path](const snapshot<T>& s) {
+        encoder->encode(s, *out);
+        out->flush();
+        if (!*out)
+            throw std::runtime_error("snapshot " + path + ": write failed");
+    };
+}
+}  // namespace nbody::utils
@@ -0,0 +1,145 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "detail/dispatch.hpp"
+#include "registry.hpp"
+#include "utils/affinity.hpp"
+#include "utils/ensemble.hpp"
+
+/// ensemble runner: every simulation of a configuration file (see
+/// utils/ensemble.hpp for its format) runs as a task of a shared TBB pool,
+/// results being appended to a JSON lines file as the runs end.
+
+// default values
+std::string ConfigPath;
+std::string Output = "nbody_ensemble.jsonl";
+int Threads = 0;
+std::string PinTag = "none";
+bool Verbose = false;
+
+void print_usage(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " --config <file> [options]\n"
+        << "Options:\n"
+        << "  --config <file>   runs, one per line of key=value pairs: name, "
+           "n, steps,\n"
+        << "                    dt, integrator, container, layout, "
+           "precision, seed,\n"
+        << "                    repeat\n"
+        << "  -o <file>         JSON lines output, one line per run (default: "
+        << Output << ")\n"
+        << "  --threads <n>     threads of the pool, 0 for all the hardware "
+           "threads\n"
+        << "                    (default: " << Threads << ")\n"
+        << "  --pin <pinning>   pins the threads: none, compact, spread "
+           "(default: "
+        << PinTag << ")\n"
+        << "  -v                prints every run as it ends\n"
+        << "  -h                display this help\n";
+}
+
+void parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc)
+            ConfigPath = argv[++i];
+        else if (arg == "-o" && i + 1 < argc)
+            Output = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            Threads = std::stoi(argv[++i]);
+        else if (arg == "--pin" && i + 1 < argc)
+            PinTag = argv[++i];
+        else if (arg == "-v")
+            Verbose = true;
+        else if (arg == "-h") {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            std::cout << "Unknown argument: " << arg << "\n";
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+}
+
+/// @brief simulate instantiated for the container, layout and precision of a
+/// run, the system of the registry being picked once
+nbody::utils::run_result simulate_run(const nbody::utils::run_config& c) {
+    return std::visit(
+        [&]<typename Entry>(Entry) {
+            return nbody::utils::simulate<typename Entry::type>(c);
+        },
+        nbody::registry::find_system(c.container, c.layout, c.precision));
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+    if (ConfigPath.empty()) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    if (Threads < 0) {
+        std::cout << "Expected a thread count >= 0: " << Threads << "\n";
+        return -1;
+    }
+
+    std::vector<nbody::utils::run_config> configs;
+    nbody::utils::pinning pin;
+    try {
+        configs = nbody::utils::read_ensemble(ConfigPath);
+        pin = nbody::utils::parse_pinning(PinTag);
+    } catch (const std::exception& e) {
+        std::cout << e.what() << "\n";
+        return -1;
+    }
+    std::ofstream out(Output);
+    if (!out) {
+        std::cout << "cannot write " << Output << "\n";
+        return -1;
+    }
+
+    nbody::utils::pinned_arena arena(
+        Threads == 0 ? tbb::task_arena::automatic : Threads, pin);
+    std::cout << "N-Body ensemble:\n"
+              << "----------------\n"
+              << "  -> runs                   : " << configs.size() << " ("
+              << ConfigPath << ")\n"
+              << "  -> threads                : " << arena.max_concurrency()
+              << " (pinning " << PinTag << ")\n"
+              << "  -> SIMD dispatch          : "
+              << nbody::detail::isa_name(nbody::detail::active_isa()) << "\n"
+              << "  -> output                 : " << Output << "\n\n";
+
+    /// lines are flushed as the runs end, a killed sweep keeps its results
+    const auto stats = arena.execute([&] {
+        return nbody::utils::run_ensemble(
+            std::span<const nbody::utils::run_config>(configs), simulate_run,
+            [&](const nbody::utils::run_result& r) {
+                const auto line = nbody::utils::to_json(r);
+                out << line << std::endl;
+                if (Verbose || !r.error.empty()) std::cout << line << "\n";
+            });
+    });
+
+    const double busy = stats.seconds > 0.0
+                             ? stats.busy_seconds /
+                                   (stats.seconds * arena.max_concurrency())
+                             : 0.0;
+    std::cout << "Ensemble ended.\n\n"
+              << "Runs:  " << stats.runs - stats.failed << " ("
+              << stats.failed << " failed)\n"
+              << "Wall time:  " << stats.seconds << " s\n"
+              << "Runs/s:  "
+              << (stats.seconds > 0.0 ? double(stats.runs) / stats.seconds
+                                      : 0.0)
+              << "\n"
+              << "Thread occupancy:  " << std::fixed << std::setprecision(1)
+              << busy * 100.0 << "%\n"
+              << "Results written to " << Output << "\n";
+    return stats.failed == 0 ? 0 : -1;
+}
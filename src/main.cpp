@@ -1,13 +1,29 @@
+#include <algorithm>
 #include <chrono>
-#include <functional>
 #include <iostream>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <variant>
 #include <vector>
 
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
+#include "detail/memory.hpp"
+#include "integrators/adaptive.hpp"
 #include "integrators/integrators.hpp"
 #include "nbody.hpp"
 #include "particles.hpp"
+#include "registry.hpp"
+#include "utils/affinity.hpp"
+#include "utils/checkpoint.hpp"
 #include "utils/init_galaxy.hpp"
+#include "utils/profiler.hpp"
+#include "utils/reorder.hpp"
+#include "utils/snapshot.hpp"
+#include "utils/snapshot_codec.hpp"
 
 // default values
 std::size_t NParticles = 1000;
@@ -16,6 +32,31 @@ float Dt = 0.01f;
 std::string IntegratorTag = "leapfrog";
 std::string LayoutTag = "SoA";
 std::string ContainerTag = "vector";
+std::string SolverTag = "direct";
+std::string PrecisionTag = "single";
+std::string TimestepTag = "fixed";
+double Eta = 0.02;
+float Theta = 0.5f;
+unsigned Order = 4;
+unsigned ReorderEvery = 0;
+std::string CurveTag = "hilbert";
+unsigned long CheckpointEvery = 0;
+std::string CheckpointPath = "nbody.ckpt";
+std::string RestartPath;
+/// flags of the command line, which a restart must not contradict
+std::set<std::string> GivenFlags;
+unsigned long SnapshotEvery = 0;
+std::string SnapshotPath = "nbody.snap";
+std::string SnapshotFormat = "raw";
+double SnapshotError = 1e-6;
+std::string TracePath = "nbody_trace.json";
+std::string FirstTouchTag = "on";
+std::string HugePagesTag = "off";
+std::string PinTag = "none";
+int Threads = 0;
+std::size_t Grain = 0;
+std::string PartitionerTag = "auto";
+std::string RangeTag = "auto";
 bool Verbose = false;
 
 void print_usage(const char* prog) {
@@ -27,19 +68,110 @@ void print_usage(const char* prog) {
         << "  -i  <nIter>       number of iterations (default: " << NIterations
         << ")\n"
         << "  -dt <timestep>    timestep (default: " << Dt << ")\n"
-        << "  -im <integrator>  integrator: euler, verlet, leapfrog (default: "
+        << "  -im <integrator>  integrator: euler, verlet, leapfrog, "
+           "leapfrog-kdk,\n"
+        << "                    yoshida4, yoshida6, hermite, block (default: "
         << IntegratorTag << ")\n"
-        << "  -l  <layout>      layout: SoA, AoS (default: " << LayoutTag
+        << "  -l  <layout>      layout: SoA, AoS, AoSoA (default: "
+        << LayoutTag << ")\n"
+        << "  -c  <container>   container: vector, aligned (default: "
+        << ContainerTag << ")\n"
+        << "  -fs <solver>      force solver: direct, symmetric, barnes-hut, "
+           "fmm (default: "
+        << SolverTag << ")\n"
+        << "  -p  <precision>   precision: single, double, mixed, compensated "
+           "(default: "
+        << PrecisionTag << ")\n"
+        << "  -ts <timestep>    timestep: fixed, acceleration, aarseth; "
+           "adaptive steps\n"
+        << "                    cover nIter * dt, of at most dt (default: "
+        << TimestepTag << ")\n"
+        << "  -eta <eta>        accuracy of the adaptive timestep (default: "
+        << Eta << ")\n"
+        << "  -th <theta>       tree opening angle (default: " << Theta
         << ")\n"
-        << "  -c  <container>   container: vector (default: " << ContainerTag
+        << "  -po <order>       fmm expansion order (default: " << Order
+        << ")\n"
+        << "  -ro <interval>    sorts particles along a space filling curve "
+           "every\n"
+        << "                    interval steps, 0 never (default: "
+        << ReorderEvery << ")\n"
+        << "  -sfc <curve>      reordering curve: morton, hilbert (default: "
+        << CurveTag << ")\n"
+        << "  --checkpoint-every <steps>  writes a checkpoint every steps "
+           "steps, 0 never\n"
+        << "                    (default: "
+        << CheckpointEvery << ")\n"
+        << "  --checkpoint <path>  checkpoint file (default: " << CheckpointPath
+        << ")\n"
+        << "  --restart <path>  resumes the run of a checkpoint, with its "
+           "integrator,\n"
+        << "                    precision, solver, timestep, container and "
+           "layout;\n"
+        << "                    -c and -l may change the storage, -c aligned "
+           "-l SoA\n"
+        << "                    steps the mapped file in place; -i counts "
+           "from its start\n"
+        << "  --snapshot-every <steps>  writes a snapshot every steps steps "
+           "in the\n"
+        << "                    background, 0 never (default: "
+        << SnapshotEvery << ")\n"
+        << "  --snapshot <path>  snapshot file (default: " << SnapshotPath
+        << ")\n"
+        << "  --snapshot-format <format>  raw, or compressed: positions, "
+           "velocities\n"
+        << "                    and masses, quantized and delta encoded "
+           "(default: "
+        << SnapshotFormat << ")\n"
+        << "  --snapshot-error <error>  quantization error of compressed "
+           "snapshots,\n"
+        << "                    relative to the bounding box (default: "
+        << SnapshotError << ")\n"
+#ifdef NBODY_PROFILE
+        << "  --trace <path>    timeline of the passes, Chrome trace format "
+           "(default: "
+        << TracePath << ")\n"
+#endif
+        << "  --first-touch <on|off>  zero the particle arenas in parallel, "
+           "pages\n"
+        << "                    landing on the node of the threads using them "
+           "(default: "
+        << FirstTouchTag << ")\n"
+        << "  --huge-pages <on|off>  back large particle arenas with "
+           "transparent huge\n"
+        << "                    pages (default: " << HugePagesTag << ")\n"
+        << "  --pin <pinning>   pins the threads: none, compact (socket by "
+           "socket),\n"
+        << "                    spread (alternating sockets) (default: "
+        << PinTag << ")\n"
+        << "  --threads <n>     threads of the parallel passes, 0 for all the "
+           "hardware\n"
+        << "                    threads (default: " << Threads << ")\n"
+        << "  --grain <n>       particles per task of the parallel passes, 0 "
+           "for the\n"
+        << "                    default of every pass (default: " << Grain
+        << ")\n"
+        << "  --partitioner <partitioner>  auto, affinity (replays the "
+           "chunks of the\n"
+        << "                    previous step) or static (default: "
+        << PartitionerTag << ")\n"
+        << "  --range <range>   splitting of the direct force pass: 1d "
+           "(sinks), 2d\n"
+        << "                    (sinks and sources) or auto, 2d when the "
+           "sinks are too\n"
+        << "                    few for the threads (default: " << RangeTag
         << ")\n"
         << "  -v                verbose mode\n"
-        << "  -h                display this help\n";
+        << "  -h                display this help\n"
+        << "Environment:\n"
+        << "  NBODY_ISA=<isa>   caps the SIMD instruction set: scalar, sse, "
+           "avx2, avx512\n";
 }
 
 void parse_args(int argc, char** argv) {
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
+        GivenFlags.insert(arg);
         if (arg == "-n" && i + 1 < argc)
             NParticles = std::stoul(argv[++i]);
         else if (arg == "-i" && i + 1 < argc)
@@ -52,6 +184,54 @@ void parse_args(int argc, char** argv) {
             LayoutTag = argv[++i];
         else if (arg == "-c" && i + 1 < argc)
             ContainerTag = argv[++i];
+        else if (arg == "-fs" && i + 1 < argc)
+            SolverTag = argv[++i];
+        else if (arg == "-p" && i + 1 < argc)
+            PrecisionTag = argv[++i];
+        else if (arg == "-ts" && i + 1 < argc)
+            TimestepTag = argv[++i];
+        else if (arg == "-eta" && i + 1 < argc)
+            Eta = std::stod(argv[++i]);
+        else if (arg == "-th" && i + 1 < argc)
+            Theta = std::stof(argv[++i]);
+        else if (arg == "-po" && i + 1 < argc)
+            Order = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "-ro" && i + 1 < argc)
+            ReorderEvery = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "-sfc" && i + 1 < argc)
+            CurveTag = argv[++i];
+        else if (arg == "--checkpoint-every" && i + 1 < argc)
+            CheckpointEvery = std::stoul(argv[++i]);
+        else if (arg == "--checkpoint" && i + 1 < argc)
+            CheckpointPath = argv[++i];
+        else if (arg == "--restart" && i + 1 < argc)
+            RestartPath = argv[++i];
+        else if (arg == "--snapshot-every" && i + 1 < argc)
+            SnapshotEvery = std::stoul(argv[++i]);
+        else if (arg == "--snapshot" && i + 1 < argc)
+            SnapshotPath = argv[++i];
+        else if (arg == "--snapshot-format" && i + 1 < argc)
+            SnapshotFormat = argv[++i];
+        else if (arg == "--snapshot-error" && i + 1 < argc)
+            SnapshotError = std::stod(argv[++i]);
+#ifdef NBODY_PROFILE
+        else if (arg == "--trace" && i + 1 < argc)
+            TracePath = argv[++i];
+#endif
+        else if (arg == "--first-touch" && i + 1 < argc)
+            FirstTouchTag = argv[++i];
+        else if (arg == "--huge-pages" && i + 1 < argc)
+            HugePagesTag = argv[++i];
+        else if (arg == "--pin" && i + 1 < argc)
+            PinTag = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            Threads = std::stoi(argv[++i]);
+        else if (arg == "--grain" && i + 1 < argc)
+            Grain = std::stoul(argv[++i]);
+        else if (arg == "--partitioner" && i + 1 < argc)
+            PartitionerTag = argv[++i];
+        else if (arg == "--range" && i + 1 < argc)
+            RangeTag = argv[++i];
         else if (arg == "-v")
             Verbose = true;
         else if (arg == "-h") {
@@ -65,56 +245,143 @@ void parse_args(int argc, char** argv) {
     }
 }
 
-template <template <typename...> typename Container, typename Layout>
-void run_simulation() {
-    using System = nbody::System<Container, float, Layout>;
-    using Integrator = std::function<void(System&, float)>;
+/// @brief integrator of the registry followed by the reordering pass of the
+/// command line, a no-op when -ro is 0
+template <typename Integrator>
+struct reordering {
+    Integrator step;
+    nbody::utils::reorder_pass pass;
 
-    System system;
-    nbody::utils::init_galaxy(system, NParticles, 42);
-
-    Integrator integrator;
-    if (IntegratorTag == "euler")
-        integrator = [](auto& s, float dt) {
-            nbody::integrators::euler(s, dt);
-        };
-    else if (IntegratorTag == "verlet")
-        integrator = [](auto& s, float dt) {
-            nbody::integrators::verlet(s, dt);
-        };
-    else if (IntegratorTag == "leapfrog")
-        integrator = [](auto& s, float dt) {
-            nbody::integrators::leapfrog(s, dt);
-        };
-    else {
-        std::cout << "Unknown integrator: " << IntegratorTag << "\n";
-        exit(-1);
+    template <typename System>
+    void operator()(System& s, float dt) {
+        step(s, dt);
+        pass(s);
+    }
+
+    /// forwards to the integrators keeping velocities half a step behind
+    template <typename System>
+    void synchronize(System& s) {
+        if constexpr (requires { step.synchronize(s); }) step.synchronize(s);
     }
+};
 
+/// @brief step loop of a run, compiled for one system and one integrator
+/// type
+/// @param solver: force solver the integrator refers to
+/// @param controller: steps of the adaptive mode, unused with fixed steps
+template <typename System, typename Integrator>
+void run_simulation(
+    System system, Integrator integrator,
+    nbody::registry::solver<typename System::value_type>& solver,
+    const nbody::utils::checkpoint_info& restart,
+    nbody::integrators::adaptive controller) {
+    const bool adaptive = TimestepTag != "fixed";
     nbody::Nbody sim(std::move(system), std::move(integrator), NIterations);
 
     double e_initial = sim.energy();
+    if (!RestartPath.empty())
+        std::cout << "Restarted from step " << restart.step << " (t = "
+                  << restart.time << ")\n";
     std::cout << "Simulation started...\n"
               << "Initial energy: " << e_initial << "\n\n";
 
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    for (unsigned long i = 1; i <= NIterations; ++i) {
-        sim.step(Dt);
-        if (Verbose && i % 100 == 0) {
+    /// with leapfrog the force pass ends on the positions the step returns,
+    /// so the direct solver can hand out the potential of verbose steps
+    auto* direct = solver.direct();
+    const bool fused_energy = Verbose && direct &&
+                              IntegratorTag == "leapfrog" && !adaptive &&
+                              ReorderEvery == 0;
+    std::vector<double> potential(fused_energy ? NParticles : 0);
+
+    /// adaptive steps cover the span of the fixed ones
+    const double span = double(NIterations) * double(Dt);
+    double time = restart.time;
+
+    /// velocities are synchronized before writing, the checkpoint holds the
+    /// state at the end of step i
+    auto checkpoint = [&](unsigned long i) {
+        sim.synchronize();
+        try {
+            nbody::utils::write_checkpoint(
+                CheckpointPath, sim.system(),
+                {i, time, Dt, IntegratorTag, LayoutTag, PrecisionTag,
+                 ContainerTag, SolverTag, TimestepTag, Eta, Theta, Order});
+        } catch (const std::runtime_error& e) {
+            std::cout << e.what() << "\n";
+            exit(-1);
+        }
+    };
+
+    /// snapshots are copied on the step loop and written in the background
+    using T = typename System::value_type;
+    std::optional<nbody::utils::snapshot_writer<T>> snapshots;
+    auto snapshot = [&](unsigned long i) {
+        sim.synchronize();
+        try {
+            if (!snapshots && SnapshotFormat == "compressed") {
+                nbody::utils::snapshot_codec_options options;
+                options.position_error = options.velocity_error =
+                    SnapshotError;
+                snapshots.emplace(
+                    nbody::utils::compressed_sink<T>(SnapshotPath, options));
+            } else if (!snapshots) {
+                snapshots.emplace(SnapshotPath);
+            }
+            snapshots->submit(sim.system(), i, time);
+        } catch (const std::exception& e) {
+            std::cout << e.what() << "\n";
+            exit(-1);
+        }
+    };
+
+    for (unsigned long i = restart.step + 1;
+         adaptive ? time < span : i <= NIterations; ++i) {
+        const bool report = Verbose && i % 100 == 0;
+        if (fused_energy && report) direct->potential = potential;
+        if (adaptive)
+            time += double(sim.step(
+                controller,
+                static_cast<float>(std::min(double(Dt), span - time))));
+        else {
+            sim.step(Dt);
+            time += double(Dt);
+        }
+        if (CheckpointEvery > 0 && i % CheckpointEvery == 0) checkpoint(i);
+        if (SnapshotEvery > 0 && i % SnapshotEvery == 0) snapshot(i);
+        if (report) {
+            if (direct) direct->potential = {};
+            const double e =
+                fused_energy ? sim.energy(potential) : sim.energy();
             std::cout << "Iteration " << i << "/" << NIterations
-                      << "  energy: " << sim.energy() << "\r";
+                      << "  energy: " << e << "\r";
             std::cout.flush();
         }
     }
 
+    if (snapshots) {
+        try {
+            snapshots->flush();
+        } catch (const std::runtime_error& e) {
+            std::cout << e.what() << "\n";
+            exit(-1);
+        }
+    }
+
     auto end_time = std::chrono::high_resolution_clock::now();
 
-    auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                            end_time - start_time)
-                            .count();
+    const double elapsed_time =
+        std::chrono::duration<double, std::milli>(end_time - start_time)
+            .count();
 
-    auto fps = NIterations * 1000 / elapsed_time;
+    /// steps actually run, a restart resumes past the first ones
+    const auto steps =
+        adaptive ? controller.steps()
+                 : NIterations - std::min<unsigned long>(restart.step,
+                                                         NIterations);
+    const double fps =
+        elapsed_time > 0.0 ? double(steps) * 1000.0 / elapsed_time : 0.0;
 
     double e_final = sim.energy();
     double drift = std::abs(e_final - e_initial) / std::abs(e_initial) * 100.0;
@@ -123,11 +390,214 @@ void run_simulation() {
               << "Iterations/s:  " << fps << "\n"
               << "Final energy:  " << e_final << "\n"
               << "Energy drift:  " << drift << "%\n";
+    if (snapshots) {
+        const auto stats = snapshots->stats();
+        std::cout << "Snapshots:  " << stats.written << " (copy "
+                  << stats.copy_seconds << " s, write " << stats.write_seconds
+                  << " s, " << stats.stalls << " stalls waiting "
+                  << stats.stall_seconds << " s)\n";
+    }
+    if (adaptive)
+        std::cout << "Steps taken:  " << controller.steps() << " (fixed dt: "
+                  << NIterations << ")\n";
+#ifdef NBODY_PROFILE
+    auto& profiler = nbody::utils::profiler::instance();
+    std::cout << "\n";
+    profiler.summary(std::cout);
+    try {
+        profiler.write_trace(TracePath);
+        std::cout << "Trace written to " << TracePath << "\n";
+    } catch (const std::runtime_error& e) {
+        std::cout << e.what() << "\n";
+    }
+#endif
+}
+
+/// @brief runs the simulation of a system of the registry: loads it, builds
+/// the force solver, then dispatches once on the integrator, the step loop
+/// being compiled for the pair
+template <typename System>
+void run_system() {
+    System system;
+    nbody::utils::checkpoint_info restart;
+    try {
+        if (RestartPath.empty()) {
+            nbody::utils::init_galaxy(system, NParticles, 42);
+        } else {
+            /// arena systems step the mapped columns of the file in place
+            restart = nbody::utils::read_checkpoint_info(RestartPath);
+            system = nbody::utils::load_checkpoint<System>(RestartPath);
+        }
+    } catch (const std::runtime_error& e) {
+        std::cout << e.what() << "\n";
+        exit(-1);
+    }
+
+    const bool adaptive = TimestepTag != "fixed";
+    auto criterion = nbody::integrators::criterion::aarseth;
+    if (TimestepTag == "acceleration")
+        criterion = nbody::integrators::criterion::acceleration;
+    else if (adaptive && TimestepTag != "aarseth") {
+        std::cout << "Unknown timestep: " << TimestepTag << "\n";
+        exit(-1);
+    }
+
+    /// symmetrized adaptive steps roll the system back, they need a leapfrog
+    /// without state between steps
+    const std::string name = adaptive && IntegratorTag == "leapfrog"
+                                 ? "leapfrog-kdk"
+                                 : IntegratorTag;
+    nbody::registry::integrator_variant entry;
+    try {
+        entry = nbody::registry::find_integrator(name);
+    } catch (const std::invalid_argument& e) {
+        std::cout << e.what() << "\n";
+        exit(-1);
+    }
+
+    /// the predictor-corrector needs the jerks of the direct kernel, block
+    /// steps recompute the forces of their active particles with it
+    if ((IntegratorTag == "hermite" || IntegratorTag == "block") &&
+        SolverTag != "direct") {
+        std::cout << "The " << IntegratorTag
+                  << " integrator computes its forces with the direct solver "
+                     "(-fs direct)\n";
+        exit(-1);
+    }
+
+    auto curve = nbody::utils::curve::hilbert;
+    if (ReorderEvery > 0) {
+        /// per-particle state kept outside the system is indexed by slot
+        if (IntegratorTag == "hermite" || IntegratorTag == "block" ||
+            (adaptive && criterion == nbody::integrators::criterion::aarseth)) {
+            std::cout << "Reordering (-ro) needs an integrator without "
+                         "per-particle state\n";
+            exit(-1);
+        }
+        if (CurveTag != "morton" && CurveTag != "hilbert") {
+            std::cout << "Unknown curve: " << CurveTag << "\n";
+            exit(-1);
+        }
+        if (CurveTag == "morton") curve = nbody::utils::curve::morton;
+    }
+
+    /// the integrators refer to the solver, which outlives the simulation
+    using T = typename System::value_type;
+    auto solver = [] {
+        try {
+            return nbody::registry::solver<T>(SolverTag, Theta, Order);
+        } catch (const std::invalid_argument& e) {
+            std::cout << e.what() << "\n";
+            exit(-1);
+        }
+    }();
+    nbody::integrators::adaptive controller(criterion, Eta,
+                                            name == "leapfrog-kdk");
+
+    std::visit(
+        [&]<typename Entry>(Entry) {
+            using Integrator = decltype(Entry::make(solver));
+            run_simulation(std::move(system),
+                           reordering<Integrator>{
+                               Entry::make(solver),
+                               nbody::utils::reorder_pass(ReorderEvery, curve)},
+                           solver, restart, controller);
+        },
+        entry);
+}
+
+/// @brief value of a flag recorded by a checkpoint, unless the command line
+/// gives another one
+/// @throws std::invalid_argument if the command line contradicts it
+template <typename T>
+void restore(const std::string& flag, T& value, const T& recorded) {
+    if (GivenFlags.contains(flag) && value != recorded) {
+        std::ostringstream message;
+        message << "--restart: " << flag << " " << value
+                << " differs from the checkpoint (" << recorded << ")";
+        throw std::invalid_argument(message.str());
+    }
+    value = recorded;
+}
+
+/// @brief configuration of the run a checkpoint was written by: its physics
+/// is restored, the container and layout only when the command line leaves
+/// them, as they select the storage. Files of the first version record no
+/// container, solver nor timestep mode, those of the command line are kept
+/// @throws std::invalid_argument for a flag contradicting the checkpoint
+void restore_run(const nbody::utils::checkpoint_info& info) {
+    NParticles = info.size;
+    restore("-dt", Dt, static_cast<float>(info.dt));
+    restore("-im", IntegratorTag, info.integrator);
+    restore("-p", PrecisionTag, info.precision);
+    if (!GivenFlags.contains("-l")) LayoutTag = info.layout;
+    if (info.timestep.empty()) return;
+    restore("-fs", SolverTag, info.solver);
+    restore("-ts", TimestepTag, info.timestep);
+    restore("-eta", Eta, info.eta);
+    restore("-th", Theta, static_cast<float>(info.theta));
+    restore("-po", Order, static_cast<unsigned>(info.order));
+    if (!GivenFlags.contains("-c")) ContainerTag = info.container;
+}
+
+/// @brief dispatches once on the container, layout and precision of the
+/// command line
+bool run_layout() {
+    nbody::registry::system_variant entry;
+    try {
+        entry = nbody::registry::find_system(ContainerTag, LayoutTag,
+                                             PrecisionTag);
+    } catch (const std::invalid_argument& e) {
+        std::cout << e.what() << "\n";
+        return false;
+    }
+    std::visit(
+        []<typename Entry>(Entry) { run_system<typename Entry::type>(); },
+        entry);
+    return true;
 }
 
 int main(int argc, char** argv) {
     parse_args(argc, argv);
 
+    if (SnapshotFormat != "raw" && SnapshotFormat != "compressed") {
+        std::cout << "Unknown snapshot format: " << SnapshotFormat << "\n";
+        return -1;
+    }
+
+    for (const auto& tag : {FirstTouchTag, HugePagesTag}) {
+        if (tag != "on" && tag != "off") {
+            std::cout << "Expected on or off: " << tag << "\n";
+            return -1;
+        }
+    }
+    nbody::detail::set_memory_policy(
+        {FirstTouchTag == "on", HugePagesTag == "on"});
+    nbody::utils::pinning pin;
+    try {
+        pin = nbody::utils::parse_pinning(PinTag);
+        nbody::detail::set_execution(
+            {Grain, nbody::detail::parse_partitioner(PartitionerTag),
+             nbody::detail::parse_ranges(RangeTag)});
+    } catch (const std::invalid_argument& e) {
+        std::cout << e.what() << "\n";
+        return -1;
+    }
+    if (Threads < 0) {
+        std::cout << "Expected a thread count >= 0: " << Threads << "\n";
+        return -1;
+    }
+
+    /// a restart resumes the configuration the checkpoint was written with
+    if (!RestartPath.empty()) {
+        try {
+            restore_run(nbody::utils::read_checkpoint_info(RestartPath));
+        } catch (const std::exception& e) {
+            std::cout << e.what() << "\n";
+            return -1;
+        }
+    }
+
     std::cout << "N-Body simulation configuration:\n"
               << "--------------------------------\n"
               << "  -> nb. of bodies     (-n ): " << NParticles << "\n"
@@ -136,18 +606,39 @@ int main(int argc, char** argv) {
               << "  -> integrator        (-im): " << IntegratorTag << "\n"
               << "  -> layout            (-l ): " << LayoutTag << "\n"
               << "  -> container         (-c ): " << ContainerTag << "\n"
+              << "  -> precision         (-p ): " << PrecisionTag << "\n"
+              << "  -> timestep mode     (-ts): " << TimestepTag << "\n"
+              << "  -> force solver      (-fs): " << SolverTag << "\n"
+              << "  -> opening angle     (-th): " << Theta << "\n"
+              << "  -> expansion order   (-po): " << Order << "\n"
+              << "  -> reorder interval  (-ro): " << ReorderEvery << " ("
+              << CurveTag << ")\n"
+              << "  -> checkpoint every       : " << CheckpointEvery << " ("
+              << CheckpointPath << ")\n"
+              << "  -> snapshot every         : " << SnapshotEvery << " ("
+              << SnapshotPath << ", " << SnapshotFormat << ")\n"
+              << "  -> restart from           : "
+              << (RestartPath.empty() ? "-" : RestartPath) << "\n"
+              << "  -> first touch / THP      : " << FirstTouchTag << " / "
+              << HugePagesTag << "\n"
+              << "  -> thread pinning         : " << PinTag << "\n"
+              << "  -> threads / grain        : "
+              << (Threads == 0 ? std::string("auto") : std::to_string(Threads))
+              << " / "
+              << (Grain == 0 ? std::string("auto") : std::to_string(Grain))
+              << "\n"
+              << "  -> partitioner / range    : " << PartitionerTag << " / "
+              << RangeTag << "\n"
+              << "  -> SIMD dispatch          : "
+              << nbody::detail::isa_name(nbody::detail::active_isa()) << "\n"
               << "  -> verbose mode      (-v ): "
               << (Verbose ? "enabled" : "disabled") << "\n\n";
 
-    if (LayoutTag == "SoA" && ContainerTag == "vector")
-        run_simulation<std::vector, SoA>();
-    else if (LayoutTag == "AoS" && ContainerTag == "vector")
-        run_simulation<std::vector, AoS>();
-    else {
-        std::cout << "Unknown layout or container: " << LayoutTag << " / "
-                  << ContainerTag << "\n";
-        return -1;
-    }
-
-    return 0;
+    /// the whole run, allocations included, happens on the threads of the
+    /// arena, so that first touched pages stay local to their pinned threads
+    nbody::utils::pinned_arena arena(
+        Threads == 0 ? tbb::task_arena::automatic : Threads, pin);
+    bool ok = false;
+    arena.execute([&] { ok = run_layout(); });
+    return ok ? 0 : -1;
 }
@@ -0,0 +1,126 @@
+#include <catch2/catch_session.hpp>
+#include <catch2/catch_template_test_macros.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "distributed/mpi.hpp"
+#include "integrators/integrators.hpp"
+#include "particles.hpp"
+#include "physics/compute_accelerations.hpp"
+#include "precision.hpp"
+#include "utils/compute_energy.hpp"
+#include "utils/init_galaxy.hpp"
+
+/// tests of the distributed mode, run by every rank of
+/// mpiexec -np 4 test_mpi: comparisons are reduced over the ranks before
+/// being checked, so that all of them take the same branch
+using AoS_system = nbody::System<std::vector, float, AoS>;
+using SoA_system = nbody::System<std::vector, float, SoA>;
+using AoSoA_system = nbody::System<std::vector, float, AoSoA<>>;
+using SoA_dual = nbody::System<std::vector, nbody::precision::dual, SoA>;
+
+namespace {
+/// particles not divisible by the ranks, the slices differ in size
+constexpr int n_particles = 1021;
+
+/// @brief largest relative error over the ranks of the accelerations of the
+/// local particles against the matching ones of the global system
+template <typename System>
+double acceleration_error(const System& local, const System& global,
+                          const nbody::distributed::communicator& comm) {
+    const auto part =
+        nbody::distributed::partition(global.size(), comm.size(), comm.rank());
+    double error = 0.0;
+    auto l = local.begin();
+    auto g = global.begin();
+    for (std::size_t i = 0; i < local.size(); ++i) {
+        auto&& p = l[i];
+        auto&& q = g[part.begin + i];
+        const double norm =
+            std::sqrt(double(q.ax) * q.ax + double(q.ay) * q.ay +
+                      double(q.az) * q.az);
+        const double diff = std::sqrt(
+            (double(p.ax) - q.ax) * (double(p.ax) - q.ax) +
+            (double(p.ay) - q.ay) * (double(p.ay) - q.ay) +
+            (double(p.az) - q.az) * (double(p.az) - q.az));
+        error = std::max(error, diff / std::max(norm, 1e-30));
+    }
+    return comm.max(error);
+}
+}  // namespace
+
+TEST_CASE("partition covers the particles once", "[mpi]") {
+    for (int ranks = 1; ranks <= 7; ++ranks) {
+        std::size_t next = 0;
+        for (int r = 0; r < ranks; ++r) {
+            const auto part = nbody::distributed::partition(100, ranks, r);
+            REQUIRE(part.begin == next);
+            REQUIRE(part.size() >= 100 / std::size_t(ranks));
+            next = part.end;
+        }
+        REQUIRE(next == 100);
+    }
+}
+
+TEMPLATE_TEST_CASE("ring_sum matches the direct sum of the whole system",
+                   "[mpi]", SoA_system, AoS_system, AoSoA_system, SoA_dual) {
+    const nbody::distributed::communicator comm;
+    TestType global;
+    nbody::utils::init_galaxy(global, n_particles);
+    auto local = nbody::distributed::local_slice(global, comm);
+
+    const auto ids = local.ids();
+    const auto part =
+        nbody::distributed::partition(global.size(), comm.size(), comm.rank());
+    REQUIRE(local.size() == part.size());
+    REQUIRE(std::equal(ids.begin(), ids.end(),
+                       global.ids().begin() + std::ptrdiff_t(part.begin)));
+
+    nbody::physics::compute_accelerations(global);
+    nbody::distributed::ring_sum solver(comm);
+    solver(local);
+    REQUIRE(solver.stats().passes == 1);
+    REQUIRE(acceleration_error(local, global, comm) < 1e-4);
+
+    /// energies are summed over the ranks
+    const double expected = nbody::utils::compute_energy(global);
+    const double energy = nbody::distributed::compute_energy(local, solver);
+    REQUIRE(std::abs(energy - expected) < 1e-4 * std::abs(expected));
+}
+
+TEST_CASE("distributed leapfrog follows the single process one", "[mpi]") {
+    const nbody::distributed::communicator comm;
+    SoA_dual global;
+    nbody::utils::init_galaxy(global, n_particles);
+    auto local = nbody::distributed::local_slice(global, comm);
+
+    nbody::distributed::ring_sum solver(comm);
+    constexpr float dt = 1.0f;
+    for (int k = 0; k < 5; ++k) {
+        nbody::integrators::leapfrog(global, dt);
+        nbody::integrators::leapfrog(local, dt, solver);
+    }
+    REQUIRE(solver.stats().passes == 5);
+
+    const auto part =
+        nbody::distributed::partition(global.size(), comm.size(), comm.rank());
+    double error = 0.0;
+    auto l = local.begin();
+    auto g = global.begin();
+    for (std::size_t i = 0; i < local.size(); ++i) {
+        auto&& p = l[i];
+        auto&& q = g[part.begin + i];
+        const double scale = std::max(std::abs(q.qx), 1.0);
+        error = std::max(error, std::abs(p.qx - q.qx) / scale);
+    }
+    REQUIRE(comm.max(error) < 1e-9);
+}
+
+int main(int argc, char** argv) {
+    nbody::distributed::environment mpi(argc, argv);
+    return Catch::Session().run(argc, argv);
+}
@@ -1,19 +1,31 @@
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <functional>
+#include <numbers>
+#include <stdexcept>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#include "integrators/adaptive.hpp"
 #include "integrators/integrators.hpp"
 #include "nbody.hpp"
 #include "particles.hpp"
+#include "registry.hpp"
 #include "utils/init_galaxy.hpp"
 
 using AoS_system = nbody::System<std::vector, float, AoS>;
 using SoA_system = nbody::System<std::vector, float, SoA>;
+using SoA_dual = nbody::System<std::vector, nbody::precision::dual, SoA>;
+using AoSoA_system = nbody::System<std::vector, float, AoSoA<>>;
 
 /// ==================== nbody tests ====================
 TEMPLATE_TEST_CASE("energy of the system should be conserved", "[integration]",
-                   SoA_system, AoS_system) {
+                   SoA_system, AoS_system, AoSoA_system) {
     TestType s;
 
     // initalize a galaxy with 100 particles, seed 42
@@ -87,4 +99,376 @@ TEMPLATE_TEST_CASE("energy of the system should be conserved", "[integration]",
         // energy should be conserved within tolerance
         REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
     }
+
+    /// ==================== fused leapfrog tests ====================
+    SECTION("leapfrog_fused") {
+        nbody::Nbody sim(std::move(s), nbody::integrators::leapfrog_fused{},
+                         1000);
+
+        // compute initial energy
+        double e_initial = sim.energy();
+
+        // run simulation
+        for (int i = 0; i < 10000; ++i) {
+            sim.step(0.01f);
+        }
+
+        double e_final = sim.energy();
+
+        // energy should be conserved within tolerance
+        REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
+    }
+
+    /// ==================== yoshida tests ====================
+    SECTION("yoshida4") {
+        nbody::Nbody sim(
+            std::move(s),
+            [](auto& system, float dt) {
+                nbody::integrators::yoshida4(system, dt);
+            },
+            1000);
+
+        double e_initial = sim.energy();
+        for (int i = 0; i < 10000; ++i) {
+            sim.step(0.01f);
+        }
+        double e_final = sim.energy();
+
+        REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
+    }
+
+    SECTION("yoshida6") {
+        nbody::Nbody sim(
+            std::move(s),
+            [](auto& system, float dt) {
+                nbody::integrators::yoshida6(system, dt);
+            },
+            1000);
+
+        double e_initial = sim.energy();
+        for (int i = 0; i < 10000; ++i) {
+            sim.step(0.01f);
+        }
+        double e_final = sim.energy();
+
+        REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
+    }
+
+    /// ==================== hermite tests ====================
+    SECTION("hermite") {
+        nbody::Nbody sim(std::move(s), nbody::integrators::hermite{}, 1000);
+
+        double e_initial = sim.energy();
+        for (int i = 0; i < 10000; ++i) {
+            sim.step(0.01f);
+        }
+        double e_final = sim.energy();
+
+        REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
+    }
+
+    /// ==================== adaptive timestep tests ====================
+    SECTION("adaptive") {
+        nbody::Nbody sim(
+            std::move(s),
+            [](auto& system, float dt) {
+                nbody::integrators::leapfrog(system, dt);
+            },
+            1000);
+        nbody::integrators::adaptive controller(
+            nbody::integrators::criterion::aarseth, 0.02, true);
+
+        double e_initial = sim.energy();
+        double time = 0.0;
+        while (time < 100.0) {
+            const float dt = sim.step(controller, 0.01f);
+            REQUIRE(dt <= 0.01f);
+            time += dt;
+        }
+        double e_final = sim.energy();
+
+        REQUIRE(controller.steps() >= 10000);
+        REQUIRE(controller.time() == Catch::Approx(time));
+        REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
+    }
+
+    /// ==================== block leapfrog tests ====================
+    SECTION("block_leapfrog") {
+        nbody::Nbody sim(std::move(s), nbody::integrators::block_leapfrog{},
+                         1000);
+
+        // compute initial energy
+        double e_initial = sim.energy();
+
+        // run simulation
+        for (int i = 0; i < 10000; ++i) {
+            sim.step(0.01f);
+        }
+
+        double e_final = sim.energy();
+
+        // energy should be conserved within tolerance
+        REQUIRE(e_final == Catch::Approx(e_initial).epsilon(0.01));
+    }
+}
+
+TEMPLATE_TEST_CASE("fused leapfrog follows the plain leapfrog trajectory",
+                   "[integration]", SoA_system, AoS_system) {
+    TestType plain;
+    TestType fused;
+    nbody::utils::init_galaxy(plain, 300, 42);
+    nbody::utils::init_galaxy(fused, 300, 42);
+
+    nbody::integrators::leapfrog_fused<> leapfrog;
+    for (int i = 0; i < 200; ++i) {
+        nbody::integrators::leapfrog(plain, 10.0f);
+        leapfrog(fused, 10.0f);
+    }
+    leapfrog.synchronize(fused);
+
+    auto it = fused.begin();
+    for (auto&& p : plain) {
+        auto&& q = *it++;
+        /// positions are ~1e8 and orbital speeds ~1e2, while the central body
+        /// barely moves under a net acceleration which is a cancellation:
+        /// absolute margins, relative to those scales, for it
+        REQUIRE(q.qx == Catch::Approx(p.qx).epsilon(1e-5).margin(1e1));
+        REQUIRE(q.vy == Catch::Approx(p.vy).epsilon(1e-4).margin(1e-2));
+    }
+}
+
+TEMPLATE_TEST_CASE("block leapfrog refines the steps of close encounters only",
+                   "[integration]", SoA_system, AoS_system) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 200, 42);
+    /// a tight binary orbiting each other far from the central body
+    s.add_particle({3e8f, 0, 0, 0, 150.0f, 0, 0, 0, 0, 1e20f, 0});
+    s.add_particle({3e8f + 1e5f, 0, 0, 0, -150.0f, 0, 0, 0, 0, 1e20f, 0});
+
+    nbody::integrators::block_leapfrog block;
+    TestType plain = s;
+    /// the block integrator starts from the forces of the initial positions
+    nbody::physics::compute_accelerations(plain);
+    for (int i = 0; i < 20; ++i) {
+        block(s, 100.0f);
+        nbody::integrators::leapfrog(plain, 100.0f);
+    }
+
+    const auto levels = block.levels();
+    const auto n = s.size();
+    REQUIRE(levels[n - 1] > 0);
+    REQUIRE(levels[n - 2] > 0);
+    for (std::size_t i = 0; i < n - 2; ++i) REQUIRE(levels[i] == 0);
+    /// one force evaluation per call for the wide orbits, many for the binary
+    REQUIRE(block.evaluations() < 2 * 21 * n);
+    REQUIRE(block.evaluations() > 21 * n);
+
+    /// the wide orbits follow the global leapfrog
+    auto it = plain.begin();
+    for (std::size_t i = 0; i < n - 2; ++i, ++it) {
+        const auto& p = s.begin()[i];
+        REQUIRE(p.qx == Catch::Approx((*it).qx).epsilon(1e-5).margin(1e1));
+        REQUIRE(p.vy == Catch::Approx((*it).vy).epsilon(1e-4).margin(1e-2));
+    }
+}
+
+/// distance to the exact position after one period of a circular orbit around
+/// a body 1e20 times heavier, integrated in the given number of steps
+template <typename Step>
+double kepler_error(Step&& step, int steps) {
+    constexpr double G = nbody::constants::G_v<double>;
+    constexpr double M = 1e20;
+    constexpr double r = 1e4;
+    const double v = std::sqrt(G * M / r);
+
+    SoA_dual s;
+    s.add_particle({0, 0, 0, 0, 0, 0, 0, 0, 0, M, 0});
+    s.add_particle({r, 0, 0, 0, v, 0, 0, 0, 0, 1, 0});
+    nbody::physics::compute_accelerations(s);
+
+    const auto dt = static_cast<float>(2 * std::numbers::pi * r / v / steps);
+    for (int i = 0; i < steps; ++i) step(s, dt);
+
+    const double angle = v / r * double(dt) * steps;
+    const auto p = s.begin()[1];
+    return std::hypot(p.qx - r * std::cos(angle), p.qy - r * std::sin(angle));
+}
+
+TEST_CASE("higher order integrators converge faster on a Kepler orbit",
+          "[integration]") {
+    auto leapfrog = [](auto& s, float dt) {
+        nbody::integrators::leapfrog(s, dt);
+    };
+    auto yoshida4 = [](auto& s, float dt) {
+        nbody::integrators::yoshida4(s, dt);
+    };
+    auto yoshida6 = [](auto& s, float dt) {
+        nbody::integrators::yoshida6(s, dt);
+    };
+    nbody::integrators::hermite hermite_32;
+    nbody::integrators::hermite hermite_64;
+
+    /// halving the step divides the error by 2^order
+    const double lf = kepler_error(leapfrog, 32);
+    REQUIRE(lf / kepler_error(leapfrog, 64) == Catch::Approx(4).epsilon(0.1));
+    const double y4 = kepler_error(yoshida4, 32);
+    REQUIRE(y4 / kepler_error(yoshida4, 64) > 12);
+    const double h4 = kepler_error(std::ref(hermite_32), 32);
+    REQUIRE(h4 / kepler_error(std::ref(hermite_64), 64) > 12);
+    const double y6 = kepler_error(yoshida6, 32);
+
+    REQUIRE(y4 < lf / 5);
+    REQUIRE(h4 < lf / 5);
+    REQUIRE(y6 < y4 / 50);
+}
+
+TEST_CASE("adaptive steps resolve an eccentric orbit with fewer forces",
+          "[integration]") {
+    constexpr double G = nbody::constants::G_v<double>;
+    constexpr double M = 1e20;
+    constexpr double r = 1e4;
+    /// apocenter of an orbit of eccentricity 0.91
+    const double v = 0.3 * std::sqrt(G * M / r);
+    const double a = r / (2 - 0.09);
+    const double span = 20 * std::numbers::pi * std::sqrt(a * a * a / (G * M));
+
+    auto make = [&] {
+        SoA_dual s;
+        s.add_particle({0, 0, 0, 0, 0, 0, 0, 0, 0, M, 0});
+        s.add_particle({r, 0, 0, 0, v, 0, 0, 0, 0, 1, 0});
+        nbody::physics::compute_accelerations(s);
+        return s;
+    };
+    auto leapfrog = [](SoA_dual& s, float dt) {
+        nbody::integrators::leapfrog(s, dt);
+    };
+    /// largest relative energy error over ten orbits
+    auto error = [](SoA_dual& s, double e_initial) {
+        return std::abs(nbody::utils::compute_energy(s) / e_initial - 1.0);
+    };
+
+    SoA_dual fixed = make();
+    const double e_initial = nbody::utils::compute_energy(fixed);
+    constexpr int steps = 4000;
+    double fixed_error = 0.0;
+    for (int i = 0; i < steps; ++i) {
+        leapfrog(fixed, static_cast<float>(span / steps));
+        fixed_error = std::max(fixed_error, error(fixed, e_initial));
+    }
+
+    SoA_dual adaptive = make();
+    nbody::integrators::adaptive controller(
+        nbody::integrators::criterion::aarseth, 0.1, true);
+    double adaptive_error = 0.0;
+    for (double time = 0.0; time < span;) {
+        const auto dt_max =
+            static_cast<float>(std::min(span / 16, span - time));
+        time += controller(adaptive, leapfrog, dt_max);
+        adaptive_error = std::max(adaptive_error, error(adaptive, e_initial));
+    }
+
+    /// symmetrized steps evaluate the forces twice
+    REQUIRE(2 * controller.steps() < steps);
+    REQUIRE(adaptive_error < fixed_error / 10);
+}
+
+TEST_CASE("adaptive steps stay positive without acceleration",
+          "[integration]") {
+    /// the middle particle feels no acceleration but a jerk: its Aarseth
+    /// estimate is 0, or rounding errors away from it
+    SoA_dual s;
+    s.add_particle({-1e4, 0, 0, 0, 0, 0, 0, 0, 0, 1e20, 0});
+    s.add_particle({0, 0, 0, 0, 10, 0, 0, 0, 0, 1e20, 0});
+    s.add_particle({1e4, 0, 0, 0, 0, 0, 0, 0, 0, 1e20, 0});
+    nbody::physics::compute_accelerations(s);
+
+    auto leapfrog = [](SoA_dual& system, float dt) {
+        nbody::integrators::leapfrog(system, dt);
+    };
+    for (const bool symmetric : {false, true}) {
+        nbody::integrators::adaptive controller(
+            nbody::integrators::criterion::aarseth, 0.02, symmetric);
+        auto system = s;
+        const float dt = controller(system, leapfrog, 1.0f);
+        /// floor of the steps, dt_max / 2^20
+        REQUIRE(dt >= 0x1p-20f);
+        REQUIRE(dt <= 1.0f);
+    }
+}
+
+/// ==================== registry tests ====================
+TEST_CASE("the registry maps names to systems and integrators",
+          "[registry]") {
+    namespace registry = nbody::registry;
+    static_assert(std::variant_size_v<registry::system_variant> == 2 * 3 * 4);
+    static_assert(std::variant_size_v<registry::integrator_variant> == 8);
+    static_assert(simulation_system<AoSoA_system>);
+    static_assert(integrator_of<nbody::integrators::hermite, SoA_system>);
+    static_assert(!integrator_of<int, SoA_system>);
+
+    /// integrators of the registry hold for the systems their solver takes
+    using euler_t = registry::integrator_t<registry::euler, SoA_system>;
+    static_assert(integrator_of<euler_t, SoA_system>);
+    static_assert(!std::invocable<euler_t&, int&, float>);
+    struct aos_only {
+        void operator()(AoS_system&) {}
+    };
+    using aos_euler =
+        decltype(registry::euler::make(std::declval<aos_only&>()));
+    using aos_leapfrog =
+        decltype(registry::leapfrog::make(std::declval<aos_only&>()));
+    static_assert(integrator_of<aos_euler, AoS_system>);
+    static_assert(!integrator_of<aos_euler, SoA_system>);
+    static_assert(integrator_of<aos_leapfrog, AoS_system>);
+    static_assert(!integrator_of<aos_leapfrog, SoA_system>);
+
+    const bool matched = std::visit(
+        []<typename Entry>(Entry) {
+            return std::same_as<typename Entry::type,
+                                nbody::System<nbody::aligned_vector,
+                                              nbody::precision::dual,
+                                              AoSoA<>>>;
+        },
+        registry::find_system("aligned", "AoSoA", "double"));
+    REQUIRE(matched);
+    REQUIRE(std::holds_alternative<registry::hermite>(
+        registry::find_integrator("hermite")));
+
+    REQUIRE_THROWS_WITH(registry::find_system("list", "SoA", "single"),
+                        "unknown container: list");
+    REQUIRE_THROWS_WITH(registry::find_system("vector", "SoAoS", "single"),
+                        "unknown layout: SoAoS");
+    REQUIRE_THROWS_WITH(registry::find_system("vector", "SoA", "quad"),
+                        "unknown precision: quad");
+    REQUIRE_THROWS_WITH(registry::find_integrator("rk4"),
+                        "unknown integrator: rk4");
+    REQUIRE_THROWS_AS(registry::solver<float>("pm", 0.5f, 4),
+                      std::invalid_argument);
+}
+
+TEST_CASE("integrators of the registry step like the direct calls",
+          "[registry]") {
+    namespace registry = nbody::registry;
+    SoA_system direct;
+    SoA_system visited;
+    nbody::utils::init_galaxy(direct, 200, 42);
+    nbody::utils::init_galaxy(visited, 200, 42);
+
+    registry::solver<float> solver("direct", 0.5f, 4);
+    std::visit(
+        [&]<typename Entry>(Entry) {
+            auto yoshida = Entry::make(solver);
+            for (int i = 0; i < 20; ++i) {
+                nbody::integrators::yoshida4(direct, 10.0f);
+                yoshida(visited, 10.0f);
+            }
+        },
+        registry::find_integrator("yoshida4"));
+
+    auto it = visited.begin();
+    for (auto&& p : direct) {
+        auto&& q = *it++;
+        REQUIRE(q.qx == p.qx);
+        REQUIRE(q.vy == p.vy);
+    }
 }
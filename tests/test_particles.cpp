@@ -1,6 +1,14 @@
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "particles.hpp"
@@ -9,33 +17,42 @@
 /// extended to other vector-like containers
 using AoS_system = nbody::System<std::vector, float, AoS>;
 using SoA_system = nbody::System<std::vector, float, SoA>;
+using AoS_aligned = nbody::System<nbody::aligned_vector, float, AoS>;
+using SoA_arena = nbody::System<nbody::aligned_vector, float, SoA>;
+using SoA_arena_double = nbody::System<nbody::aligned_vector, double, SoA>;
+using AoSoA_system = nbody::System<std::vector, float, AoSoA<>>;
+using AoSoA_narrow = nbody::System<std::vector, float, AoSoA<4>>;
 
 /// Using the catch2 unit test framework permits us to use the
 /// TEMPLATE_TEST_CASE, enabling the testing of multiple memory-layouts without
 /// adding eccessive boiler-plate
 
 TEMPLATE_TEST_CASE("default size of the system is 0", "[System]", AoS_system,
-                   SoA_system) {
+                   SoA_system, AoS_aligned, SoA_arena, AoSoA_system,
+                   AoSoA_narrow) {
     TestType s;
     REQUIRE(s.size() == 0u);
 }
 
 TEMPLATE_TEST_CASE("reserve() method doesn't change size", "[System]",
-                   AoS_system, SoA_system) {
+                   AoS_system, SoA_system, AoS_aligned, SoA_arena, AoSoA_system,
+                   AoSoA_narrow) {
     TestType s;
     s.reserve(100);
     REQUIRE(s.size() == 0u);
 }
 
 TEMPLATE_TEST_CASE("adding a Particle results in a size + 1", "[System]",
-                   AoS_system, SoA_system) {
+                   AoS_system, SoA_system, AoS_aligned, SoA_arena, AoSoA_system,
+                   AoSoA_narrow) {
     TestType s;
     s.add_particle(nbody::Particle<float>(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
     REQUIRE(s.size() == 1u);
 }
 
 TEMPLATE_TEST_CASE("Range-based for loops work as intended", "[System]",
-                   AoS_system, SoA_system) {
+                   AoS_system, SoA_system, AoS_aligned, SoA_arena, AoSoA_system,
+                   AoSoA_narrow) {
     using SystemType = TestType;
     SystemType s;
 
@@ -56,3 +73,200 @@ TEMPLATE_TEST_CASE("Range-based for loops work as intended", "[System]",
     }
     REQUIRE(sum == 6);
 }
+
+TEMPLATE_TEST_CASE("arena columns are aligned and padded", "[System]",
+                   SoA_arena, SoA_arena_double) {
+    using T = typename TestType::value_type;
+    constexpr auto lanes = nbody::cache_line / sizeof(T);
+    TestType s;
+    for (int i = 0; i < 37; ++i)
+        s.add_particle(nbody::Particle<T>(i, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+
+    REQUIRE(s.capacity() % lanes == 0u);
+    REQUIRE(s.padded_size() % lanes == 0u);
+    REQUIRE(s.padded_size() >= s.size());
+    for (auto f : {nbody::field::qx, nbody::field::vy, nbody::field::m,
+                   nbody::field::r}) {
+        const auto column = s.padded_column(f);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(column.data()) %
+                    nbody::cache_line ==
+                0u);
+        REQUIRE(s.column(f).size() == s.size());
+        /// padding lanes carry null masses and positions
+        for (auto i = s.size(); i < column.size(); ++i)
+            REQUIRE(column[i] == T{0});
+    }
+    REQUIRE(s.column(nbody::field::qx)[36] == T{36});
+    REQUIRE(s.column(nbody::field::r)[36] == T{11});
+}
+
+TEST_CASE("arena resize builds and shrinks systems in bulk", "[System]") {
+    SoA_arena s;
+    s.resize(100);
+    REQUIRE(s.size() == 100u);
+    REQUIRE(s.capacity() >= 100u);
+    for (auto&& p : s) REQUIRE(p.m == 0.0f);
+
+    auto m = s.column(nbody::field::m);
+    for (std::size_t i = 0; i < m.size(); ++i) m[i] = float(i + 1);
+    const auto capacity = s.capacity();
+    s.resize(10);
+    REQUIRE(s.size() == 10u);
+    REQUIRE(s.capacity() == capacity);
+    /// particles cut off are cleared, padding stays zero
+    REQUIRE(s.padded_column(nbody::field::m)[10] == 0.0f);
+    s.resize(20);
+    REQUIRE(s.column(nbody::field::m)[9] == 10.0f);
+    REQUIRE(s.column(nbody::field::m)[15] == 0.0f);
+}
+
+TEST_CASE("arenas are zeroed and laid out alike under every memory policy",
+          "[System]") {
+    const auto saved = nbody::detail::active_memory_policy();
+    /// big enough for the huge page path, 11 columns of 64k floats
+    constexpr std::size_t n = 65'536;
+    for (const bool first_touch : {false, true}) {
+        for (const bool huge_pages : {false, true}) {
+            nbody::detail::set_memory_policy({first_touch, huge_pages});
+            SoA_arena s;
+            s.resize(n);
+            REQUIRE(s.capacity() >= n);
+            for (std::size_t f = 0; f < 11; ++f) {
+                const auto c = s.padded_column(static_cast<nbody::field>(f));
+                REQUIRE(reinterpret_cast<std::uintptr_t>(c.data()) %
+                            nbody::cache_line ==
+                        0);
+                REQUIRE(std::all_of(c.begin(), c.end(),
+                                    [](float x) { return x == 0.0f; }));
+            }
+            /// growing moves the particles into an arena of the same policy
+            s.column(nbody::field::m)[n - 1] = 5.0f;
+            s.add_particle(
+                nbody::Particle<float>(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+            REQUIRE(s.column(nbody::field::m)[n - 1] == 5.0f);
+            REQUIRE(s.column(nbody::field::m)[n] == 10.0f);
+            SoA_arena copy = s;
+            REQUIRE(copy.column(nbody::field::r)[n] == 11.0f);
+        }
+    }
+    nbody::detail::set_memory_policy(saved);
+}
+
+TEST_CASE("arena systems copy deeply and move their arena", "[System]") {
+    SoA_arena s;
+    for (int i = 0; i < 20; ++i)
+        s.add_particle(
+            nbody::Particle<float>(i, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+
+    SoA_arena copy = s;
+    copy.column(nbody::field::qx)[0] = -1.0f;
+    REQUIRE(s.column(nbody::field::qx)[0] == 0.0f);
+    REQUIRE(copy.column(nbody::field::qx)[19] == 19.0f);
+
+    const auto* data = s.column(nbody::field::qx).data();
+    SoA_arena moved = std::move(s);
+    REQUIRE(moved.column(nbody::field::qx).data() == data);
+    REQUIRE(moved.size() == 20u);
+    REQUIRE(s.size() == 0u);
+}
+
+TEMPLATE_TEST_CASE("AoSoA blocks hold W particles and zero padding lanes",
+                   "[System]", AoSoA_system, AoSoA_narrow) {
+    using T = typename TestType::value_type;
+    constexpr auto W = TestType::block_width;
+    TestType s;
+    const std::size_t n = 3 * W + 1;
+    for (std::size_t i = 0; i < n; ++i)
+        s.add_particle(
+            nbody::Particle<T>(T(i), 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+
+    auto blocks = s.blocks();
+    REQUIRE(blocks.size() == 4u);
+    REQUIRE(s.padded_size() == 4 * W);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(blocks.data()) %
+                alignof(typename TestType::block_type) ==
+            0u);
+    /// particle i sits in lane i % W of block i / W
+    REQUIRE(blocks[2].qx[1] == T(2 * W + 1));
+    REQUIRE(blocks[3].qx[0] == T(3 * W));
+    REQUIRE(blocks[3].m[0] == T(10));
+    for (std::size_t l = 1; l < W; ++l) REQUIRE(blocks[3].m[l] == T(0));
+
+    std::size_t i = 0;
+    for (auto&& p : s) REQUIRE(p.qx == T(i++));
+    REQUIRE(i == n);
+}
+
+TEMPLATE_TEST_CASE("const systems iterate over read-only views", "[System]",
+                   AoS_system, SoA_system, SoA_arena, AoSoA_system) {
+    using iterator = decltype(std::declval<TestType&>().begin());
+    using const_iterator = decltype(std::declval<const TestType&>().begin());
+    STATIC_REQUIRE(std::random_access_iterator<iterator>);
+    STATIC_REQUIRE(std::random_access_iterator<const_iterator>);
+    using qx_type = decltype(((*const_iterator{}).qx));
+    STATIC_REQUIRE(std::is_const_v<std::remove_reference_t<qx_type>>);
+
+    TestType s;
+    for (int i = 0; i < 40; ++i)
+        s.add_particle(
+            nbody::Particle<float>(i, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+    const TestType& c = s;
+
+    REQUIRE(c.cend() - c.cbegin() == 40);
+    REQUIRE(std::count_if(c.begin(), c.end(),
+                          [](auto&& p) { return p.qx >= 20.0f; }) == 20);
+    const auto total =
+        std::transform_reduce(c.cbegin(), c.cend(), 0.0, std::plus<>{},
+                              [](auto&& p) { return double(p.qx); });
+    REQUIRE(total == 780.0);
+}
+
+TEMPLATE_TEST_CASE("columns are exposed as spans", "[System]", SoA_system,
+                   SoA_arena) {
+    TestType s;
+    for (int i = 0; i < 10; ++i)
+        s.add_particle(
+            nbody::Particle<float>(i, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+
+    std::span<float> vx = s.column(nbody::field::vx);
+    for (auto& v : vx) v *= 2.0f;
+
+    const TestType& c = s;
+    std::span<const float> read = c.column(nbody::field::vx);
+    REQUIRE(read.size() == 10u);
+    REQUIRE(read.data() == vx.data());
+    REQUIRE(std::all_of(read.begin(), read.end(),
+                        [](float v) { return v == 8.0f; }));
+    REQUIRE(c.column(nbody::field::qx)[9] == 9.0f);
+}
+
+TEMPLATE_TEST_CASE("particles are identified by their insertion index",
+                   "[System]", AoS_system, SoA_system, SoA_arena,
+                   AoSoA_system) {
+    TestType s;
+    for (int i = 0; i < 5; ++i)
+        s.add_particle(
+            nbody::Particle<float>(i, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11));
+    auto ids = s.ids();
+    REQUIRE(ids.size() == 5u);
+    for (std::size_t i = 0; i < ids.size(); ++i) REQUIRE(ids[i] == i);
+
+    /// identifiers follow copies
+    ids[0] = 4;
+    ids[4] = 0;
+    const TestType copy = s;
+    REQUIRE(copy.ids()[0] == 4u);
+    REQUIRE(copy.ids()[4] == 0u);
+}
+
+TEST_CASE("arena resize hands out fresh identifiers", "[System]") {
+    SoA_arena s;
+    s.resize(4);
+    s.ids()[0] = 3;
+    s.ids()[3] = 0;
+    s.resize(2);
+    s.resize(4);
+    REQUIRE(s.ids()[0] == 3u);
+    REQUIRE(s.ids()[2] == 4u);
+    REQUIRE(s.ids()[3] == 5u);
+}
@@ -1,24 +1,43 @@
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <concepts>
 #include <iterator>
+#include <stdexcept>
 #include <vector>
 
 #include "constants.hpp"
+#include "detail/dispatch.hpp"
+#include "detail/execution.hpp"
 #include "particles.hpp"
 #include "physics/compute_accelerations.hpp"
+#include "physics/direct_soa.hpp"
+#include "physics/jerk.hpp"
+#include "physics/symmetric.hpp"
 #include "physics/updates.hpp"
+#include "precision.hpp"
+#include "utils/init_galaxy.hpp"
 
 /// useful aliases for better clarity during testing, tests can be later
 /// extended to other vector-like containers
 using AoS_system = nbody::System<std::vector, float, AoS>;
 using SoA_system = nbody::System<std::vector, float, SoA>;
+using SoA_dual = nbody::System<std::vector, nbody::precision::dual, SoA>;
+using AoS_dual = nbody::System<std::vector, nbody::precision::dual, AoS>;
+using SoA_mixed = nbody::System<std::vector, nbody::precision::mixed, SoA>;
+using SoA_compensated =
+    nbody::System<std::vector, nbody::precision::compensated_single, SoA>;
+using AoS_compensated =
+    nbody::System<std::vector, nbody::precision::compensated_single, AoS>;
+using SoA_arena = nbody::System<nbody::aligned_vector, float, SoA>;
+using AoSoA_system = nbody::System<std::vector, float, AoSoA<>>;
 
 /// tests for the utils directory free methods
 
 /// ==================== compute_accelerations tests ====================
 TEMPLATE_TEST_CASE("compute_accelerations", "[physics]", SoA_system,
-                   AoS_system) {
+                   AoS_system, AoSoA_system) {
     SECTION("two particles accelerate towards each other") {
         TestType s;
         // particle 0 at origin, particle 1 at (1, 0, 0)
@@ -68,9 +87,427 @@ TEMPLATE_TEST_CASE("compute_accelerations", "[physics]", SoA_system,
     }
 }
 
+/// ==================== fused potential tests ====================
+TEMPLATE_TEST_CASE("compute_accelerations fills the potential on request",
+                   "[physics]", SoA_system, AoS_system, SoA_dual,
+                   AoSoA_system) {
+    TestType s;
+    s.add_particle({0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0});
+    s.add_particle({1, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0});
+
+    std::vector<double> potential(2);
+    nbody::physics::compute_accelerations(s, potential);
+
+    constexpr double G = nbody::constants::G_v<double>;
+    constexpr double soft = nbody::constants::soft_v<double>;
+    const double r = std::sqrt(1.0 + soft * soft);
+    /// the particle itself is left out of its own potential
+    REQUIRE(potential[0] == Catch::Approx(-G * 2.0 / r).epsilon(1e-5));
+    REQUIRE(potential[1] == Catch::Approx(-G * 1.0 / r).epsilon(1e-5));
+}
+
+/// ==================== precision policies tests ====================
+TEMPLATE_TEST_CASE("compute_accelerations under every precision policy",
+                   "[physics][precision]", SoA_dual, AoS_dual, SoA_mixed,
+                   SoA_compensated) {
+    using T = typename TestType::value_type;
+    TestType s;
+    s.add_particle({0, 0, 0, 0, 0, 0, 0, 0, 0, 1, T(0.1)});
+    s.add_particle({1, 0, 0, 0, 0, 0, 0, 0, 0, 2, T(0.1)});
+
+    nbody::physics::compute_accelerations(s);
+
+    constexpr double G = nbody::constants::G_v<double>;
+    constexpr double soft = nbody::constants::soft_v<double>;
+    const double r2 = 1.0 + soft * soft;
+    const double expected = G * 2.0 / (r2 * std::sqrt(r2));
+
+    auto p0 = *s.begin();
+    REQUIRE(double(p0.ax) == Catch::Approx(expected).epsilon(1e-5));
+}
+
+TEST_CASE("mixed precision direct kernels agree with the double ones",
+          "[physics][precision]") {
+    constexpr int n = 2000;
+    SoA_mixed mixed;
+    AoS_compensated compensated;
+    SoA_dual reference;
+    nbody::utils::init_galaxy(mixed, n, 7);
+    nbody::utils::init_galaxy(compensated, n, 7);
+    for (auto&& p : mixed)
+        reference.add_particle({p.qx, p.qy, p.qz, p.vx, p.vy, p.vz, p.ax,
+                                p.ay, p.az, p.m, p.r});
+
+    nbody::physics::compute_accelerations(reference);
+    nbody::physics::compute_accelerations(mixed);
+    nbody::physics::compute_accelerations_symmetric(compensated);
+
+    auto it = mixed.begin();
+    auto jt = compensated.begin();
+    for (auto&& q : reference) {
+        const auto& p = *it++;
+        const auto& c = *jt++;
+        const double norm = std::sqrt(q.ax * q.ax + q.ay * q.ay + q.az * q.az);
+        REQUIRE(std::abs(p.ax - q.ax) <= 1e-5 * norm);
+        REQUIRE(std::abs(c.ax - q.ax) <= 1e-5 * norm);
+    }
+}
+
+/// ==================== direct_soa tests ====================
+/// runs the tiled kernel with the instruction set i and compares it to the
+/// generic kernel on an AoS system
+void check_direct_soa(nbody::detail::isa i, std::size_t n) {
+    SoA_system s;
+    AoS_system reference;
+    nbody::utils::init_galaxy(s, int(n), 42);
+    nbody::utils::init_galaxy(reference, int(n), 42);
+    nbody::physics::compute_accelerations(reference);
+
+    nbody::detail::dispatch(i, [&]<typename V>(V) {
+        nbody::physics::detail::direct_soa_block<V>(
+            s.column(nbody::field::qx).data(),
+            s.column(nbody::field::qy).data(),
+            s.column(nbody::field::qz).data(), s.column(nbody::field::m).data(),
+            n, s.column(nbody::field::ax).data(),
+            s.column(nbody::field::ay).data(),
+            s.column(nbody::field::az).data(), 0, n);
+    });
+
+    auto it = reference.begin();
+    for (auto&& p : s) {
+        const auto& q = *it++;
+        const double norm =
+            std::sqrt(double(q.ax) * q.ax + double(q.ay) * q.ay +
+                      double(q.az) * q.az);
+        const double err = std::sqrt(std::pow(double(p.ax) - q.ax, 2) +
+                                     std::pow(double(p.ay) - q.ay, 2) +
+                                     std::pow(double(p.az) - q.az, 2));
+        REQUIRE(err <= 1e-4 * norm);
+    }
+}
+
+TEST_CASE("direct_soa kernel matches the generic kernel", "[physics]") {
+    using nbody::detail::isa;
+    /// every instruction set supported by the CPU running the tests, sizes
+    /// exercising incomplete j vectors, i groups and several j tiles
+    for (auto i : {isa::scalar, isa::sse, isa::avx2, isa::avx512}) {
+        if (!nbody::detail::cpu_supports(i)) continue;
+        for (std::size_t n : {1u, 7u, 33u, 1500u}) check_direct_soa(i, n);
+    }
+}
+
+TEST_CASE("padded arena columns give the accelerations of the plain columns",
+          "[physics]") {
+    /// the arena kernel streams its zero padding lanes instead of a tail
+    for (std::size_t n : {1u, 7u, 33u, 1500u}) {
+        SoA_arena s;
+        SoA_system reference;
+        nbody::utils::init_galaxy(s, int(n), 42);
+        nbody::utils::init_galaxy(reference, int(n), 42);
+        REQUIRE(s.padded_size() % SoA_arena::lanes == 0u);
+
+        std::vector<double> potential(n), reference_potential(n);
+        nbody::physics::compute_accelerations(s, potential);
+        nbody::physics::compute_accelerations(reference, reference_potential);
+
+        auto it = reference.begin();
+        std::size_t i = 0;
+        for (auto&& p : s) {
+            const auto& q = *it++;
+            REQUIRE(p.ax == Catch::Approx(q.ax).epsilon(1e-5));
+            REQUIRE(p.ay == Catch::Approx(q.ay).epsilon(1e-5));
+            REQUIRE(p.az == Catch::Approx(q.az).epsilon(1e-5));
+            REQUIRE(potential[i] ==
+                    Catch::Approx(reference_potential[i]).epsilon(1e-5));
+            ++i;
+        }
+    }
+}
+
+/// runs the AoSoA kernel on blocks of W particles and compares it to the SoA
+/// one, narrow blocks falling back to scalar code
+template <std::size_t W>
+void check_direct_aosoa(std::size_t n) {
+    nbody::System<std::vector, float, AoSoA<W>> s;
+    SoA_system reference;
+    nbody::utils::init_galaxy(s, int(n), 42);
+    nbody::utils::init_galaxy(reference, int(n), 42);
+
+    std::vector<double> potential(n), reference_potential(n);
+    nbody::physics::compute_accelerations(s, potential);
+    nbody::physics::compute_accelerations(reference, reference_potential);
+
+    /// narrow blocks sum in another order, components are compared to the
+    /// norm of the acceleration
+    auto it = reference.begin();
+    std::size_t i = 0;
+    for (auto&& p : s) {
+        const auto& q = *it++;
+        const double norm =
+            std::sqrt(double(q.ax) * q.ax + double(q.ay) * q.ay +
+                      double(q.az) * q.az);
+        REQUIRE(std::abs(double(p.ax) - q.ax) <= 1e-5 * norm);
+        REQUIRE(std::abs(double(p.ay) - q.ay) <= 1e-5 * norm);
+        REQUIRE(std::abs(double(p.az) - q.az) <= 1e-5 * norm);
+        REQUIRE(potential[i] ==
+                Catch::Approx(reference_potential[i]).epsilon(1e-5));
+        ++i;
+    }
+}
+
+TEST_CASE("AoSoA kernel matches the SoA kernel", "[physics]") {
+    /// sizes leaving the last block incomplete and spanning several tasks
+    for (std::size_t n : {1u, 7u, 33u, 1500u}) {
+        check_direct_aosoa<4>(n);
+        check_direct_aosoa<16>(n);
+        check_direct_aosoa<64>(n);
+    }
+}
+
+/// ==================== execution policy tests ====================
+namespace {
+/// @brief sets an execution policy for the scope of a test
+struct scoped_execution {
+    explicit scoped_execution(nbody::detail::execution_policy p)
+        : saved(nbody::detail::active_execution()) {
+        nbody::detail::set_execution(p);
+    }
+    ~scoped_execution() { nbody::detail::set_execution(saved); }
+    nbody::detail::execution_policy saved;
+};
+}  // namespace
+
+TEST_CASE("execution policy names and grains", "[physics][execution]") {
+    using nbody::detail::partitioner;
+    using nbody::detail::ranges;
+    for (auto p :
+         {partitioner::automatic, partitioner::affinity, partitioner::fixed})
+        REQUIRE(nbody::detail::parse_partitioner(
+                    nbody::detail::partitioner_name(p)) == p);
+    for (auto r : {ranges::automatic, ranges::one, ranges::two})
+        REQUIRE(nbody::detail::parse_ranges(nbody::detail::ranges_name(r)) ==
+                r);
+    REQUIRE_THROWS_AS(nbody::detail::parse_partitioner("simple"),
+                      std::invalid_argument);
+    REQUIRE_THROWS_AS(nbody::detail::parse_ranges("3d"),
+                      std::invalid_argument);
+
+    REQUIRE(nbody::detail::grain_of(256) == 256);
+    const scoped_execution scope({1000, partitioner::automatic});
+    REQUIRE(nbody::detail::grain_of(256) == 1000);
+    /// the policy grain counts particles, blocks hold several of them
+    REQUIRE(nbody::detail::grain_of(256, 16) == 62);
+    REQUIRE(nbody::detail::grain_of(256, 4096) == 1);
+}
+
+TEST_CASE("serial scopes run the passes in one chunk", "[physics][execution]") {
+    const scoped_execution scope(
+        {1, nbody::detail::partitioner::automatic, nbody::detail::ranges::two});
+    REQUIRE(nbody::detail::split_sources(1));
+    {
+        const nbody::detail::serial_scope serial;
+        REQUIRE(nbody::detail::serial_passes());
+        REQUIRE_FALSE(nbody::detail::split_sources(1));
+        int chunks = 0;
+        std::size_t covered = 0;
+        nbody::detail::parallel_for(
+            0, 10000, 1, [&](const tbb::blocked_range<std::size_t>& r) {
+                ++chunks;
+                covered += r.size();
+            });
+        REQUIRE(chunks == 1);
+        REQUIRE(covered == 10000);
+    }
+    REQUIRE_FALSE(nbody::detail::serial_passes());
+}
+
+TEMPLATE_TEST_CASE("direct sums agree under every partitioner and splitting",
+                   "[physics][execution]", SoA_system, SoA_dual, SoA_mixed,
+                   SoA_compensated, SoA_arena, AoSoA_system) {
+    using nbody::detail::partitioner;
+    using nbody::detail::ranges;
+    /// several j tiles, so that the 2D split has several source chunks
+    constexpr int n = 3000;
+    /// the chunks of the split are added in the accumulation type, wider
+    /// ones only differ from the unsplit sums by the final rounding
+    const double tol =
+        std::same_as<nbody::precision::system_accum_t<TestType>,
+                     typename TestType::value_type>
+            ? 1e-5
+            : 1e-6;
+    TestType reference;
+    nbody::utils::init_galaxy(reference, n, 42);
+    std::vector<double> reference_potential(n);
+    {
+        const scoped_execution scope({0, partitioner::automatic, ranges::one});
+        nbody::physics::compute_accelerations(reference, reference_potential);
+    }
+
+    for (auto p :
+         {partitioner::automatic, partitioner::affinity, partitioner::fixed}) {
+        for (auto r : {ranges::one, ranges::two}) {
+            for (std::size_t grain : {0u, 100u}) {
+                const scoped_execution scope({grain, p, r});
+                TestType s;
+                nbody::utils::init_galaxy(s, n, 42);
+                std::vector<double> potential(n);
+                nbody::physics::compute_accelerations(s, potential);
+
+                auto it = reference.begin();
+                std::size_t i = 0;
+                for (const auto& q : s) {
+                    const auto& e = *it++;
+                    const double norm =
+                        std::sqrt(double(e.ax) * e.ax + double(e.ay) * e.ay +
+                                  double(e.az) * e.az);
+                    REQUIRE(std::abs(double(q.ax) - e.ax) <= tol * norm);
+                    REQUIRE(std::abs(double(q.ay) - e.ay) <= tol * norm);
+                    REQUIRE(std::abs(double(q.az) - e.az) <= tol * norm);
+                    REQUIRE(potential[i] ==
+                            Catch::Approx(reference_potential[i])
+                                .epsilon(1e-5));
+                    ++i;
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("active instruction set is supported by the CPU", "[physics]") {
+    REQUIRE(nbody::detail::cpu_supports(nbody::detail::active_isa()));
+}
+
+/// ==================== active set tests ====================
+TEMPLATE_TEST_CASE("compute_accelerations_active updates the active particles",
+                   "[physics]", SoA_system, AoS_system, SoA_dual,
+                   AoSoA_system) {
+    TestType s;
+    TestType reference;
+    nbody::utils::init_galaxy(s, 700, 3);
+    nbody::utils::init_galaxy(reference, 700, 3);
+    nbody::physics::compute_accelerations(reference);
+
+    std::vector<std::size_t> active;
+    for (std::size_t i = 0; i < s.size(); i += 3) active.push_back(i);
+    nbody::physics::compute_accelerations_active(
+        s, std::span<const std::size_t>(active));
+
+    auto first = s.begin();
+    auto expected = reference.begin();
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        const auto& p = first[i];
+        const auto& q = expected[i];
+        if (i % 3 == 0) {
+            const double norm =
+                std::sqrt(double(q.ax) * q.ax + double(q.ay) * q.ay +
+                          double(q.az) * q.az);
+            REQUIRE(std::abs(double(p.ax) - q.ax) <= 1e-4 * norm);
+            REQUIRE(std::abs(double(p.az) - q.az) <= 1e-4 * norm);
+        } else {
+            REQUIRE(p.ax == 0);
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("compute_accelerations_and_jerks", "[physics]", SoA_dual,
+                   AoS_dual, SoA_system) {
+    using T = typename TestType::value_type;
+    constexpr double G = nbody::constants::G_v<double>;
+    constexpr double soft = nbody::constants::soft_v<double>;
+
+    SECTION("circular motion: the jerk is orthogonal to the separation") {
+        TestType s;
+        s.add_particle({0, 0, 0, 0, 0, 0, 0, 0, 0, 1e10, 0});
+        s.add_particle({1, 0, 0, 0, 2, 0, 0, 0, 0, 1, 0});
+
+        nbody::physics::jerk_columns<T> jerk;
+        nbody::physics::compute_accelerations_and_jerks(s, jerk);
+
+        const double r2 = 1.0 + soft * soft;
+        const double inv_r3 = 1.0 / (r2 * std::sqrt(r2));
+        auto p1 = s.begin()[1];
+        REQUIRE(double(p1.ax) == Catch::Approx(-G * 1e10 * inv_r3));
+        REQUIRE(double(jerk.y[1]) == Catch::Approx(-G * 1e10 * 2 * inv_r3));
+        REQUIRE(double(jerk.x[1]) == Catch::Approx(0.0).margin(1e-12));
+        /// the jerk of the central body mirrors the one of the light body
+        REQUIRE(double(jerk.y[0]) == Catch::Approx(G * 2 * inv_r3));
+    }
+
+    SECTION("matches the finite difference of the accelerations") {
+        TestType s;
+        TestType moved;
+        nbody::utils::init_galaxy(s, 300, 11);
+        nbody::physics::jerk_columns<T> jerk;
+        nbody::physics::compute_accelerations_and_jerks(s, jerk);
+
+        /// central difference over +-h
+        constexpr float h = 20.0f;
+        TestType before = s;
+        TestType after = s;
+        nbody::physics::update_positions(before, -h);
+        nbody::physics::update_positions(after, h);
+        nbody::physics::compute_accelerations(before);
+        nbody::physics::compute_accelerations(after);
+
+        auto b = before.begin();
+        auto a = after.begin();
+        for (std::size_t i = 1; i < s.size(); ++i) {
+            const double fd = (double(a[i].ax) - double(b[i].ax)) / (2 * h);
+            const double norm = std::sqrt(double(jerk.x[i]) * jerk.x[i] +
+                                          double(jerk.y[i]) * jerk.y[i] +
+                                          double(jerk.z[i]) * jerk.z[i]);
+            REQUIRE(std::abs(fd - jerk.x[i]) <= 1e-2 * norm);
+        }
+    }
+}
+
+/// ============ compute_accelerations_symmetric tests =============
+TEMPLATE_TEST_CASE("compute_accelerations_symmetric", "[physics]", SoA_system,
+                   AoS_system) {
+    SECTION("two particles accelerate towards each other") {
+        TestType s;
+        s.add_particle({0, 0, 0, 0, 0, 0, 0, 0, 0, 1.0f, 0.1f});
+        s.add_particle({1, 0, 0, 0, 0, 0, 0, 0, 0, 2.0f, 0.1f});
+
+        nbody::physics::compute_accelerations_symmetric(s);
+
+        constexpr float G = nbody::constants::G;
+        constexpr float soft = nbody::constants::soft;
+        float r2 = 1.0f + soft * soft;
+        float expected = G / (r2 * std::sqrt(r2));
+
+        auto p0 = *s.begin();
+        auto p1 = *std::next(s.begin(), 1);
+        REQUIRE(p0.ax == Catch::Approx(2.0f * expected).epsilon(1e-5));
+        REQUIRE(p1.ax == Catch::Approx(-expected).epsilon(1e-5));
+    }
+
+    SECTION("matches the direct summation over several blocks") {
+        TestType s;
+        TestType reference;
+        nbody::utils::init_galaxy(s, 1000, 42);
+        nbody::utils::init_galaxy(reference, 1000, 42);
+
+        nbody::physics::compute_accelerations_symmetric(s);
+        nbody::physics::compute_accelerations(reference);
+
+        auto it = reference.begin();
+        for (auto&& p : s) {
+            const auto& q = *it++;
+            const double norm =
+                std::sqrt(double(q.ax) * q.ax + double(q.ay) * q.ay +
+                          double(q.az) * q.az);
+            REQUIRE(std::abs(double(p.ax) - q.ax) <= 1e-4 * norm);
+            REQUIRE(std::abs(double(p.ay) - q.ay) <= 1e-4 * norm);
+            REQUIRE(std::abs(double(p.az) - q.az) <= 1e-4 * norm);
+        }
+    }
+}
+
 /// ==================== update_velocities tests ====================
 
-TEMPLATE_TEST_CASE("update_velocities", "[physics]", SoA_system, AoS_system) {
+TEMPLATE_TEST_CASE("update_velocities", "[physics]", SoA_system, AoS_system,
+                   AoSoA_system) {
     TestType s;
     // particle with known acceleration
     s.add_particle({0, 0, 0, 0, 0, 0, 2, 4, 6, 1.0f, 0.1f});
@@ -84,7 +521,8 @@ TEMPLATE_TEST_CASE("update_velocities", "[physics]", SoA_system, AoS_system) {
 }
 
 /// ==================== update_positions tests ====================
-TEMPLATE_TEST_CASE("update_positions", "[physics]", SoA_system, AoS_system) {
+TEMPLATE_TEST_CASE("update_positions", "[physics]", SoA_system, AoS_system,
+                   AoSoA_system) {
     TestType s;
     // particle with known velocity
     s.add_particle({0, 0, 0, 3, 6, 9, 0, 0, 0, 1.0f, 0.1f});
@@ -99,7 +537,7 @@ TEMPLATE_TEST_CASE("update_positions", "[physics]", SoA_system, AoS_system) {
 
 /// ============ update_positions_and_velocities tests =============
 TEMPLATE_TEST_CASE("update_positions_and_velocities", "[physics]", SoA_system,
-                   AoS_system) {
+                   AoS_system, AoSoA_system) {
     TestType s;
     // particle with known velocity and acceleration
     s.add_particle({0, 0, 0, 1, 0, 0, 2, 0, 0, 1.0f, 0.1f});
@@ -112,3 +550,96 @@ TEMPLATE_TEST_CASE("update_positions_and_velocities", "[physics]", SoA_system,
     // v = v + a * dt = 1 + 2 * 1 = 3
     REQUIRE(p.vx == Catch::Approx(3.0f));
 }
+
+/// ==================== kick_drift tests ====================
+TEMPLATE_TEST_CASE("kick_drift", "[physics]", SoA_system, AoS_system,
+                   AoSoA_system) {
+    TestType s;
+    // particle with known velocity and acceleration
+    s.add_particle({0, 0, 0, 1, 0, 0, 2, 0, 0, 1.0f, 0.1f});
+
+    nbody::physics::kick_drift(s, 0.5f, 2.0f);
+
+    auto p = *s.begin();
+    // v = v + a * dt_kick = 1 + 2 * 0.5 = 2
+    REQUIRE(p.vx == Catch::Approx(2.0f));
+    // q = q + v * dt_drift = 0 + 2 * 2 = 4
+    REQUIRE(p.qx == Catch::Approx(4.0f));
+}
+
+TEMPLATE_TEST_CASE("kick_drift of blocked systems matches the SoA one",
+                   "[physics]", AoSoA_system, AoS_system) {
+    /// full blocks and a partial last one
+    TestType s;
+    SoA_system reference;
+    nbody::utils::init_galaxy(s, 1001, 42);
+    nbody::utils::init_galaxy(reference, 1001, 42);
+    /// same accelerations in both, the force kernels differing in rounding
+    auto accelerate = [](auto& system) {
+        for (auto&& p : system) {
+            p.ax = p.vy;
+            p.ay = p.vz;
+            p.az = p.vx;
+        }
+    };
+    accelerate(s);
+    accelerate(reference);
+
+    nbody::physics::kick_drift(s, 0.5f, 2.0f);
+    nbody::physics::kick_drift(reference, 0.5f, 2.0f);
+
+    auto it = reference.begin();
+    for (auto&& p : s) {
+        auto&& q = *it++;
+        REQUIRE(p.vx == Catch::Approx(q.vx));
+        REQUIRE(p.vz == Catch::Approx(q.vz));
+        REQUIRE(p.qx == Catch::Approx(q.qx));
+        REQUIRE(p.qy == Catch::Approx(q.qy));
+    }
+}
+
+TEMPLATE_TEST_CASE("update passes cover systems spanning several tasks",
+                   "[physics]", SoA_system, AoS_system, AoSoA_system) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 10000, 42);
+    for (auto&& p : s) p.ax = p.ay = p.az = 1.0f;
+
+    nbody::physics::update_velocities(s, 2.0f);
+
+    TestType reference;
+    nbody::utils::init_galaxy(reference, 10000, 42);
+    auto it = reference.begin();
+    for (auto&& p : s) {
+        auto&& q = *it++;
+        REQUIRE(p.vx == Catch::Approx(q.vx + 2.0f));
+        REQUIRE(p.vz == Catch::Approx(q.vz + 2.0f));
+    }
+}
+
+TEMPLATE_TEST_CASE("update passes cover the particles under every partitioner",
+                   "[physics][execution]", SoA_system, AoS_system,
+                   AoSoA_system) {
+    using nbody::detail::partitioner;
+    for (auto p :
+         {partitioner::automatic, partitioner::affinity, partitioner::fixed}) {
+        /// grains below and above the width of the AoSoA blocks
+        for (std::size_t grain : {1u, 7u, 5000u}) {
+            const scoped_execution scope({grain, p});
+            TestType s;
+            nbody::utils::init_galaxy(s, 1001, 42);
+            for (auto&& q : s) q.ax = q.ay = q.az = 1.0f;
+            nbody::physics::update_velocities(s, 2.0f);
+            nbody::physics::update_velocities(s, 2.0f);
+
+            TestType reference;
+            nbody::utils::init_galaxy(reference, 1001, 42);
+            auto it = reference.begin();
+            for (auto&& q : s) {
+                auto&& e = *it++;
+                REQUIRE(q.vx == Catch::Approx(e.vx + 4.0f));
+                REQUIRE(q.vz == Catch::Approx(e.vz + 4.0f));
+            }
+        }
+    }
+}
+
@@ -0,0 +1,176 @@
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_template_test_macros.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "detail/execution.hpp"
+#include "particles.hpp"
+#include "physics/barnes_hut.hpp"
+#include "physics/compute_accelerations.hpp"
+#include "physics/fmm.hpp"
+#include "physics/octree.hpp"
+#include "utils/init_galaxy.hpp"
+
+/// useful aliases for better clarity during testing, tests can be later
+/// extended to other vector-like containers
+using AoS_system = nbody::System<std::vector, float, AoS>;
+using SoA_system = nbody::System<std::vector, float, SoA>;
+
+/// tests for the tree codes of the physics directory
+
+/// relative error on the acceleration vector of each particle between two
+/// systems with identical positions
+template <typename System>
+std::vector<double> relative_errors(System& reference, System& approx) {
+    std::vector<double> errors;
+    auto it = approx.begin();
+    for (auto&& p : reference) {
+        auto&& q = *it;
+        ++it;
+        const double dx = double(q.ax) - p.ax;
+        const double dy = double(q.ay) - p.ay;
+        const double dz = double(q.az) - p.az;
+        const double norm =
+            std::sqrt(double(p.ax) * p.ax + double(p.ay) * p.ay +
+                      double(p.az) * p.az);
+        errors.push_back(std::sqrt(dx * dx + dy * dy + dz * dz) / norm);
+    }
+    return errors;
+}
+
+/// ==================== octree tests ====================
+TEMPLATE_TEST_CASE("octree partitions every body", "[tree]", SoA_system,
+                   AoS_system) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 1000, 42);
+
+    nbody::physics::Octree<float> tree(8);
+    tree.build(s);
+
+    const auto& nodes = tree.nodes();
+    REQUIRE(tree.size() == 1000);
+    REQUIRE(nodes.front().count == 1000);
+
+    SECTION("root mass is the total mass") {
+        double mass = 0;
+        for (auto&& p : s) mass += p.m;
+        REQUIRE(nodes.front().mass == Catch::Approx(mass).epsilon(1e-5));
+    }
+
+    SECTION("leaves cover all bodies exactly once") {
+        std::vector<int> seen(1000, 0);
+        for (const auto& node : nodes) {
+            if (!node.is_leaf()) continue;
+            REQUIRE(node.count <= 8u);
+            for (auto b = node.first; b != node.first + node.count; ++b)
+                ++seen[tree.order()[b]];
+        }
+        for (auto c : seen) REQUIRE(c == 1);
+    }
+
+    SECTION("bodies lie inside their leaf cell") {
+        for (const auto& node : nodes) {
+            if (!node.is_leaf()) continue;
+            for (auto b = node.first; b != node.first + node.count; ++b) {
+                REQUIRE(std::abs(tree.x()[b] - node.cx) <= node.half * 1.001f);
+                REQUIRE(std::abs(tree.y()[b] - node.cy) <= node.half * 1.001f);
+                REQUIRE(std::abs(tree.z()[b] - node.cz) <= node.half * 1.001f);
+            }
+        }
+    }
+}
+
+/// ==================== barnes_hut tests ====================
+TEMPLATE_TEST_CASE("barnes_hut matches the direct summation", "[tree]",
+                   SoA_system, AoS_system) {
+    TestType direct;
+    TestType tree;
+    nbody::utils::init_galaxy(direct, 2000, 42);
+    nbody::utils::init_galaxy(tree, 2000, 42);
+
+    nbody::physics::compute_accelerations(direct);
+
+    SECTION("theta = 0 degenerates to the direct summation") {
+        nbody::physics::barnes_hut<float> solver(0.0f);
+        solver(tree);
+        for (auto e : relative_errors(direct, tree))
+            REQUIRE(e < 1e-3);
+    }
+
+    SECTION("theta = 0.5 stays accurate") {
+        nbody::physics::barnes_hut<float> solver(0.5f);
+        solver(tree);
+        auto errors = relative_errors(direct, tree);
+        double mean = 0;
+        for (auto e : errors) mean += e;
+        mean /= double(errors.size());
+        REQUIRE(mean < 1e-2);
+    }
+}
+
+/// ==================== fmm tests ====================
+TEMPLATE_TEST_CASE("fmm matches the direct summation", "[tree]", SoA_system,
+                   AoS_system) {
+    TestType direct;
+    TestType tree;
+    nbody::utils::init_galaxy(direct, 3000, 42);
+    nbody::utils::init_galaxy(tree, 3000, 42);
+
+    nbody::physics::compute_accelerations(direct);
+
+    auto median_error = [&](unsigned order) {
+        nbody::physics::fmm<float> solver(order, 0.5f, 16);
+        solver(tree);
+        auto errors = relative_errors(direct, tree);
+        std::nth_element(errors.begin(), errors.begin() + errors.size() / 2,
+                         errors.end());
+        return errors[errors.size() / 2];
+    };
+
+    SECTION("default order is accurate") { REQUIRE(median_error(4) < 1e-2); }
+
+    SECTION("higher orders are more accurate") {
+        REQUIRE(median_error(6) < median_error(2));
+    }
+}
+
+/// ==================== execution tests ====================
+TEMPLATE_TEST_CASE("tree solvers agree under every partitioner and serially",
+                   "[tree][execution]", SoA_system, AoS_system) {
+    using nbody::detail::partitioner;
+    const auto saved = nbody::detail::active_execution();
+
+    auto accelerations = [](auto&& solver) {
+        TestType s;
+        nbody::utils::init_galaxy(s, 3000, 42);
+        solver(s);
+        std::vector<float> a;
+        for (auto&& p : s) a.insert(a.end(), {p.ax, p.ay, p.az});
+        return a;
+    };
+    auto solvers = [&] {
+        return std::vector{
+            accelerations(nbody::physics::barnes_hut<float>(0.5f)),
+            accelerations(nbody::physics::fmm<float>(4, 0.5f, 16))};
+    };
+
+    const auto reference = solvers();
+    auto check = [&](const std::vector<std::vector<float>>& result) {
+        for (std::size_t k = 0; k < reference.size(); ++k)
+            for (std::size_t i = 0; i < reference[k].size(); ++i)
+                REQUIRE(result[k][i] ==
+                        Catch::Approx(reference[k][i]).epsilon(1e-5));
+    };
+    for (auto p :
+         {partitioner::automatic, partitioner::affinity, partitioner::fixed}) {
+        nbody::detail::set_execution({100, p});
+        check(solvers());
+    }
+    nbody::detail::set_execution(saved);
+    {
+        const nbody::detail::serial_scope serial;
+        check(solvers());
+    }
+}
@@ -1,17 +1,46 @@
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <sched.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iterator>
+#include <numeric>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "constants.hpp"
 #include "particles.hpp"
+#include "physics/compute_accelerations.hpp"
+#include "precision.hpp"
+#include "utils/affinity.hpp"
+#include "utils/checkpoint.hpp"
 #include "utils/compute_energy.hpp"
+#include "utils/ensemble.hpp"
 #include "utils/init_galaxy.hpp"
+#include "utils/profiler.hpp"
+#include "utils/reorder.hpp"
+#include "utils/snapshot.hpp"
+#include "utils/snapshot_codec.hpp"
 /// useful aliases for better clarity during testing, tests can be later
 /// extended to other vector-like containers
 using AoS_system = nbody::System<std::vector, float, AoS>;
 using SoA_system = nbody::System<std::vector, float, SoA>;
+using AoSoA_system = nbody::System<std::vector, float, AoSoA<>>;
+using SoA_arena = nbody::System<nbody::aligned_vector, float, SoA>;
 
 /// tests for the utils directory free methods
 
@@ -73,7 +102,7 @@ TEMPLATE_TEST_CASE("init_galaxy initializes particles correctly", "[init]",
 
 /// ==================== comoute_energy tests ====================
 TEMPLATE_TEST_CASE("correct energy for a two-body system", "[energy]",
-                   SoA_system, AoS_system) {
+                   SoA_system, AoS_system, AoSoA_system) {
     TestType s;
     // particle 1: mass 1kg, velocity (3,4,0) → KE = 0.5 * 1 * 25 = 12.5
     s.add_particle({0, 0, 0,  // at origin
@@ -91,6 +120,757 @@ TEMPLATE_TEST_CASE("correct energy for a two-body system", "[energy]",
     constexpr double KE = 0.5 * 1.0 * 25.0;
     constexpr double PE = -nbody::constants::G * 1.0 * 2.0 / 1.0;
 
-    REQUIRE(nbody::utils::compute_energy(s) ==
+    /// read-only systems, through their const iterators
+    const TestType& system = s;
+    REQUIRE(nbody::utils::compute_energy(system) ==
             Catch::Approx(KE + PE).epsilon(1e-5));
 }
+
+/// ==================== precision policies tests ====================
+TEST_CASE("compensated accumulator keeps the bits lost by float sums",
+          "[precision]") {
+    float plain = 0.0f;
+    nbody::precision::compensated<float> acc;
+    for (int i = 0; i < 1'000'000; ++i) {
+        plain += 0.1f;
+        nbody::precision::accumulate(acc, 0.1f);
+    }
+    /// 0.1f is slightly above 0.1
+    const double exact = 1e6 * double(0.1f);
+    REQUIRE(std::abs(nbody::precision::value(acc) - exact) < 1e-3);
+    REQUIRE(std::abs(double(plain) - exact) > 1.0);
+}
+
+TEST_CASE("energy errors stay within the rounding bounds of their policy",
+          "[precision][energy]") {
+    constexpr int n = 3000;
+    using Single = nbody::System<std::vector, nbody::precision::single, SoA>;
+    using Mixed = nbody::System<std::vector, nbody::precision::mixed, SoA>;
+    using Compensated =
+        nbody::System<std::vector, nbody::precision::compensated_single, AoS>;
+
+    Single single;
+    Mixed mixed;
+    Compensated compensated;
+    nbody::utils::init_galaxy(single, n, 42);
+    nbody::utils::init_galaxy(mixed, n, 42);
+    nbody::utils::init_galaxy(compensated, n, 42);
+
+    /// reference: same float initial conditions, summed in double
+    nbody::System<std::vector, double, SoA> reference;
+    for (auto&& p : single)
+        reference.add_particle({p.qx, p.qy, p.qz, p.vx, p.vy, p.vz, p.ax,
+                                p.ay, p.az, p.m, p.r});
+    const double e_ref = nbody::utils::compute_energy(reference);
+    double kinetic = 0.0;
+    for (auto&& p : reference)
+        kinetic += 0.5 * p.m * (p.vx * p.vx + p.vy * p.vy + p.vz * p.vz);
+
+    auto error = [&](double e) {
+        return std::abs(e - e_ref) / std::abs(e_ref);
+    };
+    /// first order bound of the relative error of the energy when every
+    /// term of the kinetic and potential sums, all of the same sign, carries
+    /// at most k float roundings
+    const double magnitude = kinetic + std::abs(kinetic - e_ref);
+    auto bound = [&](double k) {
+        return k * 0x1p-24 * magnitude / std::abs(e_ref);
+    };
+    /// a potential term rounds its differences, r^2, the inverse square root
+    /// and the mass product (the hardware estimate of the SIMD kernels adds
+    /// its Newton step), then the lanes of a row sum up to 256 / width terms
+    /// in float
+    const std::size_t width = nbody::detail::dispatch(
+        []<typename V>(V) { return V::width; });
+    const double terms = width > 1 ? 12.0 + 256.0 / double(width) : 8.0;
+
+    /// float sums add at most n roundings to every term, double and
+    /// float-float ones none at first order
+    const double e_single = error(nbody::utils::compute_energy(single));
+    const double e_mixed = error(nbody::utils::compute_energy(mixed));
+    const double e_compensated =
+        error(nbody::utils::compute_energy(compensated));
+    REQUIRE(e_single < bound(terms + n));
+    REQUIRE(e_mixed < bound(terms));
+    REQUIRE(e_compensated < bound(terms));
+
+    /// the scalar kernel sums no lanes in float and rounds its inverse
+    /// square root correctly: only the rounding of the terms is left
+    const auto saved = nbody::detail::active_isa();
+    nbody::detail::set_active_isa(nbody::detail::isa::scalar);
+    const double s_mixed = error(nbody::utils::compute_energy(mixed));
+    const double s_compensated =
+        error(nbody::utils::compute_energy(compensated));
+    nbody::detail::set_active_isa(saved);
+    REQUIRE(s_mixed < bound(8.0));
+    REQUIRE(s_compensated < bound(8.0));
+}
+
+/// ==================== fused energy tests ====================
+TEMPLATE_TEST_CASE("energy from the fused force pass matches compute_energy",
+                   "[energy]", SoA_system, AoS_system) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 1500, 42);
+
+    std::vector<double> potential(s.size());
+    nbody::physics::compute_accelerations(s, potential);
+
+    const double standalone = nbody::utils::compute_energy(s);
+    const double fused = nbody::utils::compute_energy(s, potential);
+    REQUIRE(fused == Catch::Approx(standalone).epsilon(1e-5));
+}
+
+TEMPLATE_TEST_CASE("compute_energy matches a plain pairwise sum", "[energy]",
+                   SoA_system, AoS_system) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 700, 3);
+
+    constexpr double G = nbody::constants::G_v<double>;
+    constexpr double soft = nbody::constants::soft_v<double>;
+    double expected = 0.0;
+    for (auto it = s.begin(); it != s.end(); ++it) {
+        auto&& pi = *it;
+        expected += 0.5 * double(pi.m) *
+                    (double(pi.vx) * pi.vx + double(pi.vy) * pi.vy +
+                     double(pi.vz) * pi.vz);
+        for (auto jt = it + 1; jt != s.end(); ++jt) {
+            auto&& pj = *jt;
+            const double dx = double(pi.qx) - pj.qx;
+            const double dy = double(pi.qy) - pj.qy;
+            const double dz = double(pi.qz) - pj.qz;
+            expected -= G * double(pi.m) * double(pj.m) /
+                        std::sqrt(dx * dx + dy * dy + dz * dz + soft * soft);
+        }
+    }
+    REQUIRE(double(nbody::utils::compute_energy(s)) ==
+            Catch::Approx(expected).epsilon(1e-5));
+}
+
+/// ==================== reorder tests ====================
+TEST_CASE("consecutive Hilbert keys are neighbouring cells", "[reorder]") {
+    /// cells of an 8^3 grid, coordinates in the top bits of the 21 bits
+    constexpr std::uint32_t side = 8, shift = 21 - 3;
+    struct cell {
+        std::uint64_t key;
+        int x, y, z;
+    };
+    std::vector<cell> cells;
+    for (std::uint32_t x = 0; x < side; ++x)
+        for (std::uint32_t y = 0; y < side; ++y)
+            for (std::uint32_t z = 0; z < side; ++z)
+                cells.push_back({nbody::utils::hilbert_key(
+                                     x << shift, y << shift, z << shift),
+                                 int(x), int(y), int(z)});
+    std::sort(cells.begin(), cells.end(),
+              [](const cell& a, const cell& b) { return a.key < b.key; });
+
+    for (std::size_t k = 1; k < cells.size(); ++k) {
+        const auto& a = cells[k - 1];
+        const auto& b = cells[k];
+        REQUIRE(a.key != b.key);
+        REQUIRE(std::abs(a.x - b.x) + std::abs(a.y - b.y) +
+                    std::abs(a.z - b.z) ==
+                1);
+    }
+}
+
+TEST_CASE("radix sort is a stable sort of the keys", "[reorder]") {
+    /// several chunks, keys drawn in a narrow range so that some passes are
+    /// skipped and many keys are equal
+    for (std::size_t n : {0u, 1u, 1000u, 100000u}) {
+        std::mt19937_64 rng(7);
+        std::vector<std::uint64_t> keys(n);
+        for (auto& k : keys) k = (rng() % 5000) << 20;
+        std::vector<std::uint32_t> values(n);
+        std::iota(values.begin(), values.end(), std::uint32_t{0});
+
+        std::vector<std::uint32_t> expected = values;
+        std::stable_sort(expected.begin(), expected.end(),
+                         [&](auto a, auto b) { return keys[a] < keys[b]; });
+
+        auto sorted = keys;
+        nbody::utils::detail::radix_sort(sorted, values);
+        REQUIRE(values == expected);
+        REQUIRE(std::is_sorted(sorted.begin(), sorted.end()));
+    }
+}
+
+TEMPLATE_TEST_CASE("reorder moves particles with their identifiers",
+                   "[reorder]", SoA_system, AoS_system, AoSoA_system,
+                   SoA_arena) {
+    TestType s;
+    TestType original;
+    nbody::utils::init_galaxy(s, 3000, 42);
+    nbody::utils::init_galaxy(original, 3000, 42);
+    const double e_initial = nbody::utils::compute_energy(s);
+
+    /// mean distance between particles neighbouring in memory
+    auto spread = [](TestType& system) {
+        double sum = 0.0;
+        auto it = system.begin();
+        for (std::size_t i = 1; i < system.size(); ++i) {
+            auto&& a = it[i - 1];
+            auto&& b = it[i];
+            sum += std::hypot(double(a.qx) - b.qx, double(a.qy) - b.qy,
+                              double(a.qz) - b.qz);
+        }
+        return sum / double(system.size() - 1);
+    };
+
+    for (auto c : {nbody::utils::curve::morton, nbody::utils::curve::hilbert}) {
+        const auto order = nbody::utils::reorder(s, c);
+        REQUIRE(order.size() == s.size());
+        REQUIRE(spread(s) < 0.25 * spread(original));
+
+        /// every particle is found through its identifier
+        auto ids = s.ids();
+        std::vector<bool> seen(s.size(), false);
+        auto it = s.begin();
+        auto jt = original.begin();
+        for (std::size_t k = 0; k < s.size(); ++k) {
+            REQUIRE_FALSE(seen[ids[k]]);
+            seen[ids[k]] = true;
+            auto&& p = it[k];
+            auto&& q = jt[ids[k]];
+            REQUIRE(p.qx == q.qx);
+            REQUIRE(p.vy == q.vy);
+            REQUIRE(p.m == q.m);
+        }
+    }
+    REQUIRE(nbody::utils::compute_energy(s) ==
+            Catch::Approx(e_initial).epsilon(1e-5));
+}
+
+TEST_CASE("reorder pass sorts the system every interval steps", "[reorder]") {
+    SoA_system s;
+    nbody::utils::init_galaxy(s, 500, 42);
+    nbody::utils::reorder_pass pass(3, nbody::utils::curve::morton);
+    REQUIRE_FALSE(pass(s));
+    REQUIRE_FALSE(pass(s));
+    REQUIRE(pass(s));
+    REQUIRE_FALSE(nbody::utils::reorder_pass{}(s));
+}
+
+/// ==================== checkpoint tests ====================
+/// @brief fresh path in the temporary directory
+static std::string checkpoint_path(const std::string& name) {
+    const auto path = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove(path);
+    return path.string();
+}
+
+TEMPLATE_TEST_CASE("checkpoints restore particles, identifiers and header",
+                   "[checkpoint]", SoA_system, AoS_system, AoSoA_system,
+                   SoA_arena) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 1001, 42);
+    nbody::utils::reorder(s);
+    const auto path = checkpoint_path("nbody_test.ckpt");
+
+    nbody::utils::write_checkpoint(
+        path, s,
+        {120, 1.2, 0.01, "leapfrog", "SoA", "single", "aligned", "barnes-hut",
+         "aarseth", 0.05, 0.7, 6});
+    REQUIRE_FALSE(std::filesystem::exists(path + ".tmp"));
+
+    const auto info = nbody::utils::read_checkpoint_info(path);
+    REQUIRE(info.step == 120);
+    REQUIRE(info.time == 1.2);
+    REQUIRE(info.dt == 0.01);
+    REQUIRE(info.integrator == "leapfrog");
+    REQUIRE(info.layout == "SoA");
+    REQUIRE(info.precision == "single");
+    REQUIRE(info.container == "aligned");
+    REQUIRE(info.solver == "barnes-hut");
+    REQUIRE(info.timestep == "aarseth");
+    REQUIRE(info.eta == 0.05);
+    REQUIRE(info.theta == 0.7);
+    REQUIRE(info.order == 6);
+    REQUIRE(info.size == 1001);
+
+    const auto r = nbody::utils::load_checkpoint<TestType>(path);
+    REQUIRE(r.size() == s.size());
+    auto it = s.begin();
+    auto jt = r.begin();
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        auto&& p = it[i];
+        auto&& q = jt[i];
+        REQUIRE(p.qx == q.qx);
+        REQUIRE(p.qz == q.qz);
+        REQUIRE(p.vy == q.vy);
+        REQUIRE(p.m == q.m);
+        REQUIRE(p.r == q.r);
+        REQUIRE(s.ids()[i] == r.ids()[i]);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("arena systems are stepped in place from the mapped checkpoint",
+          "[checkpoint]") {
+    SoA_arena s;
+    nbody::utils::init_galaxy(s, 100, 42);
+    const auto path = checkpoint_path("nbody_arena.ckpt");
+    nbody::utils::write_checkpoint(path, s, {});
+
+    {
+        auto r = nbody::utils::load_checkpoint<SoA_arena>(path);
+        REQUIRE(r.capacity() == r.padded_size());
+        for (auto f : {nbody::field::qx, nbody::field::m, nbody::field::r})
+            REQUIRE(reinterpret_cast<std::uintptr_t>(r.column(f).data()) %
+                        nbody::cache_line ==
+                    0);
+        REQUIRE(r.padded_column(nbody::field::m)[100] == 0.0f);
+
+        /// writes go to private pages, appended particles fill the padding
+        for (auto&& p : r) p.qx += 1.0f;
+        r.add_particle({1, 2, 3, 0, 0, 0, 0, 0, 0, 1, 1});
+        REQUIRE(r.size() == 101);
+        REQUIRE(r.ids()[100] == 100);
+        REQUIRE((*r.begin()).qx == (*s.begin()).qx + 1.0f);
+    }
+    const auto r = nbody::utils::load_checkpoint<SoA_arena>(path);
+    REQUIRE((*r.begin()).qx == (*s.begin()).qx);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("checkpoints convert between precisions", "[checkpoint]") {
+    nbody::System<std::vector, double, SoA> s;
+    nbody::utils::init_galaxy(s, 64, 42);
+    const auto path = checkpoint_path("nbody_double.ckpt");
+    nbody::utils::write_checkpoint(path, s, {});
+
+    const auto r = nbody::utils::load_checkpoint<SoA_arena>(path);
+    REQUIRE(r.size() == 64);
+    auto it = s.begin();
+    auto jt = r.begin();
+    for (std::size_t i = 0; i < s.size(); ++i)
+        REQUIRE((*jt++).qy == static_cast<float>((*it++).qy));
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("invalid checkpoints are rejected", "[checkpoint]") {
+    const auto path = checkpoint_path("nbody_invalid.ckpt");
+    REQUIRE_THROWS_AS(nbody::utils::read_checkpoint_info(path),
+                      std::runtime_error);
+
+    SoA_system s;
+    nbody::utils::init_galaxy(s, 100, 42);
+    nbody::utils::write_checkpoint(path, s, {});
+    std::filesystem::resize_file(path, 1024);
+    REQUIRE_THROWS_AS(nbody::utils::load_checkpoint<SoA_system>(path),
+                      std::runtime_error);
+
+    /// files of the first version have no run configuration
+    nbody::utils::write_checkpoint(path, s, {3, 0.1, 0.01, "verlet"});
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        const std::uint32_t version = 1;
+        f.seekp(8);
+        f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    }
+    const auto old = nbody::utils::read_checkpoint_info(path);
+    REQUIRE(old.integrator == "verlet");
+    REQUIRE(old.solver.empty());
+    REQUIRE(nbody::utils::load_checkpoint<SoA_system>(path).size() == 100);
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        const std::uint32_t version = 3;
+        f.seekp(8);
+        f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    }
+    REQUIRE_THROWS_AS(nbody::utils::read_checkpoint_info(path),
+                      std::runtime_error);
+
+    std::ofstream(path, std::ios::trunc) << std::string(512, 'x');
+    REQUIRE_THROWS_AS(nbody::utils::read_checkpoint_info(path),
+                      std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+/// ==================== snapshot tests ====================
+TEMPLATE_TEST_CASE("snapshots are written in order while the loop goes on",
+                   "[snapshot]", SoA_system, AoS_system, AoSoA_system,
+                   SoA_arena) {
+    TestType s;
+    nbody::utils::init_galaxy(s, 300, 42);
+
+    std::vector<nbody::utils::snapshot<float>> written;
+    nbody::utils::snapshot_writer<float> writer(
+        [&](const nbody::utils::snapshot<float>& frame) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            written.push_back(frame);
+        });
+    for (std::uint64_t step = 0; step < 6; ++step) {
+        (*s.begin()).qx = float(step);
+        writer.submit(s, step, 0.5 * double(step));
+    }
+    writer.flush();
+
+    const auto stats = writer.stats();
+    REQUIRE(stats.submitted == 6);
+    REQUIRE(stats.written == 6);
+    /// two buffers for a sink slower than the loop
+    REQUIRE(stats.stalls > 0);
+    REQUIRE(stats.stall_seconds > 0.0);
+    REQUIRE(stats.max_pending <= 2);
+
+    REQUIRE(written.size() == 6);
+    auto it = s.begin();
+    for (std::uint64_t step = 0; step < 6; ++step) {
+        const auto& frame = written[step];
+        REQUIRE(frame.step == step);
+        REQUIRE(frame.time == 0.5 * double(step));
+        REQUIRE(frame.size() == s.size());
+        REQUIRE(frame.column(nbody::field::qx)[0] == float(step));
+        for (std::size_t i = 1; i < s.size(); ++i) {
+            REQUIRE(frame.column(nbody::field::qy)[i] == it[i].qy);
+            REQUIRE(frame.column(nbody::field::m)[i] == it[i].m);
+            REQUIRE(frame.ids[i] == s.ids()[i]);
+        }
+    }
+}
+
+TEST_CASE("raw snapshot files are read back frame by frame", "[snapshot]") {
+    SoA_system s;
+    nbody::utils::init_galaxy(s, 100, 42);
+    const auto path = checkpoint_path("nbody_test.snap");
+    {
+        nbody::utils::snapshot_writer<float> writer(path);
+        writer.submit(s, 10, 0.1);
+        (*s.begin()).vz = 5.0f;
+        writer.submit(s, 20, 0.2);
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    nbody::utils::snapshot<float> frame;
+    REQUIRE(nbody::utils::read_frame(in, frame));
+    REQUIRE(frame.step == 10);
+    REQUIRE(frame.column(nbody::field::vz)[0] == 0.0f);
+    REQUIRE(nbody::utils::read_frame(in, frame));
+    REQUIRE(frame.step == 20);
+    REQUIRE(frame.time == 0.2);
+    REQUIRE(frame.column(nbody::field::vz)[0] == 5.0f);
+    REQUIRE(frame.column(nbody::field::r)[99] == (*(s.begin() + 99)).r);
+    REQUIRE_FALSE(nbody::utils::read_frame(in, frame));
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("failed snapshot writes reach the step loop", "[snapshot]") {
+    SoA_system s;
+    nbody::utils::init_galaxy(s, 10, 42);
+    nbody::utils::snapshot_writer<float> writer(
+        [](const nbody::utils::snapshot<float>&) {
+            throw std::runtime_error("disk full");
+        });
+    writer.submit(s, 1, 0.0);
+    REQUIRE_THROWS_AS(writer.flush(), std::runtime_error);
+    REQUIRE_THROWS_AS(writer.submit(s, 2, 0.0), std::runtime_error);
+}
+
+/// ==================== compressed snapshot tests ====================
+/// @brief frames of a system drifting along its velocities
+template <typename System>
+std::vector<nbody::utils::snapshot<float>> drifting_frames(System& s,
+                                                           int frames) {
+    std::vector<nbody::utils::snapshot<float>> out(frames);
+    for (int k = 0; k < frames; ++k) {
+        for (auto&& p : s) {
+            p.qx += 0.05f * p.vx;
+            p.qy += 0.05f * p.vy;
+            p.qz += 0.05f * p.vz;
+        }
+        out[k].assign(s, k, 0.05 * k);
+    }
+    return out;
+}
+
+TEST_CASE("compressed snapshots are error bounded and compact",
+          "[snapshot]") {
+    SoA_system s;
+    nbody::utils::init_galaxy(s, 2000, 42);
+    nbody::utils::reorder(s);
+    const auto frames = drifting_frames(s, 12);
+    const auto path = checkpoint_path("nbody_test.nbc");
+
+    nbody::utils::snapshot_codec_options options;
+    options.keyframe_interval = 5;
+    {
+        auto sink = nbody::utils::compressed_sink<float>(path, options);
+        for (const auto& f : frames) sink(f);
+    }
+
+    std::ostringstream raw;
+    for (const auto& f : frames) nbody::utils::write_frame(raw, f);
+    const auto compressed = std::filesystem::file_size(path);
+    REQUIRE(double(raw.str().size()) / double(compressed) > 8.0);
+
+    /// bounds of the grids of the first frame, a keyframe
+    auto extent = [&](std::size_t group) {
+        double e = 0.0;
+        for (auto f = group; f < group + 3; ++f) {
+            const auto c = frames[0].column(static_cast<nbody::field>(f));
+            const auto [lo, hi] = std::minmax_element(c.begin(), c.end());
+            e = std::max(e, double(*hi) - *lo);
+        }
+        return e;
+    };
+    const double q_bound = options.position_error * extent(0);
+    const double v_bound = options.velocity_error * extent(3);
+
+    nbody::utils::snapshot_reader<float> reader(path);
+    REQUIRE(reader.frames() == frames.size());
+    nbody::utils::snapshot<float> frame;
+    for (std::size_t k : {7, 2, 3, 11, 0, 4, 5}) {
+        reader.read(k, frame);
+        const auto& expected = frames[k];
+        REQUIRE(frame.step == expected.step);
+        REQUIRE(frame.time == expected.time);
+        REQUIRE(frame.ids == expected.ids);
+        for (std::size_t i = 0; i < frame.size(); ++i) {
+            using nbody::field;
+            auto close = [&](field f, double bound) {
+                const double d = std::abs(double(frame.column(f)[i]) -
+                                          expected.column(f)[i]);
+                /// rounding of the float result on top of the grid error
+                return d <= bound + 1e-6 * std::abs(expected.column(f)[i]);
+            };
+            REQUIRE(close(field::qx, q_bound));
+            REQUIRE(close(field::qz, q_bound));
+            REQUIRE(close(field::vy, v_bound));
+            REQUIRE(frame.column(field::m)[i] == expected.column(field::m)[i]);
+            REQUIRE(frame.column(field::ax)[i] == 0.0f);
+            REQUIRE(frame.column(field::r)[i] == 0.0f);
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("compressed snapshots keep the fields selected bit for bit",
+          "[snapshot]") {
+    nbody::System<std::vector, double, SoA> s;
+    nbody::utils::init_galaxy(s, 500, 42);
+
+    nbody::utils::snapshot_codec_options options;
+    options.fields = nbody::utils::mask_of({nbody::field::m, nbody::field::r,
+                                            nbody::field::ax});
+    nbody::utils::snapshot_encoder<double> encoder(options);
+    const auto path = checkpoint_path("nbody_fields.nbc");
+    nbody::utils::snapshot<double> first, second;
+    first.assign(s, 1, 0.1);
+    /// reordered particles start a new keyframe
+    nbody::utils::reorder(s);
+    second.assign(s, 2, 0.2);
+    {
+        std::ofstream out(path, std::ios::binary);
+        encoder.encode(first, out);
+        encoder.encode(second, out);
+    }
+
+    nbody::utils::snapshot_reader<float> reader(path);
+    REQUIRE(reader.frames() == 2);
+    nbody::utils::snapshot<float> frame;
+    reader.read(1, frame);
+    REQUIRE(frame.ids == second.ids);
+    for (std::size_t i = 0; i < frame.size(); ++i) {
+        using nbody::field;
+        REQUIRE(frame.column(field::m)[i] ==
+                static_cast<float>(second.column(field::m)[i]));
+        REQUIRE(frame.column(field::r)[i] ==
+                static_cast<float>(second.column(field::r)[i]));
+        REQUIRE(frame.column(field::qx)[i] == 0.0f);
+    }
+    std::filesystem::remove(path);
+
+    options.velocity_error = 0.0;
+    REQUIRE_THROWS_AS(nbody::utils::snapshot_encoder<float>(options),
+                      std::invalid_argument);
+}
+
+/// ==================== profiler tests ====================
+TEST_CASE("profiler totals phases and tasks and exports a timeline",
+          "[profile]") {
+    auto& profiler = nbody::utils::profiler::instance();
+    profiler.reset();
+    {
+        nbody::utils::profile_phase step("test_step");
+        for (int k = 0; k < 3; ++k) {
+            nbody::utils::profile_phase kick("test_kick");
+            REQUIRE(std::string(profiler.current_phase()) == "test_kick");
+            tbb::parallel_for(0, 64, [](int) {
+                nbody::utils::profile_task task;
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            });
+        }
+        /// nested phases hand the current one back when they close
+        REQUIRE(std::string(profiler.current_phase()) == "test_step");
+    }
+
+    std::ostringstream summary;
+    profiler.summary(summary);
+    const auto text = summary.str();
+    REQUIRE(text.find("test_step") != std::string::npos);
+    REQUIRE(text.find("test_kick") != std::string::npos);
+    /// three calls of the inner phase, one of the outer one
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream row(line);
+        std::string name;
+        std::size_t calls = 0;
+        if (!(row >> name >> calls)) continue;
+        if (name == "test_kick") REQUIRE(calls == 3);
+        if (name == "test_step") REQUIRE(calls == 1);
+    }
+    /// counters may be missing on this machine, never wrong when present
+    const auto c = profiler.read();
+    for (std::size_t e = 0; e < nbody::utils::counters::events; ++e)
+        if (!c.available[e]) REQUIRE(c.value[e] == 0);
+
+    const auto path =
+        (std::filesystem::temp_directory_path() / "nbody_test_trace.json")
+            .string();
+    profiler.write_trace(path);
+    std::ifstream in(path);
+    const std::string trace((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+    REQUIRE(trace.find("\"traceEvents\"") != std::string::npos);
+    REQUIRE(trace.find("\"test_kick\"") != std::string::npos);
+    REQUIRE(trace.find("\"ph\": \"X\"") != std::string::npos);
+    std::filesystem::remove(path);
+
+    profiler.reset();
+    std::ostringstream empty;
+    profiler.summary(empty);
+    REQUIRE(empty.str().find("test_kick") == std::string::npos);
+    REQUIRE_THROWS_AS(profiler.write_trace("/nonexistent/dir/trace.json"),
+                      std::runtime_error);
+}
+
+/// ==================== affinity tests ====================
+TEST_CASE("pinned arenas pin their threads and restore them", "[affinity]") {
+    using nbody::utils::pinning;
+    REQUIRE(nbody::utils::parse_pinning("spread") == pinning::spread);
+    REQUIRE_THROWS_AS(nbody::utils::parse_pinning("everywhere"),
+                      std::invalid_argument);
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    const auto count = static_cast<std::size_t>(CPU_COUNT(&allowed));
+    for (auto p : {pinning::compact, pinning::spread}) {
+        /// both orders are permutations of the CPUs the process may use
+        auto order = nbody::utils::cpu_order(p);
+        REQUIRE(order.size() == count);
+        std::sort(order.begin(), order.end());
+        REQUIRE(std::adjacent_find(order.begin(), order.end()) ==
+                order.end());
+        for (int cpu : order) REQUIRE(CPU_ISSET(cpu, &allowed));
+    }
+
+    nbody::utils::pinned_arena arena(2, pinning::compact);
+    REQUIRE(arena.max_concurrency() == 2);
+    const auto cpus = arena.cpus();
+    std::vector<int> seen(2, -1);
+    arena.execute([&] {
+        tbb::parallel_for(0, 64, [&](int) {
+            const int slot = tbb::this_task_arena::current_thread_index();
+            cpu_set_t mine;
+            CPU_ZERO(&mine);
+            sched_getaffinity(0, sizeof(mine), &mine);
+            if (CPU_COUNT(&mine) == 1)
+                for (int cpu : cpus)
+                    if (CPU_ISSET(cpu, &mine)) seen[std::size_t(slot)] = cpu;
+        });
+    });
+    /// the calling thread joined as slot 0, on the first CPU of the order
+    REQUIRE(seen[0] == cpus[0]);
+    cpu_set_t after;
+    CPU_ZERO(&after);
+    REQUIRE(sched_getaffinity(0, sizeof(after), &after) == 0);
+    REQUIRE(CPU_EQUAL(&after, &allowed));
+}
+
+/// ==================== ensemble tests ====================
+TEST_CASE("ensemble configurations are parsed line by line", "[ensemble]") {
+    std::istringstream in(
+        "# sweep over seeds\n"
+        "\n"
+        "n=500 steps=20 dt=0.005 integrator=yoshida4 repeat=3 seed=7\n"
+        "name=ref layout=AoS precision=double  # defaults otherwise\n");
+    const auto runs = nbody::utils::read_ensemble(in);
+    REQUIRE(runs.size() == 4);
+    for (std::size_t k = 0; k < 3; ++k) {
+        REQUIRE(runs[k].n == 500);
+        REQUIRE(runs[k].steps == 20);
+        REQUIRE(runs[k].dt == 0.005f);
+        REQUIRE(runs[k].integrator == "yoshida4");
+        REQUIRE(runs[k].seed == 7 + k);
+    }
+    const nbody::utils::run_config defaults;
+    REQUIRE(runs[3].name == "ref");
+    REQUIRE(runs[3].layout == "AoS");
+    REQUIRE(runs[3].precision == "double");
+    REQUIRE(runs[3].n == defaults.n);
+    REQUIRE(runs[3].integrator == defaults.integrator);
+
+    for (const char* line :
+         {"n=10 foo=1", "n", "n=-3", "n=12x", "dt=0", "integrator=rk4",
+          "layout=SoAoS", "precision=quad", "container=list", "repeat=0"})
+        REQUIRE_THROWS_AS(nbody::utils::parse_run_config(line),
+                          std::invalid_argument);
+    std::istringstream bad("n=10\nsteps=ten\n");
+    REQUIRE_THROWS_WITH(nbody::utils::read_ensemble(bad),
+                        "line 2: bad value for steps: ten");
+}
+
+TEST_CASE("ensembles run every configuration once with serial passes",
+          "[ensemble]") {
+    std::vector<nbody::utils::run_config> configs;
+    for (const char* integrator : {"leapfrog", "yoshida4", "hermite", "block"})
+        for (unsigned long seed = 1; seed <= 3; ++seed) {
+            nbody::utils::run_config c;
+            c.n = 200 + 100 * seed;
+            c.steps = 5;
+            c.integrator = integrator;
+            c.seed = seed;
+            configs.push_back(c);
+        }
+    /// a run failing on its own leaves the others going
+    configs.push_back(configs.front());
+    configs.back().name = "fails";
+
+    std::vector<nbody::utils::run_result> results;
+    std::atomic<int> parallel_passes{0};
+    const auto stats = nbody::utils::run_ensemble(
+        std::span<const nbody::utils::run_config>(configs),
+        [&](const nbody::utils::run_config& c) {
+            if (c.name == "fails") throw std::runtime_error("no luck");
+            if (!nbody::detail::serial_passes()) ++parallel_passes;
+            return nbody::utils::simulate<SoA_system>(c);
+        },
+        [&](const nbody::utils::run_result& r) { results.push_back(r); });
+
+    REQUIRE(parallel_passes == 0);
+    REQUIRE(stats.runs == configs.size());
+    REQUIRE(stats.failed == 1);
+    REQUIRE(results.size() == configs.size());
+    std::vector<bool> seen(configs.size(), false);
+    for (const auto& r : results) {
+        REQUIRE_FALSE(seen[r.index]);
+        seen[r.index] = true;
+        if (r.config.name == "fails") {
+            REQUIRE(r.error == "no luck");
+            REQUIRE(nbody::utils::to_json(r).find("\"error\": \"no luck\"") !=
+                    std::string::npos);
+            continue;
+        }
+        REQUIRE(r.error.empty());
+        /// serial passes give the energies of a run on its own
+        const auto alone =
+            nbody::utils::simulate<SoA_system>(configs[r.index]);
+        REQUIRE(r.energy_initial == Catch::Approx(alone.energy_initial));
+        REQUIRE(r.energy_final == Catch::Approx(alone.energy_final));
+        REQUIRE(r.drift < 1e-2);
+    }
+    REQUIRE_FALSE(nbody::detail::serial_passes());
+}